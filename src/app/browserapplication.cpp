@@ -23,6 +23,8 @@
 
 // Qtlangc
 #include <QtCore/QMetaObject>
+#include <QtCore/QRunnable>
+#include <QtCore/QThreadPool>
 #include <QtCore/QtGlobal>
 #include <QtGui/QTouchDevice>
 #include <QtNetwork/QNetworkInterface>
@@ -36,6 +38,7 @@
 #include "browserapplication.h"
 #include "browser-utils.h"
 #include "config.h"
+#include "database-utils.h"
 #include "domain-permissions-model.h"
 #include "domain-settings-model.h"
 #include "domain-settings-sorted-model.h"
@@ -56,6 +59,8 @@ BrowserApplication::BrowserApplication(int& argc, char** argv)
 {
     m_arguments = arguments();
     m_arguments.removeFirst();
+    connect(this, SIGNAL(applicationStateChanged(Qt::ApplicationState)),
+            SLOT(onApplicationStateChanged(Qt::ApplicationState)));
 }
 
 BrowserApplication::~BrowserApplication()
@@ -266,3 +271,25 @@ bool BrowserApplication::helpRequested()
 {
     return m_arguments.contains("--help") || m_arguments.contains("-h");
 }
+
+namespace {
+
+class CheckpointDatabasesTask : public QRunnable
+{
+public:
+    void run() override
+    {
+        DatabaseUtils::checkpointDatabases();
+    }
+};
+
+}
+
+void BrowserApplication::onApplicationStateChanged(Qt::ApplicationState state)
+{
+    // The application may be suspended or killed while inactive,
+    // make sure the write-ahead logs are merged into the databases
+    if (state != Qt::ApplicationActive) {
+        QThreadPool::globalInstance()->start(new CheckpointDatabasesTask);
+    }
+}
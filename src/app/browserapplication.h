@@ -62,6 +62,9 @@ protected:
 protected Q_SLOTS:
     virtual void onNewInstanceLaunched(const QStringList& arguments) const = 0;
 
+private Q_SLOTS:
+    void onApplicationStateChanged(Qt::ApplicationState state);
+
 private:
     QString inspectorPort() const;
     QString inspectorHost() const;
@@ -0,0 +1,331 @@
+/*
+ * Copyright 2020 UBports Foundation
+ *
+ * This file is part of morph-browser.
+ *
+ * morph-browser is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * morph-browser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "database-executor.h"
+
+// Qt
+#include <QtCore/QDebug>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QTimer>
+#include <QtSql/QSqlError>
+
+#define SQL_DRIVER QStringLiteral("QSQLITE")
+
+// Operations are written as soon as the worker is idle by default, so that
+// operations enqueued in a row (e.g. by the same user action) are committed
+// in a single transaction. The queue is flushed right away when it reaches a
+// given size.
+static const int DEFAULT_FLUSH_INTERVAL = 0;
+static const int FLUSH_THRESHOLD = 200;
+
+/*!
+    \class DatabaseExecutor
+    \brief Runs the SQL statements of a model on a separate thread.
+
+    Each DatabaseExecutor owns a connection to a SQLite database, and a
+    thread on which all the operations on this connection are performed.
+
+    Write operations are queued with enqueue(), and executed asynchronously
+    in batches, each batch in a single transaction, so that models can update
+    their in-memory state right away without waiting for the disk.
+    An optional callback is invoked on the thread of the executor (the UI
+    thread) once the operation has been executed.
+
+    The database is opened and its schema migrated asynchronously by open(),
+    operations and tasks passed in the meantime are executed once it is
+    open. Models read the database with tasks passed to post(), and populate
+    themselves from its callback, so that the UI thread never waits for the
+    disk.
+    Tasks are executed on the thread of the executor, they must not touch
+    the model itself.
+
+    run() and exec() execute a task or a statement synchronously, after all
+    the pending operations have been written. They block the calling thread,
+    and are meant for tests and for shutting down, not for the UI thread.
+
+    Pending operations are written when the executor is closed or destroyed.
+*/
+DatabaseExecutor::DatabaseExecutor(const QString& connectionName, QObject* parent)
+    : QObject(parent)
+    , m_flushInterval(DEFAULT_FLUSH_INTERVAL)
+    , m_lastOperation(0)
+{
+    qRegisterMetaType<DatabaseExecutorWorker::Task>("DatabaseExecutorWorker::Task");
+    qRegisterMetaType<DatabaseExecutorWorker::Operation>("DatabaseExecutorWorker::Operation");
+    qRegisterMetaType<QList<DatabaseExecutorWorker::Result> >("QList<DatabaseExecutorWorker::Result>");
+    m_worker = new DatabaseExecutorWorker(connectionName);
+    m_worker->setFlushInterval(m_flushInterval);
+    m_worker->moveToThread(&m_thread);
+    connect(m_worker, SIGNAL(finished(const QList<DatabaseExecutorWorker::Result>&)),
+            SLOT(onFinished(const QList<DatabaseExecutorWorker::Result>&)), Qt::QueuedConnection);
+    connect(m_worker, SIGNAL(flushed(int, qint64)), SIGNAL(flushed(int, qint64)), Qt::QueuedConnection);
+    // The connection is removed by the worker, on its own thread
+    connect(&m_thread, SIGNAL(finished()), m_worker, SLOT(deleteLater()));
+    m_thread.start(QThread::LowPriority);
+}
+
+DatabaseExecutor::~DatabaseExecutor()
+{
+    close();
+    m_thread.quit();
+    m_thread.wait();
+}
+
+const QString& DatabaseExecutor::databaseName() const
+{
+    return m_databaseName;
+}
+
+/*!
+    Open (or re-open) the given database with a connection profile (see
+    DatabaseUtils::openDatabase()), and bring its schema up to date,
+    asynchronously. opened() is emitted once done.
+*/
+void DatabaseExecutor::open(const QString& databaseName,
+                            const QList<DatabaseUtils::Migration>& migrations,
+                            const QString& profile)
+{
+    m_databaseName = databaseName;
+    QSharedPointer<bool> success(new bool(false));
+    post([databaseName, migrations, profile, success](QSqlDatabase& database) {
+        *success = DatabaseUtils::openDatabase(database, databaseName, profile) &&
+                   DatabaseUtils::migrateSchema(database, migrations);
+    }, [this, success](bool, const QVariant&) {
+        Q_EMIT opened(*success);
+    });
+}
+
+/*!
+    Write all the pending operations, and close the database.
+    This blocks until done (see run()).
+*/
+void DatabaseExecutor::close()
+{
+    run([](QSqlDatabase& database) {
+        if (database.isOpen()) {
+            database.close();
+        }
+    });
+}
+
+int DatabaseExecutor::flushInterval() const
+{
+    return m_flushInterval;
+}
+
+/*!
+    Set the delay (in milliseconds) of inactivity after which pending
+    operations are written.
+*/
+void DatabaseExecutor::setFlushInterval(int interval)
+{
+    m_flushInterval = interval;
+    m_worker->setFlushInterval(interval);
+}
+
+/*!
+    Queue a statement to be executed asynchronously with the given values
+    bound to its placeholders.
+*/
+void DatabaseExecutor::enqueue(const QString& statement, const QVariantList& values, const Callback& callback)
+{
+    DatabaseExecutorWorker::Operation operation;
+    operation.id = ++m_lastOperation;
+    operation.statement = statement;
+    operation.values = values;
+    operation.notify = bool(callback);
+    if (operation.notify) {
+        m_callbacks.insert(operation.id, callback);
+    }
+    Q_EMIT m_worker->enqueue(operation);
+}
+
+/*!
+    Run a task on the database connection, after all the pending operations
+    have been written. This blocks until done.
+*/
+void DatabaseExecutor::run(const Task& task)
+{
+    Q_EMIT m_worker->run(task);
+}
+
+/*!
+    Run a task on the database connection asynchronously, after all the
+    operations enqueued so far have been written. The optional callback is
+    invoked on the thread of the executor once the task is done.
+*/
+void DatabaseExecutor::post(const Task& task, const Callback& callback)
+{
+    int id = 0;
+    if (callback) {
+        id = ++m_lastOperation;
+        m_callbacks.insert(id, callback);
+    }
+    Q_EMIT m_worker->post(id, task);
+}
+
+/*!
+    Execute a statement synchronously, after all the pending operations have
+    been written. Return the identifier of the inserted row, if any.
+*/
+QVariant DatabaseExecutor::exec(const QString& statement, const QVariantList& values)
+{
+    QVariant lastInsertId;
+    run([&](QSqlDatabase& database) {
+        QSqlQuery query(database);
+        query.prepare(statement);
+        for (int i = 0; i < values.count(); ++i) {
+            query.bindValue(i, values.at(i));
+        }
+        if (query.exec()) {
+            lastInsertId = query.lastInsertId();
+        } else {
+            qWarning() << "Failed to execute" << statement << ":" << query.lastError().text();
+        }
+    });
+    return lastInsertId;
+}
+
+/*!
+    Write all the pending operations. This blocks until done.
+*/
+void DatabaseExecutor::flush()
+{
+    run([](QSqlDatabase&) {});
+}
+
+void DatabaseExecutor::onFinished(const QList<DatabaseExecutorWorker::Result>& results)
+{
+    Q_FOREACH(const DatabaseExecutorWorker::Result& result, results) {
+        Callback callback = m_callbacks.take(result.id);
+        if (callback) {
+            callback(result.success, result.lastInsertId);
+        }
+    }
+}
+
+DatabaseExecutorWorker::DatabaseExecutorWorker(const QString& connectionName)
+    : QObject()
+    , m_connectionName(connectionName)
+    , m_flushInterval(DEFAULT_FLUSH_INTERVAL)
+{
+    // The timer moves to the worker thread along with its parent
+    m_flush = new QTimer(this);
+    m_flush->setSingleShot(true);
+    connect(m_flush, SIGNAL(timeout()), SLOT(doFlush()));
+    connect(this, SIGNAL(enqueue(const DatabaseExecutorWorker::Operation&)),
+            SLOT(doEnqueue(const DatabaseExecutorWorker::Operation&)), Qt::QueuedConnection);
+    connect(this, SIGNAL(run(const DatabaseExecutorWorker::Task&)),
+            SLOT(doRun(const DatabaseExecutorWorker::Task&)), Qt::BlockingQueuedConnection);
+    connect(this, SIGNAL(post(int, const DatabaseExecutorWorker::Task&)),
+            SLOT(doPost(int, const DatabaseExecutorWorker::Task&)), Qt::QueuedConnection);
+}
+
+DatabaseExecutorWorker::~DatabaseExecutorWorker()
+{
+    m_queries.clear();
+    if (m_database.isValid()) {
+        m_database = QSqlDatabase();
+        QSqlDatabase::removeDatabase(m_connectionName);
+    }
+}
+
+void DatabaseExecutorWorker::setFlushInterval(int interval)
+{
+    m_flushInterval.store(interval);
+}
+
+void DatabaseExecutorWorker::doEnqueue(const Operation& operation)
+{
+    m_pending.append(operation);
+    if (m_pending.count() >= FLUSH_THRESHOLD) {
+        m_flush->stop();
+        doFlush();
+    } else {
+        m_flush->start(m_flushInterval.load());
+    }
+}
+
+void DatabaseExecutorWorker::doRun(const Task& task)
+{
+    m_flush->stop();
+    doFlush();
+    if (!m_database.isValid()) {
+        // The connection must be created on the thread that uses it
+        m_database = QSqlDatabase::addDatabase(SQL_DRIVER, m_connectionName);
+    }
+    // Prepared statements must not outlive the database they were prepared
+    // for, and the task may close or re-open it.
+    m_queries.clear();
+    task(m_database);
+}
+
+void DatabaseExecutorWorker::doPost(int id, const Task& task)
+{
+    doRun(task);
+    if (id != 0) {
+        Result result;
+        result.id = id;
+        result.success = true;
+        Q_EMIT finished(QList<Result>() << result);
+    }
+}
+
+void DatabaseExecutorWorker::doFlush()
+{
+    if (m_pending.isEmpty()) {
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    QList<Result> results;
+    m_database.transaction();
+    Q_FOREACH(const Operation& operation, m_pending) {
+        QHash<QString, QSqlQuery>::iterator it = m_queries.find(operation.statement);
+        if (it == m_queries.end()) {
+            QSqlQuery query(m_database);
+            query.prepare(operation.statement);
+            it = m_queries.insert(operation.statement, query);
+        }
+        QSqlQuery& query = it.value();
+        for (int i = 0; i < operation.values.count(); ++i) {
+            query.bindValue(i, operation.values.at(i));
+        }
+        bool success = query.exec();
+        if (!success) {
+            qWarning() << "Failed to execute" << operation.statement << ":" << query.lastError().text();
+        }
+        if (operation.notify) {
+            Result result;
+            result.id = operation.id;
+            result.success = success;
+            result.lastInsertId = query.lastInsertId();
+            results.append(result);
+        }
+    }
+    m_database.commit();
+
+    int operations = m_pending.count();
+    m_pending.clear();
+    if (!results.isEmpty()) {
+        Q_EMIT finished(results);
+    }
+    Q_EMIT flushed(operations, timer.elapsed());
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2020 UBports Foundation
+ *
+ * This file is part of morph-browser.
+ *
+ * morph-browser is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * morph-browser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DATABASE_EXECUTOR_H__
+#define __DATABASE_EXECUTOR_H__
+
+// Qt
+#include <QtCore/QAtomicInt>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QObject>
+#include <QtCore/QString>
+#include <QtCore/QThread>
+#include <QtCore/QVariant>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlQuery>
+
+// system
+#include <functional>
+
+// local
+#include "database-utils.h"
+
+class QTimer;
+
+class DatabaseExecutorWorker : public QObject {
+    Q_OBJECT
+
+public:
+    DatabaseExecutorWorker(const QString& connectionName);
+    ~DatabaseExecutorWorker();
+
+    typedef std::function<void(QSqlDatabase&)> Task;
+
+    struct Operation {
+        int id;
+        QString statement;
+        QVariantList values;
+        bool notify;
+    };
+
+    struct Result {
+        int id;
+        bool success;
+        QVariant lastInsertId;
+    };
+
+    void setFlushInterval(int interval);
+
+Q_SIGNALS:
+    void enqueue(const DatabaseExecutorWorker::Operation& operation);
+    void run(const DatabaseExecutorWorker::Task& task);
+    void post(int id, const DatabaseExecutorWorker::Task& task);
+    void finished(const QList<DatabaseExecutorWorker::Result>& results);
+    void flushed(int operations, qint64 elapsed);
+
+private Q_SLOTS:
+    void doEnqueue(const DatabaseExecutorWorker::Operation& operation);
+    void doRun(const DatabaseExecutorWorker::Task& task);
+    void doPost(int id, const DatabaseExecutorWorker::Task& task);
+    void doFlush();
+
+private:
+    QString m_connectionName;
+    QSqlDatabase m_database;
+    QList<Operation> m_pending;
+    QHash<QString, QSqlQuery> m_queries;
+    QTimer* m_flush;
+    QAtomicInt m_flushInterval;
+};
+
+class DatabaseExecutor : public QObject
+{
+    Q_OBJECT
+
+public:
+    DatabaseExecutor(const QString& connectionName, QObject* parent=0);
+    ~DatabaseExecutor();
+
+    typedef DatabaseExecutorWorker::Task Task;
+    typedef std::function<void(bool success, const QVariant& lastInsertId)> Callback;
+
+    const QString& databaseName() const;
+    void open(const QString& databaseName,
+              const QList<DatabaseUtils::Migration>& migrations=QList<DatabaseUtils::Migration>(),
+              const QString& profile=DatabaseUtils::DEFAULT_PROFILE);
+    void close();
+
+    int flushInterval() const;
+    void setFlushInterval(int interval);
+
+    void enqueue(const QString& statement, const QVariantList& values, const Callback& callback=Callback());
+    void run(const Task& task);
+    void post(const Task& task, const Callback& callback=Callback());
+    QVariant exec(const QString& statement, const QVariantList& values);
+    void flush();
+
+Q_SIGNALS:
+    void opened(bool success);
+    void flushed(int operations, qint64 elapsed);
+
+private Q_SLOTS:
+    void onFinished(const QList<DatabaseExecutorWorker::Result>& results);
+
+private:
+    QString m_databaseName;
+    int m_flushInterval;
+    int m_lastOperation;
+    QHash<int, Callback> m_callbacks;
+    QThread m_thread;
+    DatabaseExecutorWorker* m_worker;
+};
+
+Q_DECLARE_METATYPE(DatabaseExecutorWorker::Task)
+Q_DECLARE_METATYPE(DatabaseExecutorWorker::Operation)
+Q_DECLARE_METATYPE(DatabaseExecutorWorker::Result)
+
+#endif // __DATABASE_EXECUTOR_H__
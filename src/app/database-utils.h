@@ -0,0 +1,286 @@
+/*
+ * Copyright 2020 UBports Foundation
+ *
+ * This file is part of morph-browser.
+ *
+ * morph-browser is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * morph-browser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DATABASE_UTILS_H__
+#define __DATABASE_UTILS_H__
+
+// Qt
+#include <QtCore/QDebug>
+#include <QtCore/QFileInfo>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QSet>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QThread>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlError>
+#include <QtSql/QSqlQuery>
+
+namespace DatabaseUtils {
+
+// A migration step upgrades a database schema from version N to version N+1.
+// It is run inside a transaction, and returns false on failure. Long steps
+// may commit their work in batches, starting a new transaction after each
+// one, as long as they record their progress to resume from it.
+typedef bool (*Migration)(QSqlDatabase& database);
+
+static bool exec(QSqlDatabase& database, const QString& statement)
+{
+    QSqlQuery query(database);
+    if (!query.exec(statement)) {
+        qWarning() << "Failed to execute" << statement << ":" << query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+static bool hasColumn(QSqlDatabase& database, const QString& table, const QString& column)
+{
+    QSqlQuery tableInfoQuery(database);
+    tableInfoQuery.exec(QStringLiteral("PRAGMA TABLE_INFO(%1);").arg(table));
+    while (tableInfoQuery.next()) {
+        if (tableInfoQuery.value(QStringLiteral("name")).toString() == column) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int schemaVersion(QSqlDatabase& database)
+{
+    QSqlQuery versionQuery(database);
+    versionQuery.exec(QStringLiteral("PRAGMA user_version;"));
+    return versionQuery.next() ? versionQuery.value(0).toInt() : 0;
+}
+
+/*
+    Bring the schema of a database up to date.
+
+    migrations.at(i) upgrades the schema from version i to version i+1, the
+    current version being stored in the database itself (PRAGMA user_version).
+    Version 0 is any database created before schema versioning was introduced,
+    so the first migration must cope with all the legacy layouts.
+
+    Each step is run in its own transaction, so that an interrupted upgrade
+    resumes from the last successful step. The version is only updated in
+    the last transaction of a step that commits its work in batches.
+*/
+static bool migrateSchema(QSqlDatabase& database, const QList<Migration>& migrations)
+{
+    int version = schemaVersion(database);
+    for (int i = version; i < migrations.count(); ++i) {
+        database.transaction();
+        if (!migrations.at(i)(database) ||
+            !exec(database, QStringLiteral("PRAGMA user_version = %1;").arg(i + 1))) {
+            qWarning() << "Failed to migrate" << database.databaseName()
+                       << "to schema version" << (i + 1);
+            database.rollback();
+            return false;
+        }
+        database.commit();
+    }
+    return true;
+}
+
+/*
+    Connection profiles define how SQLite connections are tuned once opened.
+    Fields left to their default value (empty string, -1 or 0) keep the
+    driver defaults.
+
+    Available profiles:
+     - "default": driver defaults (rollback journal, synchronous=FULL)
+     - "wal": write-ahead log with synchronous=NORMAL, memory-mapped I/O and
+       a larger page cache; writes don’t wait for an fsync of the database,
+       at the cost of possibly losing the last transactions on power loss
+     - "durable": write-ahead log with synchronous=FULL
+     - "shared": for database files owned by another component (e.g. the
+       cookie database), only waits on locks instead of failing right away
+*/
+struct ConnectionProfile {
+    QString journalMode;
+    QString synchronous;
+    qint64 mmapSize;
+    int cacheSize; // negative values are in KiB, positive values in pages
+    int busyTimeout; // in milliseconds
+};
+
+static const QString DEFAULT_PROFILE = QStringLiteral("wal");
+
+static ConnectionProfile connectionProfile(const QString& name)
+{
+    ConnectionProfile profile;
+    profile.mmapSize = -1;
+    profile.cacheSize = 0;
+    profile.busyTimeout = 0;
+    if (name == QStringLiteral("wal") || name == QStringLiteral("durable")) {
+        profile.journalMode = QStringLiteral("WAL");
+        profile.synchronous = (name == QStringLiteral("wal")) ? QStringLiteral("NORMAL") : QStringLiteral("FULL");
+        profile.mmapSize = 32 * 1024 * 1024;
+        profile.cacheSize = -4096;
+        profile.busyTimeout = 5000;
+    } else if (name == QStringLiteral("shared")) {
+        profile.busyTimeout = 5000;
+    } else if (name != QStringLiteral("default")) {
+        qWarning() << "Unknown database connection profile:" << name;
+    }
+    return profile;
+}
+
+// The following functions share state between all the models, hence they
+// are inline rather than static.
+
+inline QMutex* profilesMutex()
+{
+    static QMutex mutex;
+    return &mutex;
+}
+
+inline QHash<QString, QString>& selectedProfiles()
+{
+    static QHash<QString, QString> profiles;
+    return profiles;
+}
+
+inline QSet<QString>& openedDatabaseFiles()
+{
+    static QSet<QString> files;
+    return files;
+}
+
+/*
+    Select the profile to use for a given connection name (to be called
+    before the corresponding database is opened).
+    Profiles can also be selected with the MORPH_SQLITE_PROFILES environment
+    variable, e.g. "morph-browser-history=durable,*=default" ("*" applies to
+    connections without an explicit profile that would use DEFAULT_PROFILE;
+    connections that ask for another one, e.g. "shared", keep it).
+*/
+inline void selectConnectionProfile(const QString& connectionName, const QString& profileName)
+{
+    QMutexLocker locker(profilesMutex());
+    selectedProfiles().insert(connectionName, profileName);
+}
+
+inline QString selectedConnectionProfile(const QString& connectionName, const QString& fallback)
+{
+    QMutexLocker locker(profilesMutex());
+    QHash<QString, QString>& profiles = selectedProfiles();
+    if (profiles.contains(connectionName)) {
+        return profiles.value(connectionName);
+    }
+    QString wildcard;
+    Q_FOREACH(const QString& item, QString::fromLocal8Bit(qgetenv("MORPH_SQLITE_PROFILES")).split(QLatin1Char(','), QString::SkipEmptyParts)) {
+        QStringList pair = item.split(QLatin1Char('='));
+        if (pair.count() != 2) {
+            continue;
+        }
+        QString name = pair.first().trimmed();
+        if (name == connectionName) {
+            return pair.last().trimmed();
+        } else if (name == QStringLiteral("*")) {
+            wildcard = pair.last().trimmed();
+        }
+    }
+    if (!wildcard.isEmpty() && (fallback == DEFAULT_PROFILE)) {
+        return wildcard;
+    }
+    return fallback;
+}
+
+static void applyConnectionProfile(QSqlDatabase& database, const ConnectionProfile& profile)
+{
+    if (profile.busyTimeout > 0) {
+        exec(database, QStringLiteral("PRAGMA busy_timeout = %1;").arg(profile.busyTimeout));
+    }
+    if (!profile.journalMode.isEmpty()) {
+        // In-memory databases always use the MEMORY journal mode
+        exec(database, QStringLiteral("PRAGMA journal_mode = %1;").arg(profile.journalMode));
+    }
+    if (!profile.synchronous.isEmpty()) {
+        exec(database, QStringLiteral("PRAGMA synchronous = %1;").arg(profile.synchronous));
+    }
+    if (profile.mmapSize >= 0) {
+        exec(database, QStringLiteral("PRAGMA mmap_size = %1;").arg(profile.mmapSize));
+    }
+    if (profile.cacheSize != 0) {
+        exec(database, QStringLiteral("PRAGMA cache_size = %1;").arg(profile.cacheSize));
+    }
+}
+
+/*
+    Open (or re-open) a database with the connection profile selected for
+    its connection name, falling back to the given profile.
+    All models open their databases through this function.
+*/
+static bool openDatabase(QSqlDatabase& database, const QString& databaseName,
+                         const QString& defaultProfile = DEFAULT_PROFILE)
+{
+    if (database.isOpen()) {
+        database.close();
+    }
+    database.setDatabaseName(databaseName);
+    if (!database.open()) {
+        qWarning() << "Failed to open database" << databaseName << ":" << database.lastError().text();
+        return false;
+    }
+    QString profileName = selectedConnectionProfile(database.connectionName(), defaultProfile);
+    applyConnectionProfile(database, connectionProfile(profileName));
+    if (databaseName != QStringLiteral(":memory:")) {
+        QMutexLocker locker(profilesMutex());
+        openedDatabaseFiles().insert(QFileInfo(databaseName).absoluteFilePath());
+    }
+    return true;
+}
+
+/*
+    Checkpoint the write-ahead log of all the database files opened so far,
+    so that the WAL files don’t keep growing and the data is safely in the
+    database files (e.g. when the application goes inactive).
+    This uses separate connections and can be called from any thread.
+*/
+static void checkpointDatabases()
+{
+    QStringList files;
+    {
+        QMutexLocker locker(profilesMutex());
+        files = openedDatabaseFiles().toList();
+    }
+    const QString connectionName = QStringLiteral("morph-browser-checkpoint-%1")
+        .arg(reinterpret_cast<quintptr>(QThread::currentThread()));
+    Q_FOREACH(const QString& file, files) {
+        if (!QFileInfo::exists(file + QStringLiteral("-wal"))) {
+            continue;
+        }
+        {
+            QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), connectionName);
+            database.setDatabaseName(file);
+            if (database.open()) {
+                exec(database, QStringLiteral("PRAGMA wal_checkpoint(PASSIVE);"));
+                database.close();
+            }
+        }
+        QSqlDatabase::removeDatabase(connectionName);
+    }
+}
+
+} // namespace DatabaseUtils
+
+#endif // __DATABASE_UTILS_H__
@@ -16,10 +16,13 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "database-executor.h"
+#include "database-utils.h"
 #include "domain-permissions-model.h"
 #include "domain-utils.h"
 
 #include <QFile>
+#include <QSharedPointer>
 #include <QtSql/QSqlQuery>
 #include <QUrl>
 
@@ -28,27 +31,24 @@
 /*!
     \class DomainPermissionsModel
     \brief model that stores domain specific permissions (e.g. block or whitelist domains).
+
+    The database is read asynchronously, loaded() is emitted once done.
+    Changes requested before are applied then.
 */
 DomainPermissionsModel::DomainPermissionsModel(QObject* parent)
 : QAbstractListModel(parent)
+, m_loaded(false)
+, m_loadRequest(0)
 {
-    m_database = QSqlDatabase::addDatabase(QLatin1String("QSQLITE"), CONNECTION_NAME);
-}
-
-DomainPermissionsModel::~DomainPermissionsModel()
-{
-    m_database.close();
-    m_database = QSqlDatabase();
-    QSqlDatabase::removeDatabase(CONNECTION_NAME);
+    m_executor = new DatabaseExecutor(CONNECTION_NAME, this);
 }
 
 void DomainPermissionsModel::resetDatabase(const QString& databaseName)
 {
     beginResetModel();
     m_entries.clear();
-    m_database.close();
-    m_database.setDatabaseName(databaseName);
-    m_database.open();
+    m_loaded = false;
+    m_executor->open(databaseName);
     createOrAlterDatabaseSchema();
     endResetModel();
     populateFromDatabase();
@@ -96,37 +96,58 @@ QVariant DomainPermissionsModel::data(const QModelIndex& index, int role) const
 void DomainPermissionsModel::createOrAlterDatabaseSchema()
 {
     // permissions table
-    QSqlQuery createQuery(m_database);
-    QString query = QLatin1String("CREATE TABLE IF NOT EXISTS domainpermissions "
-                                  "(domain VARCHAR NOT NULL UNIQUE, requestedByDomain VARCHAR, permission INTEGER, lastRequested DATETIME, PRIMARY KEY(domain));");
-    createQuery.prepare(query);
-    createQuery.exec();
+    m_executor->post([](QSqlDatabase& database) {
+        DatabaseUtils::exec(database, QLatin1String("CREATE TABLE IF NOT EXISTS domainpermissions "
+                                                    "(domain VARCHAR NOT NULL UNIQUE, requestedByDomain VARCHAR, permission INTEGER, lastRequested DATETIME, PRIMARY KEY(domain));"));
+    });
 }
 
 void DomainPermissionsModel::populateFromDatabase()
 {
     // populate domainpermissions
-    QSqlQuery populateQuery(m_database);
-    QString query = QLatin1String("SELECT domain, requestedByDomain, permission, lastRequested FROM domainpermissions;");
-    populateQuery.prepare(query);
-    populateQuery.exec();
-    int count = 0; // size() isn't supported on the sqlite backend
-    while (populateQuery.next()) {
-        DomainPermissionEntry entry;
-        entry.domain = populateQuery.value("domain").toString();
-        entry.requestedByDomain = populateQuery.value("requestedByDomain").toString();
-        entry.permission = static_cast<DomainPermission>(populateQuery.value("permission").toInt());
-        entry.lastRequested = QDateTime::fromTime_t(populateQuery.value("lastRequested").toUInt());
-        beginInsertRows(QModelIndex(), count, count);
-        m_entries.append(entry);
+    QSharedPointer<QList<DomainPermissionEntry> > entries(new QList<DomainPermissionEntry>);
+    int request = ++m_loadRequest;
+    m_executor->post([entries](QSqlDatabase& database) {
+        QSqlQuery populateQuery(database);
+        QString query = QLatin1String("SELECT domain, requestedByDomain, permission, lastRequested FROM domainpermissions;");
+        populateQuery.prepare(query);
+        populateQuery.exec();
+        while (populateQuery.next()) {
+            DomainPermissionEntry entry;
+            entry.domain = populateQuery.value("domain").toString();
+            entry.requestedByDomain = populateQuery.value("requestedByDomain").toString();
+            entry.permission = static_cast<DomainPermission>(populateQuery.value("permission").toInt());
+            entry.lastRequested = QDateTime::fromTime_t(populateQuery.value("lastRequested").toUInt());
+            entries->append(entry);
+        }
+    }, [this, entries, request](bool, const QVariant&) {
+        // Ignore the result if the database was changed in the meantime
+        if (request == m_loadRequest) {
+            publishLoadedEntries(*entries);
+        }
+    });
+}
+
+void DomainPermissionsModel::publishLoadedEntries(const QList<DomainPermissionEntry>& entries)
+{
+    if (!entries.isEmpty()) {
+        beginInsertRows(QModelIndex(), 0, entries.count() - 1);
+        m_entries = entries;
         endInsertRows();
-        count++;
+        Q_EMIT rowCountChanged();
+    }
+    m_loaded = true;
+    QList<std::function<void()> > calls;
+    calls.swap(m_deferredCalls);
+    Q_FOREACH(const std::function<void()>& call, calls) {
+        call();
     }
+    Q_EMIT loaded();
 }
 
 const QString DomainPermissionsModel::databasePath() const
 {
-    return m_database.databaseName();
+    return m_executor->databaseName();
 }
 
 void DomainPermissionsModel::setDatabasePath(const QString& path)
@@ -165,6 +186,10 @@ DomainPermissionsModel::DomainPermission DomainPermissionsModel::getPermission(c
 
 void DomainPermissionsModel::setPermission(const QString& domain, DomainPermissionsModel::DomainPermission permission, bool incognito)
 {
+    if (!m_loaded) {
+        m_deferredCalls.append([this, domain, permission, incognito]() { setPermission(domain, permission, incognito); });
+        return;
+    }
     insertEntry(domain, incognito);
     int index = getIndexForDomain(domain);
     if (index != -1) {
@@ -175,17 +200,17 @@ void DomainPermissionsModel::setPermission(const QString& domain, DomainPermissi
         entry.permission = permission;
         Q_EMIT dataChanged(this->index(index, 0), this->index(index, 0), QVector<int>() << Permission);
         // ignoring incognito here, because it will only affect an entry already present in the database
-        QSqlQuery query(m_database);
         static QString updateStatement = QLatin1String("UPDATE domainpermissions SET permission=? WHERE domain=?;");
-        query.prepare(updateStatement);
-        query.addBindValue(entry.permission);
-        query.addBindValue(domain);
-        query.exec();
+        m_executor->enqueue(updateStatement, QVariantList() << entry.permission << domain);
     }
 }
 
 void DomainPermissionsModel::setRequestedByDomain(const QString& domain, const QString& requestedByDomain, bool incognito)
 {
+    if (!m_loaded) {
+        m_deferredCalls.append([this, domain, requestedByDomain, incognito]() { setRequestedByDomain(domain, requestedByDomain, incognito); });
+        return;
+    }
     insertEntry(domain, incognito);
     int index = getIndexForDomain(domain);
     if (index != -1) {
@@ -199,13 +224,12 @@ void DomainPermissionsModel::setRequestedByDomain(const QString& domain, const Q
 
         if (! incognito)
         {
-            QSqlQuery query(m_database);
             static QString updateStatement = QLatin1String("UPDATE domainpermissions SET requestedByDomain=?, lastRequested=? WHERE domain=?;");
-            query.prepare(updateStatement);
-            query.addBindValue(entry.requestedByDomain.isEmpty() ? QString() : entry.requestedByDomain);
-            query.addBindValue(entry.lastRequested.toTime_t());
-            query.addBindValue(domain);
-            query.exec();
+            QVariantList values;
+            values << (entry.requestedByDomain.isEmpty() ? QString() : entry.requestedByDomain);
+            values << entry.lastRequested.toTime_t();
+            values << domain;
+            m_executor->enqueue(updateStatement, values);
         }
     }
 }
@@ -217,15 +241,26 @@ bool DomainPermissionsModel::contains(const QString& domain) const
 
 void DomainPermissionsModel::deleteAndResetDataBase()
 {
-    if (QFile::exists(databasePath()))
-    {
-        QFile(databasePath()).remove();
-    }
-    resetDatabase(databasePath());
+    // Pending operations are written before the file is removed, changes
+    // requested before the database was read are dropped with it
+    m_deferredCalls.clear();
+    QString path = databasePath();
+    m_executor->post([path](QSqlDatabase& database) {
+        database.close();
+        if (QFile::exists(path))
+        {
+            QFile(path).remove();
+        }
+    });
+    resetDatabase(path);
 }
 
 void DomainPermissionsModel::insertEntry(const QString &domain, bool incognito)
 {
+    if (!m_loaded) {
+        m_deferredCalls.append([this, domain, incognito]() { insertEntry(domain, incognito); });
+        return;
+    }
     if (contains(domain))
     {
         return;
@@ -242,29 +277,29 @@ void DomainPermissionsModel::insertEntry(const QString &domain, bool incognito)
 
     if (! incognito)
     {
-        QSqlQuery query(m_database);
         static QString insertStatement = QLatin1String("INSERT INTO domainpermissions (domain, permission, lastRequested) VALUES (?, ?, ?);");
-        query.prepare(insertStatement);
-        query.addBindValue(entry.domain);
-        query.addBindValue(entry.permission);
-        query.addBindValue(entry.lastRequested.toTime_t());
-        query.exec();
+        QVariantList values;
+        values << entry.domain;
+        values << entry.permission;
+        values << entry.lastRequested.toTime_t();
+        m_executor->enqueue(insertStatement, values);
     }
 }
 
 void DomainPermissionsModel::removeEntry(const QString &domain)
 {
+    if (!m_loaded) {
+        m_deferredCalls.append([this, domain]() { removeEntry(domain); });
+        return;
+    }
     int index = getIndexForDomain(domain);
     if (index != -1) {
         beginRemoveRows(QModelIndex(), index, index);
         m_entries.removeAt(index);
         endRemoveRows();
         Q_EMIT rowCountChanged();
-        QSqlQuery query(m_database);
         static QString deleteStatement = QLatin1String("DELETE FROM domainpermissions WHERE domain=?;");
-        query.prepare(deleteStatement);
-        query.addBindValue(domain);
-        query.exec();
+        m_executor->enqueue(deleteStatement, QVariantList() << domain);
     }
 }
 
@@ -22,7 +22,10 @@
 #include <QAbstractListModel>
 #include <QtCore/QDateTime>
 #include <QString>
-#include <QtSql/QSqlDatabase>
+
+#include <functional>
+
+class DatabaseExecutor;
 
 class DomainPermissionsModel : public QAbstractListModel
 {
@@ -37,7 +40,6 @@ class DomainPermissionsModel : public QAbstractListModel
 
 public:
     DomainPermissionsModel(QObject* parent=0);
-    ~DomainPermissionsModel();
 
     enum DomainPermission {
         NotSet = 0,
@@ -76,9 +78,10 @@ Q_SIGNALS:
     void databasePathChanged() const;
     void rowCountChanged();
     void whiteListModeChanged();
+    void loaded() const;
 
 private:
-    QSqlDatabase m_database;
+    DatabaseExecutor* m_executor;
     bool m_whiteListMode;
 
     struct DomainPermissionEntry {
@@ -89,10 +92,15 @@ private:
     };
 
     QList<DomainPermissionEntry> m_entries;
+    bool m_loaded;
+    int m_loadRequest;
+    // Changes requested before the database is read, applied once it is
+    QList<std::function<void()> > m_deferredCalls;
 
     void resetDatabase(const QString& databaseName);
     void createOrAlterDatabaseSchema();
     void populateFromDatabase();
+    void publishLoadedEntries(const QList<DomainPermissionEntry>& entries);
     int getIndexForDomain(const QString& domain) const;
 };
 
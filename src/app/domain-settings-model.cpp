@@ -16,16 +16,36 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "database-executor.h"
+#include "database-utils.h"
 #include "domain-settings-model.h"
 #include "domain-utils.h"
 
 #include <QFile>
+#include <QSharedPointer>
 #include <QtSql/QSqlQuery>
 #include <QUrl>
 #include <cmath>
 
 #define CONNECTION_NAME "morph-browser-domainsettings"
 
+// The schema version of the database file is owned by this model (the user
+// agents table, stored in the same file, is not versioned).
+
+// Schema version 1: unversioned databases.
+static bool createSchema(QSqlDatabase& database)
+{
+    return DatabaseUtils::exec(database, QLatin1String("CREATE TABLE IF NOT EXISTS domainsettings "
+                                                       "(domain VARCHAR NOT NULL UNIQUE, domainWithoutSubdomain VARCHAR, allowCustomUrlSchemes BOOL, allowLocation INTEGER, "
+                                                       "userAgentId INTEGER, zoomFactor REAL, PRIMARY KEY(domain), FOREIGN KEY(userAgentId) REFERENCES useragents(id)); "));
+}
+
+// Schema version 2: index the user agent column (domain is the primary key).
+static bool addIndexes(QSqlDatabase& database)
+{
+    return DatabaseUtils::exec(database, QLatin1String("CREATE INDEX IF NOT EXISTS domainsettings_userAgentId ON domainsettings (userAgentId);"));
+}
+
 namespace
 {
   const double ZoomFactorCompareThreshold = 0.01;
@@ -34,29 +54,27 @@ namespace
 /*!
     \class DomainSettingsModel
     \brief model that stores domain specific settings.
+
+    The database is read asynchronously, loaded() is emitted once done.
+    Changes requested before are applied then.
 */
 DomainSettingsModel::DomainSettingsModel(QObject* parent)
 : QAbstractListModel(parent)
+, m_loaded(false)
+, m_loadRequest(0)
 {
-    m_database = QSqlDatabase::addDatabase(QLatin1String("QSQLITE"), CONNECTION_NAME);
+    m_executor = new DatabaseExecutor(CONNECTION_NAME, this);
     m_defaultZoomFactor = 1.0;
 }
 
-DomainSettingsModel::~DomainSettingsModel()
-{
-    m_database.close();
-    m_database = QSqlDatabase();
-    QSqlDatabase::removeDatabase(CONNECTION_NAME);
-}
-
 void DomainSettingsModel::resetDatabase(const QString& databaseName)
 {
+    static const QList<DatabaseUtils::Migration> migrations =
+        QList<DatabaseUtils::Migration>() << createSchema << addIndexes;
     beginResetModel();
     m_entries.clear();
-    m_database.close();
-    m_database.setDatabaseName(databaseName);
-    m_database.open();
-    createOrAlterDatabaseSchema();
+    m_loaded = false;
+    m_executor->open(databaseName, migrations);
     removeObsoleteEntries();
     endResetModel();
     populateFromDatabase();
@@ -107,44 +125,61 @@ QVariant DomainSettingsModel::data(const QModelIndex& index, int role) const
     }
 }
 
-void DomainSettingsModel::createOrAlterDatabaseSchema()
+void DomainSettingsModel::populateFromDatabase()
 {
-    QSqlQuery createQuery(m_database);
-    QString query = QLatin1String("CREATE TABLE IF NOT EXISTS domainsettings "
-                                  "(domain VARCHAR NOT NULL UNIQUE, domainWithoutSubdomain VARCHAR, allowCustomUrlSchemes BOOL, allowLocation INTEGER, "
-                                  "userAgentId INTEGER, zoomFactor REAL, PRIMARY KEY(domain), FOREIGN KEY(userAgentId) REFERENCES useragents(id)); ");
-    createQuery.prepare(query);
-    createQuery.exec();
+    QSharedPointer<QList<DomainSetting> > entries(new QList<DomainSetting>);
+    int request = ++m_loadRequest;
+    m_executor->post([entries](QSqlDatabase& database) {
+        QSqlQuery populateQuery(database);
+        QString query = QLatin1String("SELECT domain, domainWithoutSubdomain, allowCustomUrlSchemes, allowLocation, userAgentId, zoomFactor "
+                                      "FROM domainsettings;");
+        populateQuery.prepare(query);
+        populateQuery.exec();
+        while (populateQuery.next()) {
+            DomainSetting entry;
+            entry.domain = populateQuery.value("domain").toString();
+            entry.domainWithoutSubdomain = populateQuery.value("domainWithoutSubdomain").toString();
+            entry.allowCustomUrlSchemes = populateQuery.value("allowCustomUrlSchemes").toBool();
+            entry.allowLocation = static_cast<AllowLocationPreference>(populateQuery.value("allowLocation").toInt());
+            entry.userAgentId = populateQuery.value("userAgentId").toInt();
+            entry.zoomFactor =  populateQuery.value("zoomFactor").isNull() ? std::numeric_limits<double>::quiet_NaN()
+                                                                           : populateQuery.value("zoomFactor").toDouble();
+            entries->append(entry);
+        }
+    }, [this, entries, request](bool, const QVariant&) {
+        // Ignore the result if the database was changed in the meantime
+        if (request == m_loadRequest) {
+            publishLoadedEntries(*entries);
+        }
+    });
 }
 
-void DomainSettingsModel::populateFromDatabase()
+void DomainSettingsModel::publishLoadedEntries(const QList<DomainSetting>& entries)
 {
-    QSqlQuery populateQuery(m_database);
-    QString query = QLatin1String("SELECT domain, domainWithoutSubdomain, allowCustomUrlSchemes, allowLocation, userAgentId, zoomFactor "
-                                  "FROM domainsettings;");
-    populateQuery.prepare(query);
-    populateQuery.exec();
-    int count = 0; // size() isn't supported on the sqlite backend
-    while (populateQuery.next()) {
-        DomainSetting entry;
-        entry.domain = populateQuery.value("domain").toString();
-        entry.domainWithoutSubdomain = populateQuery.value("domainWithoutSubdomain").toString();
-        entry.allowCustomUrlSchemes = populateQuery.value("allowCustomUrlSchemes").toBool();
-        entry.allowLocation = static_cast<AllowLocationPreference>(populateQuery.value("allowLocation").toInt());
-        entry.userAgentId = populateQuery.value("userAgentId").toInt();
-        entry.zoomFactor =  populateQuery.value("zoomFactor").isNull() ? std::numeric_limits<double>::quiet_NaN()
-                                                                       : populateQuery.value("zoomFactor").toDouble();
-
-        beginInsertRows(QModelIndex(), count, count);
-        m_entries.append(entry);
+    if (!entries.isEmpty()) {
+        beginInsertRows(QModelIndex(), 0, entries.count() - 1);
+        m_entries = entries;
         endInsertRows();
-        count++;
+        Q_EMIT rowCountChanged();
+    }
+    m_loaded = true;
+    // The default zoom factor was used for these domains until now
+    Q_FOREACH(const DomainSetting& entry, entries) {
+        if (!std::isnan(entry.zoomFactor)) {
+            Q_EMIT domainZoomFactorChanged(entry.domain);
+        }
+    }
+    QList<std::function<void()> > calls;
+    calls.swap(m_deferredCalls);
+    Q_FOREACH(const std::function<void()>& call, calls) {
+        call();
     }
+    Q_EMIT loaded();
 }
 
 const QString DomainSettingsModel::databasePath() const
 {
-    return m_database.databaseName();
+    return m_executor->databaseName();
 }
 
 void DomainSettingsModel::setDatabasePath(const QString& path)
@@ -176,11 +211,18 @@ bool DomainSettingsModel::contains(const QString& domain) const
 
 void DomainSettingsModel::deleteAndResetDataBase()
 {
-    if (QFile::exists(databasePath()))
-    {
-        QFile(databasePath()).remove();
-    }
-    resetDatabase(databasePath());
+    // Pending operations are written before the file is removed, changes
+    // requested before the database was read are dropped with it
+    m_deferredCalls.clear();
+    QString path = databasePath();
+    m_executor->post([path](QSqlDatabase& database) {
+        database.close();
+        if (QFile::exists(path))
+        {
+            QFile(path).remove();
+        }
+    });
+    resetDatabase(path);
 }
 
 bool DomainSettingsModel::areCustomUrlSchemesAllowed(const QString& domain)
@@ -196,6 +238,10 @@ bool DomainSettingsModel::areCustomUrlSchemesAllowed(const QString& domain)
 
 void DomainSettingsModel::allowCustomUrlSchemes(const QString& domain, bool allow)
 {
+    if (!m_loaded) {
+        m_deferredCalls.append([this, domain, allow]() { allowCustomUrlSchemes(domain, allow); });
+        return;
+    }
     insertEntry(domain);
 
     int index = getIndexForDomain(domain);
@@ -206,12 +252,8 @@ void DomainSettingsModel::allowCustomUrlSchemes(const QString& domain, bool allo
         }
         entry.allowCustomUrlSchemes = allow;
         Q_EMIT dataChanged(this->index(index, 0), this->index(index, 0), QVector<int>() << AllowCustomUrlSchemes);
-        QSqlQuery query(m_database);
         static QString updateStatement = QLatin1String("UPDATE domainsettings SET allowCustomUrlSchemes=? WHERE domain=?;");
-        query.prepare(updateStatement);
-        query.addBindValue(allow);
-        query.addBindValue(domain);
-        query.exec();
+        m_executor->enqueue(updateStatement, QVariantList() << allow << domain);
     }
 }
 
@@ -228,6 +270,10 @@ DomainSettingsModel::AllowLocationPreference DomainSettingsModel::getLocationPre
 
 void DomainSettingsModel::setLocationPreference(const QString& domain, DomainSettingsModel::AllowLocationPreference preference)
 {
+    if (!m_loaded) {
+        m_deferredCalls.append([this, domain, preference]() { setLocationPreference(domain, preference); });
+        return;
+    }
     insertEntry(domain);
 
     int index = getIndexForDomain(domain);
@@ -238,12 +284,8 @@ void DomainSettingsModel::setLocationPreference(const QString& domain, DomainSet
         }
         entry.allowLocation = preference;
         Q_EMIT dataChanged(this->index(index, 0), this->index(index, 0), QVector<int>() << AllowLocation);
-        QSqlQuery query(m_database);
         static QString updateStatement = QLatin1String("UPDATE domainsettings SET allowLocation=? WHERE domain=?;");
-        query.prepare(updateStatement);
-        query.addBindValue(entry.allowLocation);
-        query.addBindValue(domain);
-        query.exec();
+        m_executor->enqueue(updateStatement, QVariantList() << entry.allowLocation << domain);
     }
 }
 
@@ -260,6 +302,10 @@ int DomainSettingsModel::getUserAgentId(const QString& domain) const
 
 void DomainSettingsModel::setUserAgentId(const QString& domain, int userAgentId)
 {
+    if (!m_loaded) {
+        m_deferredCalls.append([this, domain, userAgentId]() { setUserAgentId(domain, userAgentId); });
+        return;
+    }
     insertEntry(domain);
 
     int index = getIndexForDomain(domain);
@@ -270,17 +316,17 @@ void DomainSettingsModel::setUserAgentId(const QString& domain, int userAgentId)
         }
         entry.userAgentId = userAgentId;
         Q_EMIT dataChanged(this->index(index, 0), this->index(index, 0), QVector<int>() << UserAgentId);
-        QSqlQuery query(m_database);
         static QString updateStatement = QLatin1String("UPDATE domainsettings SET userAgentId=? WHERE domain=?;");
-        query.prepare(updateStatement);
-        query.addBindValue((userAgentId > 0) ? userAgentId : QVariant());
-        query.addBindValue(domain);
-        query.exec();
+        m_executor->enqueue(updateStatement, QVariantList() << ((userAgentId > 0) ? userAgentId : QVariant()) << domain);
     }
 }
 
 void DomainSettingsModel::removeUserAgentIdFromAllDomains(int userAgentId)
 {
+    if (!m_loaded) {
+        m_deferredCalls.append([this, userAgentId]() { removeUserAgentIdFromAllDomains(userAgentId); });
+        return;
+    }
     bool foundDomainWithGivenUserAgentId = false;
     for (int i = 0; i < m_entries.length(); i++)
     {
@@ -293,11 +339,8 @@ void DomainSettingsModel::removeUserAgentIdFromAllDomains(int userAgentId)
 
     if (foundDomainWithGivenUserAgentId)
     {
-        QSqlQuery query(m_database);
         static QString updateStatement = QLatin1String("UPDATE domainsettings SET userAgentId=NULL WHERE userAgentId=?;");
-        query.prepare(updateStatement);
-        query.addBindValue(userAgentId);
-        query.exec();
+        m_executor->enqueue(updateStatement, QVariantList() << userAgentId);
     }
 }
 
@@ -314,6 +357,10 @@ double DomainSettingsModel::getZoomFactor(const QString& domain) const
 
 void DomainSettingsModel::setZoomFactor(const QString& domain, double zoomFactor)
 {
+    if (!m_loaded) {
+        m_deferredCalls.append([this, domain, zoomFactor]() { setZoomFactor(domain, zoomFactor); });
+        return;
+    }
     insertEntry(domain);
 
     int index = getIndexForDomain(domain);
@@ -325,17 +372,17 @@ void DomainSettingsModel::setZoomFactor(const QString& domain, double zoomFactor
         entry.zoomFactor = zoomFactor;
         Q_EMIT dataChanged(this->index(index, 0), this->index(index, 0), QVector<int>() << ZoomFactor);
         Q_EMIT domainZoomFactorChanged(domain);
-        QSqlQuery query(m_database);
         static QString updateStatement = QLatin1String("UPDATE domainsettings SET zoomFactor=? WHERE domain=?;");
-        query.prepare(updateStatement);
-        query.addBindValue(zoomFactor);
-        query.addBindValue(domain);
-        query.exec();
+        m_executor->enqueue(updateStatement, QVariantList() << zoomFactor << domain);
     }
 }
 
 void DomainSettingsModel::insertEntry(const QString &domain)
 {
+    if (!m_loaded) {
+        m_deferredCalls.append([this, domain]() { insertEntry(domain); });
+        return;
+    }
     if (contains(domain))
     {
         return;
@@ -353,21 +400,24 @@ void DomainSettingsModel::insertEntry(const QString &domain)
     endInsertRows();
     Q_EMIT rowCountChanged();
 
-    QSqlQuery query(m_database);
     static QString insertStatement = QLatin1String("INSERT INTO domainsettings (domain, domainWithoutSubdomain, allowCustomUrlSchemes, allowLocation, userAgentId, zoomFactor)"
                                                    " VALUES (?, ?, ?, ?, ?, ?);");
-    query.prepare(insertStatement);
-    query.addBindValue(entry.domain);
-    query.addBindValue(entry.domainWithoutSubdomain);
-    query.addBindValue(entry.allowCustomUrlSchemes);
-    query.addBindValue(entry.allowLocation);
-    query.addBindValue((entry.userAgentId > 0) ? entry.userAgentId : QVariant());
-    query.addBindValue(entry.zoomFactor);
-    query.exec();
+    QVariantList values;
+    values << entry.domain;
+    values << entry.domainWithoutSubdomain;
+    values << entry.allowCustomUrlSchemes;
+    values << entry.allowLocation;
+    values << ((entry.userAgentId > 0) ? entry.userAgentId : QVariant());
+    values << entry.zoomFactor;
+    m_executor->enqueue(insertStatement, values);
 }
 
 void DomainSettingsModel::removeEntry(const QString &domain)
 {
+    if (!m_loaded) {
+        m_deferredCalls.append([this, domain]() { removeEntry(domain); });
+        return;
+    }
     int index = getIndexForDomain(domain);
     if (index != -1) {
         DomainSetting& entry = m_entries[index];
@@ -379,22 +429,15 @@ void DomainSettingsModel::removeEntry(const QString &domain)
         {
             Q_EMIT domainZoomFactorChanged(domain);
         }
-        QSqlQuery query(m_database);
         static QString deleteStatement = QLatin1String("DELETE FROM domainsettings WHERE domain=?;");
-        query.prepare(deleteStatement);
-        query.addBindValue(domain);
-        query.exec();
+        m_executor->enqueue(deleteStatement, QVariantList() << domain);
     }
 }
 
 void DomainSettingsModel::removeObsoleteEntries()
 {
-    QSqlQuery query(m_database);
     static QString deleteStatement = QLatin1String("DELETE FROM domainsettings WHERE allowCustomUrlSchemes=? AND allowLocation=? AND userAgentId IS NULL AND zoomFactor IS NULL;");
-    query.prepare(deleteStatement);
-    query.addBindValue(false);
-    query.addBindValue(false);
-    query.exec();
+    m_executor->enqueue(deleteStatement, QVariantList() << false << false);
 }
 
 int DomainSettingsModel::getIndexForDomain(const QString& domain) const
@@ -21,8 +21,10 @@
 
 #include <QAbstractListModel>
 #include <QString>
-#include <QtSql/QSqlDatabase>
 
+#include <functional>
+
+class DatabaseExecutor;
 
 class DomainSettingsModel : public QAbstractListModel
 {
@@ -37,7 +39,6 @@ class DomainSettingsModel : public QAbstractListModel
 
 public:
     DomainSettingsModel(QObject* parent=0);
-    ~DomainSettingsModel();
 
     enum AllowLocationPreference {
      AskForLocationAccess = 0,
@@ -83,9 +84,10 @@ Q_SIGNALS:
     void databasePathChanged() const;
     void rowCountChanged();
     void domainZoomFactorChanged(const QString& domain);
+    void loaded() const;
 
 private:
-    QSqlDatabase m_database;
+    DatabaseExecutor* m_executor;
     double m_defaultZoomFactor;
 
     struct DomainSetting {
@@ -98,10 +100,14 @@ private:
     };
 
     QList<DomainSetting> m_entries;
+    bool m_loaded;
+    int m_loadRequest;
+    // Changes requested before the database is read, applied once it is
+    QList<std::function<void()> > m_deferredCalls;
 
     void resetDatabase(const QString& databaseName);
-    void createOrAlterDatabaseSchema();
     void populateFromDatabase();
+    void publishLoadedEntries(const QList<DomainSetting>& entries);
     void removeObsoleteEntries();
     int getIndexForDomain(const QString& domain) const;
 };
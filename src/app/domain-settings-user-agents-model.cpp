@@ -16,9 +16,12 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "database-executor.h"
+#include "database-utils.h"
 #include "domain-settings-user-agents-model.h"
 
 #include <QFile>
+#include <QSharedPointer>
 #include <QtSql/QSqlQuery>
 #include <QUrl>
 
@@ -27,27 +30,25 @@
 /*!
     \class UserAgentsModel
     \brief model that stores custom user agents.
+
+    The database is read asynchronously, loaded() is emitted once done.
+    Changes requested before are applied then.
 */
 UserAgentsModel::UserAgentsModel(QObject* parent)
 : QAbstractListModel(parent)
+, m_nextId(1)
+, m_loaded(false)
+, m_loadRequest(0)
 {
-    m_database = QSqlDatabase::addDatabase(QLatin1String("QSQLITE"), CONNECTION_NAME);
-}
-
-UserAgentsModel::~UserAgentsModel()
-{
-    m_database.close();
-    m_database = QSqlDatabase();
-    QSqlDatabase::removeDatabase(CONNECTION_NAME);
+    m_executor = new DatabaseExecutor(CONNECTION_NAME, this);
 }
 
 void UserAgentsModel::resetDatabase(const QString& databaseName)
 {
     beginResetModel();
     m_entries.clear();
-    m_database.close();
-    m_database.setDatabaseName(databaseName);
-    m_database.open();
+    m_loaded = false;
+    m_executor->open(databaseName);
     createOrAlterDatabaseSchema();
     endResetModel();
     populateFromDatabase();
@@ -91,35 +92,66 @@ QVariant UserAgentsModel::data(const QModelIndex& index, int role) const
 
 void UserAgentsModel::createOrAlterDatabaseSchema()
 {
-    QSqlQuery createQuery(m_database);
-    QString query = QLatin1String("CREATE TABLE IF NOT EXISTS useragents "
-                                  "(id INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT UNIQUE, name VARCHAR, userAgentString VARCHAR);");
-    createQuery.prepare(query);
-    createQuery.exec();
+    m_executor->post([](QSqlDatabase& database) {
+        DatabaseUtils::exec(database, QLatin1String("CREATE TABLE IF NOT EXISTS useragents "
+                                                    "(id INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT UNIQUE, name VARCHAR, userAgentString VARCHAR);"));
+    });
 }
 
 void UserAgentsModel::populateFromDatabase()
 {
-    QSqlQuery populateQuery(m_database);
-    QString query = QLatin1String("SELECT id, name, userAgentString FROM useragents");
-    populateQuery.prepare(query);
-    populateQuery.exec();
-    int count = 0; // size() isn't supported on the sqlite backend
-    while (populateQuery.next()) {
-        UserAgent entry;
-        entry.id = populateQuery.value("id").toInt();
-        entry.name = populateQuery.value("name").toString();
-        entry.userAgentString = populateQuery.value("userAgentString").toString();
-        beginInsertRows(QModelIndex(), count, count);
-        m_entries.append(entry);
+    QSharedPointer<QList<UserAgent> > entries(new QList<UserAgent>);
+    // Identifiers are never reused, even those of the entries removed last
+    QSharedPointer<int> lastId(new int(0));
+    int request = ++m_loadRequest;
+    m_executor->post([entries, lastId](QSqlDatabase& database) {
+        QSqlQuery sequenceQuery(database);
+        sequenceQuery.exec(QLatin1String("SELECT seq FROM sqlite_sequence WHERE name='useragents';"));
+        if (sequenceQuery.next()) {
+            *lastId = sequenceQuery.value(0).toInt();
+        }
+
+        QSqlQuery populateQuery(database);
+        QString query = QLatin1String("SELECT id, name, userAgentString FROM useragents");
+        populateQuery.prepare(query);
+        populateQuery.exec();
+        while (populateQuery.next()) {
+            UserAgent entry;
+            entry.id = populateQuery.value("id").toInt();
+            entry.name = populateQuery.value("name").toString();
+            entry.userAgentString = populateQuery.value("userAgentString").toString();
+            entries->append(entry);
+            *lastId = qMax(*lastId, entry.id);
+        }
+    }, [this, entries, lastId, request](bool, const QVariant&) {
+        // Ignore the result if the database was changed in the meantime
+        if (request == m_loadRequest) {
+            m_nextId = *lastId + 1;
+            publishLoadedEntries(*entries);
+        }
+    });
+}
+
+void UserAgentsModel::publishLoadedEntries(const QList<UserAgent>& entries)
+{
+    if (!entries.isEmpty()) {
+        beginInsertRows(QModelIndex(), 0, entries.count() - 1);
+        m_entries = entries;
         endInsertRows();
-        count++;
+        Q_EMIT rowCountChanged();
     }
+    m_loaded = true;
+    QList<std::function<void()> > calls;
+    calls.swap(m_deferredCalls);
+    Q_FOREACH(const std::function<void()>& call, calls) {
+        call();
+    }
+    Q_EMIT loaded();
 }
 
 const QString UserAgentsModel::databasePath() const
 {
-    return m_database.databaseName();
+    return m_executor->databaseName();
 }
 
 void UserAgentsModel::setDatabasePath(const QString& path)
@@ -141,30 +173,40 @@ bool UserAgentsModel::contains(const QString& userAgentName) const
 
 void UserAgentsModel::deleteAndResetDataBase()
 {
-    if (QFile::exists(databasePath()))
-    {
-        QFile(databasePath()).remove();
-    }
-    resetDatabase(databasePath());
+    // Pending operations are written before the file is removed, changes
+    // requested before the database was read are dropped with it
+    m_deferredCalls.clear();
+    QString path = databasePath();
+    m_executor->post([path](QSqlDatabase& database) {
+        database.close();
+        if (QFile::exists(path))
+        {
+            QFile(path).remove();
+        }
+    });
+    resetDatabase(path);
 }
 
 void UserAgentsModel::insertEntry(const QString& userAgentName, const QString& userAgentString)
 {
+    if (!m_loaded) {
+        m_deferredCalls.append([this, userAgentName, userAgentString]() { insertEntry(userAgentName, userAgentString); });
+        return;
+    }
     if (contains(userAgentName))
     {
         return;
     }
 
-    QSqlQuery query(m_database);
-    static QString insertStatement = QLatin1String("INSERT INTO useragents (name, userAgentString) VALUES (?, ?);");
-    query.prepare(insertStatement);
-    query.addBindValue(userAgentName);
-    query.addBindValue(userAgentString);
-    query.exec();
+    // The identifier of the new entry is needed right away, it is assigned
+    // here rather than by the database
+    int id = m_nextId++;
+    static QString insertStatement = QLatin1String("INSERT INTO useragents (id, name, userAgentString) VALUES (?, ?, ?);");
+    m_executor->enqueue(insertStatement, QVariantList() << id << userAgentName << userAgentString);
 
     beginInsertRows(QModelIndex(), 0, 0);
     UserAgent entry;
-    entry.id = query.lastInsertId().toInt();
+    entry.id = id;
     entry.name = userAgentName;
     entry.userAgentString = userAgentString;
     m_entries.append(entry);
@@ -174,17 +216,18 @@ void UserAgentsModel::insertEntry(const QString& userAgentName, const QString& u
 
 void UserAgentsModel::removeEntry(int userAgentId)
 {
+    if (!m_loaded) {
+        m_deferredCalls.append([this, userAgentId]() { removeEntry(userAgentId); });
+        return;
+    }
     int index = getIndexForUserAgentId(userAgentId);
     if (index != -1) {
         beginRemoveRows(QModelIndex(), index, index);
         m_entries.removeAt(index);
         endRemoveRows();
         Q_EMIT rowCountChanged();
-        QSqlQuery query(m_database);
         static QString deleteStatement = QLatin1String("DELETE FROM useragents WHERE id=?;");
-        query.prepare(deleteStatement);
-        query.addBindValue(userAgentId);
-        query.exec();
+        m_executor->enqueue(deleteStatement, QVariantList() << userAgentId);
     }
 }
 
@@ -201,6 +244,10 @@ QString UserAgentsModel::getUserAgentString(int userAgentId) const
 
 void UserAgentsModel::setUserAgentString(int userAgentId, const QString& userAgentString)
 {
+    if (!m_loaded) {
+        m_deferredCalls.append([this, userAgentId, userAgentString]() { setUserAgentString(userAgentId, userAgentString); });
+        return;
+    }
     int index = getIndexForUserAgentId(userAgentId);
     if (index != -1) {
         UserAgent& entry = m_entries[index];
@@ -209,17 +256,17 @@ void UserAgentsModel::setUserAgentString(int userAgentId, const QString& userAge
         }
         entry.userAgentString = userAgentString;
         Q_EMIT dataChanged(this->index(index, 0), this->index(index, 0), QVector<int>() << UserAgentString);
-        QSqlQuery query(m_database);
         static QString updateStatement = QLatin1String("UPDATE useragents SET userAgentString=? WHERE id=?;");
-        query.prepare(updateStatement);
-        query.addBindValue(userAgentString);
-        query.addBindValue(userAgentId);
-        query.exec();
+        m_executor->enqueue(updateStatement, QVariantList() << userAgentString << userAgentId);
     }
 }
 
 void UserAgentsModel::setUserAgentName(int userAgentId, const QString& userAgentName)
 {
+    if (!m_loaded) {
+        m_deferredCalls.append([this, userAgentId, userAgentName]() { setUserAgentName(userAgentId, userAgentName); });
+        return;
+    }
     int index = getIndexForUserAgentId(userAgentId);
     if (index != -1) {
         UserAgent& entry = m_entries[index];
@@ -228,12 +275,8 @@ void UserAgentsModel::setUserAgentName(int userAgentId, const QString& userAgent
         }
         entry.name = userAgentName;
         Q_EMIT dataChanged(this->index(index, 0), this->index(index, 0), QVector<int>() << Name);
-        QSqlQuery query(m_database);
         static QString updateStatement = QLatin1String("UPDATE useragents SET name=? WHERE id=?;");
-        query.prepare(updateStatement);
-        query.addBindValue(userAgentName);
-        query.addBindValue(userAgentId);
-        query.exec();
+        m_executor->enqueue(updateStatement, QVariantList() << userAgentName << userAgentId);
     }
 }
 
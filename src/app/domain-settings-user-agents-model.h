@@ -21,7 +21,10 @@
 
 #include <QAbstractListModel>
 #include <QString>
-#include <QtSql/QSqlDatabase>
+
+#include <functional>
+
+class DatabaseExecutor;
 
 class UserAgentsModel : public QAbstractListModel
 {
@@ -34,7 +37,6 @@ class UserAgentsModel : public QAbstractListModel
 
 public:
     UserAgentsModel(QObject* parent=0);
-    ~UserAgentsModel();
 
     enum Roles {
         Id = Qt::UserRole + 1,
@@ -61,9 +63,10 @@ public:
 Q_SIGNALS:
     void databasePathChanged() const;
     void rowCountChanged();
+    void loaded() const;
 
 private:
-    QSqlDatabase m_database;
+    DatabaseExecutor* m_executor;
     double m_defaultZoomFactor;
 
     struct UserAgent {
@@ -73,10 +76,16 @@ private:
     };
 
     QList<UserAgent> m_entries;
+    int m_nextId;
+    bool m_loaded;
+    int m_loadRequest;
+    // Changes requested before the database is read, applied once it is
+    QList<std::function<void()> > m_deferredCalls;
 
     void resetDatabase(const QString& databaseName);
     void createOrAlterDatabaseSchema();
     void populateFromDatabase();
+    void publishLoadedEntries(const QList<UserAgent>& entries);
     int getIndexForUserAgentId(int userAgentId) const;
     int getIndexForUserAgentName(const QString& userAgentName) const;
 };
@@ -16,6 +16,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "database-executor.h"
+#include "database-utils.h"
 #include "downloads-model.h"
 
 #include <QtCore/QDebug>
@@ -24,11 +26,30 @@
 #include <QtCore/QFileInfo>
 #include <QtCore/QMimeDatabase>
 #include <QtCore/QMimeType>
+#include <QtCore/QSharedPointer>
 #include <QtCore/QStandardPaths>
 #include <QtSql/QSqlQuery>
 
 #define CONNECTION_NAME "morph-browser-downloads"
 
+// Schema version 1: unversioned databases.
+static bool createSchema(QSqlDatabase& database)
+{
+    return DatabaseUtils::exec(database, QLatin1String("CREATE TABLE IF NOT EXISTS downloads "
+                                                       "(downloadId VARCHAR, url VARCHAR, path VARCHAR, "
+                                                       "mimetype VARCHAR, complete BOOL, paused BOOL, "
+                                                       "error VARCHAR, created DATETIME DEFAULT "
+                                                       "CURRENT_TIMESTAMP);"));
+}
+
+// Schema version 2: index the columns used to look up and sort entries.
+static bool addIndexes(QSqlDatabase& database)
+{
+    return DatabaseUtils::exec(database, QLatin1String("CREATE INDEX IF NOT EXISTS downloads_downloadId ON downloads (downloadId);")) &&
+           DatabaseUtils::exec(database, QLatin1String("CREATE INDEX IF NOT EXISTS downloads_path ON downloads (path);")) &&
+           DatabaseUtils::exec(database, QLatin1String("CREATE INDEX IF NOT EXISTS downloads_created ON downloads (created);"));
+}
+
 /*!
     \class DownloadsModel
     \brief List model that stores information about downloaded files.
@@ -42,9 +63,10 @@
     download first.
 
     The information is persistently stored on disk in a SQLite database.
-    The database is read at startup to populate the model, and whenever a new
+    The database is read asynchronously, one page at a time (see fetchMore()),
+    to populate the model, and whenever a new
     entry is added to the model or an entry is removed from the model
-    the database is updated. Removing a download from the model also results
+    the database is updated (asynchronously, see DatabaseExecutor). Removing a download from the model also results
     in it being deleted from the disk.
     The model doesn’t monitor the database for external changes, but does check
     that downloaded files still exist when first populating.
@@ -54,65 +76,79 @@ DownloadsModel::DownloadsModel(QObject* parent)
     , m_numRows(0)
     , m_fetchedCount(0)
     , m_canFetchMore(true)
+    , m_fetching(false)
+    , m_fetchRequest(0)
 {
-    m_database = QSqlDatabase::addDatabase(QLatin1String("QSQLITE"), CONNECTION_NAME);
-}
-
-DownloadsModel::~DownloadsModel()
-{
-    m_database.close();
-    m_database = QSqlDatabase();
-    QSqlDatabase::removeDatabase(CONNECTION_NAME);
+    m_executor = new DatabaseExecutor(CONNECTION_NAME, this);
 }
 
 void DownloadsModel::resetDatabase(const QString& databaseName)
 {
+    static const QList<DatabaseUtils::Migration> migrations =
+        QList<DatabaseUtils::Migration>() << createSchema << addIndexes;
     beginResetModel();
     m_orderedEntries.clear();
-    m_database.close();
-    m_database.setDatabaseName(databaseName);
-    m_database.open();
     m_numRows = 0;
     m_fetchedCount = 0;
     m_canFetchMore = true;
-    createOrAlterDatabaseSchema();
+    m_fetching = false;
+    ++m_fetchRequest;
+    m_executor->open(databaseName, migrations);
     endResetModel();
     Q_EMIT rowCountChanged();
 }
 
-void DownloadsModel::createOrAlterDatabaseSchema()
+/*!
+    Read the next page of downloads from the database asynchronously.
+*/
+void DownloadsModel::fetchMore(const QModelIndex &parent)
 {
-    QSqlQuery createQuery(m_database);
-    QString query = QLatin1String("CREATE TABLE IF NOT EXISTS downloads "
-                                  "(downloadId VARCHAR, url VARCHAR, path VARCHAR, "
-                                  "mimetype VARCHAR, complete BOOL, paused BOOL, "
-                                  "error VARCHAR, created DATETIME DEFAULT "
-                                  "CURRENT_TIMESTAMP);");
-    createQuery.prepare(query);
-    createQuery.exec();
+    Q_UNUSED(parent)
+
+    if (m_fetching) {
+        return;
+    }
+    m_fetching = true;
+    QSharedPointer<QList<DownloadEntry> > entries(new QList<DownloadEntry>);
+    int offset = m_fetchedCount;
+    int request = m_fetchRequest;
+    m_executor->post([entries, offset](QSqlDatabase& database) {
+        QSqlQuery populateQuery(database);
+        QString query = QLatin1String("SELECT downloadId, url, path, mimetype, "
+                                      "complete, error, created, paused "
+                                      "FROM downloads ORDER BY created DESC LIMIT 100 OFFSET ?;");
+        populateQuery.prepare(query);
+        populateQuery.addBindValue(offset);
+        populateQuery.exec();
+        while (populateQuery.next()) {
+            DownloadEntry entry;
+            entry.incognito = false;
+            entry.downloadId = populateQuery.value(0).toString();
+            entry.url = populateQuery.value(1).toUrl();
+            entry.path = populateQuery.value(2).toString();
+            entry.mimetype = populateQuery.value(3).toString();
+            entry.complete = populateQuery.value(4).toBool();
+            entry.error = populateQuery.value(5).toString();
+            entry.created = QDateTime::fromTime_t(populateQuery.value(6).toInt());
+            entry.paused = populateQuery.value(7).toBool();
+            entries->append(entry);
+        }
+    }, [this, entries, request](bool, const QVariant&) {
+        // Ignore the page if the database was changed in the meantime
+        if (request == m_fetchRequest) {
+            m_fetching = false;
+            insertFetchedEntries(*entries);
+        }
+    });
 }
 
-void DownloadsModel::fetchMore(const QModelIndex &parent)
+/* Append a page read from the database. Downloads added or removed while it
+   was being read are accounted for in m_fetchedCount, and added ones are
+   more recent than the ones read. */
+void DownloadsModel::insertFetchedEntries(const QList<DownloadEntry>& entries)
 {
-    QSqlQuery populateQuery(m_database);
-    QString query = QLatin1String("SELECT downloadId, url, path, mimetype, "
-                                  "complete, error, created, paused "
-                                  "FROM downloads ORDER BY created DESC LIMIT 100 OFFSET ?;");
-    populateQuery.prepare(query);
-    populateQuery.addBindValue(m_fetchedCount);
-    populateQuery.exec();
-    int count = 0; // size() isn't supported on the sqlite backend
-    while (populateQuery.next()) {
-        DownloadEntry entry;
-        entry.incognito = false;
-        entry.downloadId = populateQuery.value(0).toString();
-        entry.url = populateQuery.value(1).toUrl();
-        entry.path = populateQuery.value(2).toString();
-        entry.mimetype = populateQuery.value(3).toString();
-        entry.complete = populateQuery.value(4).toBool();
-        entry.error = populateQuery.value(5).toString();
-        entry.created = QDateTime::fromTime_t(populateQuery.value(6).toInt());
-        entry.paused = populateQuery.value(7).toBool();
+    int count = 0;
+    Q_FOREACH(DownloadEntry entry, entries) {
         QFileInfo fileInfo(entry.path);
         if (fileInfo.exists()) {
             entry.filename = fileInfo.fileName();
@@ -193,7 +229,7 @@ QVariant DownloadsModel::data(const QModelIndex& index, int role) const
 
 const QString DownloadsModel::databasePath() const
 {
-    return m_database.databaseName();
+    return m_executor->databaseName();
 }
 
 void DownloadsModel::setDatabasePath(const QString& path)
@@ -270,13 +306,8 @@ void DownloadsModel::setComplete(const QString& downloadId, const bool complete)
         
         Q_EMIT dataChanged(this->index(index, 0), this->index(index, 0), QVector<int>() << updatedRoles);
         if (!entry.incognito) {
-            QSqlQuery query(m_database);
             static QString updateStatement = QLatin1String("UPDATE downloads SET complete=?, mimetype=? WHERE downloadId=?;");
-            query.prepare(updateStatement);
-            query.addBindValue(entry.complete);
-            query.addBindValue(entry.mimetype);
-            query.addBindValue(downloadId);
-            query.exec();
+            m_executor->enqueue(updateStatement, QVariantList() << entry.complete << entry.mimetype << downloadId);
         }
     }
 }
@@ -292,26 +323,21 @@ void DownloadsModel::setError(const QString& downloadId, const QString& error)
         entry.error = error;
         Q_EMIT dataChanged(this->index(index, 0), this->index(index, 0), QVector<int>() << Error);
         if (!entry.incognito) {
-            QSqlQuery query(m_database);
             static QString updateStatement = QLatin1String("UPDATE downloads SET error=? WHERE downloadId=?;");
-            query.prepare(updateStatement);
-            query.addBindValue(error);
-            query.addBindValue(downloadId);
-            query.exec();
+            m_executor->enqueue(updateStatement, QVariantList() << error << downloadId);
         }
     }
 }
 
 void DownloadsModel::insertNewEntryInDatabase(const DownloadEntry& entry)
 {
-    QSqlQuery query(m_database);
     static QString insertStatement = QLatin1String("INSERT INTO downloads (downloadId, url, path, mimetype) VALUES (?, ?, ?, ?);");
-    query.prepare(insertStatement);
-    query.addBindValue(entry.downloadId);
-    query.addBindValue(entry.url);
-    query.addBindValue(entry.path);
-    query.addBindValue(entry.mimetype);
-    query.exec();
+    QVariantList values;
+    values << entry.downloadId;
+    values << entry.url;
+    values << entry.path;
+    values << entry.mimetype;
+    m_executor->enqueue(insertStatement, values);
 }
 
 /*!
@@ -356,11 +382,8 @@ void DownloadsModel::cancelDownload(const QString& downloadId)
         m_numRows--;
         Q_EMIT rowCountChanged();
         if (!incognito) {
-            QSqlQuery query(m_database);
             static QString deleteStatement = QLatin1String("DELETE FROM downloads WHERE downloadId=?;");
-            query.prepare(deleteStatement);
-            query.addBindValue(downloadId);
-            query.exec();
+            m_executor->enqueue(deleteStatement, QVariantList() << downloadId);
             m_fetchedCount--;
         }
     }
@@ -377,12 +400,8 @@ void DownloadsModel::setPaused(const QString& downloadId, bool paused)
         entry.paused = paused;
         Q_EMIT dataChanged(this->index(index, 0), this->index(index, 0), QVector<int>() << Paused);
         if (!entry.incognito) {
-            QSqlQuery query(m_database);
             static QString pauseStatement = QLatin1String("UPDATE downloads SET paused=? WHERE downloadId=?;");
-            query.prepare(pauseStatement);
-            query.addBindValue(paused);
-            query.addBindValue(downloadId);
-            query.exec();
+            m_executor->enqueue(pauseStatement, QVariantList() << paused << downloadId);
         }
     }
 }
@@ -413,18 +432,15 @@ void DownloadsModel::pruneIncognitoDownloads()
 
 void DownloadsModel::removeExistingEntryFromDatabase(const QString& path)
 {
-    QSqlQuery query(m_database);
     static QString deleteStatement = QLatin1String("DELETE FROM downloads WHERE path=?;");
-    query.prepare(deleteStatement);
-    query.addBindValue(path);
-    query.exec();
+    m_executor->enqueue(deleteStatement, QVariantList() << path);
 }
 
 bool DownloadsModel::canFetchMore(const QModelIndex &parent) const
 {
     Q_UNUSED(parent)
 
-    return m_canFetchMore;
+    return m_canFetchMore && !m_fetching;
 }
 
 int DownloadsModel::getIndexForDownloadId(const QString& downloadId) const
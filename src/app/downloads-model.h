@@ -25,7 +25,8 @@
 #include <QtCore/QSet>
 #include <QtCore/QString>
 #include <QtCore/QUrl>
-#include <QtSql/QSqlDatabase>
+
+class DatabaseExecutor;
 
 class DownloadsModel : public QAbstractListModel
 {
@@ -38,7 +39,6 @@ class DownloadsModel : public QAbstractListModel
 
 public:
     DownloadsModel(QObject* parent=0);
-    ~DownloadsModel();
 
     enum Roles {
         DownloadId = Qt::UserRole + 1,
@@ -78,10 +78,14 @@ Q_SIGNALS:
     void rowCountChanged();
 
 private:
-    QSqlDatabase m_database;
+    DatabaseExecutor* m_executor;
     int m_numRows;
     int m_fetchedCount;
     bool m_canFetchMore;
+    // Whether a page is being read, and the identifier of the database it
+    // is read from
+    bool m_fetching;
+    int m_fetchRequest;
 
     struct DownloadEntry {
         QString downloadId;
@@ -98,7 +102,7 @@ private:
     QList<DownloadEntry> m_orderedEntries;
 
     void resetDatabase(const QString& databaseName);
-    void createOrAlterDatabaseSchema();
+    void insertFetchedEntries(const QList<DownloadEntry>& entries);
     void insertNewEntryInDatabase(const DownloadEntry& entry);
     void removeExistingEntryFromDatabase(const QString& path);
     void setPaused(const QString& downloadId, bool paused);
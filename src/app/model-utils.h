@@ -0,0 +1,124 @@
+/*
+ * Copyright 2020 UBports Foundation
+ *
+ * This file is part of morph-browser.
+ *
+ * morph-browser is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * morph-browser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MODEL_UTILS_H__
+#define __MODEL_UTILS_H__
+
+// Qt
+#include <QtCore/QAbstractItemModel>
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QPair>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QUrl>
+#include <QtCore/QVariant>
+
+// Accessors shared by the list models exposed to QML, so that callers can
+// fetch only the roles they need instead of a map of all the roles.
+namespace ModelUtils {
+
+typedef QList<QPair<int, QString> > RoleList;
+
+// Resolve role names to role identifiers, all roles if names is empty.
+// Unknown role names are ignored.
+static RoleList resolveRoles(const QAbstractItemModel* model, const QStringList& names)
+{
+    RoleList roles;
+    QHash<int, QByteArray> roleNames = model->roleNames();
+    if (names.isEmpty()) {
+        QHash<int, QByteArray>::const_iterator it;
+        for (it = roleNames.constBegin(); it != roleNames.constEnd(); ++it) {
+            roles.append(qMakePair(it.key(), QString::fromUtf8(it.value())));
+        }
+    } else {
+        Q_FOREACH(const QString& name, names) {
+            int role = roleNames.key(name.toUtf8(), -1);
+            if (role != -1) {
+                roles.append(qMakePair(role, name));
+            }
+        }
+    }
+    return roles;
+}
+
+static int roleForName(const QAbstractItemModel* model, const QByteArray& name)
+{
+    return model->roleNames().key(name, -1);
+}
+
+static QVariantMap get(const QAbstractItemModel* model, int row, const RoleList& roles)
+{
+    QVariantMap item;
+    QModelIndex index = model->index(row, 0);
+    if (index.isValid()) {
+        Q_FOREACH(const RoleList::value_type& role, roles) {
+            item.insert(role.second, model->data(index, role.first));
+        }
+    }
+    return item;
+}
+
+static QVariantMap get(const QAbstractItemModel* model, int row, const QStringList& roles)
+{
+    return get(model, row, resolveRoles(model, roles));
+}
+
+static QVariantList getRange(const QAbstractItemModel* model, int from, int count, const QStringList& roles)
+{
+    QVariantList items;
+    from = qMax(0, from);
+    int to = qMin(from + count, model->rowCount());
+    if (to > from) {
+        RoleList resolved = resolveRoles(model, roles);
+        items.reserve(to - from);
+        for (int row = from; row < to; ++row) {
+            items.append(get(model, row, resolved));
+        }
+    }
+    return items;
+}
+
+static QUrl urlAt(const QAbstractItemModel* model, int row)
+{
+    int role = roleForName(model, QByteArrayLiteral("url"));
+    QModelIndex index = model->index(row, 0);
+    if ((role == -1) || !index.isValid()) {
+        return QUrl();
+    }
+    return model->data(index, role).toUrl();
+}
+
+static int indexOfUrl(const QAbstractItemModel* model, const QUrl& url)
+{
+    int role = roleForName(model, QByteArrayLiteral("url"));
+    if (role != -1) {
+        int count = model->rowCount();
+        for (int row = 0; row < count; ++row) {
+            if (model->data(model->index(row, 0), role).toUrl() == url) {
+                return row;
+            }
+        }
+    }
+    return -1;
+}
+
+} // namespace ModelUtils
+
+#endif // __MODEL_UTILS_H__
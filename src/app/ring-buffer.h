@@ -0,0 +1,105 @@
+/*
+ * Copyright 2020 UBports Foundation
+ *
+ * This file is part of morph-browser.
+ *
+ * morph-browser is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * morph-browser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __RING_BUFFER_H__
+#define __RING_BUFFER_H__
+
+// Qt
+#include <QtCore/QAtomicInteger>
+#include <QtCore/QtGlobal>
+
+// system
+#include <utility>
+
+/*
+    Fixed-size FIFO queue shared by exactly one producer thread and one
+    consumer thread, without locks: each index is only written by one side,
+    and published to the other side with release/acquire semantics.
+    The capacity is rounded up to a power of two.
+*/
+template <typename T>
+class RingBuffer
+{
+public:
+    explicit RingBuffer(int capacity)
+        : m_head(0)
+        , m_tail(0)
+    {
+        quint32 size = 1;
+        while (size < quint32(qMax(capacity, 1))) {
+            size <<= 1;
+        }
+        m_size = size;
+        m_items = new T[size];
+    }
+
+    ~RingBuffer()
+    {
+        delete [] m_items;
+    }
+
+    int capacity() const
+    {
+        return int(m_size);
+    }
+
+    // Producer side, return false if the queue is full
+    bool push(const T& item)
+    {
+        quint32 tail = m_tail.load();
+        if ((tail - m_head.loadAcquire()) == m_size) {
+            return false;
+        }
+        m_items[tail & (m_size - 1)] = item;
+        m_tail.storeRelease(tail + 1);
+        return true;
+    }
+
+    // Consumer side, return false if the queue is empty
+    bool pop(T& item)
+    {
+        quint32 head = m_head.load();
+        if (head == m_tail.loadAcquire()) {
+            return false;
+        }
+        T& slot = m_items[head & (m_size - 1)];
+        item = std::move(slot);
+        // Release the resources held by the item right away
+        slot = T();
+        m_head.storeRelease(head + 1);
+        return true;
+    }
+
+    // Consumer side
+    bool isEmpty() const
+    {
+        return m_head.load() == m_tail.loadAcquire();
+    }
+
+private:
+    Q_DISABLE_COPY(RingBuffer)
+
+    T* m_items;
+    quint32 m_size;
+    // Index of the next item to pop, only written by the consumer
+    QAtomicInteger<quint32> m_head;
+    // Index of the next item to push, only written by the producer
+    QAtomicInteger<quint32> m_tail;
+};
+
+#endif // __RING_BUFFER_H__
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2020 UBports Foundation
+ *
+ * This file is part of morph-browser.
+ *
+ * morph-browser is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * morph-browser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __URL_UTILS_H__
+#define __URL_UTILS_H__
+
+// Qt
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QUrl>
+
+namespace UrlUtils {
+
+// Query parameters that only track where a visit comes from, and don't
+// change the page. A trailing '*' matches any parameter with that prefix.
+static const QStringList DEFAULT_TRACKING_PARAMETERS = QStringList()
+    << QStringLiteral("utm_*") << QStringLiteral("fbclid") << QStringLiteral("gclid")
+    << QStringLiteral("dclid") << QStringLiteral("msclkid") << QStringLiteral("mc_eid")
+    << QStringLiteral("_ga") << QStringLiteral("yclid") << QStringLiteral("igshid");
+
+static bool isTrackingParameter(const QString& name, const QStringList& trackingParameters)
+{
+    Q_FOREACH(const QString& parameter, trackingParameters) {
+        if (parameter.endsWith(QLatin1Char('*'))) {
+            if (name.startsWith(parameter.leftRef(parameter.size() - 1))) {
+                return true;
+            }
+        } else if (name == parameter) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+    Return the URL under which a web page is stored, so that variants of the
+    same page (fragments, tracking parameters, explicit default ports and
+    trailing slashes) are not stored separately.
+    URLs other than http(s) are returned unchanged.
+*/
+static QUrl canonicalUrl(const QUrl& url, const QStringList& trackingParameters = DEFAULT_TRACKING_PARAMETERS)
+{
+    QString scheme = url.scheme();
+    bool https = (scheme == QStringLiteral("https"));
+    if (!https && (scheme != QStringLiteral("http"))) {
+        return url;
+    }
+
+    QUrl canonical(url);
+    canonical.setFragment(QString());
+    if (canonical.port() == (https ? 443 : 80)) {
+        canonical.setPort(-1);
+    }
+
+    QString path = canonical.path(QUrl::FullyEncoded);
+    if (path.isEmpty()) {
+        canonical.setPath(QStringLiteral("/"));
+    } else if ((path.size() > 1) && path.endsWith(QLatin1Char('/'))) {
+        path.chop(1);
+        canonical.setPath(path, QUrl::TolerantMode);
+    }
+
+    if (canonical.hasQuery()) {
+        // Other parameters are kept as they are, in the same order
+        QStringList kept;
+        Q_FOREACH(const QString& item, canonical.query(QUrl::FullyEncoded).split(QLatin1Char('&'))) {
+            QString name = QUrl::fromPercentEncoding(item.section(QLatin1Char('='), 0, 0).toUtf8());
+            if (!isTrackingParameter(name, trackingParameters)) {
+                kept.append(item);
+            }
+        }
+        canonical.setQuery(kept.isEmpty() ? QString() : kept.join(QLatin1Char('&')), QUrl::TolerantMode);
+    }
+    return canonical;
+}
+
+} // namespace UrlUtils
+
+#endif // __URL_UTILS_H__
@@ -27,7 +27,7 @@ Popover {
     property url bookmarkUrl
     property alias bookmarkTitle: titleTextField.text
 
-    readonly property string bookmarkFolder: folderOptionSelector.model.get(folderOptionSelector.selectedIndex).folder
+    readonly property string bookmarkFolder: folderOptionSelector.model.get(folderOptionSelector.selectedIndex, ["folder"]).folder
 
     contentHeight: bookmarkOptionsColumn.childrenRect.height + units.gu(2)
 
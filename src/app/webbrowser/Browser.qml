@@ -953,10 +953,10 @@ Common.BrowserView {
             limit: 2
             readonly property string icon: "history"
             readonly property bool displayUrl: true
-            sourceModel: TextSearchFilterModel {
+            sourceModel: HistorySearchModel {
                 sourceModel: HistoryModel
                 terms: suggestionsList.searchTerms
-                searchFields: ["url", "title"]
+                pageSize: 2
             }
         }
 
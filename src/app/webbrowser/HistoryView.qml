@@ -136,7 +136,7 @@ Common.BrowserPage {
             var indices = domainsListView.ViewItems.selectedIndices
             var domains = []
             for (var i in indices) {
-                domains.push(domainsListView.model.get(indices[i]).domain)
+                domains.push(domainsListView.model.get(indices[i], ["domain"]).domain)
             }
             domainsListView.ViewItems.selectMode = false
             for (var j in domains) {
@@ -247,7 +247,7 @@ FocusScope {
                         height: visible ? delegateHeight : 0
                         removable: index > 0
 
-                        readonly property var data: BookmarksModel.count ? limitedBookmarksModel.get(index - 1) : null
+                        readonly property var data: BookmarksModel.count ? limitedBookmarksModel.get(index - 1, ["icon", "title", "url"]) : null
                         icon: (index > 0) ? data.icon : ""
                         title: (index > 0) ? data.title : i18n.tr("Homepage")
                         url: (index > 0) ? data.url : newTabView.settingsObject.homepage
@@ -28,28 +28,21 @@ Item {
     property string capturesDir:  cacheLocation + "/captures"
     signal previewSaved(url pageUrl, url previewUrl)
 
-    LimitProxyModel {
+    TopSitesModel {
         id: topSites
         limit: 10
-        sourceModel: TopSitesModel {
-            model: HistoryModel
-        }
-        function contains(url) {
-            for (var i = 0; i < topSites.count; i++) {
-                if (topSites.get(i).url == url) return true
-            }
-            return false
-        }
-        function containsHash(hash) {
-            for (var i = 0; i < topSites.count; i++) {
-                if (Qt.md5(topSites.get(i).url) === hash) return true
-            }
-            return false
-        }
+        model: HistoryModel
+    }
+
+    // Previews are named after the URL the history stores, so that a page
+    // opened through a variant of its URL (e.g. with tracking parameters)
+    // shares the preview of its top site entry
+    function previewHash(url) {
+        return Qt.md5(HistoryModel.canonicalUrl(url).toString())
     }
 
     function previewPathFromUrl(url) {
-        return "%1/%2.png".arg(capturesDir).arg(Qt.md5(url))
+        return "%1/%2.png".arg(capturesDir).arg(previewHash(url))
     }
 
     function saveToDisk(data, url) {
@@ -77,7 +70,7 @@ Item {
     function cleanUnusedPreviews(doNotCleanUrls) {
         var dir = Qt.resolvedUrl(capturesDir)
         var previews = FileOperations.filesInDirectory(dir, ["*.png", "*.jpg"])
-        var doNotCleanHashes = doNotCleanUrls.map(function(url) { return Qt.md5(url) })
+        var doNotCleanHashes = doNotCleanUrls.map(previewHash)
         for (var i in previews) {
             var preview = previews[i]
             var hash = preview.split('.')[0]
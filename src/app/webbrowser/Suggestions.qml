@@ -57,7 +57,7 @@ FocusScope {
             if (model.forEach) {
                 model.forEach(function(item) { modelItems.push(item) })
             } else {
-                for (var i = 0; i < model.count; i++) modelItems.push(model.get(i))
+                modelItems = model.getRange(0, model.count, ["title", "url"])
             }
 
             modelItems.forEach(function(item) {
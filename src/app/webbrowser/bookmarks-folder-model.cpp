@@ -24,35 +24,63 @@
 
 /*!
     \class BookmarksFolderModel
-    \brief Proxy model that filters the contents of a bookmarks model
-           based on a folder name
+    \brief List model that exposes the entries of a bookmarks model stored
+           in a given folder
 
-    BookmarksFolderModel is a proxy model that filters the contents of a
-    bookmarks model based on a folder name.
+    BookmarksFolderModel is a view on the group of a GroupingIndex that
+    contains all the entries of a bookmarks model stored in a folder.
 
     An entry in the bookmarks model matches if it is stored in a folder
-    with the same name that the filter folder name (case-sensitive
-    comparison).
+    with the same name that the folder name (case-sensitive comparison).
 
     When no folder name is set (null or empty string), all entries that
     are not stored in any folder match.
+
+    When created with a source model, the model maintains its own index.
+    Several models can share the index of a BookmarksFolderListModel instead.
 */
 BookmarksFolderModel::BookmarksFolderModel(QObject* parent)
-    : QSortFilterProxyModel(parent)
+    : GroupModel(parent)
+{
+    connectCountChanged();
+}
+
+BookmarksFolderModel::BookmarksFolderModel(GroupingIndex* index, const QString& folder, QObject* parent)
+    : GroupModel(parent)
+    , m_folder(folder)
+{
+    setGroup(index, folder);
+    connectCountChanged();
+}
+
+void BookmarksFolderModel::connectCountChanged()
 {
+    connect(this, SIGNAL(rowsInserted(QModelIndex, int, int)), SIGNAL(countChanged()));
+    connect(this, SIGNAL(rowsRemoved(QModelIndex, int, int)), SIGNAL(countChanged()));
+    connect(this, SIGNAL(modelReset()), SIGNAL(countChanged()));
 }
 
 BookmarksModel* BookmarksFolderModel::sourceModel() const
 {
-    return qobject_cast<BookmarksModel*>(QSortFilterProxyModel::sourceModel());
+    GroupingIndex* index = groupingIndex();
+    return index ? qobject_cast<BookmarksModel*>(index->sourceModel()) : 0;
 }
 
 void BookmarksFolderModel::setSourceModel(BookmarksModel* sourceModel)
 {
     if (sourceModel != this->sourceModel()) {
-        QSortFilterProxyModel::setSourceModel(sourceModel);
+        GroupingIndex* previous = groupingIndex();
+        GroupingIndex* index = 0;
+        if (sourceModel) {
+            index = new GroupingIndex(this);
+            index->setKeyRole(BookmarksModel::Folder);
+            index->setSourceModel(sourceModel);
+        }
+        setGroup(index, m_folder);
+        if (previous && (previous->parent() == this)) {
+            delete previous;
+        }
         Q_EMIT sourceModelChanged();
-        Q_EMIT countChanged();
     }
 }
 
@@ -65,9 +93,8 @@ void BookmarksFolderModel::setFolder(const QString& folder)
 {
     if (folder != m_folder) {
         m_folder = folder;
-        invalidate();
+        setGroup(groupingIndex(), folder);
         Q_EMIT folderChanged();
-        Q_EMIT countChanged();
     }
 }
 
@@ -95,10 +122,3 @@ QVariantMap BookmarksFolderModel::get(int row) const
 
     return res;
 }
-
-bool BookmarksFolderModel::filterAcceptsRow(int source_row, const QModelIndex& source_parent) const
-{
-    QModelIndex index = sourceModel()->index(source_row, 0, source_parent);
-    QString folder = sourceModel()->data(index, BookmarksModel::Folder).toString();
-    return (folder.compare(m_folder, Qt::CaseSensitive) == 0);
-}
@@ -20,12 +20,14 @@
 #define __BOOKMARKS_FOLDER_MODEL_H__
 
 // Qt
-#include <QtCore/QSortFilterProxyModel>
 #include <QtCore/QString>
 
+// local
+#include "grouping-index.h"
+
 class BookmarksModel;
 
-class BookmarksFolderModel : public QSortFilterProxyModel
+class BookmarksFolderModel : public GroupModel
 {
     Q_OBJECT
 
@@ -35,6 +37,7 @@ class BookmarksFolderModel : public QSortFilterProxyModel
 
 public:
     BookmarksFolderModel(QObject* parent=0);
+    BookmarksFolderModel(GroupingIndex* index, const QString& folder, QObject* parent=0);
 
     BookmarksModel* sourceModel() const;
     void setSourceModel(BookmarksModel* sourceModel);
@@ -50,12 +53,10 @@ Q_SIGNALS:
     void folderChanged() const;
     void countChanged() const;
 
-protected:
-    // reimplemented from QSortFilterProxyModel
-    bool filterAcceptsRow(int source_row, const QModelIndex& source_parent) const;
-
 private:
     QString m_folder;
+
+    void connectCountChanged();
 };
 
 #endif // __BOOKMARKS_FOLDER_MODEL_H__
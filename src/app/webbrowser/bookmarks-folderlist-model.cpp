@@ -16,14 +16,19 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "../model-utils.h"
 #include "bookmarks-folder-model.h"
 #include "bookmarks-folderlist-model.h"
 #include "bookmarks-model.h"
+#include "grouping-index.h"
 
 // Qt
 #include <QtCore/QDebug>
 #include <QtCore/QStringList>
 
+// system
+#include <algorithm>
+
 /*!
     \class BookmarksFolderListModel
     \brief List model that exposes bookmarks entries grouped by folder name
@@ -32,11 +37,16 @@
     from a BookmarksModel grouped by folder name. Each item in the list has
     two roles: 'folder' for the folder name and 'entries' for the corresponding
     BookmarksFolderModel that contains all entries in this group.
+
+    All the BookmarksFolderModels share a single GroupingIndex, so that a
+    change in the bookmarks model only affects the folder it belongs to.
 */
 BookmarksFolderListModel::BookmarksFolderListModel(QObject* parent)
     : QAbstractListModel(parent)
     , m_sourceModel(0)
 {
+    m_index = new GroupingIndex(this);
+    m_index->setKeyRole(BookmarksModel::Folder);
 }
 
 BookmarksFolderListModel::~BookmarksFolderListModel()
@@ -65,8 +75,8 @@ QVariant BookmarksFolderListModel::data(const QModelIndex& index, int role) cons
     if (!index.isValid() || !checkValidFolderIndex(index.row())) {
         return QVariant();
     }
-    const QString folder = m_folders.keys().at(index.row());
-    BookmarksFolderModel* entries = m_folders.value(folder);
+    const QString& folder = m_folders.at(index.row());
+    BookmarksFolderModel* entries = m_entries.value(folder);
 
     switch (role) {
     case Folder:
@@ -92,6 +102,8 @@ void BookmarksFolderListModel::setSourceModel(BookmarksModel* sourceModel)
         }
         clearFolders();
         m_sourceModel = sourceModel;
+        // The index must be updated before the folders are re-populated
+        m_index->setSourceModel(sourceModel);
         populateModel();
         if (m_sourceModel != 0) {
             connect(m_sourceModel, SIGNAL(folderAdded(const QString&)), SLOT(onFolderAdded(const QString&)));
@@ -103,30 +115,23 @@ void BookmarksFolderListModel::setSourceModel(BookmarksModel* sourceModel)
     }
 }
 
-QVariantMap BookmarksFolderListModel::get(int row) const
+QVariantMap BookmarksFolderListModel::get(int row, const QStringList& roles) const
 {
-    if (!checkValidFolderIndex(row)) {
-        return QVariantMap();
-    }
-
-    QVariantMap res;
-    QHash<int,QByteArray> names = roleNames();
-    QHashIterator<int, QByteArray> i(names);
-
-    while (i.hasNext()) {
-        i.next();
-        QModelIndex idx = index(row, 0);
-        QVariant data = idx.data(i.key());
-        res[i.value()] = data;
-    }
+    return ModelUtils::get(this, row, roles);
+}
 
-    return res;
+QVariantList BookmarksFolderListModel::getRange(int from, int count, const QStringList& roles) const
+{
+    return ModelUtils::getRange(this, from, count, roles);
 }
 
 int BookmarksFolderListModel::indexOf(const QString& folder) const
 {
-    QStringList folders = m_folders.keys();
-    return folders.indexOf(folder);
+    QStringList::const_iterator it = std::lower_bound(m_folders.constBegin(), m_folders.constEnd(), folder);
+    if ((it != m_folders.constEnd()) && (*it == folder)) {
+        return it - m_folders.constBegin();
+    }
+    return -1;
 }
 
 void BookmarksFolderListModel::createNewFolder(const QString& folder)
@@ -145,16 +150,16 @@ bool BookmarksFolderListModel::checkValidFolderIndex(int index) const
 
 void BookmarksFolderListModel::clearFolders()
 {
-    Q_FOREACH(const QString& folder, m_folders.keys()) {
-        delete m_folders.take(folder);
-    }
+    qDeleteAll(m_entries);
+    m_entries.clear();
+    m_folders.clear();
 }
 
 void BookmarksFolderListModel::populateModel()
 {
     if (m_sourceModel != 0) {
         Q_FOREACH(const QString& folder, m_sourceModel->folders()) {
-            if (!m_folders.contains(folder)) {
+            if (!m_entries.contains(folder)) {
                 addFolder(folder);
             }
         }
@@ -163,15 +168,8 @@ void BookmarksFolderListModel::populateModel()
 
 void BookmarksFolderListModel::onFolderAdded(const QString& folder)
 {
-    if (!m_folders.contains(folder)) {
-        QStringList folders = m_folders.keys();
-        int insertAt = 0;
-        while (insertAt < folders.count()) {
-            if (folder.compare(folders.at(insertAt)) < 0) {
-                break;
-            }
-            ++insertAt;
-        }
+    if (!m_entries.contains(folder)) {
+        int insertAt = std::lower_bound(m_folders.constBegin(), m_folders.constEnd(), folder) - m_folders.constBegin();
         beginInsertRows(QModelIndex(), insertAt, insertAt);
         addFolder(folder);
         endInsertRows();
@@ -192,16 +190,15 @@ void BookmarksFolderListModel::onModelReset()
 
 void BookmarksFolderListModel::addFolder(const QString& folder)
 {
-    BookmarksFolderModel* model = new BookmarksFolderModel(this);
-    model->setSourceModel(m_sourceModel);
-    model->setFolder(folder);
+    BookmarksFolderModel* model = new BookmarksFolderModel(m_index, folder, this);
     connect(model, SIGNAL(rowsInserted(QModelIndex, int, int)), SLOT(onFolderDataChanged()));
     connect(model, SIGNAL(rowsRemoved(QModelIndex, int, int)), SLOT(onFolderDataChanged()));
     connect(model, SIGNAL(rowsMoved(QModelIndex, int, int, QModelIndex, int)), SLOT(onFolderDataChanged()));
     connect(model, SIGNAL(layoutChanged(QList<QPersistentModelIndex>, QAbstractItemModel::LayoutChangeHint)), SLOT(onFolderDataChanged()));
     connect(model, SIGNAL(dataChanged(QModelIndex, QModelIndex)), SLOT(onFolderDataChanged()));
     connect(model, SIGNAL(modelReset()), SLOT(onFolderDataChanged()));
-    m_folders.insert(folder, model);
+    m_entries.insert(folder, model);
+    m_folders.insert(std::lower_bound(m_folders.begin(), m_folders.end(), folder), folder);
 }
 
 void BookmarksFolderListModel::onFolderDataChanged()
@@ -214,7 +211,7 @@ void BookmarksFolderListModel::onFolderDataChanged()
 
 void BookmarksFolderListModel::emitDataChanged(const QString& folder)
 {
-    int i = m_folders.keys().indexOf(folder);
+    int i = indexOf(folder);
     if (i != -1) {
         QModelIndex index = this->index(i, 0);
         Q_EMIT dataChanged(index, index, QVector<int>() << Entries);
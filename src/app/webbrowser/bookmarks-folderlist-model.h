@@ -21,11 +21,13 @@
 
 // Qt
 #include <QtCore/QAbstractListModel>
-#include <QtCore/QMap>
+#include <QtCore/QHash>
 #include <QtCore/QString>
+#include <QtCore/QStringList>
 
 class BookmarksFolderModel;
 class BookmarksModel;
+class GroupingIndex;
 
 class BookmarksFolderListModel : public QAbstractListModel
 {
@@ -53,7 +55,8 @@ public:
     BookmarksModel* sourceModel() const;
     void setSourceModel(BookmarksModel* sourceModel);
 
-    Q_INVOKABLE QVariantMap get(int row) const;
+    Q_INVOKABLE QVariantMap get(int row, const QStringList& roles=QStringList()) const;
+    Q_INVOKABLE QVariantList getRange(int from, int count, const QStringList& roles=QStringList()) const;
     Q_INVOKABLE int indexOf(const QString& folder) const;
     Q_INVOKABLE void createNewFolder(const QString& folder);
 
@@ -69,7 +72,10 @@ private Q_SLOTS:
 
 private:
     BookmarksModel* m_sourceModel;
-    QMap<QString, BookmarksFolderModel*> m_folders;
+    GroupingIndex* m_index;
+    // Sorted alphabetically
+    QStringList m_folders;
+    QHash<QString, BookmarksFolderModel*> m_entries;
 
     bool checkValidFolderIndex(int row) const;
     void clearFolders();
@@ -0,0 +1,336 @@
+/*
+ * Copyright 2020 UBports Foundation
+ *
+ * This file is part of morph-browser.
+ *
+ * morph-browser is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * morph-browser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bookmarks-html.h"
+
+// Qt
+#include <QtCore/QIODevice>
+#include <QtCore/QRegularExpression>
+
+// The file is read in chunks, only the tag or text being parsed is kept
+static const int CHUNK_SIZE = 64 * 1024;
+
+static QString decodeEntities(const QString& text)
+{
+    if (!text.contains(QLatin1Char('&'))) {
+        return text;
+    }
+    QString decoded;
+    decoded.reserve(text.size());
+    int position = 0;
+    while (position < text.size()) {
+        int start = text.indexOf(QLatin1Char('&'), position);
+        int end = (start == -1) ? -1 : text.indexOf(QLatin1Char(';'), start);
+        if (end == -1) {
+            decoded.append(text.midRef(position));
+            break;
+        }
+        decoded.append(text.midRef(position, start - position));
+        QStringRef entity = text.midRef(start + 1, end - start - 1);
+        if (entity == QLatin1String("amp")) {
+            decoded.append(QLatin1Char('&'));
+        } else if (entity == QLatin1String("lt")) {
+            decoded.append(QLatin1Char('<'));
+        } else if (entity == QLatin1String("gt")) {
+            decoded.append(QLatin1Char('>'));
+        } else if (entity == QLatin1String("quot")) {
+            decoded.append(QLatin1Char('"'));
+        } else if (entity == QLatin1String("apos")) {
+            decoded.append(QLatin1Char('\''));
+        } else if (entity.startsWith(QLatin1Char('#'))) {
+            bool ok = false;
+            uint code = entity.startsWith(QLatin1String("#x"), Qt::CaseInsensitive) ?
+                entity.mid(2).toUInt(&ok, 16) : entity.mid(1).toUInt(&ok, 10);
+            if (ok) {
+                decoded.append(QString::fromUcs4(&code, 1));
+            } else {
+                decoded.append(text.midRef(start, end - start + 1));
+            }
+        } else {
+            // Unknown entity, keep it as is
+            decoded.append(text.midRef(start, end - start + 1));
+        }
+        position = end + 1;
+    }
+    return decoded;
+}
+
+/*!
+    \class BookmarksHtmlReader
+    \brief Streaming reader for bookmarks in the Netscape bookmark file format
+
+    The Netscape bookmark file format (bookmarks.html) is the format used by
+    all major browsers to import and export bookmarks. Folders are headings
+    followed by nested lists of links:
+
+        <DT><H3>Folder</H3>
+        <DL><p>
+            <DT><A HREF="http://example.org/" ADD_DATE="1577836800">Example</A>
+        </DL><p>
+
+    Folders are flattened: a bookmark belongs to the innermost folder it is
+    in, and bookmarks in the toolbar folder belong to the enclosing folder.
+    The file is read incrementally, one bookmark at a time.
+*/
+BookmarksHtmlReader::BookmarksHtmlReader(QIODevice* device)
+    : m_stream(device)
+    , m_position(0)
+    , m_hasPendingFolder(false)
+{
+    m_stream.setCodec("UTF-8");
+}
+
+/*!
+    Read the next bookmark of the file.
+
+    Return false once the end of the file has been reached.
+*/
+bool BookmarksHtmlReader::readNext(HtmlBookmark& bookmark)
+{
+    Tag tag;
+    while (readTag(tag)) {
+        if (tag.name == QLatin1String("H3") && !tag.closing) {
+            QString folder = readText(tag.name);
+            m_pendingFolder = tag.attributes.contains(QStringLiteral("PERSONAL_TOOLBAR_FOLDER")) ?
+                currentFolder() : folder;
+            m_hasPendingFolder = true;
+        } else if (tag.name == QLatin1String("DL")) {
+            if (!tag.closing) {
+                // A list without a heading stays in the enclosing folder
+                m_folders.append(m_hasPendingFolder ? m_pendingFolder : currentFolder());
+                m_hasPendingFolder = false;
+            } else if (!m_folders.isEmpty()) {
+                m_folders.removeLast();
+            }
+        } else if (tag.name == QLatin1String("A") && !tag.closing) {
+            QString title = readText(tag.name);
+            QUrl url(tag.attributes.value(QStringLiteral("HREF")));
+            // Skip the smart folders of Firefox
+            if (!url.isValid() || url.isEmpty() || (url.scheme() == QLatin1String("place"))) {
+                continue;
+            }
+            bookmark.url = url;
+            bookmark.title = title;
+            bookmark.icon = QUrl(tag.attributes.value(QStringLiteral("ICON_URI")));
+            qint64 created = tag.attributes.value(QStringLiteral("ADD_DATE")).toLongLong();
+            bookmark.created = (created > 0) ? QDateTime::fromMSecsSinceEpoch(created * 1000) : QDateTime();
+            bookmark.folder = currentFolder();
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+    Read more of the file into the buffer, discarding what was parsed.
+    Return false if the end of the file was reached.
+*/
+bool BookmarksHtmlReader::fill()
+{
+    if (m_stream.atEnd()) {
+        return false;
+    }
+    if (m_position > 0) {
+        m_buffer.remove(0, m_position);
+        m_position = 0;
+    }
+    m_buffer.append(m_stream.read(CHUNK_SIZE));
+    return true;
+}
+
+/*
+    Read the next tag, skipping the text before it, comments and
+    declarations.
+*/
+bool BookmarksHtmlReader::readTag(Tag& tag)
+{
+    static const QRegularExpression attributeExpression(
+        QStringLiteral("([A-Za-z_:-]+)\\s*=\\s*(?:\"([^\"]*)\"|'([^']*)'|([^\\s\"'>]+))"));
+
+    while (true) {
+        int start = m_buffer.indexOf(QLatin1Char('<'), m_position);
+        if (start == -1) {
+            m_position = m_buffer.size();
+            if (!fill()) {
+                return false;
+            }
+            continue;
+        }
+        m_position = start;
+        if ((m_buffer.size() - start < 4) && fill()) {
+            continue;
+        }
+
+        if (m_buffer.midRef(start, 4) == QLatin1String("<!--")) {
+            int end = m_buffer.indexOf(QLatin1String("-->"), start + 4);
+            if (end == -1) {
+                if (!fill()) {
+                    return false;
+                }
+                continue;
+            }
+            m_position = end + 3;
+            continue;
+        }
+
+        // Attribute values may contain '>'
+        int end = -1;
+        bool quoted = false;
+        for (int i = start + 1; i < m_buffer.size(); ++i) {
+            QChar c = m_buffer.at(i);
+            if (c == QLatin1Char('"')) {
+                quoted = !quoted;
+            } else if ((c == QLatin1Char('>')) && !quoted) {
+                end = i;
+                break;
+            }
+        }
+        if (end == -1) {
+            if (!fill()) {
+                return false;
+            }
+            continue;
+        }
+        m_position = end + 1;
+
+        QStringRef content = m_buffer.midRef(start + 1, end - start - 1);
+        if (content.startsWith(QLatin1Char('!')) || content.startsWith(QLatin1Char('?'))) {
+            continue;
+        }
+        tag.closing = content.startsWith(QLatin1Char('/'));
+        int nameStart = tag.closing ? 1 : 0;
+        int nameEnd = nameStart;
+        while ((nameEnd < content.size()) && content.at(nameEnd).isLetterOrNumber()) {
+            ++nameEnd;
+        }
+        tag.name = content.mid(nameStart, nameEnd - nameStart).toString().toUpper();
+        tag.attributes.clear();
+        if (!tag.closing) {
+            QRegularExpressionMatchIterator it = attributeExpression.globalMatch(content.mid(nameEnd).toString());
+            while (it.hasNext()) {
+                QRegularExpressionMatch match = it.next();
+                QString value = match.captured(2);
+                if (value.isNull()) {
+                    value = match.captured(3);
+                }
+                if (value.isNull()) {
+                    value = match.captured(4);
+                }
+                tag.attributes.insert(match.captured(1).toUpper(), decodeEntities(value));
+            }
+        }
+        return true;
+    }
+}
+
+/*
+    Read the text up to the next tag, and consume that tag if it closes the
+    given element.
+*/
+QString BookmarksHtmlReader::readText(const QString& closingTag)
+{
+    QString text;
+    QString closing = QStringLiteral("</") + closingTag;
+    while (true) {
+        int end = m_buffer.indexOf(QLatin1Char('<'), m_position);
+        if (end == -1) {
+            text.append(m_buffer.midRef(m_position));
+            m_position = m_buffer.size();
+            if (!fill()) {
+                break;
+            }
+            continue;
+        }
+        text.append(m_buffer.midRef(m_position, end - m_position));
+        m_position = end;
+        if ((m_buffer.size() - end <= closing.size()) && fill()) {
+            continue;
+        }
+        if (m_buffer.midRef(end, closing.size()).compare(closing, Qt::CaseInsensitive) == 0) {
+            Tag tag;
+            readTag(tag);
+        }
+        break;
+    }
+    return decodeEntities(text).simplified();
+}
+
+QString BookmarksHtmlReader::currentFolder() const
+{
+    return m_folders.isEmpty() ? QString() : m_folders.last();
+}
+
+/*!
+    \class BookmarksHtmlWriter
+    \brief Streaming writer for bookmarks in the Netscape bookmark file format
+
+    Bookmarks must be written grouped by folder, bookmarks that are not in a
+    folder first.
+*/
+BookmarksHtmlWriter::BookmarksHtmlWriter(QIODevice* device)
+    : m_stream(device)
+    , m_inFolder(false)
+{
+    m_stream.setCodec("UTF-8");
+}
+
+void BookmarksHtmlWriter::writeHeader()
+{
+    m_stream << "<!DOCTYPE NETSCAPE-Bookmark-file-1>\n"
+             << "<!-- This is an automatically generated file.\n"
+             << "     It will be read and overwritten.\n"
+             << "     DO NOT EDIT! -->\n"
+             << "<META HTTP-EQUIV=\"Content-Type\" CONTENT=\"text/html; charset=UTF-8\">\n"
+             << "<TITLE>Bookmarks</TITLE>\n"
+             << "<H1>Bookmarks</H1>\n"
+             << "<DL><p>\n";
+}
+
+void BookmarksHtmlWriter::write(const HtmlBookmark& bookmark)
+{
+    if (bookmark.folder != m_folder) {
+        if (m_inFolder) {
+            m_stream << "    </DL><p>\n";
+        }
+        m_inFolder = !bookmark.folder.isEmpty();
+        if (m_inFolder) {
+            m_stream << "    <DT><H3>" << bookmark.folder.toHtmlEscaped() << "</H3>\n"
+                     << "    <DL><p>\n";
+        }
+        m_folder = bookmark.folder;
+    }
+    m_stream << (m_inFolder ? "        " : "    ")
+             << "<DT><A HREF=\"" << QString::fromUtf8(bookmark.url.toEncoded()).toHtmlEscaped() << "\"";
+    if (bookmark.created.isValid()) {
+        m_stream << " ADD_DATE=\"" << (bookmark.created.toMSecsSinceEpoch() / 1000) << "\"";
+    }
+    if (!bookmark.icon.isEmpty()) {
+        m_stream << " ICON_URI=\"" << QString::fromUtf8(bookmark.icon.toEncoded()).toHtmlEscaped() << "\"";
+    }
+    m_stream << ">" << bookmark.title.toHtmlEscaped() << "</A>\n";
+}
+
+void BookmarksHtmlWriter::writeFooter()
+{
+    if (m_inFolder) {
+        m_stream << "    </DL><p>\n";
+        m_inFolder = false;
+    }
+    m_stream << "</DL><p>\n";
+    m_stream.flush();
+}
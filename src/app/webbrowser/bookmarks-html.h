@@ -0,0 +1,84 @@
+/*
+ * Copyright 2020 UBports Foundation
+ *
+ * This file is part of morph-browser.
+ *
+ * morph-browser is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * morph-browser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BOOKMARKS_HTML_H__
+#define __BOOKMARKS_HTML_H__
+
+// Qt
+#include <QtCore/QDateTime>
+#include <QtCore/QHash>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QTextStream>
+#include <QtCore/QUrl>
+
+class QIODevice;
+
+struct HtmlBookmark {
+    QUrl url;
+    QString title;
+    QUrl icon;
+    QDateTime created;
+    QString folder;
+};
+
+class BookmarksHtmlReader
+{
+public:
+    BookmarksHtmlReader(QIODevice* device);
+
+    bool readNext(HtmlBookmark& bookmark);
+
+private:
+    struct Tag {
+        QString name;
+        bool closing;
+        QHash<QString, QString> attributes;
+    };
+
+    QTextStream m_stream;
+    QString m_buffer;
+    int m_position;
+    // Folder of each open list, the innermost one last
+    QStringList m_folders;
+    // Folder of the next list, once its heading has been read
+    QString m_pendingFolder;
+    bool m_hasPendingFolder;
+
+    bool fill();
+    bool readTag(Tag& tag);
+    QString readText(const QString& closingTag);
+    QString currentFolder() const;
+};
+
+class BookmarksHtmlWriter
+{
+public:
+    BookmarksHtmlWriter(QIODevice* device);
+
+    void writeHeader();
+    void write(const HtmlBookmark& bookmark);
+    void writeFooter();
+
+private:
+    QTextStream m_stream;
+    bool m_inFolder;
+    QString m_folder;
+};
+
+#endif // __BOOKMARKS_HTML_H__
@@ -16,14 +16,62 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "../database-executor.h"
+#include "../database-utils.h"
+#include "bookmarks-html.h"
 #include "bookmarks-model.h"
+#include "bookmarks-sorted-model.h"
 
 // Qt
 #include <QtCore/QDebug>
+#include <QtCore/QFile>
+#include <QtCore/QPair>
+#include <QtCore/QSaveFile>
+#include <QtCore/QSet>
+#include <QtCore/QSharedPointer>
 #include <QtSql/QSqlQuery>
 
+// system
+#include <algorithm>
+
 #define CONNECTION_NAME "morph-browser-bookmarks"
 
+// Schema version 1: unversioned databases, possibly created before the
+// 'created' and/or 'folderId' columns were introduced.
+static bool createSchema(QSqlDatabase& database)
+{
+    if (!DatabaseUtils::exec(database, QLatin1String("CREATE TABLE IF NOT EXISTS bookmarks "
+                                                     "(url VARCHAR, title VARCHAR, icon VARCHAR, "
+                                                     "created INTEGER, folderId INTEGER);")) ||
+        !DatabaseUtils::exec(database, QLatin1String("CREATE TABLE IF NOT EXISTS folders "
+                                                     "(folderId INTEGER PRIMARY KEY, folder VARCHAR);"))) {
+        return false;
+    }
+    if (!DatabaseUtils::hasColumn(database, QLatin1String("bookmarks"), QLatin1String("created"))) {
+        // the default for the column is an empty value, which is interpreted as zero
+        // when converted to a number. Zero represents a date far in the past, so
+        // any newly created bookmark will correctly be represented as more recent than any other
+        if (!DatabaseUtils::exec(database, QLatin1String("ALTER TABLE bookmarks ADD COLUMN created INTEGER;"))) {
+            return false;
+        }
+    }
+    if (!DatabaseUtils::hasColumn(database, QLatin1String("bookmarks"), QLatin1String("folderId"))) {
+        if (!DatabaseUtils::exec(database, QLatin1String("ALTER TABLE bookmarks ADD COLUMN folderId INTEGER;"))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Schema version 2: index the columns used to look up, sort and group entries.
+static bool addIndexes(QSqlDatabase& database)
+{
+    return DatabaseUtils::exec(database, QLatin1String("CREATE INDEX IF NOT EXISTS bookmarks_url ON bookmarks (url);")) &&
+           DatabaseUtils::exec(database, QLatin1String("CREATE INDEX IF NOT EXISTS bookmarks_created ON bookmarks (created);")) &&
+           DatabaseUtils::exec(database, QLatin1String("CREATE INDEX IF NOT EXISTS bookmarks_folderId ON bookmarks (folderId);")) &&
+           DatabaseUtils::exec(database, QLatin1String("CREATE INDEX IF NOT EXISTS folders_folder ON folders (folder);"));
+}
+
 /*!
     \class BookmarksModel
     \brief List model that stores information about bookmarked websites.
@@ -34,137 +82,239 @@
     The model is sorted alphabetically at all times (by URL).
 
     The information is persistently stored on disk in a SQLite database.
-    The database is read at startup to populate the model, and whenever a new
-    entry is added to the model or an entry is removed from the model
-    the database is updated.
+    The database is read asynchronously at startup to populate the model,
+    loaded() is emitted once done, and entries added in the meantime are
+    merged with the ones read. Whenever a new entry is added to the model or
+    an entry is removed from the model the database is updated
+    (asynchronously, see DatabaseExecutor).
     However the model doesn’t monitor the database for external changes.
+
+    Bookmarks can be imported from and exported to the Netscape bookmark file
+    format (bookmarks.html) used by other browsers. Files are read and written
+    on the thread of the database, and imported bookmarks are published to
+    the model all at once.
 */
 BookmarksModel::BookmarksModel(QObject* parent)
     : QAbstractListModel(parent)
+    , m_nextFolderId(new QAtomicInt(1))
+    , m_lastProvisionalFolderId(0)
+    , m_loaded(false)
+    , m_loadRequest(0)
+    , m_indexOffset(0)
 {
-    m_database = QSqlDatabase::addDatabase(QLatin1String("QSQLITE"), CONNECTION_NAME);
-}
-
-BookmarksModel::~BookmarksModel()
-{
-    m_database.close();
-    m_database = QSqlDatabase();
-    QSqlDatabase::removeDatabase(CONNECTION_NAME);
+    m_executor = new DatabaseExecutor(CONNECTION_NAME, this);
 }
 
 void BookmarksModel::resetDatabase(const QString& databaseName)
 {
+    static const QList<DatabaseUtils::Migration> migrations =
+        QList<DatabaseUtils::Migration>() << createSchema << addIndexes;
     beginResetModel();
     m_folders.clear();
-    m_urls.clear();
+    m_folderIds.clear();
+    // An import still running on the previous database keeps its own counter
+    m_nextFolderId.reset(new QAtomicInt(1));
+    m_urlIndex.clear();
+    m_indexOffset = 0;
     m_orderedEntries.clear();
-    m_database.close();
-    m_database.setDatabaseName(databaseName);
-    m_database.open();
-    createOrAlterDatabaseSchema();
+    m_loaded = false;
+    m_executor->open(databaseName, migrations);
+    //Add default empty folder
+    insertFolder(0, "");
     endResetModel();
+    Q_EMIT folderAdded("");
     populateFromDatabase();
     Q_EMIT rowCountChanged();
 }
 
-void BookmarksModel::createOrAlterDatabaseSchema()
+/* Read the database asynchronously, bookmarks added in the meantime are
+   merged with the ones read (see publishLoadedEntries()). */
+void BookmarksModel::populateFromDatabase()
 {
-    QSqlQuery createQuery(m_database);
-    QString query = QLatin1String("CREATE TABLE IF NOT EXISTS bookmarks "
-                                  "(url VARCHAR, title VARCHAR, icon VARCHAR, "
-                                  "created INTEGER, folderId INTEGER);");
-    createQuery.prepare(query);
-    createQuery.exec();
-
-    QSqlQuery createFolderQuery(m_database);
-    query = QLatin1String("CREATE TABLE IF NOT EXISTS folders "
-                          "(folderId INTEGER PRIMARY KEY, folder VARCHAR);");
-    createFolderQuery.prepare(query);
-    createFolderQuery.exec();
-
-    // Older version of the database schema didn’t have 'created' and/or
-    // 'folderId' columns
-    QSqlQuery tableInfoQuery(m_database);
-    query = QLatin1String("PRAGMA TABLE_INFO(bookmarks);");
-    tableInfoQuery.prepare(query);
-    tableInfoQuery.exec();
-
-    bool missingCreatedColumn = true;
-    bool missingFolderIdColumn = true;
-
-    while (tableInfoQuery.next()) {
-        if (tableInfoQuery.value("name").toString() == "created") {
-            missingCreatedColumn = false;
+    QSharedPointer<ReadResult> result(new ReadResult);
+    result->success = false;
+    QSharedPointer<QAtomicInt> nextFolderId = m_nextFolderId;
+    int request = ++m_loadRequest;
+    m_executor->post([result, nextFolderId](QSqlDatabase& database) {
+        QSqlQuery populateFolderQuery(database);
+        QString query = QLatin1String("SELECT folderId, folder FROM folders;");
+        populateFolderQuery.prepare(query);
+        populateFolderQuery.exec();
+        int maxFolderId = 0;
+        while (populateFolderQuery.next()) {
+            int folderId = populateFolderQuery.value(0).toInt();
+            result->folders.append(qMakePair(folderId, populateFolderQuery.value(1).toString()));
+            maxFolderId = qMax(maxFolderId, folderId);
         }
-        if (tableInfoQuery.value("name").toString() == "folderId") {
-            missingFolderIdColumn = false;
+        // Imports run after this task, and use the counter right away
+        nextFolderId->storeRelease(maxFolderId + 1);
+
+        QSqlQuery populateQuery(database);
+        query = QLatin1String("SELECT url, title, icon, created, folderId, rowid "
+                              "FROM bookmarks ORDER BY created DESC;");
+        populateQuery.prepare(query);
+        populateQuery.exec();
+        while (populateQuery.next()) {
+            BookmarkEntry entry;
+            entry.url = populateQuery.value(0).toUrl();
+            entry.title = populateQuery.value(1).toString();
+            entry.icon = populateQuery.value(2).toUrl();
+            entry.created = QDateTime::fromMSecsSinceEpoch(populateQuery.value(3).toULongLong());
+            entry.folderId = populateQuery.value(4).toInt();
+            result->entries.append(entry);
+            result->rowIds.append(populateQuery.value(5).toLongLong());
         }
-        if (!missingCreatedColumn && !missingFolderIdColumn) {
-            break;
+        result->success = true;
+    }, [this, result, request](bool, const QVariant&) {
+        // Ignore the result if the database was changed in the meantime
+        if (request == m_loadRequest) {
+            publishLoadedEntries(*result);
         }
-    }
-    if (missingCreatedColumn) {
-        QSqlQuery addCreatedColumnQuery(m_database);
-        query = QLatin1String("ALTER TABLE bookmarks ADD COLUMN created INTEGER;");
-        addCreatedColumnQuery.prepare(query);
-        addCreatedColumnQuery.exec();
-        // the default for the column is an empty value, which is interpreted as zero
-        // when converted to a number. Zero represents a date far in the past, so
-        // any newly created bookmark will correctly be represented as more recent than any other
-    }
-    if (missingFolderIdColumn) {
-        QSqlQuery addFolderColumnQuery(m_database);
-        query = QLatin1String("ALTER TABLE bookmarks ADD COLUMN folderId INTEGER;");
-        addFolderColumnQuery.prepare(query);
-        addFolderColumnQuery.exec();
-    }
+    });
 }
 
-void BookmarksModel::populateFromDatabase()
+/* Merge the bookmarks read from the database with the ones added while it
+   was being read. Folders added in the meantime get their final
+   identifier, the one of the folder with the same name if any. URLs that
+   were bookmarked in the meantime keep the entry added by the user, like
+   for an import (see publishImportedEntries()). */
+void BookmarksModel::publishLoadedEntries(const ReadResult& result)
 {
-    //Add default empty folder
-    m_folders.insert(0, "");
-    Q_EMIT folderAdded("");
-
-    QSqlQuery populateFolderQuery(m_database);
-    QString query = QLatin1String("SELECT folderId, folder FROM folders;");
-    populateFolderQuery.prepare(query);
-    populateFolderQuery.exec();
-    while (populateFolderQuery.next()) {
-        QString folder = populateFolderQuery.value(1).toString();
-        m_folders.insert(populateFolderQuery.value(0).toInt(), folder);
-        Q_EMIT folderAdded(folder);
+    static QString moveStatement = QLatin1String("UPDATE bookmarks SET folderId = ? WHERE folderId = ?;");
+    static QString deleteStatement = QLatin1String("DELETE FROM bookmarks WHERE rowid = ?;");
+    QHash<int, int> provisionalFolderIds;
+    QStringList addedFolders;
+    for (int i = 0; i < result.folders.count(); ++i) {
+        int folderId = result.folders.at(i).first;
+        const QString& folder = result.folders.at(i).second;
+        QHash<QString, int>::const_iterator existing = m_folderIds.constFind(folder);
+        if (existing == m_folderIds.constEnd()) {
+            insertFolder(folderId, folder);
+            addedFolders.append(folder);
+        } else if (existing.value() < 0) {
+            provisionalFolderIds.insert(existing.value(), folderId);
+            m_folders.remove(existing.value());
+            insertFolder(folderId, folder);
+        }
+    }
+    Q_FOREACH(int provisionalId, m_folders.keys()) {
+        if (provisionalId < 0) {
+            QString folder = m_folders.take(provisionalId);
+            int folderId = m_nextFolderId->fetchAndAddOrdered(1);
+            insertNewFolderInDatabase(folderId, folder);
+            insertFolder(folderId, folder);
+            provisionalFolderIds.insert(provisionalId, folderId);
+        }
+    }
+    for (QHash<int, int>::const_iterator it = provisionalFolderIds.constBegin();
+         it != provisionalFolderIds.constEnd(); ++it) {
+        m_executor->enqueue(moveStatement, QVariantList() << it.value() << it.key());
+    }
+    for (QList<BookmarkEntry>::iterator it = m_orderedEntries.begin(); it != m_orderedEntries.end(); ++it) {
+        if (it->folderId < 0) {
+            it->folderId = provisionalFolderIds.value(it->folderId);
+        }
     }
 
-    QSqlQuery populateQuery(m_database);
-    query = QLatin1String("SELECT url, title, icon, created, folderId "
-                          "FROM bookmarks ORDER BY created DESC;");
-    populateQuery.prepare(query);
-    populateQuery.exec();
-    int count = 0;
-    while (populateQuery.next()) {
-        BookmarkEntry entry;
-        entry.url = populateQuery.value(0).toUrl();
-        entry.title = populateQuery.value(1).toString();
-        entry.icon = populateQuery.value(2).toUrl();
-        entry.created = QDateTime::fromMSecsSinceEpoch(populateQuery.value(3).toULongLong());
-        entry.folderId = populateQuery.value(4).toInt();
-
-        if (m_folders.contains(entry.folderId)) {
-            entry.folder = m_folders.value(entry.folderId);
+    QList<BookmarkEntry> entries;
+    entries.reserve(result.entries.count());
+    for (int i = 0; i < result.entries.count(); ++i) {
+        BookmarkEntry entry = result.entries.at(i);
+        if (m_urlIndex.contains(entry.url)) {
+            m_executor->enqueue(deleteStatement, QVariantList() << result.rowIds.at(i));
+            continue;
+        }
+        QHash<int, QString>::const_iterator folder = m_folders.constFind(entry.folderId);
+        if (folder != m_folders.constEnd()) {
+            entry.folder = folder.value();
         } else {
             entry.folderId = 0;
             updateExistingEntryInDatabase(entry);
         }
+        entries.append(entry);
+    }
 
-        beginInsertRows(QModelIndex(), count, count);
-        m_urls.insert(entry.url);
-        m_orderedEntries.append(entry);
-        endInsertRows();
-        ++count;
+    m_loaded = true;
+    if (!entries.isEmpty()) {
+        if (m_orderedEntries.isEmpty()) {
+            beginInsertRows(QModelIndex(), 0, entries.count() - 1);
+            mergeEntries(entries);
+            endInsertRows();
+        } else {
+            beginResetModel();
+            mergeEntries(entries);
+            endResetModel();
+        }
+    }
+    Q_FOREACH(const QString& folder, addedFolders) {
+        Q_EMIT folderAdded(folder);
+    }
+    if (!entries.isEmpty()) {
+        Q_EMIT rowCountChanged();
+    }
+    Q_EMIT loaded();
+}
+
+/* Merge entries sorted by creation date, most recent first, into the model
+   and index them. Entries whose URL is already bookmarked come after it. */
+void BookmarksModel::mergeEntries(const QList<BookmarkEntry>& entries)
+{
+    QList<BookmarkEntry> merged;
+    merged.reserve(m_orderedEntries.count() + entries.count());
+    QList<BookmarkEntry>::const_iterator existing = m_orderedEntries.constBegin();
+    Q_FOREACH(const BookmarkEntry& entry, entries) {
+        while ((existing != m_orderedEntries.constEnd()) && (existing->created >= entry.created)) {
+            merged.append(*existing++);
+        }
+        merged.append(entry);
+    }
+    while (existing != m_orderedEntries.constEnd()) {
+        merged.append(*existing++);
+    }
+    m_orderedEntries = merged;
+    m_urlIndex.clear();
+    m_urlIndex.reserve(m_orderedEntries.count());
+    m_indexOffset = 0;
+    for (int i = m_orderedEntries.count() - 1; i >= 0; --i) {
+        // Iterate backwards so that the first occurrence of a URL wins
+        m_urlIndex.insert(m_orderedEntries.at(i).url, i);
+    }
+}
+
+int BookmarksModel::getEntryIndex(const QUrl& url) const
+{
+    QHash<QUrl, int>::const_iterator it = m_urlIndex.constFind(url);
+    if (it == m_urlIndex.constEnd()) {
+        return -1;
+    }
+    return it.value() - m_indexOffset;
+}
+
+void BookmarksModel::unindexEntry(int index)
+{
+    // Must be called before the entry is actually removed from the list.
+    // Rows after the removed one move up by one: update whichever side of the
+    // list is shorter.
+    int count = m_orderedEntries.count();
+    m_urlIndex.remove(m_orderedEntries.at(index).url);
+    if (index < count / 2) {
+        ++m_indexOffset;
+        for (int i = 0; i < index; ++i) {
+            ++m_urlIndex[m_orderedEntries.at(i).url];
+        }
+    } else {
+        for (int i = index + 1; i < count; ++i) {
+            --m_urlIndex[m_orderedEntries.at(i).url];
+        }
     }
 }
 
+void BookmarksModel::insertFolder(int folderId, const QString& folder)
+{
+    m_folders.insert(folderId, folder);
+    m_folderIds.insert(folder, folderId);
+}
+
 QHash<int, QByteArray> BookmarksModel::roleNames() const
 {
     static QHash<int, QByteArray> roles;
@@ -208,7 +358,7 @@ QVariant BookmarksModel::data(const QModelIndex& index, int role) const
 
 const QString BookmarksModel::databasePath() const
 {
-    return m_database.databaseName();
+    return m_executor->databaseName();
 }
 
 void BookmarksModel::setDatabasePath(const QString& path)
@@ -230,14 +380,46 @@ QStringList BookmarksModel::folders() const
 
 int BookmarksModel::addFolder(const QString& folder)
 {
-    int newFolderId = insertNewFolderInDatabase(folder);
-    if (newFolderId != 0) {
-        m_folders.insert(newFolderId, folder);
-        Q_EMIT folderAdded(folder);
+    int newFolderId;
+    if (m_loaded) {
+        newFolderId = m_nextFolderId->fetchAndAddOrdered(1);
+        insertNewFolderInDatabase(newFolderId, folder);
+    } else {
+        newFolderId = --m_lastProvisionalFolderId;
     }
+    insertFolder(newFolderId, folder);
+    Q_EMIT folderAdded(folder);
     return newFolderId;
 }
 
+/*!
+    Return the row of the entry with the given URL, or -1.
+*/
+int BookmarksModel::indexOf(const QUrl& url) const
+{
+    return getEntryIndex(url);
+}
+
+/*!
+    Return a view on the bookmarks sorted by a given role (Title, Url or
+    Created), kept up to date incrementally as bookmarks change.
+    Views are created on first use and shared.
+*/
+QAbstractItemModel* BookmarksModel::sortedBy(int role, Qt::SortOrder order)
+{
+    if ((role != Title) && (role != Url) && (role != Created)) {
+        qWarning() << "Bookmarks cannot be sorted by role" << role;
+        return 0;
+    }
+    int key = role * 2 + ((order == Qt::AscendingOrder) ? 0 : 1);
+    BookmarksSortedModel* model = m_sortedModels.value(key);
+    if (!model) {
+        model = new BookmarksSortedModel(this, role, order, this);
+        m_sortedModels.insert(key, model);
+    }
+    return model;
+}
+
 /*!
     Test if a given URL is already bookmarked.
 
@@ -246,7 +428,7 @@ int BookmarksModel::addFolder(const QString& folder)
 */
 bool BookmarksModel::contains(const QUrl& url) const
 {
-    return m_urls.contains(url);
+    return m_urlIndex.contains(url);
 }
 
 /*!
@@ -256,7 +438,7 @@ bool BookmarksModel::contains(const QUrl& url) const
 */
 void BookmarksModel::add(const QUrl& url, const QString& title, const QUrl& icon, const QString& folder)
 {
-    if (m_urls.contains(url)) {
+    if (m_urlIndex.contains(url)) {
         qWarning() << "URL already bookmarked:" << url;
     } else {
         beginInsertRows(QModelIndex(), 0, 0);
@@ -267,8 +449,10 @@ void BookmarksModel::add(const QUrl& url, const QString& title, const QUrl& icon
         entry.created = QDateTime::currentDateTime();
         entry.folder = folder;
         entry.folderId = getFolderId(entry.folder);
-        m_urls.insert(url);
         m_orderedEntries.prepend(entry);
+        // All existing rows are shifted down by one
+        --m_indexOffset;
+        m_urlIndex.insert(url, m_indexOffset);
         endInsertRows();
         Q_EMIT added(url);
         insertNewEntryInDatabase(entry);
@@ -278,21 +462,16 @@ void BookmarksModel::add(const QUrl& url, const QString& title, const QUrl& icon
 
 void BookmarksModel::insertNewEntryInDatabase(const BookmarkEntry& entry)
 {
-    QSqlQuery query(m_database);
     static QString insertStatement = QLatin1String("INSERT INTO bookmarks (url, "
                                                    "title, icon, created, folderId) "
                                                    "VALUES (?, ?, ?, ?, ?);");
-    query.prepare(insertStatement);
-    query.addBindValue(entry.url.toString());
-    query.addBindValue(entry.title);
-    query.addBindValue(entry.icon.toString());
-    query.addBindValue(entry.created.toMSecsSinceEpoch());
-    if (!entry.folderId) {
-        query.addBindValue(QVariant());
-    } else {
-        query.addBindValue(entry.folderId);
-    }
-    query.exec();
+    QVariantList values;
+    values << entry.url.toString();
+    values << entry.title;
+    values << entry.icon.toString();
+    values << entry.created.toMSecsSinceEpoch();
+    values << (entry.folderId ? QVariant(entry.folderId) : QVariant());
+    m_executor->enqueue(insertStatement, values);
 }
 
 /*!
@@ -302,22 +481,15 @@ void BookmarksModel::insertNewEntryInDatabase(const BookmarkEntry& entry)
 */
 void BookmarksModel::remove(const QUrl& url)
 {
-    if (m_urls.contains(url)) {
-        int index = 0;
-        Q_FOREACH(BookmarkEntry entry, m_orderedEntries) {
-            if (entry.url == url) {
-                beginRemoveRows(QModelIndex(), index, index);
-                m_orderedEntries.removeAt(index);
-                m_urls.remove(url);
-                endRemoveRows();
-                Q_EMIT removed(url);
-                removeExistingEntryFromDatabase(url);
-                Q_EMIT rowCountChanged();
-                return;
-            } else {
-                index++;
-            }
-        };
+    int index = getEntryIndex(url);
+    if (index != -1) {
+        beginRemoveRows(QModelIndex(), index, index);
+        unindexEntry(index);
+        m_orderedEntries.removeAt(index);
+        endRemoveRows();
+        Q_EMIT removed(url);
+        removeExistingEntryFromDatabase(url);
+        Q_EMIT rowCountChanged();
     } else {
         qWarning() << "Invalid bookmark:" << url;
     }
@@ -325,39 +497,29 @@ void BookmarksModel::remove(const QUrl& url)
 
 void BookmarksModel::removeExistingEntryFromDatabase(const QUrl& url)
 {
-    QSqlQuery query(m_database);
     static QString deleteStatement = QLatin1String("DELETE FROM bookmarks WHERE url=?;");
-    query.prepare(deleteStatement);
-    query.addBindValue(url.toString());
-    query.exec();
+    m_executor->enqueue(deleteStatement, QVariantList() << url.toString());
 }
 
 void BookmarksModel::update(const QUrl& url, const QString& title, const QString& folder)
 {
-    if (m_urls.contains(url)) {
-        int index = 0;
-        Q_FOREACH(BookmarkEntry entry, m_orderedEntries) {
-            if (entry.url == url) {
-                BookmarkEntry& updatedEntry = m_orderedEntries[index];
-                QVector<int> roles;
-                if (title != updatedEntry.title) {
-                    updatedEntry.title = title;
-                    roles << Title;
-                }
-                if (folder != updatedEntry.folder) {
-                    updatedEntry.folder = folder;
-                    updatedEntry.folderId = getFolderId(updatedEntry.folder);
-                    roles << Folder;
-                }
-                if (!roles.isEmpty()) {
-                    Q_EMIT dataChanged(this->index(index, 0), this->index(index, 0), roles);
-                    updateExistingEntryInDatabase(updatedEntry);
-                }
-                return;
-            } else {
-                index++;
-            }
-        };
+    int index = getEntryIndex(url);
+    if (index != -1) {
+        BookmarkEntry& updatedEntry = m_orderedEntries[index];
+        QVector<int> roles;
+        if (title != updatedEntry.title) {
+            updatedEntry.title = title;
+            roles << Title;
+        }
+        if (folder != updatedEntry.folder) {
+            updatedEntry.folder = folder;
+            updatedEntry.folderId = getFolderId(updatedEntry.folder);
+            roles << Folder;
+        }
+        if (!roles.isEmpty()) {
+            Q_EMIT dataChanged(this->index(index, 0), this->index(index, 0), roles);
+            updateExistingEntryInDatabase(updatedEntry);
+        }
     } else {
         qWarning() << "Invalid bookmark:" << url;
     }
@@ -365,51 +527,229 @@ void BookmarksModel::update(const QUrl& url, const QString& title, const QString
 
 void BookmarksModel::updateExistingEntryInDatabase(const BookmarkEntry& entry)
 {
-    QSqlQuery query(m_database);
     static QString updateStatement = QLatin1String("UPDATE bookmarks SET title=?, "
                                                    "icon=?, created=?, folderId=? "
                                                    "WHERE url=?;");
-    query.prepare(updateStatement);
-    query.addBindValue(entry.title);
-    query.addBindValue(entry.icon.toString());
-    query.addBindValue(entry.created.toMSecsSinceEpoch());
-    if (entry.folderId == 0) {
-        query.addBindValue(QVariant());
-    } else {
-        query.addBindValue(entry.folderId);
-    }
-    query.addBindValue(entry.url.toString());
-    query.exec();
+    QVariantList values;
+    values << entry.title;
+    values << entry.icon.toString();
+    values << entry.created.toMSecsSinceEpoch();
+    values << ((entry.folderId == 0) ? QVariant() : QVariant(entry.folderId));
+    values << entry.url.toString();
+    m_executor->enqueue(updateStatement, values);
 }
 
 int BookmarksModel::getFolderId(const QString& folder) {
-    QHashIterator<int, QString> i(m_folders);
-    while (i.hasNext()) {
-        i.next();
-        if (i.value() == folder) {
-            return i.key();
+    QHash<QString, int>::const_iterator it = m_folderIds.constFind(folder);
+    if (it != m_folderIds.constEnd()) {
+        return it.value();
+    }
+    return addFolder(folder);
+}
+
+void BookmarksModel::insertNewFolderInDatabase(int folderId, const QString& folder)
+{
+    static QString insertStatement = QLatin1String("INSERT INTO folders (folderId, folder) VALUES (?, ?);");
+    m_executor->enqueue(insertStatement, QVariantList() << folderId << folder);
+}
+
+/*!
+    Import bookmarks from a file in the Netscape bookmark file format.
+
+    Bookmarks whose URL is already bookmarked are skipped, missing folders
+    are created. Folders created with the same name while importing are
+    merged when the imported bookmarks are published. The file is parsed and the bookmarks are written to the
+    database in a single transaction asynchronously, then the model is reset
+    with the imported bookmarks, and importFinished() is emitted.
+*/
+void BookmarksModel::importBookmarks(const QString& path)
+{
+    QSharedPointer<ReadResult> result(new ReadResult);
+    result->success = false;
+    QSharedPointer<QAtomicInt> nextFolderId = m_nextFolderId;
+    m_executor->post([path, result, nextFolderId](QSqlDatabase& database) {
+        QFile file(path);
+        if (!file.open(QIODevice::ReadOnly)) {
+            qWarning() << "Failed to open bookmarks file" << path;
+            return;
         }
+
+        QHash<QString, int> folderIds;
+        folderIds.insert(QString(), 0);
+        QSqlQuery query(database);
+        query.setForwardOnly(true);
+        query.exec(QLatin1String("SELECT folderId, folder FROM folders;"));
+        while (query.next()) {
+            folderIds.insert(query.value(1).toString(), query.value(0).toInt());
+        }
+        QSet<QString> urls;
+        query.exec(QLatin1String("SELECT url FROM bookmarks;"));
+        while (query.next()) {
+            urls.insert(query.value(0).toString());
+        }
+        query.finish();
+
+        database.transaction();
+        QSqlQuery insertFolderQuery(database);
+        insertFolderQuery.prepare(QLatin1String("INSERT INTO folders (folderId, folder) VALUES (?, ?);"));
+        QSqlQuery insertQuery(database);
+        insertQuery.prepare(QLatin1String("INSERT INTO bookmarks (url, title, icon, created, folderId) "
+                                          "VALUES (?, ?, ?, ?, ?);"));
+        BookmarksHtmlReader reader(&file);
+        HtmlBookmark bookmark;
+        QDateTime now = QDateTime::currentDateTime();
+        bool success = true;
+        while (success && reader.readNext(bookmark)) {
+            QString url = bookmark.url.toString();
+            if (urls.contains(url)) {
+                continue;
+            }
+            urls.insert(url);
+
+            QHash<QString, int>::const_iterator folder = folderIds.constFind(bookmark.folder);
+            int folderId = 0;
+            if (folder != folderIds.constEnd()) {
+                folderId = folder.value();
+            } else {
+                folderId = nextFolderId->fetchAndAddOrdered(1);
+                insertFolderQuery.bindValue(0, folderId);
+                insertFolderQuery.bindValue(1, bookmark.folder);
+                success = insertFolderQuery.exec();
+                folderIds.insert(bookmark.folder, folderId);
+                result->folders.append(qMakePair(folderId, bookmark.folder));
+            }
+
+            BookmarkEntry entry;
+            entry.url = bookmark.url;
+            entry.title = bookmark.title;
+            entry.icon = bookmark.icon;
+            entry.created = bookmark.created.isValid() ? bookmark.created : now;
+            entry.folderId = folderId;
+            entry.folder = bookmark.folder;
+            insertQuery.bindValue(0, url);
+            insertQuery.bindValue(1, entry.title);
+            insertQuery.bindValue(2, entry.icon.toString());
+            insertQuery.bindValue(3, entry.created.toMSecsSinceEpoch());
+            insertQuery.bindValue(4, folderId ? QVariant(folderId) : QVariant());
+            success = success && insertQuery.exec();
+            result->entries.append(entry);
+            result->rowIds.append(insertQuery.lastInsertId().toLongLong());
+        }
+
+        if (success && database.commit()) {
+            result->success = true;
+        } else {
+            qWarning() << "Failed to import bookmarks from" << path;
+            database.rollback();
+            result->folders.clear();
+            result->entries.clear();
+            result->rowIds.clear();
+        }
+    }, [this, result](bool, const QVariant&) {
+        int count = publishImportedEntries(*result);
+        Q_EMIT importFinished(result->success, count);
+    });
+}
+
+/* Merge the imported entries into the model and return how many of them
+   were published. URLs that were bookmarked while importing keep the entry
+   added by the user, the corresponding imported rows are removed from the
+   database as the url column is not unique. Likewise imported folders that
+   were created by the user while importing are merged into the existing
+   ones. */
+int BookmarksModel::publishImportedEntries(const ReadResult& result)
+{
+    if (result.folders.isEmpty() && result.entries.isEmpty()) {
+        return 0;
     }
 
-    return addFolder(folder);
+    static QString deleteStatement = QLatin1String("DELETE FROM bookmarks WHERE rowid = ?;");
+    static QString moveStatement = QLatin1String("UPDATE bookmarks SET folderId = ? WHERE folderId = ?;");
+    static QString deleteFolderStatement = QLatin1String("DELETE FROM folders WHERE folderId = ?;");
+    QList<QPair<int, QString> > folders;
+    QHash<int, int> mergedFolderIds;
+    for (int i = 0; i < result.folders.count(); ++i) {
+        const QPair<int, QString>& folder = result.folders.at(i);
+        QHash<QString, int>::const_iterator existing = m_folderIds.constFind(folder.second);
+        if (existing != m_folderIds.constEnd()) {
+            mergedFolderIds.insert(folder.first, existing.value());
+            m_executor->enqueue(moveStatement, QVariantList() << existing.value() << folder.first);
+            m_executor->enqueue(deleteFolderStatement, QVariantList() << folder.first);
+        } else {
+            folders.append(folder);
+        }
+    }
+
+    QList<BookmarkEntry> imported;
+    imported.reserve(result.entries.count());
+    for (int i = 0; i < result.entries.count(); ++i) {
+        const BookmarkEntry& entry = result.entries.at(i);
+        if (m_urlIndex.contains(entry.url)) {
+            m_executor->enqueue(deleteStatement, QVariantList() << result.rowIds.at(i));
+        } else {
+            imported.append(entry);
+            imported.last().folderId = mergedFolderIds.value(entry.folderId, entry.folderId);
+        }
+    }
+    std::stable_sort(imported.begin(), imported.end(),
+                     [](const BookmarkEntry& a, const BookmarkEntry& b) {
+                         return a.created > b.created;
+                     });
+
+    beginResetModel();
+    for (int i = 0; i < folders.count(); ++i) {
+        insertFolder(folders.at(i).first, folders.at(i).second);
+    }
+    mergeEntries(imported);
+    endResetModel();
+
+    for (int i = 0; i < folders.count(); ++i) {
+        Q_EMIT folderAdded(folders.at(i).second);
+    }
+    Q_EMIT rowCountChanged();
+    return imported.count();
 }
 
-int BookmarksModel::insertNewFolderInDatabase(const QString& folder)
+/*!
+    Export all bookmarks to a file in the Netscape bookmark file format.
+
+    The bookmarks are read from the database and written to the file as they
+    are read, asynchronously, then exportFinished() is emitted.
+*/
+void BookmarksModel::exportBookmarks(const QString& path)
 {
-    QSqlQuery insertQuery(m_database);
-    QString query = QLatin1String("INSERT INTO folders (folder) VALUES (?);");
-    insertQuery.prepare(query);
-    insertQuery.addBindValue(folder);
-    insertQuery.exec();
-
-    QSqlQuery selectQuery(m_database);
-    query = QLatin1String("SELECT folderId FROM folders WHERE folder=?;");
-    selectQuery.prepare(query);
-    selectQuery.addBindValue(folder);
-    selectQuery.exec();
-    if (selectQuery.next()) {
-        return selectQuery.value(0).toInt();
-    }
-
-    return 0;
+    QSharedPointer<QPair<bool, int> > result(new QPair<bool, int>(false, 0));
+    m_executor->post([path, result](QSqlDatabase& database) {
+        QSaveFile file(path);
+        if (!file.open(QIODevice::WriteOnly)) {
+            qWarning() << "Failed to open bookmarks file" << path;
+            return;
+        }
+        BookmarksHtmlWriter writer(&file);
+        writer.writeHeader();
+        // Bookmarks that are not in a folder come first
+        QSqlQuery query(database);
+        query.setForwardOnly(true);
+        query.exec(QLatin1String("SELECT bookmarks.url, bookmarks.title, bookmarks.icon, "
+                                 "bookmarks.created, folders.folder FROM bookmarks "
+                                 "LEFT JOIN folders ON bookmarks.folderId = folders.folderId "
+                                 "ORDER BY folders.folder, bookmarks.created DESC;"));
+        HtmlBookmark bookmark;
+        while (query.next()) {
+            bookmark.url = query.value(0).toUrl();
+            bookmark.title = query.value(1).toString();
+            bookmark.icon = query.value(2).toUrl();
+            bookmark.created = QDateTime::fromMSecsSinceEpoch(query.value(3).toLongLong());
+            bookmark.folder = query.value(4).toString();
+            writer.write(bookmark);
+            ++result->second;
+        }
+        writer.writeFooter();
+        result->first = file.commit();
+        if (!result->first) {
+            qWarning() << "Failed to write bookmarks file" << path;
+        }
+    }, [this, result](bool, const QVariant&) {
+        Q_EMIT exportFinished(result->first, result->second);
+    });
 }
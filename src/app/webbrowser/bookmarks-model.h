@@ -21,12 +21,17 @@
 
 // Qt
 #include <QtCore/QAbstractListModel>
+#include <QtCore/QAtomicInt>
 #include <QtCore/QDateTime>
+#include <QtCore/QHash>
 #include <QtCore/QList>
-#include <QtCore/QSet>
+#include <QtCore/QPair>
+#include <QtCore/QSharedPointer>
 #include <QtCore/QString>
 #include <QtCore/QUrl>
-#include <QtSql/QSqlDatabase>
+
+class BookmarksSortedModel;
+class DatabaseExecutor;
 
 class BookmarksModel : public QAbstractListModel
 {
@@ -39,7 +44,6 @@ class BookmarksModel : public QAbstractListModel
 
 public:
     BookmarksModel(QObject* parent=0);
-    ~BookmarksModel();
 
     enum Roles {
         Url = Qt::UserRole + 1,
@@ -60,20 +64,30 @@ public:
     QStringList folders() const;
     int addFolder(const QString& folder);
 
+    int indexOf(const QUrl& url) const;
+
     Q_INVOKABLE bool contains(const QUrl& url) const;
     Q_INVOKABLE void add(const QUrl& url, const QString& title, const QUrl& icon, const QString& folder);
     Q_INVOKABLE void remove(const QUrl& url);
     Q_INVOKABLE void update(const QUrl& url, const QString& title, const QString& folder);
 
+    Q_INVOKABLE QAbstractItemModel* sortedBy(int role, Qt::SortOrder order=Qt::AscendingOrder);
+
+    Q_INVOKABLE void importBookmarks(const QString& path);
+    Q_INVOKABLE void exportBookmarks(const QString& path);
+
 Q_SIGNALS:
     void databasePathChanged() const;
     void folderAdded(const QString& folder) const;
     void added(const QUrl& url) const;
     void removed(const QUrl& url) const;
     void rowCountChanged();
+    void loaded() const;
+    void importFinished(bool success, int count) const;
+    void exportFinished(bool success, int count) const;
 
 private:
-    QSqlDatabase m_database;
+    DatabaseExecutor* m_executor;
 
     struct BookmarkEntry {
         QUrl url;
@@ -83,18 +97,46 @@ private:
         int folderId;
         QString folder;
     };
+    // Bookmarks read from the database or imported from a file
+    struct ReadResult {
+        bool success;
+        QList<QPair<int, QString> > folders;
+        QList<BookmarkEntry> entries;
+        QList<qint64> rowIds;
+    };
     QHash<int, QString> m_folders;
-    QSet<QUrl> m_urls;
+    QHash<QString, int> m_folderIds;
+    // Identifier of the next folder, shared with imports running on the
+    // thread of the database so that folders get distinct identifiers
+    // without waiting for it
+    QSharedPointer<QAtomicInt> m_nextFolderId;
+    // Folders added before the database is read get provisional (negative)
+    // identifiers, and are written once it is read
+    int m_lastProvisionalFolderId;
+    bool m_loaded;
+    int m_loadRequest;
     QList<BookmarkEntry> m_orderedEntries;
 
+    // Maps each URL to a key from which its row is computed as
+    // (key - m_indexOffset), so that prepending an entry is O(1).
+    QHash<QUrl, int> m_urlIndex;
+    int m_indexOffset;
+
+    QHash<int, BookmarksSortedModel*> m_sortedModels;
+
     void resetDatabase(const QString& databaseName);
-    void createOrAlterDatabaseSchema();
     void populateFromDatabase();
+    void publishLoadedEntries(const ReadResult& result);
+    void mergeEntries(const QList<BookmarkEntry>& entries);
+    int getEntryIndex(const QUrl& url) const;
+    void unindexEntry(int index);
+    void insertFolder(int folderId, const QString& folder);
+    int publishImportedEntries(const ReadResult& result);
     void insertNewEntryInDatabase(const BookmarkEntry& entry);
     void removeExistingEntryFromDatabase(const QUrl& url);
     void updateExistingEntryInDatabase(const BookmarkEntry& entry);
     int getFolderId(const QString& folder);
-    int insertNewFolderInDatabase(const QString& folder);
+    void insertNewFolderInDatabase(int folderId, const QString& folder);
 };
 
 #endif // __BOOKMARKS_MODEL_H__
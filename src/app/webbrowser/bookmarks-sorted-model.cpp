@@ -0,0 +1,234 @@
+/*
+ * Copyright 2020 UBports Foundation
+ *
+ * This file is part of morph-browser.
+ *
+ * morph-browser is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * morph-browser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bookmarks-model.h"
+#include "bookmarks-sorted-model.h"
+
+// system
+#include <algorithm>
+
+/*!
+    \class BookmarksSortedModel
+    \brief List model that exposes the bookmarks sorted by title, URL or
+           creation date
+
+    BookmarksSortedModel is a view on a BookmarksModel that keeps its own
+    order of the bookmarks, sorted by one role (BookmarksModel::Title,
+    BookmarksModel::Url or BookmarksModel::Created), and forwards to the
+    source model for the data.
+
+    The order is maintained incrementally: a bookmark that is added, removed
+    or whose sort key changes is located by bisection, so that a single
+    change does not re-sort the whole model. Titles are compared with
+    collation keys computed once per bookmark.
+
+    Bookmarks with the same sort key are sorted by URL.
+*/
+BookmarksSortedModel::BookmarksSortedModel(BookmarksModel* sourceModel, int sortRole,
+                                           Qt::SortOrder sortOrder, QObject* parent)
+    : QAbstractListModel(parent)
+    , m_sourceModel(sourceModel)
+    , m_sortRole(sortRole)
+    , m_sortOrder(sortOrder)
+{
+    m_collator.setCaseSensitivity(Qt::CaseInsensitive);
+    m_collator.setNumericMode(true);
+    populate();
+    connect(m_sourceModel, SIGNAL(modelReset()), SLOT(onModelReset()));
+    connect(m_sourceModel, SIGNAL(layoutChanged(QList<QPersistentModelIndex>, QAbstractItemModel::LayoutChangeHint)),
+            SLOT(onModelReset()));
+    connect(m_sourceModel, SIGNAL(rowsInserted(const QModelIndex&, int, int)),
+            SLOT(onRowsInserted(const QModelIndex&, int, int)));
+    connect(m_sourceModel, SIGNAL(rowsAboutToBeRemoved(const QModelIndex&, int, int)),
+            SLOT(onRowsAboutToBeRemoved(const QModelIndex&, int, int)));
+    connect(m_sourceModel, SIGNAL(dataChanged(const QModelIndex&, const QModelIndex&, const QVector<int>&)),
+            SLOT(onDataChanged(const QModelIndex&, const QModelIndex&, const QVector<int>&)));
+}
+
+BookmarksModel* BookmarksSortedModel::sourceModel() const
+{
+    return m_sourceModel;
+}
+
+int BookmarksSortedModel::sortRole() const
+{
+    return m_sortRole;
+}
+
+Qt::SortOrder BookmarksSortedModel::sortOrder() const
+{
+    return m_sortOrder;
+}
+
+/*!
+    Return the row in the source model of a row of this model, or -1.
+*/
+int BookmarksSortedModel::sourceRow(int row) const
+{
+    if ((row < 0) || (row >= m_items.count())) {
+        return -1;
+    }
+    return m_sourceModel->indexOf(m_items.at(row).url);
+}
+
+QHash<int, QByteArray> BookmarksSortedModel::roleNames() const
+{
+    return m_sourceModel->roleNames();
+}
+
+int BookmarksSortedModel::rowCount(const QModelIndex& parent) const
+{
+    Q_UNUSED(parent);
+    return m_items.count();
+}
+
+QVariant BookmarksSortedModel::data(const QModelIndex& index, int role) const
+{
+    int row = index.isValid() ? sourceRow(index.row()) : -1;
+    if (row == -1) {
+        return QVariant();
+    }
+    return m_sourceModel->data(m_sourceModel->index(row, 0), role);
+}
+
+BookmarksSortedModel::Item BookmarksSortedModel::makeItem(int sourceRow) const
+{
+    QModelIndex index = m_sourceModel->index(sourceRow, 0);
+    QString title = (m_sortRole == BookmarksModel::Title) ?
+        m_sourceModel->data(index, BookmarksModel::Title).toString() : QString();
+    Item item = { QUrl(), QString(), QDateTime(), m_collator.sortKey(title) };
+    item.url = m_sourceModel->data(index, BookmarksModel::Url).toUrl();
+    item.urlString = item.url.toString();
+    if (m_sortRole == BookmarksModel::Created) {
+        item.created = m_sourceModel->data(index, BookmarksModel::Created).toDateTime();
+    }
+    return item;
+}
+
+bool BookmarksSortedModel::lessThan(const Item& a, const Item& b) const
+{
+    int result = 0;
+    switch (m_sortRole) {
+    case BookmarksModel::Title:
+        result = a.titleKey.compare(b.titleKey);
+        break;
+    case BookmarksModel::Created:
+        result = (a.created < b.created) ? -1 : ((b.created < a.created) ? 1 : 0);
+        break;
+    default:
+        break;
+    }
+    if (result == 0) {
+        result = a.urlString.compare(b.urlString);
+    }
+    return (m_sortOrder == Qt::AscendingOrder) ? (result < 0) : (result > 0);
+}
+
+int BookmarksSortedModel::lowerBound(const Item& item) const
+{
+    QList<Item>::const_iterator it = std::lower_bound(m_items.constBegin(), m_items.constEnd(), item,
+        [this](const Item& a, const Item& b) { return lessThan(a, b); });
+    return it - m_items.constBegin();
+}
+
+void BookmarksSortedModel::populate()
+{
+    m_items.clear();
+    m_itemsByUrl.clear();
+    int count = m_sourceModel->rowCount();
+    m_items.reserve(count);
+    m_itemsByUrl.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        Item item = makeItem(i);
+        m_items.append(item);
+        m_itemsByUrl.insert(item.url, item);
+    }
+    std::sort(m_items.begin(), m_items.end(),
+              [this](const Item& a, const Item& b) { return lessThan(a, b); });
+}
+
+void BookmarksSortedModel::onModelReset()
+{
+    beginResetModel();
+    populate();
+    endResetModel();
+}
+
+void BookmarksSortedModel::onRowsInserted(const QModelIndex& parent, int first, int last)
+{
+    Q_UNUSED(parent);
+    for (int i = first; i <= last; ++i) {
+        Item item = makeItem(i);
+        int position = lowerBound(item);
+        beginInsertRows(QModelIndex(), position, position);
+        m_items.insert(position, item);
+        m_itemsByUrl.insert(item.url, item);
+        endInsertRows();
+    }
+}
+
+void BookmarksSortedModel::onRowsAboutToBeRemoved(const QModelIndex& parent, int first, int last)
+{
+    Q_UNUSED(parent);
+    for (int i = first; i <= last; ++i) {
+        QUrl url = m_sourceModel->data(m_sourceModel->index(i, 0), BookmarksModel::Url).toUrl();
+        QHash<QUrl, Item>::iterator it = m_itemsByUrl.find(url);
+        if (it == m_itemsByUrl.end()) {
+            continue;
+        }
+        int position = lowerBound(it.value());
+        m_itemsByUrl.erase(it);
+        beginRemoveRows(QModelIndex(), position, position);
+        m_items.removeAt(position);
+        endRemoveRows();
+    }
+}
+
+void BookmarksSortedModel::onDataChanged(const QModelIndex& topLeft, const QModelIndex& bottomRight, const QVector<int>& roles)
+{
+    bool keyChanged = roles.isEmpty() || roles.contains(m_sortRole);
+    for (int i = topLeft.row(); i <= bottomRight.row(); ++i) {
+        QUrl url = m_sourceModel->data(m_sourceModel->index(i, 0), BookmarksModel::Url).toUrl();
+        QHash<QUrl, Item>::iterator it = m_itemsByUrl.find(url);
+        if (it == m_itemsByUrl.end()) {
+            continue;
+        }
+        int position = lowerBound(it.value());
+        if (keyChanged) {
+            Item item = makeItem(i);
+            it.value() = item;
+            m_items[position] = item;
+            // Move the bookmark only if it is no longer between its neighbours
+            int destination = position;
+            if ((position > 0) && lessThan(item, m_items.at(position - 1))) {
+                destination = std::lower_bound(m_items.constBegin(), m_items.constBegin() + position, item,
+                    [this](const Item& a, const Item& b) { return lessThan(a, b); }) - m_items.constBegin();
+            } else if ((position < m_items.count() - 1) && lessThan(m_items.at(position + 1), item)) {
+                destination = std::lower_bound(m_items.constBegin() + position + 1, m_items.constEnd(), item,
+                    [this](const Item& a, const Item& b) { return lessThan(a, b); }) - m_items.constBegin();
+            }
+            if (destination != position) {
+                beginMoveRows(QModelIndex(), position, position, QModelIndex(), destination);
+                m_items.move(position, (destination > position) ? destination - 1 : destination);
+                endMoveRows();
+                position = (destination > position) ? destination - 1 : destination;
+            }
+        }
+        Q_EMIT dataChanged(index(position, 0), index(position, 0), roles);
+    }
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2020 UBports Foundation
+ *
+ * This file is part of morph-browser.
+ *
+ * morph-browser is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * morph-browser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BOOKMARKS_SORTED_MODEL_H__
+#define __BOOKMARKS_SORTED_MODEL_H__
+
+// Qt
+#include <QtCore/QAbstractListModel>
+#include <QtCore/QCollator>
+#include <QtCore/QCollatorSortKey>
+#include <QtCore/QDateTime>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QString>
+#include <QtCore/QUrl>
+
+class BookmarksModel;
+
+class BookmarksSortedModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+    Q_PROPERTY(int sortRole READ sortRole CONSTANT)
+    Q_PROPERTY(Qt::SortOrder sortOrder READ sortOrder CONSTANT)
+
+public:
+    BookmarksSortedModel(BookmarksModel* sourceModel, int sortRole,
+                         Qt::SortOrder sortOrder=Qt::AscendingOrder, QObject* parent=0);
+
+    BookmarksModel* sourceModel() const;
+    int sortRole() const;
+    Qt::SortOrder sortOrder() const;
+
+    int sourceRow(int row) const;
+
+    // reimplemented from QAbstractListModel
+    QHash<int, QByteArray> roleNames() const;
+    int rowCount(const QModelIndex& parent=QModelIndex()) const;
+    QVariant data(const QModelIndex& index, int role) const;
+
+private Q_SLOTS:
+    void onModelReset();
+    void onRowsInserted(const QModelIndex& parent, int first, int last);
+    void onRowsAboutToBeRemoved(const QModelIndex& parent, int first, int last);
+    void onDataChanged(const QModelIndex& topLeft, const QModelIndex& bottomRight, const QVector<int>& roles);
+
+private:
+    struct Item {
+        QUrl url;
+        QString urlString;
+        QDateTime created;
+        // Only computed when sorting by title
+        QCollatorSortKey titleKey;
+    };
+
+    BookmarksModel* m_sourceModel;
+    int m_sortRole;
+    Qt::SortOrder m_sortOrder;
+    QCollator m_collator;
+    QList<Item> m_items;
+    // Sort key of each bookmark, to find it back in m_items
+    QHash<QUrl, Item> m_itemsByUrl;
+
+    Item makeItem(int sourceRow) const;
+    bool lessThan(const Item& a, const Item& b) const;
+    int lowerBound(const Item& item) const;
+    void populate();
+};
+
+#endif // __BOOKMARKS_SORTED_MODEL_H__
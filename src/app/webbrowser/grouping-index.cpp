@@ -0,0 +1,667 @@
+/*
+ * Copyright 2020 UBports Foundation
+ *
+ * This file is part of morph-browser.
+ *
+ * morph-browser is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * morph-browser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "grouping-index.h"
+
+// Qt
+#include <QtCore/QPair>
+#include <QtCore/QSet>
+
+// system
+#include <algorithm>
+
+/*!
+    \class GroupingIndex
+    \brief Index of the rows of a list model grouped by the value of a role
+
+    GroupingIndex keeps, for each distinct value of a given role (the key) in
+    a source list model, the ordered list of the source rows that have this
+    value. The index is updated incrementally from the changes notified by
+    the source model, so that the cost of a change doesn't depend on the
+    number of groups: rows are shifted from the closest end of the source
+    model (rows inserted at the top of a source model only cost the size of
+    their groups), and the cost otherwise depends on the rows the change
+    affects.
+
+    Each group can be exposed as a list model with a GroupModel, that
+    forwards to the source model and is notified only of the changes that
+    affect its own rows.
+
+    groupAdded() and groupRemoved() are emitted when the first row with a
+    given key is added to the source model, and when the last one is
+    removed. They are not emitted when the source model is reset.
+*/
+GroupingIndex::GroupingIndex(QObject* parent)
+    : QObject(parent)
+    , m_sourceModel(0)
+    , m_keyRole(Qt::DisplayRole)
+    , m_caseSensitivity(Qt::CaseSensitive)
+    , m_rowOffset(0)
+{
+}
+
+GroupingIndex::~GroupingIndex()
+{
+    Q_FOREACH(GroupModel* view, views()) {
+        view->m_index = 0;
+    }
+}
+
+QAbstractItemModel* GroupingIndex::sourceModel() const
+{
+    return m_sourceModel;
+}
+
+void GroupingIndex::setSourceModel(QAbstractItemModel* sourceModel)
+{
+    if (sourceModel == m_sourceModel) {
+        return;
+    }
+    beginReset();
+    if (m_sourceModel) {
+        m_sourceModel->disconnect(this);
+    }
+    m_sourceModel = sourceModel;
+    if (m_sourceModel) {
+        connect(m_sourceModel, SIGNAL(modelAboutToBeReset()), SLOT(onSourceModelAboutToBeReset()));
+        connect(m_sourceModel, SIGNAL(modelReset()), SLOT(onSourceModelReset()));
+        connect(m_sourceModel, SIGNAL(layoutAboutToBeChanged(QList<QPersistentModelIndex>, QAbstractItemModel::LayoutChangeHint)),
+                SLOT(onSourceModelAboutToBeReset()));
+        connect(m_sourceModel, SIGNAL(layoutChanged(QList<QPersistentModelIndex>, QAbstractItemModel::LayoutChangeHint)),
+                SLOT(onSourceModelReset()));
+        connect(m_sourceModel, SIGNAL(destroyed()), SLOT(onSourceModelDestroyed()));
+        connect(m_sourceModel, SIGNAL(rowsInserted(const QModelIndex&, int, int)),
+                SLOT(onRowsInserted(const QModelIndex&, int, int)));
+        connect(m_sourceModel, SIGNAL(rowsAboutToBeRemoved(const QModelIndex&, int, int)),
+                SLOT(onRowsAboutToBeRemoved(const QModelIndex&, int, int)));
+        connect(m_sourceModel, SIGNAL(rowsRemoved(const QModelIndex&, int, int)),
+                SLOT(onRowsRemoved(const QModelIndex&, int, int)));
+        connect(m_sourceModel, SIGNAL(rowsAboutToBeMoved(const QModelIndex&, int, int, const QModelIndex&, int)),
+                SLOT(onRowsAboutToBeMoved(const QModelIndex&, int, int, const QModelIndex&, int)));
+        connect(m_sourceModel, SIGNAL(rowsMoved(const QModelIndex&, int, int, const QModelIndex&, int)),
+                SLOT(onRowsMoved(const QModelIndex&, int, int, const QModelIndex&, int)));
+        connect(m_sourceModel, SIGNAL(dataChanged(const QModelIndex&, const QModelIndex&, const QVector<int>&)),
+                SLOT(onDataChanged(const QModelIndex&, const QModelIndex&, const QVector<int>&)));
+    }
+    endReset();
+}
+
+int GroupingIndex::keyRole() const
+{
+    return m_keyRole;
+}
+
+void GroupingIndex::setKeyRole(int role)
+{
+    if (role != m_keyRole) {
+        beginReset();
+        m_keyRole = role;
+        endReset();
+    }
+}
+
+Qt::CaseSensitivity GroupingIndex::caseSensitivity() const
+{
+    return m_caseSensitivity;
+}
+
+/*!
+    Set whether keys that only differ by case belong to the same group.
+    Keys of case-insensitive groups are case-folded.
+*/
+void GroupingIndex::setCaseSensitivity(Qt::CaseSensitivity sensitivity)
+{
+    if (sensitivity != m_caseSensitivity) {
+        beginReset();
+        m_caseSensitivity = sensitivity;
+        endReset();
+    }
+}
+
+QString GroupingIndex::normalizedKey(const QString& key) const
+{
+    return (m_caseSensitivity == Qt::CaseSensitive) ? key : key.toCaseFolded();
+}
+
+/*!
+    Return the keys of all groups, in the order of their first row in the
+    source model.
+*/
+QStringList GroupingIndex::keys() const
+{
+    return keysOfRows(0, rowCount() - 1);
+}
+
+bool GroupingIndex::contains(const QString& key) const
+{
+    return m_groups.contains(key);
+}
+
+/*!
+    Return the source rows of a group, in ascending order.
+*/
+QVector<int> GroupingIndex::rows(const QString& key) const
+{
+    QVector<int> rows = m_groups.value(key);
+    for (int i = 0; i < rows.count(); ++i) {
+        rows[i] += m_rowOffset;
+    }
+    return rows;
+}
+
+int GroupingIndex::rowCount() const
+{
+    return int(m_rowKeys.size());
+}
+
+// Position in a group of the first source row that is not lower than row
+int GroupingIndex::lowerBound(const QVector<int>& rows, int row) const
+{
+    return std::lower_bound(rows.constBegin(), rows.constEnd(), row - m_rowOffset) - rows.constBegin();
+}
+
+int GroupingIndex::groupRowCount(const QString& key) const
+{
+    QHash<QString, QVector<int> >::const_iterator it = m_groups.constFind(key);
+    return (it != m_groups.constEnd()) ? it.value().count() : 0;
+}
+
+int GroupingIndex::groupSourceRow(const QString& key, int position) const
+{
+    QHash<QString, QVector<int> >::const_iterator it = m_groups.constFind(key);
+    if ((it == m_groups.constEnd()) || (position >= it.value().count())) {
+        return -1;
+    }
+    return it.value().at(position) + m_rowOffset;
+}
+
+/*
+    Shift the source rows from first to last by delta in their groups,
+    before the offset changes. The rows they are shifted to must be free, so
+    that the groups remain sorted.
+*/
+void GroupingIndex::shiftRows(int first, int last, int delta)
+{
+    Q_FOREACH(const QString& key, keysOfRows(first, last)) {
+        QVector<int>& rows = m_groups[key];
+        int to = lowerBound(rows, last + 1);
+        for (int i = lowerBound(rows, first); i < to; ++i) {
+            rows[i] += delta;
+        }
+    }
+}
+
+void GroupingIndex::attach(GroupModel* view)
+{
+    if (view->m_allRows) {
+        m_allRowsViews.append(view);
+    } else {
+        m_views.insert(view->m_key, view);
+    }
+}
+
+void GroupingIndex::detach(GroupModel* view)
+{
+    if (view->m_allRows) {
+        m_allRowsViews.removeOne(view);
+    } else {
+        m_views.remove(view->m_key, view);
+    }
+}
+
+QList<GroupModel*> GroupingIndex::views() const
+{
+    return m_views.values() + m_allRowsViews;
+}
+
+void GroupingIndex::beginReset()
+{
+    Q_FOREACH(GroupModel* view, views()) {
+        view->beginResetModel();
+    }
+}
+
+void GroupingIndex::endReset()
+{
+    rebuild();
+    Q_FOREACH(GroupModel* view, views()) {
+        view->endResetModel();
+    }
+}
+
+void GroupingIndex::rebuild()
+{
+    m_groups.clear();
+    m_rowKeys.clear();
+    m_rowOffset = 0;
+    if (m_sourceModel) {
+        int count = m_sourceModel->rowCount();
+        for (int i = 0; i < count; ++i) {
+            QString key = sourceKey(i);
+            m_rowKeys.push_back(key);
+            m_groups[key].append(i);
+        }
+    }
+}
+
+/*
+    Return the distinct keys of a range of source rows, in order.
+*/
+QStringList GroupingIndex::keysOfRows(int first, int last) const
+{
+    QStringList keys;
+    QSet<QString> seen;
+    for (int i = first; i <= last; ++i) {
+        const QString& key = m_rowKeys.at(i);
+        if (!seen.contains(key)) {
+            seen.insert(key);
+            keys.append(key);
+        }
+    }
+    return keys;
+}
+
+QString GroupingIndex::sourceKey(int row) const
+{
+    QModelIndex index = m_sourceModel->index(row, 0);
+    return normalizedKey(m_sourceModel->data(index, m_keyRole).toString());
+}
+
+void GroupingIndex::onSourceModelAboutToBeReset()
+{
+    beginReset();
+}
+
+void GroupingIndex::onSourceModelReset()
+{
+    endReset();
+}
+
+void GroupingIndex::onSourceModelDestroyed()
+{
+    beginReset();
+    m_sourceModel = 0;
+    endReset();
+}
+
+void GroupingIndex::onRowsInserted(const QModelIndex& parent, int first, int last)
+{
+    if (parent.isValid()) {
+        return;
+    }
+    int count = last - first + 1;
+
+    // Shift the rows that follow the inserted ones, this does not change
+    // the position of any row in its group. When there are fewer rows
+    // before, all rows are shifted through the offset and the rows before
+    // are shifted back.
+    Q_FOREACH(GroupModel* view, m_allRowsViews) {
+        view->beginInsertRows(QModelIndex(), first, last);
+    }
+    QVector<QString> insertedKeys;
+    insertedKeys.reserve(count);
+    QStringList keys;
+    QHash<QString, QVector<int> > insertedRows;
+    for (int i = first; i <= last; ++i) {
+        QString key = sourceKey(i);
+        insertedKeys.append(key);
+        if (!insertedRows.contains(key)) {
+            keys.append(key);
+        }
+        insertedRows[key].append(i);
+    }
+    if (first < rowCount() - first) {
+        shiftRows(0, first - 1, -count);
+        m_rowOffset += count;
+    } else {
+        shiftRows(first, rowCount() - 1, count);
+    }
+    m_rowKeys.insert(m_rowKeys.begin() + first, insertedKeys.constBegin(), insertedKeys.constEnd());
+    Q_FOREACH(GroupModel* view, m_allRowsViews) {
+        view->endInsertRows();
+    }
+
+    // The inserted rows of a given group are contiguous in this group
+    Q_FOREACH(const QString& key, keys) {
+        bool added = !m_groups.contains(key);
+        QVector<int>& rows = m_groups[key];
+        const QVector<int>& inserted = insertedRows[key];
+        int position = lowerBound(rows, first);
+        QList<GroupModel*> views = m_views.values(key);
+        Q_FOREACH(GroupModel* view, views) {
+            view->beginInsertRows(QModelIndex(), position, position + inserted.count() - 1);
+        }
+        rows.insert(position, inserted.count(), 0);
+        for (int i = 0; i < inserted.count(); ++i) {
+            rows[position + i] = inserted.at(i) - m_rowOffset;
+        }
+        Q_FOREACH(GroupModel* view, views) {
+            view->endInsertRows();
+        }
+        if (added) {
+            Q_EMIT groupAdded(key);
+        }
+    }
+}
+
+void GroupingIndex::onRowsAboutToBeRemoved(const QModelIndex& parent, int first, int last)
+{
+    if (parent.isValid()) {
+        return;
+    }
+    m_changingGroups = keysOfRows(first, last);
+    Q_FOREACH(const QString& key, m_changingGroups) {
+        const QVector<int>& rows = m_groups[key];
+        int from = lowerBound(rows, first);
+        int to = lowerBound(rows, last + 1) - 1;
+        Q_FOREACH(GroupModel* view, m_views.values(key)) {
+            view->beginRemoveRows(QModelIndex(), from, to);
+        }
+    }
+    Q_FOREACH(GroupModel* view, m_allRowsViews) {
+        view->beginRemoveRows(QModelIndex(), first, last);
+    }
+}
+
+void GroupingIndex::onRowsRemoved(const QModelIndex& parent, int first, int last)
+{
+    if (parent.isValid()) {
+        return;
+    }
+    int count = last - first + 1;
+    Q_FOREACH(const QString& key, m_changingGroups) {
+        QVector<int>& rows = m_groups[key];
+        int from = lowerBound(rows, first);
+        rows.remove(from, lowerBound(rows, last + 1) - from);
+    }
+    // Shift the rows on the side with fewer rows (see onRowsInserted())
+    if (first < rowCount() - 1 - last) {
+        shiftRows(0, first - 1, count);
+        m_rowOffset -= count;
+    } else {
+        shiftRows(last + 1, rowCount() - 1, -count);
+    }
+    m_rowKeys.erase(m_rowKeys.begin() + first, m_rowKeys.begin() + last + 1);
+
+    QStringList removed;
+    Q_FOREACH(const QString& key, m_changingGroups) {
+        Q_FOREACH(GroupModel* view, m_views.values(key)) {
+            view->endRemoveRows();
+        }
+        if (m_groups.value(key).isEmpty()) {
+            m_groups.remove(key);
+            removed.append(key);
+        }
+    }
+    m_changingGroups.clear();
+    Q_FOREACH(GroupModel* view, m_allRowsViews) {
+        view->endRemoveRows();
+    }
+    Q_FOREACH(const QString& key, removed) {
+        Q_EMIT groupRemoved(key);
+    }
+}
+
+void GroupingIndex::onRowsAboutToBeMoved(const QModelIndex& sourceParent, int sourceStart, int sourceEnd,
+                                         const QModelIndex& destinationParent, int destinationRow)
+{
+    if (sourceParent.isValid() || destinationParent.isValid()) {
+        return;
+    }
+    // Only the groups of the moved rows may be re-ordered, the rows they
+    // jump over keep their relative order.
+    m_changingGroups.clear();
+    Q_FOREACH(const QString& key, keysOfRows(sourceStart, sourceEnd)) {
+        const QVector<int>& rows = m_groups[key];
+        int from = lowerBound(rows, sourceStart);
+        int to = lowerBound(rows, sourceEnd + 1);
+        int destination = lowerBound(rows, destinationRow);
+        if ((destination < from) || (destination > to)) {
+            Q_FOREACH(GroupModel* view, m_views.values(key)) {
+                view->beginMoveRows(QModelIndex(), from, to - 1, QModelIndex(), destination);
+            }
+            m_changingGroups.append(key);
+        }
+    }
+    Q_FOREACH(GroupModel* view, m_allRowsViews) {
+        view->beginMoveRows(QModelIndex(), sourceStart, sourceEnd, QModelIndex(), destinationRow);
+    }
+}
+
+void GroupingIndex::onRowsMoved(const QModelIndex& sourceParent, int sourceStart, int sourceEnd,
+                                const QModelIndex& destinationParent, int destinationRow)
+{
+    if (sourceParent.isValid() || destinationParent.isValid()) {
+        return;
+    }
+    int count = sourceEnd - sourceStart + 1;
+    bool down = (destinationRow > sourceEnd);
+    // Only the rows between the moved ones and their destination change
+    int low = down ? sourceStart : destinationRow;
+    int high = down ? destinationRow : sourceEnd + 1;
+    Q_FOREACH(const QString& key, keysOfRows(low, high - 1)) {
+        QVector<int>& rows = m_groups[key];
+        int from = lowerBound(rows, low);
+        int to = lowerBound(rows, high);
+        for (int i = from; i < to; ++i) {
+            int row = rows.at(i) + m_rowOffset;
+            if ((row >= sourceStart) && (row <= sourceEnd)) {
+                row = down ? row + (destinationRow - sourceEnd - 1) : row - (sourceStart - destinationRow);
+            } else {
+                row = down ? row - count : row + count;
+            }
+            rows[i] = row - m_rowOffset;
+        }
+        std::sort(rows.begin() + from, rows.begin() + to);
+    }
+    if (down) {
+        std::rotate(m_rowKeys.begin() + sourceStart, m_rowKeys.begin() + sourceEnd + 1,
+                    m_rowKeys.begin() + destinationRow);
+    } else {
+        std::rotate(m_rowKeys.begin() + destinationRow, m_rowKeys.begin() + sourceStart,
+                    m_rowKeys.begin() + sourceEnd + 1);
+    }
+
+    Q_FOREACH(const QString& key, m_changingGroups) {
+        Q_FOREACH(GroupModel* view, m_views.values(key)) {
+            view->endMoveRows();
+        }
+    }
+    m_changingGroups.clear();
+    Q_FOREACH(GroupModel* view, m_allRowsViews) {
+        view->endMoveRows();
+    }
+}
+
+void GroupingIndex::onDataChanged(const QModelIndex& topLeft, const QModelIndex& bottomRight, const QVector<int>& roles)
+{
+    if (topLeft.parent().isValid()) {
+        return;
+    }
+    int first = topLeft.row();
+    int last = bottomRight.row();
+    bool keyChanged = roles.isEmpty() || roles.contains(m_keyRole);
+    if (keyChanged) {
+        for (int i = first; i <= last; ++i) {
+            QString key = sourceKey(i);
+            if (key != m_rowKeys.at(i)) {
+                changeRowKey(i, key);
+            }
+        }
+    }
+
+    // Notify each group once, for the range of its rows that changed
+    QHash<QString, QPair<int, int> > changes;
+    for (int i = first; i <= last; ++i) {
+        const QString& key = m_rowKeys.at(i);
+        if (!changes.contains(key) && m_views.contains(key)) {
+            const QVector<int>& rows = m_groups[key];
+            changes.insert(key, qMakePair(lowerBound(rows, first), lowerBound(rows, last + 1) - 1));
+        }
+    }
+    for (QHash<QString, QPair<int, int> >::const_iterator it = changes.constBegin(); it != changes.constEnd(); ++it) {
+        Q_FOREACH(GroupModel* view, m_views.values(it.key())) {
+            Q_EMIT view->dataChanged(view->index(it.value().first, 0), view->index(it.value().second, 0), roles);
+        }
+    }
+    Q_FOREACH(GroupModel* view, m_allRowsViews) {
+        Q_EMIT view->dataChanged(view->index(first, 0), view->index(last, 0), roles);
+    }
+}
+
+/*
+    Move a source row whose key changed from its group to its new group.
+*/
+void GroupingIndex::changeRowKey(int row, const QString& key)
+{
+    QString previous = m_rowKeys.at(row);
+    m_rowKeys[row] = key;
+
+    QVector<int>& previousRows = m_groups[previous];
+    int position = lowerBound(previousRows, row);
+    QList<GroupModel*> views = m_views.values(previous);
+    Q_FOREACH(GroupModel* view, views) {
+        view->beginRemoveRows(QModelIndex(), position, position);
+    }
+    previousRows.remove(position);
+    Q_FOREACH(GroupModel* view, views) {
+        view->endRemoveRows();
+    }
+    bool removed = previousRows.isEmpty();
+    if (removed) {
+        m_groups.remove(previous);
+    }
+
+    bool added = !m_groups.contains(key);
+    QVector<int>& rows = m_groups[key];
+    position = lowerBound(rows, row);
+    views = m_views.values(key);
+    Q_FOREACH(GroupModel* view, views) {
+        view->beginInsertRows(QModelIndex(), position, position);
+    }
+    rows.insert(position, row - m_rowOffset);
+    Q_FOREACH(GroupModel* view, views) {
+        view->endInsertRows();
+    }
+
+    if (removed) {
+        Q_EMIT groupRemoved(previous);
+    }
+    if (added) {
+        Q_EMIT groupAdded(key);
+    }
+}
+
+/*!
+    \class GroupModel
+    \brief List model that exposes the rows of a group of a GroupingIndex
+
+    GroupModel is a lightweight view on one group of a GroupingIndex: it
+    holds no data of its own, and forwards to the source model of the index.
+    The rows are exposed in the order of the source model.
+
+    If allRows is set, all the rows of the source model are exposed.
+*/
+GroupModel::GroupModel(QObject* parent)
+    : QAbstractListModel(parent)
+    , m_index(0)
+    , m_allRows(false)
+{
+}
+
+GroupModel::~GroupModel()
+{
+    if (m_index) {
+        m_index->detach(this);
+    }
+}
+
+GroupingIndex* GroupModel::groupingIndex() const
+{
+    return m_index;
+}
+
+const QString& GroupModel::groupKey() const
+{
+    return m_key;
+}
+
+bool GroupModel::allRows() const
+{
+    return m_allRows;
+}
+
+void GroupModel::setGroup(GroupingIndex* index, const QString& key, bool allRows)
+{
+    QString normalizedKey = index ? index->normalizedKey(key) : key;
+    if ((index == m_index) && (normalizedKey == m_key) && (allRows == m_allRows)) {
+        return;
+    }
+    beginResetModel();
+    if (m_index) {
+        m_index->detach(this);
+    }
+    m_index = index;
+    m_key = normalizedKey;
+    m_allRows = allRows;
+    if (m_index) {
+        m_index->attach(this);
+    }
+    endResetModel();
+}
+
+/*!
+    Return the row in the source model of a row of the group, or -1.
+*/
+int GroupModel::sourceRow(int row) const
+{
+    if (!m_index || (row < 0)) {
+        return -1;
+    }
+    if (m_allRows) {
+        return (row < m_index->rowCount()) ? row : -1;
+    }
+    return m_index->groupSourceRow(m_key, row);
+}
+
+QHash<int, QByteArray> GroupModel::roleNames() const
+{
+    if (m_index && m_index->sourceModel()) {
+        return m_index->sourceModel()->roleNames();
+    }
+    return QAbstractListModel::roleNames();
+}
+
+int GroupModel::rowCount(const QModelIndex& parent) const
+{
+    Q_UNUSED(parent);
+    if (!m_index) {
+        return 0;
+    }
+    return m_allRows ? m_index->rowCount() : m_index->groupRowCount(m_key);
+}
+
+QVariant GroupModel::data(const QModelIndex& index, int role) const
+{
+    int row = index.isValid() ? sourceRow(index.row()) : -1;
+    if (row == -1) {
+        return QVariant();
+    }
+    QAbstractItemModel* source = m_index->sourceModel();
+    return source->data(source->index(row, 0), role);
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2020 UBports Foundation
+ *
+ * This file is part of morph-browser.
+ *
+ * morph-browser is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * morph-browser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GROUPING_INDEX_H__
+#define __GROUPING_INDEX_H__
+
+// Qt
+#include <QtCore/QAbstractItemModel>
+#include <QtCore/QAbstractListModel>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMultiHash>
+#include <QtCore/QObject>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+
+// system
+#include <deque>
+
+class GroupModel;
+
+class GroupingIndex : public QObject
+{
+    Q_OBJECT
+
+public:
+    GroupingIndex(QObject* parent=0);
+    ~GroupingIndex();
+
+    QAbstractItemModel* sourceModel() const;
+    void setSourceModel(QAbstractItemModel* sourceModel);
+
+    int keyRole() const;
+    void setKeyRole(int role);
+
+    Qt::CaseSensitivity caseSensitivity() const;
+    void setCaseSensitivity(Qt::CaseSensitivity sensitivity);
+
+    QString normalizedKey(const QString& key) const;
+    QStringList keys() const;
+    bool contains(const QString& key) const;
+    QVector<int> rows(const QString& key) const;
+    int rowCount() const;
+
+Q_SIGNALS:
+    void groupAdded(const QString& key);
+    void groupRemoved(const QString& key);
+
+private Q_SLOTS:
+    void onSourceModelAboutToBeReset();
+    void onSourceModelReset();
+    void onSourceModelDestroyed();
+    void onRowsInserted(const QModelIndex& parent, int first, int last);
+    void onRowsAboutToBeRemoved(const QModelIndex& parent, int first, int last);
+    void onRowsRemoved(const QModelIndex& parent, int first, int last);
+    void onRowsAboutToBeMoved(const QModelIndex& sourceParent, int sourceStart, int sourceEnd,
+                              const QModelIndex& destinationParent, int destinationRow);
+    void onRowsMoved(const QModelIndex& sourceParent, int sourceStart, int sourceEnd,
+                     const QModelIndex& destinationParent, int destinationRow);
+    void onDataChanged(const QModelIndex& topLeft, const QModelIndex& bottomRight, const QVector<int>& roles);
+
+private:
+    friend class GroupModel;
+
+    QAbstractItemModel* m_sourceModel;
+    int m_keyRole;
+    Qt::CaseSensitivity m_caseSensitivity;
+    // Source rows of each group, in ascending order, stored relatively to
+    // m_rowOffset so that shifting all of them doesn't touch them
+    QHash<QString, QVector<int> > m_groups;
+    int m_rowOffset;
+    // Group of each source row
+    std::deque<QString> m_rowKeys;
+    QMultiHash<QString, GroupModel*> m_views;
+    QList<GroupModel*> m_allRowsViews;
+    // Groups affected by a removal or a move, between the notifications
+    // sent before and after the change
+    QStringList m_changingGroups;
+
+    void attach(GroupModel* view);
+    void detach(GroupModel* view);
+    QList<GroupModel*> views() const;
+    void beginReset();
+    void endReset();
+    void rebuild();
+    QStringList keysOfRows(int first, int last) const;
+    QString sourceKey(int row) const;
+    int lowerBound(const QVector<int>& rows, int row) const;
+    int groupRowCount(const QString& key) const;
+    int groupSourceRow(const QString& key, int position) const;
+    void shiftRows(int first, int last, int delta);
+    void changeRowKey(int row, const QString& key);
+};
+
+class GroupModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    GroupModel(QObject* parent=0);
+    ~GroupModel();
+
+    GroupingIndex* groupingIndex() const;
+    const QString& groupKey() const;
+    bool allRows() const;
+    void setGroup(GroupingIndex* index, const QString& key, bool allRows=false);
+
+    int sourceRow(int row) const;
+
+    // reimplemented from QAbstractListModel
+    QHash<int, QByteArray> roleNames() const;
+    int rowCount(const QModelIndex& parent=QModelIndex()) const;
+    QVariant data(const QModelIndex& index, int role) const;
+
+private:
+    friend class GroupingIndex;
+
+    GroupingIndex* m_index;
+    QString m_key;
+    bool m_allRows;
+};
+
+#endif // __GROUPING_INDEX_H__
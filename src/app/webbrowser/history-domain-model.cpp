@@ -24,36 +24,65 @@
 
 /*!
     \class HistoryDomainModel
-    \brief Proxy model that filters the contents of a history model
-           based on a domain name
+    \brief List model that exposes the entries of a history model for a
+           given domain name
 
-    HistoryDomainModel is a proxy model that filters the contents of a
-    history model based on a domain name.
+    HistoryDomainModel is a view on the group of a GroupingIndex that
+    contains all the entries of a history model for a domain name.
 
     An entry in the history model matches if the domain name extracted from
-    its URL equals the filter domain name (case-insensitive comparison).
+    its URL equals the domain name (case-insensitive comparison).
 
     When no domain name is set (null or empty string), all entries match.
+
+    When created with a source model, the model maintains its own index.
+    Several models can share the index of a HistoryDomainListModel instead.
 */
 HistoryDomainModel::HistoryDomainModel(QObject* parent)
-    : QSortFilterProxyModel(parent)
+    : GroupModel(parent)
+{
+    connectModelChanged();
+}
+
+HistoryDomainModel::HistoryDomainModel(GroupingIndex* index, const QString& domain, QObject* parent)
+    : GroupModel(parent)
+    , m_domain(domain)
+{
+    setGroup(index, domain, domain.isEmpty());
+    onModelChanged();
+    connectModelChanged();
+}
+
+void HistoryDomainModel::connectModelChanged()
 {
-    connect(this, SIGNAL(layoutChanged(QList<QPersistentModelIndex>, QAbstractItemModel::LayoutChangeHint)), SLOT(onModelChanged()));
     connect(this, SIGNAL(modelReset()), SLOT(onModelChanged()));
     connect(this, SIGNAL(rowsInserted(QModelIndex, int, int)), SLOT(onModelChanged()));
     connect(this, SIGNAL(rowsRemoved(QModelIndex, int, int)), SLOT(onModelChanged()));
+    connect(this, SIGNAL(rowsMoved(QModelIndex, int, int, QModelIndex, int)), SLOT(onModelChanged()));
     connect(this, SIGNAL(dataChanged(QModelIndex, QModelIndex, QVector<int>)), SLOT(onModelChanged()));
 }
 
 HistoryModel* HistoryDomainModel::sourceModel() const
 {
-    return qobject_cast<HistoryModel*>(QSortFilterProxyModel::sourceModel());
+    GroupingIndex* index = groupingIndex();
+    return index ? qobject_cast<HistoryModel*>(index->sourceModel()) : 0;
 }
 
 void HistoryDomainModel::setSourceModel(HistoryModel* sourceModel)
 {
     if (sourceModel != this->sourceModel()) {
-        QSortFilterProxyModel::setSourceModel(sourceModel);
+        GroupingIndex* previous = groupingIndex();
+        GroupingIndex* index = 0;
+        if (sourceModel) {
+            index = new GroupingIndex(this);
+            index->setKeyRole(HistoryModel::Domain);
+            index->setCaseSensitivity(Qt::CaseInsensitive);
+            index->setSourceModel(sourceModel);
+        }
+        setGroup(index, m_domain, m_domain.isEmpty());
+        if (previous && (previous->parent() == this)) {
+            delete previous;
+        }
         Q_EMIT sourceModelChanged();
     }
 }
@@ -67,7 +96,7 @@ void HistoryDomainModel::setDomain(const QString& domain)
 {
     if (domain != m_domain) {
         m_domain = domain;
-        invalidate();
+        setGroup(groupingIndex(), domain, domain.isEmpty());
         Q_EMIT domainChanged();
     }
 }
@@ -87,16 +116,6 @@ const QUrl& HistoryDomainModel::lastVisitedIcon() const
     return m_lastVisitedIcon;
 }
 
-bool HistoryDomainModel::filterAcceptsRow(int source_row, const QModelIndex& source_parent) const
-{
-    if (m_domain.isEmpty()) {
-        return true;
-    }
-    QModelIndex index = sourceModel()->index(source_row, 0, source_parent);
-    QString domain = sourceModel()->data(index, HistoryModel::Domain).toString();
-    return (domain.compare(m_domain, Qt::CaseInsensitive) == 0);
-}
-
 void HistoryDomainModel::onModelChanged()
 {
     // If the rowCount is zero all the history entries of this model were
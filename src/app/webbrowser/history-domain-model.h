@@ -21,13 +21,15 @@
 
 // Qt
 #include <QtCore/QDateTime>
-#include <QtCore/QSortFilterProxyModel>
 #include <QtCore/QString>
 #include <QtCore/QUrl>
 
+// local
+#include "grouping-index.h"
+
 class HistoryModel;
 
-class HistoryDomainModel : public QSortFilterProxyModel
+class HistoryDomainModel : public GroupModel
 {
     Q_OBJECT
 
@@ -39,6 +41,7 @@ class HistoryDomainModel : public QSortFilterProxyModel
 
 public:
     HistoryDomainModel(QObject* parent=0);
+    HistoryDomainModel(GroupingIndex* index, const QString& domain, QObject* parent=0);
 
     HistoryModel* sourceModel() const;
     void setSourceModel(HistoryModel* sourceModel);
@@ -57,16 +60,14 @@ Q_SIGNALS:
     void lastVisitedTitleChanged() const;
     void lastVisitedIconChanged() const;
 
-protected:
-    // reimplemented from QSortFilterProxyModel
-    bool filterAcceptsRow(int source_row, const QModelIndex& source_parent) const;
-
 private:
     QString m_domain;
     QDateTime m_lastVisit;
     QString m_lastVisitedTitle;
     QUrl m_lastVisitedIcon;
 
+    void connectModelChanged();
+
 private Q_SLOTS:
     void onModelChanged();
 };
@@ -16,6 +16,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "../model-utils.h"
+#include "grouping-index.h"
 #include "history-domain-model.h"
 #include "history-domainlist-model.h"
 #include "history-model.h"
@@ -32,11 +34,19 @@
     three roles: 'domain' for the domain name, 'lastVisit' for the timestamp
     of the last page visited in this domain, and 'entries' for the corresponding
     HistoryDomainModel that contains all entries in this group.
+
+    All the HistoryDomainModels share a single GroupingIndex, so that a
+    change in the history model only affects the domain it belongs to.
 */
 HistoryDomainListModel::HistoryDomainListModel(QObject* parent)
     : QAbstractListModel(parent)
     , m_sourceModel(0)
 {
+    m_index = new GroupingIndex(this);
+    m_index->setKeyRole(HistoryModel::Domain);
+    m_index->setCaseSensitivity(Qt::CaseInsensitive);
+    connect(m_index, SIGNAL(groupAdded(const QString&)), SLOT(onDomainAdded(const QString&)));
+    connect(m_index, SIGNAL(groupRemoved(const QString&)), SLOT(onDomainRemoved(const QString&)));
 }
 
 HistoryDomainListModel::~HistoryDomainListModel()
@@ -61,7 +71,7 @@ QHash<int, QByteArray> HistoryDomainListModel::roleNames() const
 int HistoryDomainListModel::rowCount(const QModelIndex& parent) const
 {
     Q_UNUSED(parent);
-    return m_domains.count();
+    return m_domainModels.count();
 }
 
 QVariant HistoryDomainListModel::data(const QModelIndex& index, int role) const
@@ -69,12 +79,11 @@ QVariant HistoryDomainListModel::data(const QModelIndex& index, int role) const
     if (!index.isValid()) {
         return QVariant();
     }
-    const QString domain = m_domainsPerLastVisit.at(index.row());
-    HistoryDomainModel* entries = m_domains.value(domain);
+    HistoryDomainModel* entries = m_domainModels.at(index.row());
 
     switch (role) {
     case Domain:
-        return domain;
+        return entries->domain();
     case LastVisit:
         return entries->lastVisit();
     case LastVisitDate:
@@ -104,10 +113,10 @@ void HistoryDomainListModel::setSourceModel(HistoryModel* sourceModel)
         }
         clearDomains();
         m_sourceModel = sourceModel;
+        // The index must be updated before the domains are re-populated
+        m_index->setSourceModel(sourceModel);
         populateModel();
         if (m_sourceModel != 0) {
-            connect(m_sourceModel, SIGNAL(rowsInserted(const QModelIndex&, int, int)),
-                    SLOT(onRowsInserted(const QModelIndex&, int, int)));
             connect(m_sourceModel, SIGNAL(modelReset()), SLOT(onModelReset()));
             connect(m_sourceModel, SIGNAL(layoutChanged(QList<QPersistentModelIndex>, QAbstractItemModel::LayoutChangeHint)),
                     SLOT(onModelReset()));
@@ -117,64 +126,51 @@ void HistoryDomainListModel::setSourceModel(HistoryModel* sourceModel)
     }
 }
 
-QVariantMap HistoryDomainListModel::get(int row) const
+QVariantMap HistoryDomainListModel::get(int row, const QStringList& roles) const
 {
-    if (row < 0 || row >= rowCount()) {
-        return QVariantMap();
-    }
-
-    QVariantMap res;
-    QHash<int,QByteArray> names = roleNames();
-    QHashIterator<int, QByteArray> i(names);
-
-    while (i.hasNext()) {
-        i.next();
-        QModelIndex idx = index(row, 0);
-        QVariant data = idx.data(i.key());
-        res[i.value()] = data;
-    }
+    return ModelUtils::get(this, row, roles);
+}
 
-    return res;
+QVariantList HistoryDomainListModel::getRange(int from, int count, const QStringList& roles) const
+{
+    return ModelUtils::getRange(this, from, count, roles);
 }
 
 void HistoryDomainListModel::clearDomains()
 {
-    Q_FOREACH(const QString& domain, m_domains.keys()) {
-        delete m_domains.take(domain);
-    }
-    m_domainsPerLastVisit.clear();
+    qDeleteAll(m_domainModels);
+    m_domainModels.clear();
+    m_domainRows.clear();
+    m_domains.clear();
 }
 
 void HistoryDomainListModel::populateModel()
 {
-    if (m_sourceModel != 0) {
-        int count = m_sourceModel->rowCount();
-        for (int i = 0; i < count; ++i) {
-            QString domain = getDomainFromSourceModel(m_sourceModel->index(i, 0));
-            if (!m_domains.contains(domain)) {
-                insertNewDomain(domain);
-            }
-        }
+    Q_FOREACH(const QString& domain, m_index->keys()) {
+        insertNewDomain(domain);
     }
 }
 
-void HistoryDomainListModel::onRowsInserted(const QModelIndex& parent, int start, int end)
-{
-    for (int i = start; i <= end; ++i) {
-        QString domain = getDomainFromSourceModel(m_sourceModel->index(i, 0, parent));
-        if (!m_domains.contains(domain)) {
-            QStringList domains = m_domainsPerLastVisit;
-            int insertAt = 0;
-            while (insertAt < domains.count()) {
-                if (domain.compare(domains.at(insertAt)) < 0) {
-                    break;
-                }
-                ++insertAt;
-            }
-            beginInsertRows(QModelIndex(), insertAt, insertAt);
-            insertNewDomain(domain);
-            endInsertRows();
+void HistoryDomainListModel::onDomainAdded(const QString& domain)
+{
+    int insertAt = m_domainModels.count();
+    beginInsertRows(QModelIndex(), insertAt, insertAt);
+    insertNewDomain(domain);
+    endInsertRows();
+}
+
+void HistoryDomainListModel::onDomainRemoved(const QString& domain)
+{
+    HistoryDomainModel* model = m_domains.take(domain);
+    if (m_domainRows.contains(model)) {
+        int removeAt = m_domainRows.take(model);
+        beginRemoveRows(QModelIndex(), removeAt, removeAt);
+        m_domainModels.removeAt(removeAt);
+        for (int i = removeAt; i < m_domainModels.count(); ++i) {
+            m_domainRows[m_domainModels.at(i)] = i;
         }
+        delete model;
+        endRemoveRows();
     }
 }
 
@@ -188,42 +184,24 @@ void HistoryDomainListModel::onModelReset()
 
 void HistoryDomainListModel::insertNewDomain(const QString& domain)
 {
-    HistoryDomainModel* model = new HistoryDomainModel(this);
-    model->setSourceModel(m_sourceModel);
-    model->setDomain(domain);
+    HistoryDomainModel* model = new HistoryDomainModel(m_index, domain, this);
     connect(model, SIGNAL(rowsInserted(QModelIndex, int, int)), SLOT(onDomainDataChanged()));
-    connect(model, SIGNAL(rowsRemoved(QModelIndex, int, int)), SLOT(onDomainRowsRemoved(QModelIndex, int, int)));
+    connect(model, SIGNAL(rowsRemoved(QModelIndex, int, int)), SLOT(onDomainRowsRemoved()));
     connect(model, SIGNAL(rowsMoved(QModelIndex, int, int, QModelIndex, int)), SLOT(onDomainDataChanged()));
-    connect(model, SIGNAL(layoutChanged(QList<QPersistentModelIndex>, QAbstractItemModel::LayoutChangeHint)), SLOT(onDomainDataChanged()));
     connect(model, SIGNAL(dataChanged(QModelIndex, QModelIndex)), SLOT(onDomainDataChanged()));
     connect(model, SIGNAL(modelReset()), SLOT(onDomainDataChanged()));
     connect(model, SIGNAL(lastVisitChanged()), SLOT(onDomainDataChanged()));
     m_domains.insert(domain, model);
-    m_domainsPerLastVisit.append(domain);
+    m_domainRows.insert(model, m_domainModels.count());
+    m_domainModels.append(model);
 }
 
-QString HistoryDomainListModel::getDomainFromSourceModel(const QModelIndex& index) const
+void HistoryDomainListModel::onDomainRowsRemoved()
 {
-    return m_sourceModel->data(index, HistoryModel::Domain).toString();
-}
-
-void HistoryDomainListModel::onDomainRowsRemoved(const QModelIndex& parent, int start, int end)
-{
-    Q_UNUSED(parent);
-    Q_UNUSED(start);
-    Q_UNUSED(end);
+    // Empty domains are removed when the index notifies it
     HistoryDomainModel* model = qobject_cast<HistoryDomainModel*>(sender());
-    if (model != 0) {
-        const QString& domain = model->domain();
-        if (model->rowCount() == 0) {
-            int removeAt = m_domainsPerLastVisit.indexOf(domain);
-            beginRemoveRows(QModelIndex(), removeAt, removeAt);
-            delete m_domains.take(domain);
-            m_domainsPerLastVisit.removeAt(removeAt);
-            endRemoveRows();
-        } else {
-            emitDataChanged(domain);
-        }
+    if ((model != 0) && (model->rowCount() > 0)) {
+        emitDataChanged(model);
     }
 }
 
@@ -231,13 +209,13 @@ void HistoryDomainListModel::onDomainDataChanged()
 {
     HistoryDomainModel* model = qobject_cast<HistoryDomainModel*>(sender());
     if (model != 0) {
-        emitDataChanged(model->domain());
+        emitDataChanged(model);
     }
 }
 
-void HistoryDomainListModel::emitDataChanged(const QString& domain)
+void HistoryDomainListModel::emitDataChanged(HistoryDomainModel* model)
 {
-    int i = m_domainsPerLastVisit.indexOf(domain);
+    int i = m_domainRows.value(model, -1);
     if (i != -1) {
         QModelIndex index = this->index(i, 0);
         Q_EMIT dataChanged(index, index, QVector<int>() << LastVisit << LastVisitDate << LastVisitedTitle << LastVisitedIcon << Entries);
@@ -21,9 +21,12 @@
 
 // Qt
 #include <QtCore/QAbstractListModel>
-#include <QtCore/QMap>
+#include <QtCore/QHash>
+#include <QtCore/QList>
 #include <QtCore/QString>
+#include <QtCore/QStringList>
 
+class GroupingIndex;
 class HistoryDomainModel;
 class HistoryModel;
 
@@ -56,28 +59,33 @@ public:
     HistoryModel* sourceModel() const;
     void setSourceModel(HistoryModel* sourceModel);
 
-    Q_INVOKABLE QVariantMap get(int row) const;
+    Q_INVOKABLE QVariantMap get(int row, const QStringList& roles=QStringList()) const;
+    Q_INVOKABLE QVariantList getRange(int from, int count, const QStringList& roles=QStringList()) const;
 
 Q_SIGNALS:
     void sourceModelChanged() const;
 
 private Q_SLOTS:
-    void onRowsInserted(const QModelIndex& parent, int start, int end);
+    void onDomainAdded(const QString& domain);
+    void onDomainRemoved(const QString& domain);
     void onModelReset();
 
-    void onDomainRowsRemoved(const QModelIndex& parent, int start, int end);
+    void onDomainRowsRemoved();
     void onDomainDataChanged();
 
 private:
     HistoryModel* m_sourceModel;
-    QMap<QString, HistoryDomainModel*> m_domains;
-    QStringList m_domainsPerLastVisit;
+    GroupingIndex* m_index;
+    QHash<QString, HistoryDomainModel*> m_domains;
+    // In the order in which domains were first seen
+    QList<HistoryDomainModel*> m_domainModels;
+    // Row of each domain model, to notify its changes without a lookup
+    QHash<HistoryDomainModel*, int> m_domainRows;
 
     void clearDomains();
     void populateModel();
     void insertNewDomain(const QString& domain);
-    QString getDomainFromSourceModel(const QModelIndex& index) const;
-    void emitDataChanged(const QString& domain);
+    void emitDataChanged(HistoryDomainModel* model);
 };
 
 #endif // __HISTORY_DOMAINLIST_MODEL_H__
@@ -23,6 +23,10 @@
 #include <QtCore/QDebug>
 #include <QtCore/QStringList>
 
+// system
+#include <algorithm>
+#include <functional>
+
 /*!
     \class HistoryLastVisitDateListModel
     \brief List model that exposes a list of all last visit dates from history
@@ -35,10 +39,15 @@
     The source model needs to expose a role named 'lastVisitDate', from which
     the input dates will be read. If such role is not present, this model will
     not expose any dates.
+
+    The model keeps the number of source rows for each date, and the date of
+    each source row, so that it can be updated from the rows inserted,
+    removed, moved or changed in the source model without scanning it.
 */
 HistoryLastVisitDateListModel::HistoryLastVisitDateListModel(QObject* parent)
     : QAbstractListModel(parent)
     , m_sourceModel(0)
+    , m_sourceModelRole(-1)
 {
 }
 
@@ -109,6 +118,8 @@ void HistoryLastVisitDateListModel::setSourceModel(QVariant sourceModel)
             connect(m_sourceModel,
                     SIGNAL(rowsMoved(const QModelIndex&, int, int, const QModelIndex&, int)),
                     SLOT(onRowsMoved(const QModelIndex&, int, int, const QModelIndex&, int)));
+            connect(m_sourceModel, SIGNAL(dataChanged(const QModelIndex&, const QModelIndex&)),
+                    SLOT(onDataChanged(const QModelIndex&, const QModelIndex&)));
             connect(m_sourceModel, SIGNAL(modelReset()), SLOT(onModelReset()));
             connect(m_sourceModel, SIGNAL(layoutChanged(QList<QPersistentModelIndex>, QAbstractItemModel::LayoutChangeHint)),
                     SLOT(onModelReset()));
@@ -121,54 +132,93 @@ void HistoryLastVisitDateListModel::setSourceModel(QVariant sourceModel)
 void HistoryLastVisitDateListModel::clearLastVisitDates()
 {
     m_orderedDates.clear();
-    Q_FOREACH(const QDate& lastVisitDate, m_lastVisitDates.keys()) {
-        delete m_lastVisitDates.take(lastVisitDate);
-    }
+    m_lastVisitDates.clear();
+    m_rowDates.clear();
 }
 
 void HistoryLastVisitDateListModel::populateModel()
 {
-    if (m_sourceModel != 0) {
-        int count = m_sourceModel->rowCount();
-        for (int i = 0; i < count; ++i) {
-            insertNewHistoryEntry(new QPersistentModelIndex(m_sourceModel->index(i, 0)), false);
+    if ((m_sourceModel == 0) || (m_sourceModelRole == -1)) {
+        return;
+    }
+    int count = m_sourceModel->rowCount();
+    m_rowDates.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        QDate lastVisitDate = sourceDate(i);
+        m_rowDates.append(lastVisitDate);
+        ++m_lastVisitDates[lastVisitDate];
+    }
+    if (!m_lastVisitDates.isEmpty()) {
+        // Add default entry to represent all dates
+        m_orderedDates.reserve(m_lastVisitDates.count() + 1);
+        m_orderedDates.append(QDate());
+        QMap<QDate, int>::const_iterator it = m_lastVisitDates.constEnd();
+        while (it != m_lastVisitDates.constBegin()) {
+            --it;
+            m_orderedDates.append(it.key());
         }
     }
 }
 
-void HistoryLastVisitDateListModel::onRowsInserted(const QModelIndex& parent, int start, int end)
+QDate HistoryLastVisitDateListModel::sourceDate(int row) const
 {
-    for (int i = start; i <= end; ++i) {
-        insertNewHistoryEntry(new QPersistentModelIndex(m_sourceModel->index(i, 0)), true);
+    return m_sourceModel->data(m_sourceModel->index(row, 0), m_sourceModelRole).toDate();
+}
+
+/*
+    Return the row of a date in the ordered list of dates, or the row where
+    it would be inserted if it is not in the list.
+*/
+int HistoryLastVisitDateListModel::datePosition(const QDate& date) const
+{
+    if (m_orderedDates.isEmpty()) {
+        return 1;
     }
+    // Skip the default entry, the other dates are in descending order
+    return std::lower_bound(m_orderedDates.constBegin() + 1, m_orderedDates.constEnd(),
+                            date, std::greater<QDate>()) - m_orderedDates.constBegin();
 }
 
-void HistoryLastVisitDateListModel::onRowsRemoved(const QModelIndex& parent, int start, int end)
+void HistoryLastVisitDateListModel::addDate(const QDate& date, bool notify)
 {
-    QMap<QDate, QList<QPersistentModelIndex*>*>::iterator lastVisitDate = m_lastVisitDates.begin();
-    while (lastVisitDate != m_lastVisitDates.end()) {
-
-        QList<QPersistentModelIndex*>::iterator entry = lastVisitDate.value()->begin();
-        while (entry != lastVisitDate.value()->end()) {
-            QPersistentModelIndex *index = *entry;
-            if (!index->isValid()) {
-                entry = lastVisitDate.value()->erase(entry);
-            } else {
-                ++entry;
-            }
-        }
+    int& count = m_lastVisitDates[date];
+    if (count++ > 0) {
+        return;
+    }
 
-        if (lastVisitDate.value()->isEmpty()) {
-            int removeAt = m_orderedDates.indexOf(lastVisitDate.key());
-            beginRemoveRows(QModelIndex(), removeAt, removeAt);
-            m_orderedDates.removeAt(removeAt);
-            delete lastVisitDate.value();
-            lastVisitDate = m_lastVisitDates.erase(lastVisitDate);
-            endRemoveRows();
-        } else {
-            ++lastVisitDate;
+    if (m_orderedDates.isEmpty()) {
+        // Add default entry to represent all dates
+        if (notify) {
+            beginInsertRows(QModelIndex(), 0, 0);
         }
+        m_orderedDates.append(QDate());
+        if (notify) {
+            endInsertRows();
+        }
+    }
+
+    int insertAt = datePosition(date);
+    if (notify) {
+        beginInsertRows(QModelIndex(), insertAt, insertAt);
+    }
+    m_orderedDates.insert(insertAt, date);
+    if (notify) {
+        endInsertRows();
+    }
+}
+
+void HistoryLastVisitDateListModel::removeDate(const QDate& date)
+{
+    QMap<QDate, int>::iterator it = m_lastVisitDates.find(date);
+    if ((it == m_lastVisitDates.end()) || (--it.value() > 0)) {
+        return;
     }
+    m_lastVisitDates.erase(it);
+
+    int removeAt = datePosition(date);
+    beginRemoveRows(QModelIndex(), removeAt, removeAt);
+    m_orderedDates.remove(removeAt);
+    endRemoveRows();
 
     if (m_lastVisitDates.isEmpty()) {
         // Remove the default entry if model is empty
@@ -178,38 +228,66 @@ void HistoryLastVisitDateListModel::onRowsRemoved(const QModelIndex& parent, int
     }
 }
 
+void HistoryLastVisitDateListModel::onRowsInserted(const QModelIndex& parent, int start, int end)
+{
+    if (parent.isValid() || (m_sourceModelRole == -1)) {
+        return;
+    }
+    m_rowDates.insert(start, end - start + 1, QDate());
+    for (int i = start; i <= end; ++i) {
+        QDate lastVisitDate = sourceDate(i);
+        m_rowDates[i] = lastVisitDate;
+        addDate(lastVisitDate, true);
+    }
+}
+
+void HistoryLastVisitDateListModel::onRowsRemoved(const QModelIndex& parent, int start, int end)
+{
+    if (parent.isValid() || (m_sourceModelRole == -1)) {
+        return;
+    }
+    QVector<QDate> removed = m_rowDates.mid(start, end - start + 1);
+    m_rowDates.remove(start, end - start + 1);
+    Q_FOREACH(const QDate& lastVisitDate, removed) {
+        removeDate(lastVisitDate);
+    }
+}
+
 void HistoryLastVisitDateListModel::onRowsMoved(const QModelIndex& parent, int start, int end, const QModelIndex& destination, int row)
 {
-    Q_UNUSED(parent);
-    Q_UNUSED(destination);
-
-    // Rows were moved in the source model, meaning that their last visit dates
-    // were potentially updated, so we remove all the dates corresponding to
-    // the rows before they were moved, and we add all the dates corresponding
-    // to the rows after they were moved.
-
-    // Determine a lower and upper bound for the dates that should be removed
-    // by looking at the indexes surrounding the rows before they were moved.
-    QDate lower = m_sourceModel->data(m_sourceModel->index((row < start) ? end + 1 : start, 0), m_sourceModelRole).toDate();
-    if (!lower.isValid()) {
-        // The last row was moved too, we don’t have a strict lower bound.
-        lower = m_orderedDates.last().addDays(-1);
+    if (parent.isValid() || destination.isValid() || (m_sourceModelRole == -1)) {
+        return;
     }
-    QDate upper = m_sourceModel->data(m_sourceModel->index((row < start) ? end : start - 1, 0), m_sourceModelRole).toDate();
-    for (QDate i = upper.addDays(-1); i > lower; i = i.addDays(-1)) {
-        if (m_orderedDates.contains(i)) {
-            int removeAt = m_orderedDates.indexOf(i);
-            beginRemoveRows(QModelIndex(), removeAt, removeAt);
-            m_orderedDates.removeAt(removeAt);
-            delete m_lastVisitDates.take(i);
-            endRemoveRows();
-        }
+
+    // Moving rows does not change the number of rows per date, but the
+    // source model may have updated the last visit date of the moved rows
+    // (e.g. when visiting again a page moves it to the top of the history).
+    QVector<QDate>::iterator first = m_rowDates.begin() + start;
+    QVector<QDate>::iterator last = m_rowDates.begin() + end + 1;
+    if (row < start) {
+        std::rotate(m_rowDates.begin() + row, first, last);
+    } else {
+        std::rotate(first, last, m_rowDates.begin() + row);
+        row -= end - start + 1;
     }
+    onDataChanged(m_sourceModel->index(row, 0), m_sourceModel->index(row + end - start, 0));
+}
 
-    // Now add back dates for all the rows after they were moved.
-    for (int i = 0; i <= (end - start); ++i) {
-        int index = i + row + ((row < start) ? 0 : start - end);
-        insertNewHistoryEntry(new QPersistentModelIndex(m_sourceModel->index(index, 0)), true);
+void HistoryLastVisitDateListModel::onDataChanged(const QModelIndex& topLeft, const QModelIndex& bottomRight)
+{
+    if (topLeft.parent().isValid() || (m_sourceModelRole == -1)) {
+        return;
+    }
+    for (int i = topLeft.row(); i <= bottomRight.row(); ++i) {
+        QDate lastVisitDate = sourceDate(i);
+        if (lastVisitDate != m_rowDates.at(i)) {
+            // Add the new date first, so that the default entry is not
+            // removed and added back when the date of the only row changes
+            QDate previous = m_rowDates.at(i);
+            m_rowDates[i] = lastVisitDate;
+            addDate(lastVisitDate, true);
+            removeDate(previous);
+        }
     }
 }
 
@@ -232,46 +310,3 @@ void HistoryLastVisitDateListModel::onModelReset()
     populateModel();
     endResetModel();
 }
-
-void HistoryLastVisitDateListModel::insertNewHistoryEntry(QPersistentModelIndex* index, bool notify)
-{
-    if (m_sourceModelRole == -1) {
-        return;
-    }
-
-    QDate lastVisitDate = index->data(m_sourceModelRole).toDate();
-    if (!m_lastVisitDates.contains(lastVisitDate)) {
-        if (m_orderedDates.isEmpty()) {
-            // Add default entry to represent all dates
-            if (notify) {
-                beginInsertRows(QModelIndex(), 0, 0);
-            }
-            m_orderedDates.append(QDate());
-            if (notify) {
-                endInsertRows();
-            }
-        }
-
-        int insertAt = 1;
-        QList<QPersistentModelIndex*> *entries = new QList<QPersistentModelIndex*>();
-        while (insertAt < m_orderedDates.count()) {
-            if (lastVisitDate > m_orderedDates.at(insertAt)) {
-                break;
-            }
-            ++insertAt;
-        }
-
-        if (notify) {
-            beginInsertRows(QModelIndex(), insertAt, insertAt);
-        }
-
-        m_orderedDates.insert(insertAt, lastVisitDate);
-        m_lastVisitDates.insert(lastVisitDate, entries);
-
-        if (notify) {
-            endInsertRows();
-        }
-    }
-
-    m_lastVisitDates[lastVisitDate]->append(index);
-}
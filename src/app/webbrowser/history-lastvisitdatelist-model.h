@@ -21,9 +21,10 @@
 
 // Qt
 #include <QtCore/QAbstractListModel>
+#include <QtCore/QDate>
 #include <QtCore/QMap>
-#include <QtCore/QSortFilterProxyModel>
 #include <QtCore/QString>
+#include <QtCore/QVector>
 
 class HistoryLastVisitDateListModel : public QAbstractListModel
 {
@@ -56,17 +57,25 @@ private Q_SLOTS:
     void onRowsInserted(const QModelIndex& parent, int start, int end);
     void onRowsRemoved(const QModelIndex& parent, int start, int end);
     void onRowsMoved(const QModelIndex& parent, int start, int end, const QModelIndex& destination, int row);
+    void onDataChanged(const QModelIndex& topLeft, const QModelIndex& bottomRight);
     void onModelReset();
 
 private:
     QAbstractItemModel* m_sourceModel;
     int m_sourceModelRole;
-    QMap<QDate, QList<QPersistentModelIndex*>*> m_lastVisitDates;
-    QList<QDate> m_orderedDates;
+    // Number of source rows for each last visit date
+    QMap<QDate, int> m_lastVisitDates;
+    // Last visit date of each source row, in the order of the source model
+    QVector<QDate> m_rowDates;
+    // Distinct last visit dates, most recent first, after the default entry
+    QVector<QDate> m_orderedDates;
 
     void clearLastVisitDates();
     void populateModel();
-    void insertNewHistoryEntry(QPersistentModelIndex* index, bool notify);
+    QDate sourceDate(int row) const;
+    int datePosition(const QDate& date) const;
+    void addDate(const QDate& date, bool notify);
+    void removeDate(const QDate& date);
     void updateSourceModelRole();
 };
 
@@ -16,17 +16,441 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "../database-utils.h"
 #include "../domain-utils.h"
+#include "../model-utils.h"
+#include "../url-utils.h"
 #include "history-model.h"
+#include "top-sites-model.h"
 
 // Qt
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDebug>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFileInfo>
+#include <QtCore/QPair>
+#include <QtCore/QRegExp>
+#include <QtCore/QTimeZone>
 #include <QtCore/QTimer>
-#include <QtCore/QWriteLocker>
+#include <QtSql/QSqlError>
 #include <QtSql/QSqlQuery>
 
+// system
+#include <algorithm>
+#include <limits>
+
 #define SQL_DRIVER QStringLiteral("QSQLITE")
 #define CONNECTION_NAME QStringLiteral("morph-browser-history")
 
+// Pending database operations are flushed after a period of inactivity, or as
+// soon as the queue reaches a given size.
+static const int FLUSH_INTERVAL = 1000;
+static const int FLUSH_THRESHOLD = 200;
+
+// Operations are passed from the model to the worker through a queue of a
+// fixed size. When it is full, operations are appended to an overflow list
+// instead, the model never waits for the worker.
+static const int QUEUE_CAPACITY = 1024;
+
+// At startup, the entries needed by the new tab page (most recent and most
+// visited) are fetched first, then the whole history is fetched in batches,
+// one batch per call to the worker.
+static const int PRIORITY_RECENT_ENTRIES = 100;
+static const int PRIORITY_TOP_ENTRIES = 50;
+static const int FETCH_BATCH_SIZE = 1000;
+
+// Once the history is loaded, entries stored before the 'domain' column was
+// introduced are updated in small batches, whenever no other operation is
+// pending. Progress is implicitly saved as each batch is committed.
+static const int BACKFILL_INTERVAL = 100;
+static const int BACKFILL_BATCH_SIZE = 100;
+
+// Retention limits are enforced once the history is loaded, whenever they
+// change, and when the model grows past the maximum number of entries by a
+// given margin. Entries are pruned in batches, least valuable first: each
+// visit weighs as much as a week of recency.
+static const int RETENTION_MARGIN = 100;
+static const int PRUNE_BATCH_SIZE = 500;
+static const int PRUNE_VISIT_WEIGHT = 7 * 24 * 60 * 60;
+
+// History imported from other browsers is read in batches, most recent first,
+// each batch being written in a single transaction and then added to the
+// model at once.
+#define IMPORT_CONNECTION_NAME QStringLiteral("morph-browser-history-import")
+static const int IMPORT_BATCH_SIZE = 5000;
+// Chromium timestamps are in microseconds since 1601-01-01 (UTC)
+static const qint64 CHROMIUM_EPOCH_OFFSET = Q_INT64_C(11644473600);
+
+// Long schema migrations commit their work in batches of this many entries.
+static const int MIGRATION_BATCH_SIZE = 5000;
+
+// In virtualized mode, entries are read from the database in pages, and only
+// a given number of entries around the rows most recently read are kept in
+// memory.
+static const int VIRTUAL_PAGE_SIZE = 100;
+static const int VIRTUAL_CACHE_SIZE = 1000;
+
+// The local dates of entries are computed when their last visit changes, and
+// computed again for all entries only when the system time zone changes,
+// which is checked periodically. Dates of past visits don’t depend on the
+// current date, so nothing needs to be done at midnight.
+static const int TIME_ZONE_CHECK_INTERVAL = 60 * 1000;
+static const qint32 INVALID_DAY = std::numeric_limits<qint32>::min();
+
+static qint32 localDay(qint64 lastVisit)
+{
+    QDate date = QDateTime::fromMSecsSinceEpoch(lastVisit, Qt::UTC).toLocalTime().date();
+    return date.isValid() ? qint32(date.toJulianDay()) : INVALID_DAY;
+}
+
+static QDate dayToDate(qint32 day)
+{
+    return (day == INVALID_DAY) ? QDate() : QDate::fromJulianDay(day);
+}
+
+static void setLastVisit(HistoryModel::HistoryEntry& entry, qint64 lastVisit)
+{
+    entry.lastVisit = lastVisit;
+    entry.lastVisitDay = localDay(lastVisit);
+}
+
+// Schema version 1: unversioned databases, possibly created before the
+// 'domain' column was introduced.
+static bool createSchema(QSqlDatabase& database)
+{
+    if (!DatabaseUtils::exec(database, QStringLiteral("CREATE TABLE IF NOT EXISTS history "
+                                                      "(url VARCHAR, domain VARCHAR, title VARCHAR,"
+                                                      " icon VARCHAR, visits INTEGER, lastVisit DATETIME);"))) {
+        return false;
+    }
+    if (!DatabaseUtils::hasColumn(database, QStringLiteral("history"), QStringLiteral("domain"))) {
+        if (!DatabaseUtils::exec(database, QStringLiteral("ALTER TABLE history ADD COLUMN domain VARCHAR;"))) {
+            return false;
+        }
+        // Updating all the entries in the database to add the domain is a
+        // costly operation that would slow down the application startup,
+        // it is done in the background (see DbWorker::doBackfillDomains()).
+    }
+    return DatabaseUtils::exec(database, QStringLiteral("CREATE TABLE IF NOT EXISTS history_hidden (url VARCHAR);"));
+}
+
+// Schema version 2: index the columns used to look up and delete entries.
+static bool addIndexes(QSqlDatabase& database)
+{
+    return DatabaseUtils::exec(database, QStringLiteral("CREATE INDEX IF NOT EXISTS history_url ON history (url);")) &&
+           DatabaseUtils::exec(database, QStringLiteral("CREATE INDEX IF NOT EXISTS history_domain ON history (domain);")) &&
+           DatabaseUtils::exec(database, QStringLiteral("CREATE INDEX IF NOT EXISTS history_lastVisit ON history (lastVisit);")) &&
+           DatabaseUtils::exec(database, QStringLiteral("CREATE INDEX IF NOT EXISTS history_hidden_url ON history_hidden (url);"));
+}
+
+// Schema version 3: full-text index over the URL, title and domain of
+// entries, kept in sync with the history table by triggers.
+static bool addFullTextIndex(QSqlDatabase& database)
+{
+    // FTS5 is an optional SQLite extension, searches fall back to pattern
+    // matching when it is not available.
+    QSqlQuery query(database);
+    if (!query.exec(QStringLiteral("CREATE VIRTUAL TABLE IF NOT EXISTS history_fts USING fts5"
+                                   "(url, title, domain, content='history', content_rowid='rowid');"))) {
+        qWarning() << "Full-text search of the history is not available:" << query.lastError().text();
+        return true;
+    }
+    return DatabaseUtils::exec(database, QStringLiteral("CREATE TRIGGER IF NOT EXISTS history_fts_insert AFTER INSERT ON history BEGIN "
+                                                        "INSERT INTO history_fts (rowid, url, title, domain) "
+                                                        "VALUES (new.rowid, new.url, new.title, new.domain); END;")) &&
+           DatabaseUtils::exec(database, QStringLiteral("CREATE TRIGGER IF NOT EXISTS history_fts_delete AFTER DELETE ON history BEGIN "
+                                                        "INSERT INTO history_fts (history_fts, rowid, url, title, domain) "
+                                                        "VALUES ('delete', old.rowid, old.url, old.title, old.domain); END;")) &&
+           DatabaseUtils::exec(database, QStringLiteral("CREATE TRIGGER IF NOT EXISTS history_fts_update AFTER UPDATE ON history BEGIN "
+                                                        "INSERT INTO history_fts (history_fts, rowid, url, title, domain) "
+                                                        "VALUES ('delete', old.rowid, old.url, old.title, old.domain); "
+                                                        "INSERT INTO history_fts (rowid, url, title, domain) "
+                                                        "VALUES (new.rowid, new.url, new.title, new.domain); END;")) &&
+           DatabaseUtils::exec(database, QStringLiteral("INSERT INTO history_fts (history_fts) VALUES ('rebuild');"));
+}
+
+// Keep the full-text index of the normalized schema (see normalizeSchema())
+// up to date with the history table.
+static bool createFullTextTriggers(QSqlDatabase& database)
+{
+    return DatabaseUtils::exec(database, QStringLiteral("CREATE TRIGGER IF NOT EXISTS history_fts_insert AFTER INSERT ON history BEGIN "
+                                                        "INSERT INTO history_fts (rowid, url, title, domain) "
+                                                        "VALUES (new.rowid, new.url, new.title, "
+                                                        "(SELECT domain FROM history_domains WHERE id = new.domainId)); END;")) &&
+           DatabaseUtils::exec(database, QStringLiteral("CREATE TRIGGER IF NOT EXISTS history_fts_delete AFTER DELETE ON history BEGIN "
+                                                        "INSERT INTO history_fts (history_fts, rowid, url, title, domain) "
+                                                        "VALUES ('delete', old.rowid, old.url, old.title, "
+                                                        "(SELECT domain FROM history_domains WHERE id = old.domainId)); END;")) &&
+           DatabaseUtils::exec(database, QStringLiteral("CREATE TRIGGER IF NOT EXISTS history_fts_update AFTER UPDATE ON history BEGIN "
+                                                        "INSERT INTO history_fts (history_fts, rowid, url, title, domain) "
+                                                        "VALUES ('delete', old.rowid, old.url, old.title, "
+                                                        "(SELECT domain FROM history_domains WHERE id = old.domainId)); "
+                                                        "INSERT INTO history_fts (rowid, url, title, domain) "
+                                                        "VALUES (new.rowid, new.url, new.title, "
+                                                        "(SELECT domain FROM history_domains WHERE id = new.domainId)); END;"));
+}
+
+// Schema version 4: domains and icons, which repeat across many entries, are
+// stored once in dictionary tables and referenced by integer keys. Entries
+// are read through the history_entries view, which resolves the keys.
+// Hidden URLs are few and don't necessarily have an entry in the history,
+// they are still stored as text.
+static bool normalizeSchema(QSqlDatabase& database)
+{
+    static const char* statements[] = {
+        "CREATE TABLE IF NOT EXISTS history_domains (id INTEGER PRIMARY KEY, domain VARCHAR UNIQUE);",
+        "CREATE TABLE IF NOT EXISTS history_icons (id INTEGER PRIMARY KEY, icon VARCHAR UNIQUE);",
+        "INSERT OR IGNORE INTO history_domains (domain) SELECT DISTINCT domain FROM history "
+        "WHERE domain IS NOT NULL AND domain != '';",
+        "INSERT OR IGNORE INTO history_icons (icon) SELECT DISTINCT icon FROM history "
+        "WHERE icon IS NOT NULL AND icon != '';",
+        // The full-text index refers to the columns of the old table
+        "DROP TRIGGER IF EXISTS history_fts_insert;",
+        "DROP TRIGGER IF EXISTS history_fts_delete;",
+        "DROP TRIGGER IF EXISTS history_fts_update;",
+        "DROP TABLE IF EXISTS history_fts;",
+        "CREATE TABLE history_normalized (url VARCHAR, domainId INTEGER, title VARCHAR,"
+        " iconId INTEGER, visits INTEGER, lastVisit DATETIME);",
+        // Row identifiers are kept, they order entries visited within the
+        // same second
+        "INSERT INTO history_normalized (rowid, url, domainId, title, iconId, visits, lastVisit) "
+        "SELECT history.rowid, history.url, history_domains.id, history.title, history_icons.id, "
+        "history.visits, history.lastVisit FROM history "
+        "LEFT JOIN history_domains ON history_domains.domain = history.domain "
+        "LEFT JOIN history_icons ON history_icons.icon = history.icon;",
+        "DROP TABLE history;",
+        "ALTER TABLE history_normalized RENAME TO history;",
+        "CREATE INDEX history_url ON history (url);",
+        "CREATE INDEX history_domainId ON history (domainId);",
+        "CREATE INDEX history_lastVisit ON history (lastVisit);",
+        "CREATE VIEW history_entries AS SELECT history.rowid AS entryId, history.url AS url, "
+        "history_domains.domain AS domain, history.title AS title, history_icons.icon AS icon, "
+        "history.visits AS visits, history.lastVisit AS lastVisit FROM history "
+        "LEFT JOIN history_domains ON history_domains.id = history.domainId "
+        "LEFT JOIN history_icons ON history_icons.id = history.iconId;",
+    };
+    for (uint i = 0; i < sizeof(statements) / sizeof(statements[0]); ++i) {
+        if (!DatabaseUtils::exec(database, QString::fromLatin1(statements[i]))) {
+            return false;
+        }
+    }
+
+    QSqlQuery query(database);
+    if (!query.exec(QStringLiteral("CREATE VIRTUAL TABLE IF NOT EXISTS history_fts USING fts5"
+                                   "(url, title, domain, content='history_entries', content_rowid='entryId');"))) {
+        qWarning() << "Full-text search of the history is not available:" << query.lastError().text();
+        return true;
+    }
+    return createFullTextTriggers(database) &&
+           DatabaseUtils::exec(database, QStringLiteral("INSERT INTO history_fts (history_fts) VALUES ('rebuild');"));
+}
+
+// Schema version 5: URLs are stored in canonical form (see
+// UrlUtils::canonicalUrl(), with the default tracking parameters). Entries
+// for variants of the same page are merged into the most recent one, which
+// gets the visits of all of them.
+// Entries are processed in rowid order, in batches committed one at a time
+// along with the last rowid processed, so that an interrupted migration
+// resumes where it stopped instead of holding the whole history in memory
+// in a single transaction. Processed entries have distinct canonical URLs,
+// so each entry only needs to be compared to the one processed before it
+// with the same canonical URL, if any.
+static bool mergeUrlVariants(QSqlDatabase& database)
+{
+    if (!DatabaseUtils::exec(database, QStringLiteral("CREATE TABLE IF NOT EXISTS history_merge_progress "
+                                                      "(lastRowid INTEGER);"))) {
+        return false;
+    }
+    QSqlQuery query(database);
+    query.setForwardOnly(true);
+    if (!query.exec(QStringLiteral("SELECT lastRowid FROM history_merge_progress;"))) {
+        return false;
+    }
+    qint64 lastRowid = query.next() ? query.value(0).toLongLong() : 0;
+    query.finish();
+
+    QSqlQuery batchQuery(database);
+    batchQuery.setForwardOnly(true);
+    batchQuery.prepare(QStringLiteral("SELECT rowid, url, visits, lastVisit FROM history "
+                                      "WHERE rowid > ? ORDER BY rowid LIMIT ?;"));
+    QSqlQuery mergedQuery(database);
+    mergedQuery.setForwardOnly(true);
+    mergedQuery.prepare(QStringLiteral("SELECT rowid, visits, lastVisit FROM history "
+                                       "WHERE url = ? AND rowid < ?;"));
+    QSqlQuery renameQuery(database);
+    renameQuery.prepare(QStringLiteral("UPDATE history SET url=?, visits=? WHERE rowid=?;"));
+    QSqlQuery visitsQuery(database);
+    visitsQuery.prepare(QStringLiteral("UPDATE history SET visits=? WHERE rowid=?;"));
+    QSqlQuery deleteQuery(database);
+    deleteQuery.prepare(QStringLiteral("DELETE FROM history WHERE rowid=?;"));
+    QSqlQuery progressQuery(database);
+    progressQuery.prepare(QStringLiteral("INSERT OR REPLACE INTO history_merge_progress (rowid, lastRowid) "
+                                         "VALUES (1, ?);"));
+
+    struct Row {
+        qint64 rowid;
+        QString url;
+        int visits;
+        qint64 lastVisit;
+    };
+    while (true) {
+        QList<Row> rows;
+        batchQuery.bindValue(0, lastRowid);
+        batchQuery.bindValue(1, MIGRATION_BATCH_SIZE);
+        if (!batchQuery.exec()) {
+            return false;
+        }
+        while (batchQuery.next()) {
+            Row row;
+            row.rowid = batchQuery.value(0).toLongLong();
+            row.url = batchQuery.value(1).toString();
+            row.visits = batchQuery.value(2).toInt();
+            row.lastVisit = batchQuery.value(3).toLongLong();
+            rows.append(row);
+        }
+        batchQuery.finish();
+        if (rows.isEmpty()) {
+            break;
+        }
+
+        Q_FOREACH(const Row& row, rows) {
+            QString canonical = UrlUtils::canonicalUrl(QUrl(row.url)).toString();
+            mergedQuery.bindValue(0, canonical);
+            mergedQuery.bindValue(1, row.rowid);
+            if (!mergedQuery.exec()) {
+                return false;
+            }
+            bool merged = mergedQuery.next();
+            qint64 otherRowid = merged ? mergedQuery.value(0).toLongLong() : 0;
+            int otherVisits = merged ? mergedQuery.value(1).toInt() : 0;
+            qint64 otherLastVisit = merged ? mergedQuery.value(2).toLongLong() : 0;
+            mergedQuery.finish();
+            if (merged && (otherLastVisit > row.lastVisit)) {
+                // The entry processed before is the most recent one, it is
+                // kept (on ties, the most recent rowid wins)
+                visitsQuery.bindValue(0, otherVisits + row.visits);
+                visitsQuery.bindValue(1, otherRowid);
+                deleteQuery.bindValue(0, row.rowid);
+                if (!visitsQuery.exec() || !deleteQuery.exec()) {
+                    return false;
+                }
+            } else if (merged || (canonical != row.url)) {
+                if (merged) {
+                    deleteQuery.bindValue(0, otherRowid);
+                    if (!deleteQuery.exec()) {
+                        return false;
+                    }
+                }
+                renameQuery.bindValue(0, canonical);
+                renameQuery.bindValue(1, row.visits + otherVisits);
+                renameQuery.bindValue(2, row.rowid);
+                if (!renameQuery.exec()) {
+                    return false;
+                }
+            }
+        }
+
+        lastRowid = rows.last().rowid;
+        progressQuery.bindValue(0, lastRowid);
+        if (!progressQuery.exec()) {
+            return false;
+        }
+        if (rows.count() < MIGRATION_BATCH_SIZE) {
+            // The last batch is committed along with the new schema version
+            break;
+        }
+        if (!database.commit() || !database.transaction()) {
+            return false;
+        }
+    }
+
+    // Hidden URLs are few, they are simply written again
+    QSet<QString> hiddenUrls;
+    if (!query.exec(QStringLiteral("SELECT url FROM history_hidden;"))) {
+        return false;
+    }
+    while (query.next()) {
+        hiddenUrls.insert(UrlUtils::canonicalUrl(QUrl(query.value(0).toString())).toString());
+    }
+    query.finish();
+    if (!DatabaseUtils::exec(database, QStringLiteral("DELETE FROM history_hidden;"))) {
+        return false;
+    }
+    QSqlQuery hiddenQuery(database);
+    hiddenQuery.prepare(QStringLiteral("INSERT INTO history_hidden (url) VALUES (?);"));
+    Q_FOREACH(const QString& url, hiddenUrls) {
+        hiddenQuery.bindValue(0, url);
+        if (!hiddenQuery.exec()) {
+            return false;
+        }
+    }
+    return DatabaseUtils::exec(database, QStringLiteral("DROP TABLE history_merge_progress;"));
+}
+
+// Schema version 6: lastVisit has a precision of one second, entries last
+// visited within the same second are ordered by visitId, a sequence number
+// set on each visit. Entries visited before have none, and come after the
+// ones visited since within the same second.
+static bool addVisitOrder(QSqlDatabase& database)
+{
+    static const char* statements[] = {
+        "ALTER TABLE history ADD COLUMN visitId INTEGER;",
+        "DROP INDEX IF EXISTS history_lastVisit;",
+        "CREATE INDEX history_lastVisit ON history (lastVisit, visitId);",
+        "DROP VIEW history_entries;",
+        "CREATE VIEW history_entries AS SELECT history.rowid AS entryId, history.url AS url, "
+        "history_domains.domain AS domain, history.title AS title, history_icons.icon AS icon, "
+        "history.visits AS visits, history.lastVisit AS lastVisit, history.visitId AS visitId "
+        "FROM history "
+        "LEFT JOIN history_domains ON history_domains.id = history.domainId "
+        "LEFT JOIN history_icons ON history_icons.id = history.iconId;",
+    };
+    for (uint i = 0; i < sizeof(statements) / sizeof(statements[0]); ++i) {
+        if (!DatabaseUtils::exec(database, QString::fromLatin1(statements[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Schema version 7: the full-text index is tokenized in trigrams, so that
+// searches match terms anywhere in the URL or title (e.g. "tube" matches
+// youtube.com) rather than at the start of words. The trigram tokenizer
+// requires SQLite 3.34, searches fall back to pattern matching without it.
+static bool indexTrigrams(QSqlDatabase& database)
+{
+    if (!DatabaseUtils::exec(database, QStringLiteral("DROP TABLE IF EXISTS history_fts;"))) {
+        return false;
+    }
+    QSqlQuery query(database);
+    if (!query.exec(QStringLiteral("CREATE VIRTUAL TABLE history_fts USING fts5"
+                                   "(url, title, domain, content='history_entries', content_rowid='entryId', "
+                                   "tokenize='trigram');"))) {
+        qWarning() << "Full-text search of the history is not available:" << query.lastError().text();
+        // The triggers would fail to update the missing index
+        return DatabaseUtils::exec(database, QStringLiteral("DROP TRIGGER IF EXISTS history_fts_insert;")) &&
+               DatabaseUtils::exec(database, QStringLiteral("DROP TRIGGER IF EXISTS history_fts_delete;")) &&
+               DatabaseUtils::exec(database, QStringLiteral("DROP TRIGGER IF EXISTS history_fts_update;"));
+    }
+    return createFullTextTriggers(database) &&
+           DatabaseUtils::exec(database, QStringLiteral("INSERT INTO history_fts (history_fts) VALUES ('rebuild');"));
+}
+
+// Trigrams can't match terms shorter than three characters
+static const int MIN_TRIGRAM_TERM_LENGTH = 3;
+
+// Turn a user query into a FTS5 query that matches entries containing each
+// of the terms.
+static QString fullTextQuery(const QStringList& terms)
+{
+    QStringList tokens;
+    Q_FOREACH(QString term, terms) {
+        term.replace(QLatin1Char('"'), QStringLiteral("\"\""));
+        tokens.append(QStringLiteral("\"%1\"").arg(term));
+    }
+    return tokens.join(QLatin1Char(' '));
+}
+
 /*!
     \class HistoryModel
     \brief List model that stores information about navigation history.
@@ -41,24 +465,116 @@
     The database is read at startup to populate the model, and whenever a new
     entry is added to the model the database is updated.
     However the model doesn’t monitor the database for external changes.
+    Domains and icons are stored once in the database, in dictionary tables
+    referenced by the entries.
     All database operations are performed on a separate thread in order not to
     block the UI thread.
+
+    URLs are stored in canonical form (without fragment, tracking parameters,
+    default port or trailing slash, see the canonicalizeUrls and
+    trackingParameters properties), so that variants of the same page are
+    counted as visits to a single entry.
+
+    Entries are indexed by URL, so that looking up an existing entry (when
+    adding, updating, hiding or removing it) doesn’t require a linear scan of
+    the whole history. They are stored in a compact form (interned domains
+    and icons, UTF-8 URLs, integer timestamps) in contiguous memory.
+    The local date of the last visit of each entry is cached along with it.
+
+    Entries are fetched from the database in batches, the most recent and the
+    most visited ones first. The loadProgress property reports how much of
+    the history has been loaded so far (from 0 to 1).
+
+    The domain of entries stored by older versions of the browser is computed
+    when they are loaded, and later saved to the database in the background.
+
+    The history can be searched with search(), which returns ranked results
+    from the database (asynchronously, see searchFinished()), without
+    relying on the entries loaded in the model.
+
+    The history of other browsers (Chromium and Firefox profiles) can be
+    imported with importHistory(). Rows are streamed from the other
+    browser’s database in the background, and entries that are not in the
+    history yet are added in large batches.
+
+    The size of the history can be bounded with the maxEntries, maxAge (in
+    days) and maxDatabaseSize (in bytes) properties, 0 meaning no limit.
+    When a limit is exceeded, the oldest and least visited entries are
+    removed, and the space they used in the database is reclaimed.
+
+    When the virtualized property is set, entries are not loaded in memory:
+    the model only knows how many entries there are, and reads pages of
+    entries from the database when they are first accessed, keeping the
+    most recently used ones. Memory usage then doesn’t depend on the size of
+    the history. Pages are read in the background: rows of a page not read
+    yet have no data until dataChanged() is emitted for them. Changes don’t
+    wait for the database either: visited entries are moved or inserted at
+    the top right away, and their rows are corrected once the database is
+    updated, while bulk removals reset the model once it is. The other
+    accessors (get(), getRange(), urlAt(), indexOfUrl()) wait for the
+    database when the entry is not in memory.
+    Entries visited within the same second are sorted by order of visit.
 */
 HistoryModel::HistoryModel(QObject* parent)
     : QAbstractListModel(parent)
+    , m_indexOffset(0)
+    , m_fetchedCount(0)
+    , m_fetchTotal(0)
+    , m_loaded(false)
+    , m_maxEntries(0)
+    , m_maxAge(0)
+    , m_maxDatabaseSize(0)
+    , m_retentionPasses(0)
+    , m_canonicalizeUrls(true)
+    , m_trackingParameters(UrlUtils::DEFAULT_TRACKING_PARAMETERS)
+    , m_lastSearchRequest(0)
+    , m_lastTopEntriesRequest(0)
+    , m_importedCount(0)
+    , m_virtualized(false)
+    , m_virtualCount(0)
+    , m_cacheOffset(0)
+    , m_lastRequest(0)
+    , m_waitForPages(false)
+    , m_unresolvedOperations(0)
+    , m_resetRequest(0)
 {
+    qRegisterMetaType<QList<QUrl> >("QList<QUrl>");
+    qRegisterMetaType<QList<DbWorker::Entry> >("QList<DbWorker::Entry>");
     m_dbWorker = new DbWorker;
     m_dbWorker->moveToThread(&m_dbWorkerThread);
-    connect(m_dbWorker, SIGNAL(hiddenEntryFetched(const QUrl&)),
-            SLOT(onHiddenEntryFetched(const QUrl&)), Qt::QueuedConnection);
-    connect(m_dbWorker,
-            SIGNAL(entryFetched(const QUrl&, const QString&, const QString&,
-                                const QUrl&, int, const QDateTime&)),
-            SLOT(onEntryFetched(const QUrl&, const QString&, const QString&,
-                                const QUrl&, int, const QDateTime&)),
-            Qt::QueuedConnection);
-    connect(m_dbWorker, SIGNAL(loaded()), SIGNAL(loaded()));
+    connect(m_dbWorker, SIGNAL(hiddenEntriesFetched(const QList<QUrl>&)),
+            SLOT(onHiddenEntriesFetched(const QList<QUrl>&)), Qt::QueuedConnection);
+    connect(m_dbWorker, SIGNAL(fetchStarted(int)),
+            SLOT(onFetchStarted(int)), Qt::QueuedConnection);
+    connect(m_dbWorker, SIGNAL(entriesFetched(const QList<DbWorker::Entry>&)),
+            SLOT(onEntriesFetched(const QList<DbWorker::Entry>&)), Qt::QueuedConnection);
+    connect(m_dbWorker, SIGNAL(loaded()), SLOT(onLoaded()), Qt::QueuedConnection);
+    connect(m_dbWorker, SIGNAL(entriesPruned(const QList<DbWorker::Entry>&)),
+            SLOT(onEntriesPruned(const QList<DbWorker::Entry>&)), Qt::QueuedConnection);
+    connect(m_dbWorker, SIGNAL(retentionEnforced()), SLOT(onRetentionEnforced()), Qt::QueuedConnection);
+    connect(m_dbWorker, SIGNAL(flushed(int, int, qint64)), SIGNAL(flushed(int, int, qint64)));
+    connect(m_dbWorker, SIGNAL(searchFinished(int, const QList<DbWorker::Entry>&)),
+            SIGNAL(searchFinished(int, const QList<DbWorker::Entry>&)), Qt::QueuedConnection);
+    connect(m_dbWorker, SIGNAL(topEntriesFetched(int, const QList<DbWorker::Entry>&)),
+            SIGNAL(topEntriesFetched(int, const QList<DbWorker::Entry>&)), Qt::QueuedConnection);
+    connect(m_dbWorker, SIGNAL(entriesImported(const QList<DbWorker::Entry>&)),
+            SLOT(onEntriesImported(const QList<DbWorker::Entry>&)), Qt::QueuedConnection);
+    connect(m_dbWorker, SIGNAL(importFinished(bool, int)),
+            SLOT(onImportFinished(bool, int)), Qt::QueuedConnection);
+    connect(m_dbWorker, SIGNAL(pageFetched(int, int, const QList<DbWorker::Entry>&)),
+            SLOT(onPageFetched(int, int, const QList<DbWorker::Entry>&)), Qt::QueuedConnection);
+    connect(m_dbWorker, SIGNAL(operationApplied(int, int, int)),
+            SLOT(onOperationApplied(int, int, int)), Qt::QueuedConnection);
+    connect(m_dbWorker, SIGNAL(entriesCounted(int, int)),
+            SLOT(onEntriesCounted(int, int)), Qt::QueuedConnection);
     m_dbWorkerThread.start(QThread::LowPriority);
+    clearEntries();
+
+    m_timeZoneId = QTimeZone::systemTimeZoneId();
+    m_timeZoneCheck = new QTimer(this);
+    m_timeZoneCheck->setInterval(TIME_ZONE_CHECK_INTERVAL);
+    connect(m_timeZoneCheck, SIGNAL(timeout()), SLOT(checkTimeZone()));
+    m_timeZoneCheck->start();
 }
 
 HistoryModel::~HistoryModel()
@@ -69,610 +585,2878 @@ HistoryModel::~HistoryModel()
 }
 
 void HistoryModel::resetDatabase(const QString& databaseName)
+{
+    Q_EMIT m_dbWorker->resetDatabase(databaseName);
+    reload();
+}
+
+void HistoryModel::reload()
 {
     beginResetModel();
     m_hiddenEntries.clear();
-    m_entries.clear();
-    Q_EMIT m_dbWorker->resetDatabase(databaseName);
+    clearEntries();
+    clearVirtualRows();
+    m_fetchedCount = 0;
+    m_fetchTotal = 0;
+    m_loaded = false;
+    if (m_virtualized) {
+        QList<QUrl> hiddenUrls;
+        QMetaObject::invokeMethod(m_dbWorker, "doFetchHiddenUrls", Qt::BlockingQueuedConnection,
+                                  Q_RETURN_ARG(QList<QUrl>, hiddenUrls));
+        onHiddenEntriesFetched(hiddenUrls);
+        QMetaObject::invokeMethod(m_dbWorker, "doCountEntries", Qt::BlockingQueuedConnection,
+                                  Q_RETURN_ARG(int, m_virtualCount));
+    }
     endResetModel();
-    Q_EMIT m_dbWorker->fetchEntries();
+    Q_EMIT loadProgressChanged();
+    if (m_virtualized) {
+        Q_EMIT rowCountChanged();
+        Q_EMIT m_dbWorker->startBackfill();
+        QMetaObject::invokeMethod(this, "onLoaded", Qt::QueuedConnection);
+    } else {
+        Q_EMIT m_dbWorker->fetchEntries();
+    }
 }
 
-void HistoryModel::onHiddenEntryFetched(const QUrl& url)
+void HistoryModel::clearEntries()
 {
-    m_hiddenEntries.insert(url);
+    m_entries.clear();
+    rebuildUrlIndex();
+    m_lastLoadedUrl.clear();
+    m_domains.clear();
+    m_domainIds.clear();
+    m_icons.clear();
+    m_iconIds.clear();
+    m_dayStrings.clear();
+    // Index 0 is for entries without a domain or icon
+    internDomain(QString());
+    internIcon(QUrl());
 }
 
-void HistoryModel::onEntryFetched(const QUrl& url, const QString& domain, const QString& title,
-                                  const QUrl& icon, int visits, const QDateTime& lastVisit)
+quint32 HistoryModel::internDomain(const QString& domain)
 {
-    HistoryEntry entry;
-    entry.url = url;
-    if (domain.isEmpty()) {
-        entry.domain = DomainUtils::extractTopLevelDomainName(url);
-    } else {
-        entry.domain = domain;
+    QHash<QString, quint32>::const_iterator it = m_domainIds.constFind(domain);
+    if (it != m_domainIds.constEnd()) {
+        return it.value();
     }
-    entry.title = title;
-    entry.icon = icon;
-    entry.visits = visits;
-    entry.lastVisit = lastVisit;
-    entry.hidden = m_hiddenEntries.contains(url);
-    int index = m_entries.count();
-    beginInsertRows(QModelIndex(), index, index);
-    m_entries.append(entry);
-    endInsertRows();
+    quint32 id = m_domains.count();
+    m_domains.append(domain);
+    m_domainIds.insert(domain, id);
+    return id;
 }
 
-QHash<int, QByteArray> HistoryModel::roleNames() const
+quint32 HistoryModel::internIcon(const QUrl& icon)
 {
-    static QHash<int, QByteArray> roles;
-    if (roles.isEmpty()) {
-        roles[Url] = "url";
-        roles[Domain] = "domain";
-        roles[Title] = "title";
-        roles[Icon] = "icon";
-        roles[Visits] = "visits";
-        roles[LastVisit] = "lastVisit";
-        roles[LastVisitDate] = "lastVisitDate";
-        roles[LastVisitDateString] = "lastVisitDateString";
-        roles[Hidden] = "hidden";
+    QHash<QUrl, quint32>::const_iterator it = m_iconIds.constFind(icon);
+    if (it != m_iconIds.constEnd()) {
+        return it.value();
     }
-    return roles;
+    quint32 id = m_icons.count();
+    m_icons.append(icon);
+    m_iconIds.insert(icon, id);
+    return id;
 }
 
-int HistoryModel::rowCount(const QModelIndex& parent) const
+const QString& HistoryModel::dayString(qint32 day) const
 {
-    Q_UNUSED(parent);
-    return m_entries.count();
+    QHash<qint32, QString>::iterator it = m_dayStrings.find(day);
+    if (it == m_dayStrings.end()) {
+        it = m_dayStrings.insert(day, dayToDate(day).toString(Qt::ISODate));
+    }
+    return it.value();
 }
 
-QVariant HistoryModel::data(const QModelIndex& index, int role) const
+const HistoryModel::HistoryEntry& HistoryModel::entryAt(int row) const
 {
-    if (!index.isValid()) {
-        return QVariant();
-    }
-    const HistoryEntry& entry = m_entries.at(index.row());
-    switch (role) {
-    case Url:
-        return entry.url;
-    case Domain:
-        return entry.domain;
-    case Title:
-        return entry.title;
-    case Icon:
-        return entry.icon;
-    case Visits:
-        return entry.visits;
-    case LastVisit:
-        return entry.lastVisit;
-    case LastVisitDate:
-        return entry.lastVisit.toLocalTime().date();
-    case LastVisitDateString:
-        return entry.lastVisit.toLocalTime().date().toString(Qt::ISODate);
-    case Hidden:
-        return entry.hidden;
-    default:
-        return QVariant();
-    }
+    return m_entries.at(m_entries.count() - 1 - row);
 }
 
-const QString HistoryModel::databasePath() const
+HistoryModel::HistoryEntry& HistoryModel::entryAt(int row)
 {
-    return m_databasePath;
+    return m_entries[m_entries.count() - 1 - row];
 }
 
-void HistoryModel::setDatabasePath(const QString& path)
+void HistoryModel::insertEntries(int row, const QVector<HistoryEntry>& entries)
 {
-    if (path != m_databasePath) {
-        m_databasePath = path;
-        if (path.isEmpty()) {
-            resetDatabase(":memory:");
-        } else {
-            resetDatabase(path);
-        }
-        Q_EMIT databasePathChanged();
+    // Entries are sorted by last visit, most recent first, and inserted
+    // before the given row: store them in reverse order, after the older ones.
+    int position = m_entries.count() - row;
+    m_entries.insert(position, entries.count(), HistoryEntry());
+    for (int i = 0; i < entries.count(); ++i) {
+        m_entries[position + entries.count() - 1 - i] = entries.at(i);
     }
 }
 
-int HistoryModel::getEntryIndex(const QUrl& url) const
+void HistoryModel::onHiddenEntriesFetched(const QList<QUrl>& urls)
 {
-    for (int i = 0; i < m_entries.count(); ++i) {
-        if (m_entries.at(i).url == url) {
-            return i;
-        }
+    Q_FOREACH(const QUrl& url, urls) {
+        m_hiddenEntries.insert(url);
     }
-    return -1;
 }
 
-/*!
-    Add an entry to the model.
-
-    If an entry with the same URL already exists, it is updated.
-    Otherwise a new entry is created and added to the model.
+void HistoryModel::onFetchStarted(int count)
+{
+    if (m_virtualized) {
+        // Switched to virtualized mode while the history was being loaded
+        return;
+    }
+    // The whole history is fetched from the start, including the entries
+    // fetched first
+    m_fetchedCount = 0;
+    m_fetchTotal = count;
+    m_lastLoadedUrl.clear();
+    Q_EMIT loadProgressChanged();
+}
 
-    Return the total number of visits for the URL.
-*/
-int HistoryModel::add(const QUrl& url, const QString& title, const QUrl& icon)
+void HistoryModel::onEntriesFetched(const QList<DbWorker::Entry>& entries)
 {
-    if (url.isEmpty()) {
-        return 0;
+    if (m_virtualized) {
+        return;
     }
-    int count = 1;
-    QDateTime now = QDateTime::currentDateTimeUtc();
-    int index = getEntryIndex(url);
-    if (index == -1) {
-        HistoryEntry entry;
-        entry.url = url;
-        entry.domain = DomainUtils::extractTopLevelDomainName(url);
-        entry.title = title;
-        entry.icon = icon;
-        entry.visits = 1;
-        entry.lastVisit = now;
-        entry.hidden = m_hiddenEntries.contains(entry.url);
-        beginInsertRows(QModelIndex(), 0, 0);
-        m_entries.prepend(entry);
-        endInsertRows();
-        insertNewEntryInDatabase(entry);
-        Q_EMIT rowCountChanged();
-    } else {
-        QVector<int> roles;
-        roles << Visits;
-        if (index == 0) {
-            HistoryEntry& entry = m_entries.first();
-            if (title != entry.title) {
-                entry.title = title;
-                roles << Title;
-            }
-            if (icon != entry.icon) {
-                entry.icon = icon;
-                roles << Icon;
+    insertLoadedEntries(entries);
+    m_fetchedCount += entries.count();
+    Q_EMIT rowCountChanged();
+    Q_EMIT loadProgressChanged();
+}
+
+void HistoryModel::insertFetchedEntries(const QList<DbWorker::Entry>& entries)
+{
+    // Fetched entries are sorted by last visit (most recent first), but they
+    // may need to be interleaved with entries that were fetched (or added)
+    // before. Insert them in as few contiguous runs as possible.
+    int i = 0;
+    while (i < entries.count()) {
+        int row = insertionRow(entries.at(i).lastVisit.toMSecsSinceEpoch());
+        int end = entries.count();
+        if (row < m_entries.count()) {
+            qint64 next = entryAt(row).lastVisit;
+            end = i + 1;
+            while ((end < entries.count()) && (entries.at(end).lastVisit.toMSecsSinceEpoch() > next)) {
+                ++end;
             }
-            count = ++entry.visits;
-            if (now != entry.lastVisit) {
-                if (now.date() != entry.lastVisit.date()) {
-                    roles << LastVisitDate;
-                    roles << LastVisitDateString;
-                }
-                entry.lastVisit = now;
-                roles << LastVisit;
+        }
+
+        QVector<HistoryEntry> run;
+        run.reserve(end - i);
+        QSet<QByteArray> runUrls;
+        for (int j = i; j < end; ++j) {
+            HistoryEntry entry = fetchedEntry(entries.at(j));
+            if (m_urlIndex.contains(entry.url) || runUrls.contains(entry.url)) {
+                // The entry was added while the history was being loaded
+                continue;
             }
-        } else {
-            beginMoveRows(QModelIndex(), index, index, QModelIndex(), 0);
-            HistoryEntry entry = m_entries.takeAt(index);
-            if (title != entry.title) {
-                entry.title = title;
-                roles << Title;
+            runUrls.insert(entry.url);
+            run.append(entry);
+        }
+
+        if (!run.isEmpty()) {
+            beginInsertRows(QModelIndex(), row, row + run.count() - 1);
+            insertEntries(row, run);
+            indexInsertedEntries(row, run.count());
+            endInsertRows();
+        }
+        i = end;
+    }
+}
+
+/*
+    Insert a batch of the history being loaded, read in the order of the
+    rows. Entries already in the model (fetched first, or added while the
+    history was being loaded) are skipped, and the others are inserted after
+    the last entry of the history read before them, so that entries visited
+    within the same second keep the order of the database.
+*/
+void HistoryModel::insertLoadedEntries(const QList<DbWorker::Entry>& entries)
+{
+    int i = 0;
+    while (i < entries.count()) {
+        int previous = m_lastLoadedUrl.isEmpty() ? -1 : getEntryIndex(m_lastLoadedUrl);
+        HistoryEntry first = fetchedEntry(entries.at(i));
+        int index = getEntryIndex(first.url);
+        if (index != -1) {
+            if (index > previous) {
+                m_lastLoadedUrl = first.url;
             }
-            if (icon != entry.icon) {
-                entry.icon = icon;
-                roles << Icon;
+            ++i;
+            continue;
+        }
+
+        // Entries more recent than the ones read so far were added to the
+        // model, and entries visited within the same second that are not
+        // read yet come after
+        int row = qMax(previous + 1, insertionRow(first.lastVisit, true));
+        qint64 next = (row < m_entries.count()) ? entryAt(row).lastVisit : std::numeric_limits<qint64>::min();
+        QVector<HistoryEntry> run;
+        QSet<QByteArray> runUrls;
+        run.append(first);
+        runUrls.insert(first.url);
+        int end = i + 1;
+        while (end < entries.count()) {
+            HistoryEntry entry = fetchedEntry(entries.at(end));
+            if ((entry.lastVisit < next) || m_urlIndex.contains(entry.url)) {
+                break;
             }
-            count = ++entry.visits;
-            if (now != entry.lastVisit) {
-                if (now.date() != entry.lastVisit.date()) {
-                    roles << LastVisitDate;
-                    roles << LastVisitDateString;
-                }
-                entry.lastVisit = now;
-                roles << LastVisit;
+            if (!runUrls.contains(entry.url)) {
+                runUrls.insert(entry.url);
+                run.append(entry);
             }
-            m_entries.prepend(entry);
-            endMoveRows();
+            ++end;
         }
-        Q_EMIT dataChanged(this->index(0, 0), this->index(0, 0), roles);
-        updateExistingEntryInDatabase(m_entries.first());
+
+        beginInsertRows(QModelIndex(), row, row + run.count() - 1);
+        insertEntries(row, run);
+        indexInsertedEntries(row, run.count());
+        endInsertRows();
+        m_lastLoadedUrl = run.last().url;
+        i = end;
     }
-    return count;
 }
 
-/*!
-    Update an existing entry in the model.
+HistoryModel::HistoryEntry HistoryModel::fetchedEntry(const DbWorker::Entry& fetched)
+{
+    HistoryEntry entry;
+    entry.url = fetched.url.toString().toUtf8();
+    if (fetched.domain.isEmpty()) {
+        // Not backfilled yet
+        entry.domain = internDomain(DomainUtils::extractTopLevelDomainName(fetched.url));
+    } else {
+        entry.domain = internDomain(fetched.domain);
+    }
+    entry.title = fetched.title;
+    entry.icon = internIcon(fetched.icon);
+    entry.visits = fetched.visits;
+    setLastVisit(entry, fetched.lastVisit.toMSecsSinceEpoch());
+    entry.hidden = m_hiddenEntries.contains(fetched.url);
+    return entry;
+}
 
-    If no entry with the same URL exists yet, do nothing (and return false).
-    Otherwise the title and icon of the existing entry are updated (the number
-    of visits remains unchanged).
+void HistoryModel::onEntriesImported(const QList<DbWorker::Entry>& entries)
+{
+    if (m_virtualized) {
+        reloadVirtualRows();
+    } else {
+        int count = m_entries.count();
+        insertFetchedEntries(entries);
+        if (m_entries.count() != count) {
+            Q_EMIT rowCountChanged();
+        }
+    }
+    m_importedCount += entries.count();
+    Q_EMIT importProgress(m_importedCount);
+}
 
-    Return true if an update actually happened, false otherwise.
-*/
-bool HistoryModel::update(const QUrl& url, const QString& title, const QUrl& icon)
+void HistoryModel::onImportFinished(bool success, int count)
 {
-    if (url.isEmpty()) {
-        return false;
+    m_importedCount = 0;
+    enforceRetention();
+    Q_EMIT importFinished(success, count);
+}
+
+void HistoryModel::onPageFetched(int requestId, int offset, const QList<DbWorker::Entry>& entries)
+{
+    int page = offset / VIRTUAL_PAGE_SIZE;
+    if (!m_virtualized || (m_pageRequests.value(page) != requestId)) {
+        // The rows were counted again since the page was requested
+        return;
     }
-    int index = getEntryIndex(url);
-    if (index == -1) {
-        return false;
+    m_pageRequests.remove(page);
+    int first = m_virtualCount;
+    int last = -1;
+    for (int i = 0; i < entries.count(); ++i) {
+        // Rows visited or removed since the page was requested are in
+        // memory already, the others may have moved
+        int row = mappedRow(offset + i, requestId);
+        if ((row == -1) || (row >= m_virtualCount) || cachedEntry(row)) {
+            continue;
+        }
+        DbWorker::Entry entry = entries.at(i);
+        if (entry.domain.isEmpty()) {
+            // Not backfilled yet
+            entry.domain = DomainUtils::extractTopLevelDomainName(entry.url);
+        }
+        cacheEntry(row, entry);
+        first = qMin(first, row);
+        last = qMax(last, row);
+    }
+    if (m_pageRequests.isEmpty()) {
+        m_rowChanges.clear();
+    }
+    if (last >= first) {
+        trimCache(first);
+        Q_EMIT dataChanged(this->index(first, 0), this->index(last, 0));
+    }
+}
+
+void HistoryModel::onOperationApplied(int requestId, int row, int visits)
+{
+    QHash<int, VirtualOperation>::iterator it = m_virtualOperations.find(requestId);
+    if (it == m_virtualOperations.end()) {
+        // Sent before the rows were counted again
+        return;
+    }
+    VirtualOperation operation = it.value();
+    m_virtualOperations.erase(it);
+    if (!operation.exact) {
+        --m_unresolvedOperations;
+    }
+
+    if (!operation.applied) {
+        // The rows before the operation are the rows of the model
+        if (row >= m_virtualCount) {
+            // Out of sync with the database (written by another process)
+            reloadVirtualRows();
+        } else if (operation.type == DbWorker::RemoveEntryByUrl) {
+            if (row != -1) {
+                removeVirtualRow(row, requestId);
+            }
+        } else {
+            operation.entry.visits = visits;
+            if (row == -1) {
+                insertVirtualRow(operation.entry, requestId);
+            } else {
+                moveVirtualRow(row, operation.entry, requestId);
+            }
+        }
+        return;
+    }
+    if (row != operation.row) {
+        if ((operation.type == DbWorker::VisitEntry) && (operation.row == -1) &&
+            !operation.exact && (row + 1 < m_virtualCount)) {
+            // The entry was not in memory, its previous row is after the one
+            // inserted for it (no rows changed since)
+            removeVirtualRow(row + 1, requestId);
+        } else {
+            // The rows are out of sync with the database
+            reloadVirtualRows();
+            return;
+        }
+    }
+    if (operation.type == DbWorker::VisitEntry) {
+        // The number of visits is only known once the database is updated
+        int current = cachedRow(operation.entry.url);
+        if ((current != -1) && (cachedEntry(current)->visits != visits)) {
+            DbWorker::Entry entry = *cachedEntry(current);
+            entry.visits = visits;
+            cacheEntry(current, entry);
+            Q_EMIT dataChanged(this->index(current, 0), this->index(current, 0), QVector<int>() << Visits);
+        }
+    }
+}
+
+void HistoryModel::onEntriesCounted(int requestId, int count)
+{
+    if (!m_virtualized || (requestId != m_resetRequest)) {
+        return;
+    }
+    m_resetRequest = 0;
+    beginResetModel();
+    clearCache();
+    m_virtualCount = count;
+    endResetModel();
+    Q_EMIT rowCountChanged();
+}
+
+void HistoryModel::checkTimeZone()
+{
+    QByteArray timeZoneId = QTimeZone::systemTimeZoneId();
+    if (timeZoneId == m_timeZoneId) {
+        return;
+    }
+    m_timeZoneId = timeZoneId;
+    for (int i = 0; i < m_entries.count(); ++i) {
+        HistoryEntry& entry = m_entries[i];
+        entry.lastVisitDay = localDay(entry.lastVisit);
+    }
+    int count = rowCount();
+    if (count > 0) {
+        QVector<int> roles;
+        roles << LastVisitDate << LastVisitDateString;
+        Q_EMIT dataChanged(index(0, 0), index(count - 1, 0), roles);
+    }
+}
+
+void HistoryModel::onLoaded()
+{
+    m_loaded = true;
+    Q_EMIT loadProgressChanged();
+    Q_EMIT loaded();
+    enforceRetention();
+}
+
+void HistoryModel::enforceRetention()
+{
+    if (m_loaded && ((m_maxEntries > 0) || (m_maxAge > 0) || (m_maxDatabaseSize > 0))) {
+        ++m_retentionPasses;
+        Q_EMIT m_dbWorker->enforceRetention(m_maxEntries, m_maxAge, m_maxDatabaseSize);
+    }
+}
+
+void HistoryModel::enforceRetentionIfGrown()
+{
+    // Entries may be added in batches, past the exact threshold. Entries
+    // added while a pass is running are accounted for by that pass.
+    if ((m_maxEntries > 0) && (rowCount() >= m_maxEntries + RETENTION_MARGIN) && (m_retentionPasses == 0)) {
+        enforceRetention();
+    }
+}
+
+void HistoryModel::onRetentionEnforced()
+{
+    --m_retentionPasses;
+}
+
+void HistoryModel::onEntriesPruned(const QList<DbWorker::Entry>& entries)
+{
+    if (m_virtualized) {
+        reloadVirtualRows();
+        return;
+    }
+    QList<int> rows;
+    Q_FOREACH(const DbWorker::Entry& pruned, entries) {
+        int index = getEntryIndex(pruned.url);
+        if (index == -1) {
+            continue;
+        }
+        const HistoryEntry& entry = entryAt(index);
+        if ((entry.lastVisit / 1000) > pruned.lastVisit.toTime_t()) {
+            // Visited again while being pruned, store it back
+            insertNewEntryInDatabase(entry);
+        } else {
+            rows.append(index);
+        }
+    }
+    if (!rows.isEmpty()) {
+        removeRowRanges(rows);
+        Q_EMIT rowCountChanged();
+    }
+}
+
+int HistoryModel::insertionRow(qint64 lastVisit, bool beforeSameVisit) const
+{
+    // Entries are sorted by last visit, most recent first: return the first
+    // row whose last visit is older than the given timestamp (or as old if
+    // beforeSameVisit is true).
+    int low = 0;
+    int high = m_entries.count();
+    while (low < high) {
+        int middle = (low + high) / 2;
+        qint64 visit = entryAt(middle).lastVisit;
+        if ((visit < lastVisit) || (beforeSameVisit && (visit == lastVisit))) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+    return low;
+}
+
+QHash<int, QByteArray> HistoryModel::roleNames() const
+{
+    static QHash<int, QByteArray> roles;
+    if (roles.isEmpty()) {
+        roles[Url] = "url";
+        roles[Domain] = "domain";
+        roles[Title] = "title";
+        roles[Icon] = "icon";
+        roles[Visits] = "visits";
+        roles[LastVisit] = "lastVisit";
+        roles[LastVisitDate] = "lastVisitDate";
+        roles[LastVisitDateString] = "lastVisitDateString";
+        roles[Hidden] = "hidden";
+    }
+    return roles;
+}
+
+int HistoryModel::rowCount(const QModelIndex& parent) const
+{
+    Q_UNUSED(parent);
+    return m_virtualized ? m_virtualCount : m_entries.count();
+}
+
+QVariant HistoryModel::data(const QModelIndex& index, int role) const
+{
+    if (!index.isValid()) {
+        return QVariant();
+    }
+    if (m_virtualized) {
+        return virtualData(index.row(), role);
+    }
+    const HistoryEntry& entry = entryAt(index.row());
+    switch (role) {
+    case Url:
+        return QUrl(QString::fromUtf8(entry.url));
+    case Domain:
+        return m_domains.at(entry.domain);
+    case Title:
+        return entry.title;
+    case Icon:
+        return m_icons.at(entry.icon);
+    case Visits:
+        return entry.visits;
+    case LastVisit:
+        return QDateTime::fromMSecsSinceEpoch(entry.lastVisit, Qt::UTC);
+    case LastVisitDate:
+        return dayToDate(entry.lastVisitDay);
+    case LastVisitDateString:
+        return dayString(entry.lastVisitDay);
+    case Hidden:
+        return entry.hidden;
+    default:
+        return QVariant();
+    }
+}
+
+const QString HistoryModel::databasePath() const
+{
+    return m_databasePath;
+}
+
+qreal HistoryModel::loadProgress() const
+{
+    if (m_loaded) {
+        return 1.0;
+    }
+    if (m_fetchTotal <= 0) {
+        return 0.0;
+    }
+    return qMin(qreal(1.0), qreal(m_fetchedCount) / m_fetchTotal);
+}
+
+int HistoryModel::maxEntries() const
+{
+    return m_maxEntries;
+}
+
+void HistoryModel::setMaxEntries(int maxEntries)
+{
+    if (maxEntries != m_maxEntries) {
+        m_maxEntries = maxEntries;
+        Q_EMIT maxEntriesChanged();
+        enforceRetention();
+    }
+}
+
+int HistoryModel::maxAge() const
+{
+    return m_maxAge;
+}
+
+void HistoryModel::setMaxAge(int maxAge)
+{
+    if (maxAge != m_maxAge) {
+        m_maxAge = maxAge;
+        Q_EMIT maxAgeChanged();
+        enforceRetention();
+    }
+}
+
+qint64 HistoryModel::maxDatabaseSize() const
+{
+    return m_maxDatabaseSize;
+}
+
+void HistoryModel::setMaxDatabaseSize(qint64 maxDatabaseSize)
+{
+    if (maxDatabaseSize != m_maxDatabaseSize) {
+        m_maxDatabaseSize = maxDatabaseSize;
+        Q_EMIT maxDatabaseSizeChanged();
+        enforceRetention();
+    }
+}
+
+bool HistoryModel::virtualized() const
+{
+    return m_virtualized;
+}
+
+/*!
+    Switch between loading all the entries in memory and reading them from
+    the database on demand.
+    The model is reset and the entries are loaded again.
+*/
+void HistoryModel::setVirtualized(bool virtualized)
+{
+    if (virtualized != m_virtualized) {
+        m_virtualized = virtualized;
+        Q_EMIT virtualizedChanged();
+        if (!m_databasePath.isEmpty()) {
+            reload();
+        }
+    }
+}
+
+bool HistoryModel::canonicalizeUrls() const
+{
+    return m_canonicalizeUrls;
+}
+
+/*!
+    Whether URLs are stored in canonical form (see UrlUtils::canonicalUrl()),
+    so that visits to variants of the same page are counted as visits to
+    a single entry. This is the default.
+    Entries already in the history are left untouched when this changes.
+*/
+void HistoryModel::setCanonicalizeUrls(bool canonicalize)
+{
+    if (canonicalize != m_canonicalizeUrls) {
+        m_canonicalizeUrls = canonicalize;
+        Q_EMIT canonicalizeUrlsChanged();
+    }
+}
+
+const QStringList& HistoryModel::trackingParameters() const
+{
+    return m_trackingParameters;
+}
+
+/*!
+    Set the query parameters removed from URLs when they are canonicalized.
+    A trailing '*' matches any parameter with that prefix, e.g. "utm_*".
+*/
+void HistoryModel::setTrackingParameters(const QStringList& parameters)
+{
+    if (parameters != m_trackingParameters) {
+        m_trackingParameters = parameters;
+        Q_EMIT trackingParametersChanged();
+    }
+}
+
+/*!
+    Return the URL under which the history stores the given one (see
+    canonicalizeUrls), e.g. to key data attached to history entries.
+*/
+QUrl HistoryModel::canonicalUrl(const QUrl& url) const
+{
+    return m_canonicalizeUrls ? UrlUtils::canonicalUrl(url, m_trackingParameters) : url;
+}
+
+void HistoryModel::setDatabasePath(const QString& path)
+{
+    if (path != m_databasePath) {
+        m_databasePath = path;
+        if (path.isEmpty()) {
+            resetDatabase(":memory:");
+        } else {
+            resetDatabase(path);
+        }
+        Q_EMIT databasePathChanged();
+    }
+}
+
+int HistoryModel::getEntryIndex(const QUrl& url) const
+{
+    return getEntryIndex(url.toString().toUtf8());
+}
+
+int HistoryModel::getEntryIndex(const QByteArray& url) const
+{
+    QHash<QByteArray, int>::const_iterator it = m_urlIndex.constFind(url);
+    if (it == m_urlIndex.constEnd()) {
+        return -1;
+    }
+    return it.value() - m_indexOffset;
+}
+
+void HistoryModel::indexPrependedEntry()
+{
+    // All existing rows are shifted down by one
+    --m_indexOffset;
+    m_urlIndex.insert(entryAt(0).url, m_indexOffset);
+}
+
+void HistoryModel::indexInsertedEntries(int first, int count)
+{
+    // Must be called after the entries were inserted in the list.
+    // Rows after the inserted ones move down: update whichever side of the
+    // list is shorter.
+    int total = m_entries.count();
+    if (first < (total - first - count)) {
+        m_indexOffset -= count;
+        for (int i = 0; i < first; ++i) {
+            m_urlIndex[entryAt(i).url] -= count;
+        }
+    } else {
+        for (int i = first + count; i < total; ++i) {
+            m_urlIndex[entryAt(i).url] += count;
+        }
+    }
+    for (int i = first; i < first + count; ++i) {
+        m_urlIndex.insert(entryAt(i).url, i + m_indexOffset);
+    }
+}
+
+void HistoryModel::unindexEntry(int index)
+{
+    // Must be called before the entry is actually removed from the list.
+    // Rows after the removed one move up by one: update whichever side of the
+    // list is shorter.
+    int count = m_entries.count();
+    m_urlIndex.remove(entryAt(index).url);
+    if (index < count / 2) {
+        ++m_indexOffset;
+        for (int i = 0; i < index; ++i) {
+            ++m_urlIndex[entryAt(i).url];
+        }
+    } else {
+        for (int i = index + 1; i < count; ++i) {
+            --m_urlIndex[entryAt(i).url];
+        }
+    }
+}
+
+void HistoryModel::reindexEntryMovedToFront(int index)
+{
+    // Must be called before the entry is actually moved in the list.
+    // Rows before the moved one move down by one: update whichever side of
+    // the list is shorter.
+    int count = m_entries.count();
+    if (index < count / 2) {
+        for (int i = 0; i < index; ++i) {
+            ++m_urlIndex[entryAt(i).url];
+        }
+    } else {
+        --m_indexOffset;
+        for (int i = index + 1; i < count; ++i) {
+            --m_urlIndex[entryAt(i).url];
+        }
+    }
+    m_urlIndex.insert(entryAt(index).url, m_indexOffset);
+}
+
+void HistoryModel::rebuildUrlIndex()
+{
+    m_urlIndex.clear();
+    m_urlIndex.reserve(m_entries.count());
+    m_indexOffset = 0;
+    for (int i = m_entries.count() - 1; i >= 0; --i) {
+        // Iterate backwards so that the first occurrence of a URL wins
+        m_urlIndex.insert(entryAt(i).url, i);
+    }
+}
+
+/*!
+    Add an entry to the model.
+
+    If an entry with the same canonical URL already exists, it is updated.
+    Otherwise a new entry is created and added to the model.
+
+    Return the total number of visits for the URL. In virtualized mode, that
+    is 1 if the entry is not in memory (the number of visits is updated when
+    the database is).
+*/
+int HistoryModel::add(const QUrl& pageUrl, const QString& title, const QUrl& icon)
+{
+    if (pageUrl.isEmpty()) {
+        return 0;
+    }
+    QUrl url = canonicalUrl(pageUrl);
+    if (m_virtualized) {
+        return addVirtualEntry(url, title, icon);
+    }
+    int count = 1;
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    int index = getEntryIndex(url);
+    if (index == -1) {
+        HistoryEntry entry;
+        entry.url = url.toString().toUtf8();
+        entry.domain = internDomain(DomainUtils::extractTopLevelDomainName(url));
+        entry.title = title;
+        entry.icon = internIcon(icon);
+        entry.visits = 1;
+        setLastVisit(entry, now);
+        entry.hidden = m_hiddenEntries.contains(url);
+        beginInsertRows(QModelIndex(), 0, 0);
+        m_entries.append(entry);
+        indexPrependedEntry();
+        endInsertRows();
+        insertNewEntryInDatabase(entry);
+        Q_EMIT rowCountChanged();
+        enforceRetentionIfGrown();
+    } else {
+        if (index > 0) {
+            // Only the entries more recent than the one moved are shifted
+            beginMoveRows(QModelIndex(), index, index, QModelIndex(), 0);
+            reindexEntryMovedToFront(index);
+            int position = m_entries.count() - 1 - index;
+            std::rotate(m_entries.begin() + position, m_entries.begin() + position + 1, m_entries.end());
+            endMoveRows();
+        }
+        HistoryEntry& entry = entryAt(0);
+        QVector<int> roles;
+        roles << Visits;
+        if (title != entry.title) {
+            entry.title = title;
+            roles << Title;
+        }
+        quint32 iconId = internIcon(icon);
+        if (iconId != entry.icon) {
+            entry.icon = iconId;
+            roles << Icon;
+        }
+        count = ++entry.visits;
+        if (now != entry.lastVisit) {
+            qint32 day = entry.lastVisitDay;
+            setLastVisit(entry, now);
+            if (entry.lastVisitDay != day) {
+                roles << LastVisitDate;
+                roles << LastVisitDateString;
+            }
+            roles << LastVisit;
+        }
+        Q_EMIT dataChanged(this->index(0, 0), this->index(0, 0), roles);
+        updateExistingEntryInDatabase(entry);
+    }
+    return count;
+}
+
+/*!
+    Update an existing entry in the model.
+
+    If no entry with the same URL exists yet, do nothing (and return false).
+    Otherwise the title and icon of the existing entry are updated (the number
+    of visits remains unchanged).
+
+    Return true if an update actually happened, false otherwise. In
+    virtualized mode, entries not in memory are updated in the background,
+    and false is returned.
+*/
+bool HistoryModel::update(const QUrl& pageUrl, const QString& title, const QUrl& icon)
+{
+    if (pageUrl.isEmpty()) {
+        return false;
+    }
+    QUrl url = canonicalUrl(pageUrl);
+    if (m_virtualized) {
+        return updateVirtualEntry(url, title, icon);
+    }
+    int index = getEntryIndex(url);
+    if (index == -1) {
+        return false;
+    }
+    QVector<int> roles;
+    HistoryEntry& entry = entryAt(index);
+    if (title != entry.title) {
+        entry.title = title;
+        roles << Title;
+    }
+    quint32 iconId = internIcon(icon);
+    if (iconId != entry.icon) {
+        entry.icon = iconId;
+        roles << Icon;
+    }
+    if (roles.isEmpty()) {
+        return false;
+    }
+    Q_EMIT dataChanged(this->index(index, 0), this->index(index, 0), roles);
+    updateExistingEntryInDatabase(entry);
+    return true;
+}
+
+/*!
+    Remove a given URL from the history model.
+
+    If the URL was not previously visited, do nothing.
+*/
+void HistoryModel::removeEntryByUrl(const QUrl& pageUrl)
+{
+    if (pageUrl.isEmpty()) {
+        return;
+    }
+    QUrl url = canonicalUrl(pageUrl);
+
+    if (m_virtualized) {
+        removeVirtualEntry(url);
+    } else {
+        removeByIndex(getEntryIndex(url));
+        removeEntryFromDatabaseByUrl(url);
+    }
+    Q_EMIT rowCountChanged();
+}
+
+/*!
+    Remove all urls last visited in a given DATE from the history model.
+*/
+void HistoryModel::removeEntriesByDate(const QDate& date)
+{
+    if (!date.isValid()) {
+        return;
+    }
+
+    if (m_virtualized) {
+        removeEntriesFromDatabaseByDate(date);
+        reloadVirtualRows();
+        return;
+    }
+
+    qint32 day = date.toJulianDay();
+    QList<int> rows;
+    for (int i = 0; i < m_entries.count(); ++i) {
+        if (entryAt(i).lastVisitDay == day) {
+            rows.append(i);
+        }
+    }
+    removeRowRanges(rows);
+    removeEntriesFromDatabaseByDate(date);
+    Q_EMIT rowCountChanged();
+}
+
+/*!
+    Remove all urls from a given DOMAIN from the history model.
+*/
+void HistoryModel::removeEntriesByDomain(const QString& domain)
+{
+    if (domain.isEmpty()) {
+        return;
+    }
+
+    if (m_virtualized) {
+        removeEntriesFromDatabaseByDomain(domain);
+        reloadVirtualRows();
+        return;
+    }
+
+    QList<int> rows;
+    if (m_domainIds.contains(domain)) {
+        quint32 domainId = m_domainIds.value(domain);
+        for (int i = 0; i < m_entries.count(); ++i) {
+            if (entryAt(i).domain == domainId) {
+                rows.append(i);
+            }
+        }
+    }
+    removeRowRanges(rows);
+    removeEntriesFromDatabaseByDomain(domain);
+    Q_EMIT rowCountChanged();
+}
+
+void HistoryModel::removeByIndex(int index)
+{
+    if (index >= 0) {
+        beginRemoveRows(QModelIndex(), index, index);
+        unindexEntry(index);
+        m_entries.remove(m_entries.count() - 1 - index);
+        endRemoveRows();
+    }
+}
+
+void HistoryModel::removeRowRanges(QList<int> rows)
+{
+    if (rows.isEmpty()) {
+        return;
+    }
+    // Remove contiguous rows at once, starting from the end of the list so
+    // that the rows yet to be removed are not shifted.
+    std::sort(rows.begin(), rows.end());
+    int i = rows.count() - 1;
+    while (i >= 0) {
+        int last = rows.at(i);
+        int first = last;
+        while ((i > 0) && (rows.at(i - 1) == first - 1)) {
+            --first;
+            --i;
+        }
+        beginRemoveRows(QModelIndex(), first, last);
+        m_entries.remove(m_entries.count() - 1 - last, last - first + 1);
+        endRemoveRows();
+        --i;
+    }
+    rebuildUrlIndex();
+}
+
+void HistoryModel::insertNewEntryInDatabase(const HistoryEntry& entry)
+{
+    DbWorker::QueuedOperation operation;
+    operation.type = DbWorker::InsertNewEntry;
+    operation.url = QString::fromUtf8(entry.url);
+    operation.domain = m_domains.at(entry.domain);
+    operation.title = entry.title;
+    operation.icon = m_icons.at(entry.icon).toString();
+    operation.visits = entry.visits;
+    operation.lastVisit = uint(entry.lastVisit / 1000);
+    m_dbWorker->enqueue(operation);
+}
+
+void HistoryModel::insertNewEntryInHiddenDatabase(const QUrl& url)
+{
+    DbWorker::QueuedOperation operation;
+    operation.type = DbWorker::InsertNewHiddenEntry;
+    operation.url = url.toString();
+    m_dbWorker->enqueue(operation);
+}
+
+void HistoryModel::updateExistingEntryInDatabase(const HistoryEntry& entry)
+{
+    DbWorker::QueuedOperation operation;
+    operation.type = DbWorker::UpdateExistingEntry;
+    operation.url = QString::fromUtf8(entry.url);
+    operation.domain = m_domains.at(entry.domain);
+    operation.title = entry.title;
+    operation.icon = m_icons.at(entry.icon).toString();
+    operation.visits = entry.visits;
+    operation.lastVisit = uint(entry.lastVisit / 1000);
+    m_dbWorker->enqueue(operation);
+}
+
+void HistoryModel::removeEntryFromDatabaseByUrl(const QUrl& url)
+{
+    DbWorker::QueuedOperation operation;
+    operation.type = DbWorker::RemoveEntryByUrl;
+    operation.url = url.toString();
+    m_dbWorker->enqueue(operation);
+}
+
+void HistoryModel::removeEntryFromHiddenDatabaseByUrl(const QUrl& url)
+{
+    DbWorker::QueuedOperation operation;
+    operation.type = DbWorker::RemoveHiddenEntryByUrl;
+    operation.url = url.toString();
+    m_dbWorker->enqueue(operation);
+}
+
+void HistoryModel::removeEntriesFromDatabaseByDate(const QDate& date)
+{
+    DbWorker::QueuedOperation operation;
+    operation.type = DbWorker::RemoveEntriesByDate;
+    QDateTime dateTime = QDateTime(date);
+    operation.lastVisit = dateTime.toTime_t();
+    dateTime.setTime(QTime(23, 59, 59, 999));
+    operation.lastVisitEnd = dateTime.toTime_t();
+    m_dbWorker->enqueue(operation);
+}
+
+void HistoryModel::removeEntriesFromDatabaseByDomain(const QString& domain)
+{
+    DbWorker::QueuedOperation operation;
+    operation.type = DbWorker::RemoveEntriesByDomain;
+    operation.domain = domain;
+    m_dbWorker->enqueue(operation);
+}
+
+void HistoryModel::clearAll()
+{
+    if (rowCount() > 0) {
+        beginResetModel();
+        m_hiddenEntries.clear();
+        clearEntries();
+        clearVirtualRows();
+        endResetModel();
+        clearDatabase();
+        Q_EMIT rowCountChanged();
+    }
+}
+
+void HistoryModel::clearDatabase()
+{
+    DbWorker::QueuedOperation operation;
+    operation.type = DbWorker::Clear;
+    m_dbWorker->enqueue(operation);
+    operation.type = DbWorker::ClearHidden;
+    m_dbWorker->enqueue(operation);
+}
+
+/*!
+    Mark an entry in the model as hidden.
+
+    Add a new entry to the hidden list.
+    If an entry with the URL exists, it is updated, and entryHiddenChanged()
+    is emitted in any case (in virtualized mode, dataChanged() is only
+    emitted for entries in memory).
+*/
+void HistoryModel::hide(const QUrl& pageUrl)
+{
+    QUrl url = canonicalUrl(pageUrl);
+    if (url.isEmpty() || m_hiddenEntries.contains(url)) {
+        return;
+    }
+
+    m_hiddenEntries.insert(url);
+
+    // In virtualized mode, entries not in memory are updated when read
+    int index = m_virtualized ? cachedRow(url) : getEntryIndex(url);
+    if (index != -1) {
+        if (!m_virtualized) {
+            entryAt(index).hidden = true;
+        }
+        Q_EMIT dataChanged(this->index(index, 0), this->index(index, 0), QVector<int>() << Hidden);
+    }
+
+    insertNewEntryInHiddenDatabase(url);
+    Q_EMIT entryHiddenChanged(url, true);
+}
+
+/*!
+    Mark an entry in the model as not hidden.
+
+    If an entry with the URL exists on the hidden entries, it is removed.
+    If an entry with the URL exists, it is updated, and entryHiddenChanged()
+    is emitted in any case.
+*/
+void HistoryModel::unHide(const QUrl& pageUrl)
+{
+    QUrl url = canonicalUrl(pageUrl);
+    if (url.isEmpty() || !m_hiddenEntries.contains(url)) {
+        return;
+    }
+
+    m_hiddenEntries.remove(url);
+
+    int index = m_virtualized ? cachedRow(url) : getEntryIndex(url);
+    if (index != -1) {
+        if (!m_virtualized) {
+            entryAt(index).hidden = false;
+        }
+        Q_EMIT dataChanged(this->index(index, 0), this->index(index, 0), QVector<int>() << Hidden);
+    }
+
+    removeEntryFromHiddenDatabaseByUrl(url);
+    Q_EMIT entryHiddenChanged(url, false);
+}
+
+/*!
+    Return the given roles (all of them if none is specified) of the entry
+    at the given index, as a map of role names to values.
+*/
+QVariantMap HistoryModel::get(int i, const QStringList& roles) const
+{
+    // In virtualized mode, return the entry rather than no data if its page
+    // was not read yet
+    m_waitForPages = true;
+    QVariantMap entry = ModelUtils::get(this, i, roles);
+    m_waitForPages = false;
+    return entry;
+}
+
+/*!
+    Return the given roles (all of them if none is specified) of up to count
+    entries starting at the given index, as a list of maps.
+*/
+QVariantList HistoryModel::getRange(int from, int count, const QStringList& roles) const
+{
+    m_waitForPages = true;
+    QVariantList entries = ModelUtils::getRange(this, from, count, roles);
+    m_waitForPages = false;
+    return entries;
+}
+
+QUrl HistoryModel::urlAt(int index) const
+{
+    if ((index < 0) || (index >= rowCount())) {
+        return QUrl();
+    }
+    if (m_virtualized) {
+        const DbWorker::Entry* entry = virtualEntryAt(index);
+        return entry ? entry->url : QUrl();
+    }
+    return QUrl(QString::fromUtf8(entryAt(index).url));
+}
+
+/*!
+    Return the index of the entry for the given URL, or -1 if there is none.
+*/
+int HistoryModel::indexOfUrl(const QUrl& pageUrl) const
+{
+    QUrl url = canonicalUrl(pageUrl);
+    if (!m_virtualized) {
+        return getEntryIndex(url);
+    }
+    int row = cachedRow(url);
+    if (row == -1) {
+        // The rows must reflect the database before it is looked up
+        waitForVirtualOperations();
+        row = findVirtualRow(url);
+    }
+    return row;
+}
+
+/*!
+    Search the history for entries whose URL or title contain each of the
+    whitespace-separated terms of the query (case insensitive), most recent
+    first.
+
+    Results are paged (offset, limit) and returned asynchronously through
+    the searchFinished() signal, along with the request identifier returned
+    by this function.
+*/
+int HistoryModel::search(const QString& query, int offset, int limit)
+{
+    int requestId = ++m_lastSearchRequest;
+    Q_EMIT m_dbWorker->search(requestId, query, offset, limit);
+    return requestId;
+}
+
+/*!
+    Read from the database the (at most) limit entries that are not hidden
+    and have the highest frecency (see TopSitesModel::frecency()), most
+    frecent first, without loading the history in memory.
+
+    Entries are returned asynchronously through the topEntriesFetched()
+    signal, along with the request identifier returned by this function.
+*/
+int HistoryModel::fetchTopEntries(int limit)
+{
+    int requestId = ++m_lastTopEntriesRequest;
+    Q_EMIT m_dbWorker->fetchTopEntries(requestId, limit);
+    return requestId;
+}
+
+/*!
+    Import the history of another browser, from a Chromium ‘History’ or a
+    Firefox ‘places.sqlite’ database file.
+
+    URLs already in the history are left untouched. Non-web URLs, pages
+    hidden in the other browser and URLs hidden in this one (see hide())
+    are skipped.
+    importProgress() is emitted as entries are added to the model, and
+    importFinished() once done.
+*/
+void HistoryModel::importHistory(const QString& path)
+{
+    Q_EMIT m_dbWorker->importHistory(path, m_canonicalizeUrls, m_trackingParameters);
+}
+
+/*
+    Return the entry at a given row in virtualized mode, reading the page
+    that contains it from the database if it is not in memory, or nullptr
+    if there is no such entry. The pointer is only valid until the rows
+    change or another page is read.
+*/
+const DbWorker::Entry* HistoryModel::virtualEntryAt(int row) const
+{
+    const DbWorker::Entry* entry = cachedEntry(row);
+    if (entry) {
+        return entry;
+    }
+    // The rows must reflect the database before it is read
+    waitForVirtualOperations();
+    if (row >= m_virtualCount) {
+        return nullptr;
+    }
+    int page = row / VIRTUAL_PAGE_SIZE;
+    QList<DbWorker::Entry> fetched;
+    QMetaObject::invokeMethod(m_dbWorker, "doFetchPage", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(QList<DbWorker::Entry>, fetched),
+                              Q_ARG(int, page * VIRTUAL_PAGE_SIZE), Q_ARG(int, VIRTUAL_PAGE_SIZE));
+    for (int i = 0; i < fetched.count(); ++i) {
+        int fetchedRow = page * VIRTUAL_PAGE_SIZE + i;
+        if ((fetchedRow < m_virtualCount) && !cachedEntry(fetchedRow)) {
+            DbWorker::Entry entry = fetched.at(i);
+            if (entry.domain.isEmpty()) {
+                // Not backfilled yet
+                entry.domain = DomainUtils::extractTopLevelDomainName(entry.url);
+            }
+            cacheEntry(fetchedRow, entry);
+        }
+    }
+    trimCache(row);
+    return cachedEntry(row);
+}
+
+/*
+    Return the entry at a given row in virtualized mode if it is in memory.
+    Otherwise, request the page that contains it from the database in the
+    background and return nullptr, dataChanged() is emitted for the rows of
+    the page once it is read.
+*/
+const DbWorker::Entry* HistoryModel::cachedVirtualEntryAt(int row) const
+{
+    const DbWorker::Entry* entry = cachedEntry(row);
+    if (!entry) {
+        int page = row / VIRTUAL_PAGE_SIZE;
+        if (!m_pageRequests.contains(page)) {
+            int requestId = ++m_lastRequest;
+            m_pageRequests.insert(page, requestId);
+            Q_EMIT m_dbWorker->fetchPage(requestId, page * VIRTUAL_PAGE_SIZE, VIRTUAL_PAGE_SIZE);
+        }
+    }
+    return entry;
+}
+
+const DbWorker::Entry* HistoryModel::cachedEntry(int row) const
+{
+    QMap<int, DbWorker::Entry>::const_iterator it = m_cachedEntries.constFind(row + m_cacheOffset);
+    return (it != m_cachedEntries.constEnd()) ? &it.value() : nullptr;
+}
+
+int HistoryModel::cachedRow(const QUrl& url) const
+{
+    QHash<QUrl, int>::const_iterator it = m_cachedUrls.constFind(url);
+    return (it != m_cachedUrls.constEnd()) ? it.value() - m_cacheOffset : -1;
+}
+
+void HistoryModel::cacheEntry(int row, const DbWorker::Entry& entry) const
+{
+    int key = row + m_cacheOffset;
+    QMap<int, DbWorker::Entry>::iterator it = m_cachedEntries.find(key);
+    if (it != m_cachedEntries.end()) {
+        if ((it.value().url != entry.url) && (m_cachedUrls.value(it.value().url, -1) == key)) {
+            m_cachedUrls.remove(it.value().url);
+        }
+        it.value() = entry;
+    } else {
+        m_cachedEntries.insert(key, entry);
+    }
+    // A URL has two rows until the database tells which one is out of date,
+    // the most recent one is looked up
+    QHash<QUrl, int>::iterator url = m_cachedUrls.find(entry.url);
+    if ((url == m_cachedUrls.end()) || (url.value() > key)) {
+        m_cachedUrls.insert(entry.url, key);
+    }
+}
+
+void HistoryModel::uncacheRow(int row) const
+{
+    int key = row + m_cacheOffset;
+    QMap<int, DbWorker::Entry>::iterator it = m_cachedEntries.find(key);
+    if (it != m_cachedEntries.end()) {
+        QHash<QUrl, int>::iterator url = m_cachedUrls.find(it.value().url);
+        if ((url != m_cachedUrls.end()) && (url.value() == key)) {
+            m_cachedUrls.erase(url);
+        }
+        m_cachedEntries.erase(it);
+    }
+}
+
+/*
+    Shift the cached rows from first to last (to the last row if last is -1)
+    by delta rows. The rows they are shifted to must not be cached, except
+    the ones shifted themselves.
+*/
+void HistoryModel::shiftCachedRows(int first, int last, int delta) const
+{
+    if ((first == 0) && (last == -1)) {
+        m_cacheOffset -= delta;
+        return;
+    }
+    QList<QPair<int, DbWorker::Entry> > shifted;
+    QMap<int, DbWorker::Entry>::iterator it = m_cachedEntries.lowerBound(first + m_cacheOffset);
+    while ((it != m_cachedEntries.end()) && ((last == -1) || (it.key() <= last + m_cacheOffset))) {
+        shifted.append(qMakePair(it.key(), it.value()));
+        it = m_cachedEntries.erase(it);
+    }
+    // Shift the rows in the direction they move, so that the keys of the
+    // URLs are not shifted twice
+    for (int i = 0; i < shifted.count(); ++i) {
+        const QPair<int, DbWorker::Entry>& cached = shifted.at((delta > 0) ? shifted.count() - 1 - i : i);
+        int key = cached.first + delta;
+        m_cachedEntries.insert(key, cached.second);
+        QHash<QUrl, int>::iterator url = m_cachedUrls.find(cached.second.url);
+        if ((url != m_cachedUrls.end()) && (url.value() == cached.first)) {
+            url.value() = key;
+        }
+    }
+}
+
+/*
+    Drop the cached entries farthest from a given row, so that no more than
+    VIRTUAL_CACHE_SIZE are kept.
+*/
+void HistoryModel::trimCache(int row) const
+{
+    int key = row + m_cacheOffset;
+    while (m_cachedEntries.count() > VIRTUAL_CACHE_SIZE) {
+        bool first = (key - m_cachedEntries.firstKey()) > (m_cachedEntries.lastKey() - key);
+        uncacheRow((first ? m_cachedEntries.firstKey() : m_cachedEntries.lastKey()) - m_cacheOffset);
+    }
+}
+
+void HistoryModel::clearCache()
+{
+    m_cachedEntries.clear();
+    m_cachedUrls.clear();
+    m_cacheOffset = 0;
+    // Pages being read would be out of date
+    m_pageRequests.clear();
+    m_rowChanges.clear();
+}
+
+bool HistoryModel::allRowsCached() const
+{
+    return m_cachedEntries.count() >= m_virtualCount;
+}
+
+QVariant HistoryModel::virtualData(int row, int role) const
+{
+    const DbWorker::Entry* entry = m_waitForPages ? virtualEntryAt(row) : cachedVirtualEntryAt(row);
+    if (!entry) {
+        return QVariant();
+    }
+    switch (role) {
+    case Url:
+        return entry->url;
+    case Domain:
+        return entry->domain;
+    case Title:
+        return entry->title;
+    case Icon:
+        return entry->icon;
+    case Visits:
+        return entry->visits;
+    case LastVisit:
+        return entry->lastVisit.toUTC();
+    case LastVisitDate:
+        return entry->lastVisit.toLocalTime().date();
+    case LastVisitDateString:
+        return dayString(localDay(entry->lastVisit.toMSecsSinceEpoch()));
+    case Hidden:
+        return m_hiddenEntries.contains(entry->url);
+    default:
+        return QVariant();
+    }
+}
+
+int HistoryModel::findVirtualRow(const QUrl& url) const
+{
+    int row = -1;
+    QMetaObject::invokeMethod(m_dbWorker, "doFindRow", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(int, row), Q_ARG(QString, url.toString()));
+    return row;
+}
+
+/*
+    Whether some rows of the model in virtualized mode are not known to
+    match the database until the result of an operation is received.
+    Changes of the rows are then made in the order the database is updated.
+*/
+bool HistoryModel::virtualRowsUnresolved() const
+{
+    return (m_unresolvedOperations > 0) || (m_resetRequest != 0);
+}
+
+void HistoryModel::waitForVirtualOperations() const
+{
+    while (virtualRowsUnresolved()) {
+        QMetaObject::invokeMethod(m_dbWorker, "doFlush", Qt::BlockingQueuedConnection);
+        // Receive the results sent meanwhile
+        QCoreApplication::sendPostedEvents(const_cast<HistoryModel*>(this), QEvent::MetaCall);
+    }
+}
+
+/*
+    Visit an entry in virtualized mode, without waiting for the database. An
+    entry in memory is moved to the top right away, the database does the
+    same. Otherwise it is inserted at the top, and its previous row, if any,
+    is removed once the database tells where it was. While that is pending,
+    other visits are applied as their results are received.
+*/
+int HistoryModel::addVirtualEntry(const QUrl& url, const QString& title, const QUrl& icon)
+{
+    DbWorker::Entry entry;
+    entry.url = url;
+    entry.domain = DomainUtils::extractTopLevelDomainName(url);
+    entry.title = title;
+    entry.icon = icon;
+    entry.visits = 1;
+    entry.lastVisit = QDateTime::fromTime_t(QDateTime::currentDateTimeUtc().toTime_t());
+
+    VirtualOperation operation;
+    operation.type = DbWorker::VisitEntry;
+    operation.row = -1;
+    operation.applied = !virtualRowsUnresolved();
+    operation.exact = false;
+    if (operation.applied) {
+        operation.row = cachedRow(url);
+        operation.exact = (operation.row != -1) || allRowsCached();
+        if (operation.row != -1) {
+            entry.visits = cachedEntry(operation.row)->visits + 1;
+        }
+    }
+    operation.entry = entry;
+    int requestId = ++m_lastRequest;
+    m_virtualOperations.insert(requestId, operation);
+    if (!operation.exact) {
+        ++m_unresolvedOperations;
+    }
+    storeVirtualEntry(DbWorker::VisitEntry, entry, requestId);
+
+    if (operation.applied) {
+        if (operation.row == -1) {
+            insertVirtualRow(entry, requestId);
+        } else {
+            moveVirtualRow(operation.row, entry, requestId);
+        }
+    }
+    return entry.visits;
+}
+
+bool HistoryModel::updateVirtualEntry(const QUrl& url, const QString& title, const QUrl& icon)
+{
+    // Visits not applied to the rows yet insert or move the entry with the
+    // latest title and icon
+    for (QHash<int, VirtualOperation>::iterator it = m_virtualOperations.begin();
+         it != m_virtualOperations.end(); ++it) {
+        if (!it.value().applied && (it.value().entry.url == url)) {
+            it.value().entry.title = title;
+            it.value().entry.icon = icon;
+        }
+    }
+
+    int row = cachedRow(url);
+    DbWorker::Entry entry;
+    if (row == -1) {
+        // Updated in the database if it has an entry for the URL
+        entry.url = url;
+        entry.title = title;
+        entry.icon = icon;
+        entry.visits = 0;
+        storeVirtualEntry(DbWorker::UpdateEntryAttributes, entry);
+        return false;
     }
+    entry = *cachedEntry(row);
     QVector<int> roles;
-    const HistoryEntry& entry = m_entries.at(index);
     if (title != entry.title) {
-        m_entries[index].title = title;
+        entry.title = title;
         roles << Title;
     }
     if (icon != entry.icon) {
-        m_entries[index].icon = icon;
+        entry.icon = icon;
         roles << Icon;
     }
-    if (roles.isEmpty()) {
-        return false;
+    if (roles.isEmpty()) {
+        return false;
+    }
+    cacheEntry(row, entry);
+    storeVirtualEntry(DbWorker::UpdateEntryAttributes, entry);
+    Q_EMIT dataChanged(this->index(row, 0), this->index(row, 0), roles);
+    return true;
+}
+
+void HistoryModel::removeVirtualEntry(const QUrl& url)
+{
+    VirtualOperation operation;
+    operation.type = DbWorker::RemoveEntryByUrl;
+    operation.entry.url = url;
+    operation.entry.visits = 0;
+    operation.row = -1;
+    operation.applied = false;
+    if (!virtualRowsUnresolved()) {
+        // If the entry is not in memory while all rows are, there is none
+        operation.row = cachedRow(url);
+        operation.applied = (operation.row != -1) || allRowsCached();
+    }
+    operation.exact = operation.applied;
+    int requestId = ++m_lastRequest;
+    m_virtualOperations.insert(requestId, operation);
+    if (!operation.exact) {
+        ++m_unresolvedOperations;
+    }
+    storeVirtualEntry(DbWorker::RemoveEntryByUrl, operation.entry, requestId);
+
+    if (operation.row != -1) {
+        removeVirtualRow(operation.row, requestId);
+    }
+}
+
+void HistoryModel::storeVirtualEntry(DbWorker::Operation type, const DbWorker::Entry& entry, int requestId)
+{
+    DbWorker::QueuedOperation operation;
+    operation.type = type;
+    operation.url = entry.url.toString();
+    operation.domain = entry.domain;
+    operation.title = entry.title;
+    operation.icon = entry.icon.toString();
+    operation.visits = entry.visits;
+    operation.lastVisit = entry.lastVisit.toTime_t();
+    operation.requestId = requestId;
+    m_dbWorker->enqueue(operation);
+}
+
+void HistoryModel::insertVirtualRow(const DbWorker::Entry& entry, int origin)
+{
+    beginInsertRows(QModelIndex(), 0, 0);
+    shiftCachedRows(0, -1, 1);
+    cacheEntry(0, entry);
+    trimCache(0);
+    ++m_virtualCount;
+    logRowChange(origin, RowInserted, 0);
+    endInsertRows();
+    Q_EMIT rowCountChanged();
+    enforceRetentionIfGrown();
+}
+
+void HistoryModel::moveVirtualRow(int row, const DbWorker::Entry& entry, int origin)
+{
+    if (row > 0) {
+        beginMoveRows(QModelIndex(), row, row, QModelIndex(), 0);
+        uncacheRow(row);
+        shiftCachedRows(0, row - 1, 1);
+        cacheEntry(0, entry);
+        logRowChange(origin, RowMoved, row);
+        endMoveRows();
+    } else {
+        cacheEntry(0, entry);
+    }
+    Q_EMIT dataChanged(this->index(0, 0), this->index(0, 0));
+}
+
+void HistoryModel::removeVirtualRow(int row, int origin)
+{
+    beginRemoveRows(QModelIndex(), row, row);
+    uncacheRow(row);
+    shiftCachedRows(row + 1, -1, -1);
+    --m_virtualCount;
+    logRowChange(origin, RowRemoved, row);
+    endRemoveRows();
+    Q_EMIT rowCountChanged();
+}
+
+void HistoryModel::logRowChange(int origin, RowChangeType type, int row)
+{
+    // Only needed to place the entries of the pages being read
+    if (!m_pageRequests.isEmpty()) {
+        RowChange change;
+        change.origin = origin;
+        change.type = type;
+        change.row = row;
+        m_rowChanges.append(change);
+    }
+}
+
+/*
+    Return the row an entry of a page is at now, given its row when the page
+    was read, or -1 if it was moved or removed since (its data in the page
+    is out of date then). Only the changes made by operations sent after the
+    page was requested apply: the database reflected the others.
+*/
+int HistoryModel::mappedRow(int row, int requestId) const
+{
+    Q_FOREACH(const RowChange& change, m_rowChanges) {
+        if (change.origin < requestId) {
+            continue;
+        }
+        switch (change.type) {
+        case RowInserted:
+            if (row >= change.row) {
+                ++row;
+            }
+            break;
+        case RowMoved:
+            if (row == change.row) {
+                return -1;
+            } else if (row < change.row) {
+                ++row;
+            }
+            break;
+        case RowRemoved:
+            if (row == change.row) {
+                return -1;
+            } else if (row > change.row) {
+                --row;
+            }
+            break;
+        }
+    }
+    return row;
+}
+
+void HistoryModel::clearVirtualRows()
+{
+    clearCache();
+    // Results of the operations sent before are not needed anymore
+    m_virtualOperations.clear();
+    m_unresolvedOperations = 0;
+    m_resetRequest = 0;
+    m_virtualCount = 0;
+}
+
+/*
+    Count the rows again once the database is up to date, and reset the
+    model then (see onEntriesCounted()). Results of the operations sent
+    before are not needed anymore.
+*/
+void HistoryModel::reloadVirtualRows()
+{
+    m_virtualOperations.clear();
+    m_unresolvedOperations = 0;
+    m_resetRequest = ++m_lastRequest;
+    Q_EMIT m_dbWorker->countEntries(m_resetRequest);
+}
+
+DbWorker::DbWorker()
+    : QObject()
+    , m_queue(QUEUE_CAPACITY)
+    , m_drainPending(0)
+    , m_overflowing(0)
+    , m_enqueuedCount(0)
+    , m_resultsPending(false)
+    , m_flush(nullptr)
+    , m_backfill(nullptr)
+    , m_fullTextSearch(false)
+    , m_lastVisitId(0)
+    , m_fetch(0)
+    , m_fetchLastVisit(0)
+    , m_fetchVisitId(0)
+    , m_fetchEntryId(0)
+    , m_importQuery(nullptr)
+    , m_importCanonicalize(false)
+    , m_importedCount(0)
+{
+    // Ensure all database operations are performed on the same thread
+    connect(this, SIGNAL(resetDatabase(const QString&)),
+            SLOT(doResetDatabase(const QString&)), Qt::QueuedConnection);
+    connect(this, SIGNAL(fetchEntries()),
+            SLOT(doFetchEntries()), Qt::QueuedConnection);
+    connect(this, SIGNAL(enforceRetention(int, int, qint64)),
+            SLOT(doEnforceRetention(int, int, qint64)), Qt::QueuedConnection);
+    connect(this, SIGNAL(search(int, const QString&, int, int)),
+            SLOT(doSearch(int, const QString&, int, int)), Qt::QueuedConnection);
+    connect(this, SIGNAL(fetchTopEntries(int, int)),
+            SLOT(doFetchTopEntries(int, int)), Qt::QueuedConnection);
+    connect(this, SIGNAL(fetchPage(int, int, int)),
+            SLOT(doRequestPage(int, int, int)), Qt::QueuedConnection);
+    connect(this, SIGNAL(countEntries(int)),
+            SLOT(doRequestCount(int)), Qt::QueuedConnection);
+    connect(this, SIGNAL(importHistory(const QString&, bool, const QStringList&)),
+            SLOT(doImportHistory(const QString&, bool, const QStringList&)), Qt::QueuedConnection);
+    connect(this, SIGNAL(startBackfill()),
+            SLOT(doStartBackfill()), Qt::QueuedConnection);
+}
+
+DbWorker::~DbWorker()
+{
+    stopTimers();
+    if (m_importQuery) {
+        closeImport();
+    }
+    doFlush();
+    closeDatabase();
+    m_database = QSqlDatabase();
+    QSqlDatabase::removeDatabase(CONNECTION_NAME);
+}
+
+void DbWorker::closeDatabase()
+{
+    // Prepared statements must be released before the connection is closed
+    m_queries.clear();
+    m_dictionaryIds[Domains].clear();
+    m_dictionaryIds[Icons].clear();
+    if (m_database.isOpen()) {
+        m_database.close();
+    }
+}
+
+void DbWorker::stopTimers()
+{
+    if (m_flush) {
+        m_flush->stop();
+        delete m_flush;
+        m_flush = nullptr;
+    }
+    if (m_backfill) {
+        m_backfill->stop();
+        delete m_backfill;
+        m_backfill = nullptr;
+    }
+}
+
+void DbWorker::doResetDatabase(const QString& databaseName)
+{
+    stopTimers();
+    // Batches of the history being loaded, if any, are not fetched anymore
+    ++m_fetch;
+    if (m_importQuery) {
+        // The rest of the import would go to the new database
+        finishImport(false);
+    }
+    doFlush();
+    closeDatabase();
+    if (!m_database.isValid()) {
+         m_database = QSqlDatabase::addDatabase(SQL_DRIVER, CONNECTION_NAME);
+    }
+    DatabaseUtils::openDatabase(m_database, databaseName);
+    doCreateOrAlterDatabaseSchema();
+}
+
+void DbWorker::doCreateOrAlterDatabaseSchema()
+{
+    static const QList<DatabaseUtils::Migration> migrations =
+        QList<DatabaseUtils::Migration>() << createSchema << addIndexes << addFullTextIndex
+                                          << normalizeSchema << mergeUrlVariants << addVisitOrder
+                                          << indexTrigrams;
+    DatabaseUtils::migrateSchema(m_database, migrations);
+
+    QSqlQuery query(m_database);
+    query.exec(QStringLiteral("SELECT name FROM sqlite_master WHERE type='table' AND name='history_fts';"));
+    m_fullTextSearch = query.next();
+    query.exec(QStringLiteral("SELECT MAX(visitId) FROM history;"));
+    m_lastVisitId = query.next() ? query.value(0).toLongLong() : 0;
+}
+
+void DbWorker::doFetchEntries()
+{
+    Q_EMIT hiddenEntriesFetched(doFetchHiddenUrls());
+
+    // Fetch the entries needed by the new tab page first
+    QSqlQuery priorityQuery(m_database);
+    QString query = QStringLiteral("SELECT url, domain, title, icon, visits, lastVisit FROM history_entries "
+                                   "WHERE entryId IN (SELECT rowid FROM history "
+                                   "ORDER BY lastVisit DESC, visitId DESC, rowid DESC LIMIT ?) "
+                                   "OR entryId IN (SELECT rowid FROM history ORDER BY visits DESC LIMIT ?) "
+                                   "ORDER BY lastVisit DESC, visitId DESC, entryId DESC;");
+    priorityQuery.setForwardOnly(true);
+    priorityQuery.prepare(query);
+    priorityQuery.addBindValue(PRIORITY_RECENT_ENTRIES);
+    priorityQuery.addBindValue(PRIORITY_TOP_ENTRIES);
+    priorityQuery.exec();
+    QSet<QString> fetched;
+    QList<Entry> entries = fetchEntryBatch(priorityQuery, fetched, -1);
+    if (!entries.isEmpty()) {
+        Q_EMIT entriesFetched(entries);
+    }
+
+    // Then fetch the whole history in batches, each one in a separate call
+    // so that operations enqueued meanwhile are not held until the end of
+    // the load. Entries fetched first are fetched again, they tell the model
+    // where the entries visited within the same second go.
+    QSqlQuery countQuery(m_database);
+    query = QStringLiteral("SELECT COUNT(*) FROM history;");
+    countQuery.prepare(query);
+    countQuery.exec();
+    Q_EMIT fetchStarted(countQuery.next() ? countQuery.value(0).toInt() : 0);
+    m_fetchLastVisit = std::numeric_limits<qint64>::max();
+    m_fetchVisitId = 0;
+    m_fetchEntryId = 0;
+    QMetaObject::invokeMethod(this, "doFetchBatch", Qt::QueuedConnection, Q_ARG(int, ++m_fetch));
+}
+
+/*
+    Fetch the next batch of the history being loaded, in the order of the
+    rows of the model, starting after the last entry fetched (keyset
+    pagination, the entries before are not read again).
+*/
+void DbWorker::doFetchBatch(int fetch)
+{
+    if (fetch != m_fetch) {
+        // The database was reset
+        return;
+    }
+    QSqlQuery batchQuery(m_database);
+    batchQuery.setForwardOnly(true);
+    batchQuery.prepare(QStringLiteral("SELECT url, domain, title, icon, visits, lastVisit, IFNULL(visitId, 0), entryId "
+                                      "FROM history_entries WHERE lastVisit <= ? AND (lastVisit < ? OR "
+                                      "(lastVisit = ? AND (IFNULL(visitId, 0) < ? OR "
+                                      "(IFNULL(visitId, 0) = ? AND entryId < ?)))) "
+                                      "ORDER BY lastVisit DESC, visitId DESC, entryId DESC LIMIT ?;"));
+    batchQuery.addBindValue(m_fetchLastVisit);
+    batchQuery.addBindValue(m_fetchLastVisit);
+    batchQuery.addBindValue(m_fetchLastVisit);
+    batchQuery.addBindValue(m_fetchVisitId);
+    batchQuery.addBindValue(m_fetchVisitId);
+    batchQuery.addBindValue(m_fetchEntryId);
+    batchQuery.addBindValue(FETCH_BATCH_SIZE);
+    batchQuery.exec();
+    QList<Entry> entries;
+    while (batchQuery.next()) {
+        entries.append(readEntry(batchQuery));
+        m_fetchLastVisit = batchQuery.value(5).toLongLong();
+        m_fetchVisitId = batchQuery.value(6).toLongLong();
+        m_fetchEntryId = batchQuery.value(7).toLongLong();
+    }
+    if (!entries.isEmpty()) {
+        Q_EMIT entriesFetched(entries);
+    }
+    if (entries.count() == FETCH_BATCH_SIZE) {
+        QMetaObject::invokeMethod(this, "doFetchBatch", Qt::QueuedConnection, Q_ARG(int, fetch));
+        return;
+    }
+    Q_EMIT loaded();
+
+    doStartBackfill();
+}
+
+QList<QUrl> DbWorker::doFetchHiddenUrls()
+{
+    QList<QUrl> hiddenUrls;
+    QSqlQuery populateHiddenQuery(m_database);
+    QString query = QStringLiteral("SELECT url FROM history_hidden;");
+    populateHiddenQuery.prepare(query);
+    populateHiddenQuery.exec();
+    while (populateHiddenQuery.next()) {
+        hiddenUrls.append(populateHiddenQuery.value(0).toUrl());
+    }
+    return hiddenUrls;
+}
+
+int DbWorker::doCountEntries()
+{
+    // The database must reflect the model before entries are counted
+    doFlush();
+    return countEntries();
+}
+
+void DbWorker::doRequestCount(int requestId)
+{
+    Q_EMIT entriesCounted(requestId, doCountEntries());
+}
+
+/*
+    Read a page of entries, in the order of the rows of the model in
+    virtualized mode: most recent first, then in reverse order of visit (see
+    addVisitOrder()) and of insertion.
+*/
+QList<DbWorker::Entry> DbWorker::doFetchPage(int offset, int limit)
+{
+    doFlush();
+    QList<Entry> entries;
+    QSqlQuery pageQuery(m_database);
+    pageQuery.setForwardOnly(true);
+    pageQuery.prepare(QStringLiteral("SELECT url, domain, title, icon, visits, lastVisit FROM history_entries "
+                                     "ORDER BY lastVisit DESC, visitId DESC, entryId DESC LIMIT ? OFFSET ?;"));
+    pageQuery.addBindValue(limit);
+    pageQuery.addBindValue(offset);
+    pageQuery.exec();
+    while (pageQuery.next()) {
+        entries.append(readEntry(pageQuery));
+    }
+    return entries;
+}
+
+void DbWorker::doRequestPage(int requestId, int offset, int limit)
+{
+    Q_EMIT pageFetched(requestId, offset, doFetchPage(offset, limit));
+}
+
+int DbWorker::doFindRow(const QString& url)
+{
+    doFlush();
+    return findRow(url);
+}
+
+/*
+    Return the row of the entry for a given URL in virtualized mode (see
+    doFetchPage()), or -1 if there is none, and its number of visits.
+*/
+int DbWorker::findRow(const QString& url, int* visits)
+{
+    QSqlQuery entryQuery(m_database);
+    entryQuery.prepare(QStringLiteral("SELECT lastVisit, IFNULL(visitId, 0), rowid, visits FROM history WHERE url=? "
+                                      "ORDER BY lastVisit DESC, visitId DESC, rowid DESC LIMIT 1;"));
+    entryQuery.addBindValue(url);
+    entryQuery.exec();
+    if (!entryQuery.next()) {
+        return -1;
+    }
+    QVariant lastVisit = entryQuery.value(0);
+    QVariant visitId = entryQuery.value(1);
+    QVariant rowid = entryQuery.value(2);
+    if (visits) {
+        *visits = entryQuery.value(3).toInt();
+    }
+    entryQuery.finish();
+
+    QSqlQuery rowQuery(m_database);
+    rowQuery.prepare(QStringLiteral("SELECT COUNT(*) FROM history WHERE "
+                                    "lastVisit > ? OR (lastVisit = ? AND (IFNULL(visitId, 0) > ? OR "
+                                    "(IFNULL(visitId, 0) = ? AND rowid > ?)));"));
+    rowQuery.addBindValue(lastVisit);
+    rowQuery.addBindValue(lastVisit);
+    rowQuery.addBindValue(visitId);
+    rowQuery.addBindValue(visitId);
+    rowQuery.addBindValue(rowid);
+    rowQuery.exec();
+    return rowQuery.next() ? rowQuery.value(0).toInt() : -1;
+}
+
+void DbWorker::doStartBackfill()
+{
+    if (!m_backfill) {
+        m_backfill = new QTimer;
+        m_backfill->setInterval(BACKFILL_INTERVAL);
+        m_backfill->setSingleShot(true);
+        connect(m_backfill, SIGNAL(timeout()), SLOT(doBackfillDomains()));
+    }
+    m_backfill->start();
+}
+
+void DbWorker::doBackfillDomains()
+{
+    if (m_flush && m_flush->isActive()) {
+        // Let pending operations be flushed first
+        m_backfill->start();
+        return;
+    }
+
+    QList<QPair<qint64, QString> > rows;
+    QSqlQuery selectQuery(m_database);
+    QString query = QStringLiteral("SELECT rowid, url FROM history WHERE domainId IS NULL LIMIT ?;");
+    selectQuery.prepare(query);
+    selectQuery.addBindValue(BACKFILL_BATCH_SIZE);
+    selectQuery.exec();
+    while (selectQuery.next()) {
+        rows.append(qMakePair(selectQuery.value(0).toLongLong(), selectQuery.value(1).toString()));
+    }
+    selectQuery.finish();
+    if (rows.isEmpty()) {
+        return;
+    }
+
+    m_database.transaction();
+    QSqlQuery updateQuery(m_database);
+    query = QStringLiteral("UPDATE history SET domainId=? WHERE rowid=?;");
+    updateQuery.prepare(query);
+    for (int i = 0; i < rows.count(); ++i) {
+        QString domain = DomainUtils::extractTopLevelDomainName(QUrl(rows.at(i).second));
+        updateQuery.bindValue(0, dictionaryId(Domains, domain, true));
+        updateQuery.bindValue(1, rows.at(i).first);
+        updateQuery.exec();
+    }
+    m_database.commit();
+
+    if (rows.count() == BACKFILL_BATCH_SIZE) {
+        m_backfill->start();
+    }
+}
+
+void DbWorker::doEnforceRetention(int maxEntries, int maxAge, qint64 maxDatabaseSize)
+{
+    // The database must reflect the model before entries are selected
+    doFlush();
+
+    QString query;
+    int pruned = 0;
+    if (maxAge > 0) {
+        QSqlQuery ageQuery(m_database);
+        query = QStringLiteral("SELECT url, lastVisit FROM history WHERE lastVisit < ? LIMIT ?;");
+        ageQuery.prepare(query);
+        ageQuery.bindValue(0, QDateTime::currentDateTimeUtc().addDays(-maxAge).toTime_t());
+        ageQuery.bindValue(1, PRUNE_BATCH_SIZE);
+        int count;
+        do {
+            count = pruneEntries(ageQuery);
+            pruned += count;
+        } while (count == PRUNE_BATCH_SIZE);
+    }
+
+    QSqlQuery leastValuableQuery(m_database);
+    query = QStringLiteral("SELECT url, lastVisit FROM history "
+                           "ORDER BY lastVisit + visits * ? ASC LIMIT ?;");
+    leastValuableQuery.prepare(query);
+    leastValuableQuery.bindValue(0, PRUNE_VISIT_WEIGHT);
+    if (maxEntries > 0) {
+        int excess = countEntries() - maxEntries;
+        while (excess > 0) {
+            leastValuableQuery.bindValue(1, qMin(excess, PRUNE_BATCH_SIZE));
+            int count = pruneEntries(leastValuableQuery);
+            if (count == 0) {
+                break;
+            }
+            pruned += count;
+            excess -= count;
+        }
+    }
+    if (maxDatabaseSize > 0) {
+        // Pages freed by deleted rows are not in use anymore, even before
+        // they are reclaimed.
+        leastValuableQuery.bindValue(1, PRUNE_BATCH_SIZE);
+        while (databaseSize() > maxDatabaseSize) {
+            int count = pruneEntries(leastValuableQuery);
+            if (count == 0) {
+                break;
+            }
+            pruned += count;
+        }
+    }
+
+    if (pruned > 0) {
+        removeUnusedDictionaryEntries();
+        reclaimFreePages();
+    }
+    Q_EMIT retentionEnforced();
+}
+
+int DbWorker::countEntries()
+{
+    QSqlQuery query(m_database);
+    query.exec(QStringLiteral("SELECT COUNT(*) FROM history;"));
+    return query.next() ? query.value(0).toInt() : 0;
+}
+
+qint64 DbWorker::databaseSize()
+{
+    qint64 values[3] = {0, 0, 0};
+    static const char* pragmas[3] = {"page_count", "freelist_count", "page_size"};
+    for (int i = 0; i < 3; ++i) {
+        QSqlQuery query(m_database);
+        query.exec(QStringLiteral("PRAGMA %1;").arg(QLatin1String(pragmas[i])));
+        if (query.next()) {
+            values[i] = query.value(0).toLongLong();
+        }
+    }
+    return (values[0] - values[1]) * values[2];
+}
+
+int DbWorker::pruneEntries(QSqlQuery& selection)
+{
+    // Delete the entries returned by the selection (url, lastVisit) in a
+    // single transaction, and notify the model.
+    QList<Entry> entries;
+    selection.exec();
+    while (selection.next()) {
+        Entry entry;
+        entry.url = QUrl(selection.value(0).toString());
+        entry.visits = 0;
+        entry.lastVisit = QDateTime::fromTime_t(selection.value(1).toInt());
+        entries.append(entry);
+    }
+    selection.finish();
+    if (entries.isEmpty()) {
+        return 0;
+    }
+
+    m_database.transaction();
+    QSqlQuery& deleteQuery = preparedQuery(RemoveEntryByUrl);
+    Q_FOREACH(const Entry& entry, entries) {
+        deleteQuery.bindValue(0, entry.url.toString());
+        deleteQuery.exec();
+    }
+    m_database.commit();
+    Q_EMIT entriesPruned(entries);
+    return entries.count();
+}
+
+void DbWorker::reclaimFreePages()
+{
+    QSqlQuery query(m_database);
+    query.exec(QStringLiteral("PRAGMA auto_vacuum;"));
+    bool incremental = query.next() && (query.value(0).toInt() == 2);
+    query.finish();
+    if (incremental) {
+        DatabaseUtils::exec(m_database, QStringLiteral("PRAGMA incremental_vacuum;"));
+    } else {
+        // Databases created without incremental vacuum need to be rebuilt
+        // once to enable it. VACUUM fails while statements are pending.
+        m_queries.clear();
+        DatabaseUtils::exec(m_database, QStringLiteral("PRAGMA auto_vacuum = INCREMENTAL;"));
+        DatabaseUtils::exec(m_database, QStringLiteral("VACUUM;"));
+        if (m_fullTextSearch) {
+            // VACUUM may renumber the rows the full-text index refers to
+            DatabaseUtils::exec(m_database, QStringLiteral("INSERT INTO history_fts (history_fts) VALUES ('rebuild');"));
+        }
+    }
+}
+
+void DbWorker::doSearch(int requestId, const QString& query, int offset, int limit)
+{
+    // Recent changes must be found too
+    doFlush();
+
+    QStringList terms = query.split(QRegExp(QStringLiteral("\\s+")), QString::SkipEmptyParts);
+    QList<Entry> entries;
+    if (terms.isEmpty()) {
+        Q_EMIT searchFinished(requestId, entries);
+        return;
+    }
+
+    bool fullText = m_fullTextSearch;
+    Q_FOREACH(const QString& term, terms) {
+        if (term.length() < MIN_TRIGRAM_TERM_LENGTH) {
+            fullText = false;
+        }
+    }
+
+    // Results are sorted like the rows of the model, most recent first
+    QSqlQuery searchQuery(m_database);
+    searchQuery.setForwardOnly(true);
+    if (fullText) {
+        searchQuery.prepare(QStringLiteral("SELECT history_entries.url, history_entries.domain, "
+                                           "history_entries.title, history_entries.icon, "
+                                           "history_entries.visits, history_entries.lastVisit FROM history_fts "
+                                           "JOIN history_entries ON history_entries.entryId = history_fts.rowid "
+                                           "WHERE history_fts MATCH ? "
+                                           "ORDER BY history_entries.lastVisit DESC, history_entries.visitId DESC, "
+                                           "history_entries.entryId DESC LIMIT ? OFFSET ?;"));
+        searchQuery.addBindValue(fullTextQuery(terms));
+    } else {
+        QStringList conditions;
+        for (int i = 0; i < terms.count(); ++i) {
+            conditions.append(QStringLiteral("(url LIKE ? ESCAPE '\\' OR title LIKE ? ESCAPE '\\')"));
+        }
+        searchQuery.prepare(QStringLiteral("SELECT url, domain, title, icon, visits, lastVisit "
+                                           "FROM history_entries WHERE %1 "
+                                           "ORDER BY lastVisit DESC, visitId DESC, entryId DESC "
+                                           "LIMIT ? OFFSET ?;").arg(conditions.join(QStringLiteral(" AND "))));
+        Q_FOREACH(QString term, terms) {
+            term.replace(QLatin1Char('\\'), QStringLiteral("\\\\"));
+            term.replace(QLatin1Char('%'), QStringLiteral("\\%"));
+            term.replace(QLatin1Char('_'), QStringLiteral("\\_"));
+            QString pattern = QStringLiteral("%%1%").arg(term);
+            searchQuery.addBindValue(pattern);
+            searchQuery.addBindValue(pattern);
+        }
+    }
+    searchQuery.addBindValue(limit);
+    searchQuery.addBindValue(offset);
+    if (searchQuery.exec()) {
+        QSet<QString> fetched;
+        entries = fetchEntryBatch(searchQuery, fetched, -1);
+    } else {
+        qWarning() << "Failed to search the history:" << searchQuery.lastError().text();
     }
-    Q_EMIT dataChanged(this->index(index, 0), this->index(index, 0), roles);
-    updateExistingEntryInDatabase(entry);
-    return true;
+    Q_EMIT searchFinished(requestId, entries);
 }
 
-/*!
-    Remove a given URL from the history model.
-
-    If the URL was not previously visited, do nothing.
+/*
+    Entries are read from the most recent one, and the frecency of the ones
+    not read yet is bounded by that of the most visited entry at the last
+    visit read: reading stops when it can't rank among the top entries.
 */
-void HistoryModel::removeEntryByUrl(const QUrl& url)
+void DbWorker::doFetchTopEntries(int requestId, int limit)
 {
-    if (url.isEmpty()) {
+    // Recent visits must be accounted for
+    doFlush();
+
+    QList<Entry> entries;
+    QList<double> scores;
+    if (limit <= 0) {
+        Q_EMIT topEntriesFetched(requestId, entries);
         return;
     }
+    QSqlQuery query(m_database);
+    query.exec(QStringLiteral("SELECT MAX(visits) FROM history;"));
+    int maxVisits = query.next() ? query.value(0).toInt() : 0;
+    query.finish();
+    QSet<QUrl> hiddenUrls = doFetchHiddenUrls().toSet();
 
-    removeByIndex(getEntryIndex(url));
-    removeEntryFromDatabaseByUrl(url);
-    Q_EMIT rowCountChanged();
+    query.setForwardOnly(true);
+    query.prepare(QStringLiteral("SELECT url, domain, title, icon, visits, lastVisit FROM history_entries "
+                                 "ORDER BY lastVisit DESC, visitId DESC, entryId DESC;"));
+    if (!query.exec()) {
+        qWarning() << "Failed to read the top entries of the history:" << query.lastError().text();
+    }
+    while (query.next()) {
+        Entry entry = readEntry(query);
+        if ((entries.count() == limit) &&
+            (TopSitesModel::frecency(maxVisits, entry.lastVisit) <= scores.last())) {
+            break;
+        }
+        if (hiddenUrls.contains(entry.url)) {
+            continue;
+        }
+        double score = TopSitesModel::frecency(entry.visits, entry.lastVisit);
+        if ((entries.count() == limit) && (score <= scores.last())) {
+            continue;
+        }
+        if (entry.domain.isEmpty()) {
+            // Not backfilled yet
+            entry.domain = DomainUtils::extractTopLevelDomainName(entry.url);
+        }
+        int row = 0;
+        while ((row < scores.count()) && (scores.at(row) >= score)) {
+            ++row;
+        }
+        entries.insert(row, entry);
+        scores.insert(row, score);
+        if (entries.count() > limit) {
+            entries.removeLast();
+            scores.removeLast();
+        }
+    }
+    query.finish();
+    Q_EMIT topEntriesFetched(requestId, entries);
 }
 
-/*!
-    Remove all urls last visited in a given DATE from the history model.
-*/
-void HistoryModel::removeEntriesByDate(const QDate& date)
+void DbWorker::doImportHistory(const QString& path, bool canonicalize, const QStringList& trackingParameters)
 {
-    if (!date.isValid()) {
+    if (m_importQuery) {
+        // Imports run one after the other
+        QMetaObject::invokeMethod(this, "doImportHistory", Qt::QueuedConnection, Q_ARG(QString, path),
+                                  Q_ARG(bool, canonicalize), Q_ARG(QStringList, trackingParameters));
         return;
     }
 
-    for (int i = m_entries.count() - 1; i >= 0; --i) {
-        if (m_entries.at(i).lastVisit.toLocalTime().date() == date) {
-            removeByIndex(i);
+    // Imported URLs are compared to the ones in the database
+    doFlush();
+
+    bool success = false;
+    {
+        QSqlDatabase source = QSqlDatabase::addDatabase(SQL_DRIVER, IMPORT_CONNECTION_NAME);
+        // The other browser may be running and holding a lock on its history
+        source.setConnectOptions(QStringLiteral("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=5000"));
+        source.setDatabaseName(path);
+        if (QFileInfo::exists(path) && source.open()) {
+            m_importQuery = new QSqlQuery(source);
+            m_importQuery->setForwardOnly(true);
+            if (DatabaseUtils::hasColumn(source, QStringLiteral("urls"), QStringLiteral("last_visit_time"))) {
+                // Chromium
+                success = m_importQuery->exec(QStringLiteral("SELECT url, title, visit_count, "
+                                                             "last_visit_time / 1000000 - %1 FROM urls "
+                                                             "WHERE hidden = 0 AND last_visit_time > 0 "
+                                                             "ORDER BY last_visit_time DESC;").arg(CHROMIUM_EPOCH_OFFSET));
+            } else if (DatabaseUtils::hasColumn(source, QStringLiteral("moz_places"), QStringLiteral("last_visit_date"))) {
+                // Firefox
+                success = m_importQuery->exec(QStringLiteral("SELECT url, title, visit_count, "
+                                                             "last_visit_date / 1000000 FROM moz_places "
+                                                             "WHERE hidden = 0 AND last_visit_date > 0 "
+                                                             "ORDER BY last_visit_date DESC;"));
+            } else {
+                qWarning() << "Unknown history database format:" << path;
+            }
+            if (!success && m_importQuery->lastError().isValid()) {
+                qWarning() << "Failed to read history from" << path << ":" << m_importQuery->lastError().text();
+            }
+        } else {
+            qWarning() << "Failed to open history database" << path << ":" << source.lastError().text();
         }
     }
-    removeEntriesFromDatabaseByDate(date);
-    Q_EMIT rowCountChanged();
+    if (!success) {
+        finishImport(false);
+        return;
+    }
+
+    m_importCanonicalize = canonicalize;
+    m_importTrackingParameters = trackingParameters;
+    m_importedCount = 0;
+    // The URLs in the history are read once rather than looked up for each
+    // row of the source. URLs hidden by the user are not imported either.
+    QSqlQuery urlsQuery(m_database);
+    urlsQuery.setForwardOnly(true);
+    if (urlsQuery.exec(QStringLiteral("SELECT url FROM history UNION SELECT url FROM history_hidden;"))) {
+        while (urlsQuery.next()) {
+            m_importedUrls.insert(urlsQuery.value(0).toString());
+        }
+    }
+    urlsQuery.finish();
+    QMetaObject::invokeMethod(this, "doImportBatch", Qt::QueuedConnection);
 }
 
-/*!
-    Remove all urls from a given DOMAIN from the history model.
+/*
+    Read a batch of (url, title, visits, lastVisit) rows from the history of
+    the other browser, and write the ones for URLs not in the history yet in
+    a single transaction. Each batch is run as a separate call, so that
+    other requests (e.g. reading the pages of a virtualized model) only wait
+    for the current batch instead of the whole import.
 */
-void HistoryModel::removeEntriesByDomain(const QString& domain)
+void DbWorker::doImportBatch()
 {
-    if (domain.isEmpty()) {
+    if (!m_importQuery) {
         return;
     }
+    // Entries added to the history since the previous batch are written
+    // first, their URLs are then skipped (see flushPending())
+    doFlush();
 
-    for (int i = m_entries.count() - 1; i >= 0; --i) {
-        if (m_entries.at(i).domain == domain) {
-            removeByIndex(i);
+    QSqlQuery& insertQuery = preparedQuery(InsertNewEntry);
+    QList<Entry> entries;
+    bool more = true;
+    m_database.transaction();
+    while (entries.count() < IMPORT_BATCH_SIZE) {
+        if (!m_importQuery->next()) {
+            more = false;
+            break;
+        }
+        QUrl url(m_importQuery->value(0).toString());
+        if (m_importCanonicalize) {
+            url = UrlUtils::canonicalUrl(url, m_importTrackingParameters);
+        }
+        QString scheme = url.scheme();
+        if ((scheme != QStringLiteral("http")) && (scheme != QStringLiteral("https"))) {
+            continue;
         }
+        QString urlString = url.toString();
+        if (m_importedUrls.contains(urlString)) {
+            continue;
+        }
+        m_importedUrls.insert(urlString);
+        Entry entry;
+        entry.url = url;
+        entry.domain = DomainUtils::extractTopLevelDomainName(url);
+        entry.title = m_importQuery->value(1).toString();
+        entry.visits = qMax(1, m_importQuery->value(2).toInt());
+        entry.lastVisit = QDateTime::fromTime_t(m_importQuery->value(3).toUInt());
+        insertQuery.bindValue(0, urlString);
+        insertQuery.bindValue(1, dictionaryId(Domains, entry.domain, true));
+        insertQuery.bindValue(2, entry.title);
+        insertQuery.bindValue(3, QVariant());
+        insertQuery.bindValue(4, entry.visits);
+        insertQuery.bindValue(5, entry.lastVisit.toTime_t());
+        // Imported entries were not visited in this browser
+        insertQuery.bindValue(6, QVariant());
+        insertQuery.exec();
+        entries.append(entry);
     }
-    removeEntriesFromDatabaseByDomain(domain);
-    Q_EMIT rowCountChanged();
-}
-
-void HistoryModel::removeByIndex(int index)
-{
-    if (index >= 0) {
-        beginRemoveRows(QModelIndex(), index, index);
-        m_entries.removeAt(index);
-        endRemoveRows();
+    m_database.commit();
+    if (!entries.isEmpty()) {
+        m_importedCount += entries.count();
+        Q_EMIT entriesImported(entries);
     }
-}
 
-void HistoryModel::insertNewEntryInDatabase(const HistoryEntry& entry)
-{
-    QVariantList values;
-    values << entry.url.toString();
-    values << entry.domain;
-    values << entry.title;
-    values << entry.icon.toString();
-    values << entry.lastVisit.toTime_t();
-    Q_EMIT m_dbWorker->enqueue(DbWorker::InsertNewEntry, values);
+    if (more) {
+        QMetaObject::invokeMethod(this, "doImportBatch", Qt::QueuedConnection);
+    } else {
+        finishImport(true);
+    }
 }
 
-void HistoryModel::insertNewEntryInHiddenDatabase(const QUrl& url)
+void DbWorker::finishImport(bool success)
 {
-    Q_EMIT m_dbWorker->enqueue(DbWorker::InsertNewHiddenEntry, QVariantList() << url.toString());
+    int imported = m_importedCount;
+    closeImport();
+    Q_EMIT importFinished(success, imported);
 }
 
-void HistoryModel::updateExistingEntryInDatabase(const HistoryEntry& entry)
+void DbWorker::closeImport()
 {
-    QVariantList values;
-    values << entry.domain;
-    values << entry.title;
-    values << entry.icon.toString();
-    values << entry.visits;
-    values << entry.lastVisit.toTime_t();
-    values << entry.url.toString();
-    Q_EMIT m_dbWorker->enqueue(DbWorker::UpdateExistingEntry, values);
+    delete m_importQuery;
+    m_importQuery = nullptr;
+    m_importedUrls.clear();
+    m_importedCount = 0;
+    QSqlDatabase::database(IMPORT_CONNECTION_NAME, false).close();
+    QSqlDatabase::removeDatabase(IMPORT_CONNECTION_NAME);
 }
 
-void HistoryModel::removeEntryFromDatabaseByUrl(const QUrl& url)
+QList<DbWorker::Entry> DbWorker::fetchEntryBatch(QSqlQuery& query, QSet<QString>& fetched, int limit)
 {
-    Q_EMIT m_dbWorker->enqueue(DbWorker::RemoveEntryByUrl, QVariantList() << url.toString());
+    // Read up to limit entries from the query (all of them if limit is -1).
+    // Entries already fetched are skipped. When reading a whole query, the
+    // entries read are added to the set of fetched entries.
+    QList<Entry> entries;
+    while (((limit == -1) || (entries.count() < limit)) && query.next()) {
+        QString url = query.value(0).toString();
+        if (fetched.contains(url)) {
+            continue;
+        }
+        if (limit == -1) {
+            fetched.insert(url);
+        }
+        entries.append(readEntry(query));
+    }
+    return entries;
 }
 
-void HistoryModel::removeEntryFromHiddenDatabaseByUrl(const QUrl& url)
+DbWorker::Entry DbWorker::readEntry(const QSqlQuery& query)
 {
-    Q_EMIT m_dbWorker->enqueue(DbWorker::RemoveHiddenEntryByUrl, QVariantList() << url.toString());
+    // Columns: url, domain, title, icon, visits, lastVisit
+    Entry entry;
+    entry.url = QUrl(query.value(0).toString());
+    entry.domain = query.value(1).toString();
+    entry.title = query.value(2).toString();
+    entry.icon = query.value(3).toUrl();
+    entry.visits = query.value(4).toInt();
+    entry.lastVisit = QDateTime::fromTime_t(query.value(5).toInt());
+    return entry;
 }
 
-void HistoryModel::removeEntriesFromDatabaseByDate(const QDate& date)
+/*
+    Queue an operation to be written to the database.
+    This is called by the model, on its own thread: the worker is woken up
+    once for all the operations enqueued until it starts draining the queue,
+    and values are passed as they are, without a metacall per operation.
+    This never waits for the worker, even if it is busy with a long task
+    (e.g. a retention pass): when the queue is full, operations are appended
+    to an overflow list, under a lock only held to append or take the list.
+    Once an operation overflows, the following ones do too until the worker
+    takes the list, so that operations are drained in order.
+*/
+void DbWorker::enqueue(const QueuedOperation& operation)
 {
-    QVariantList values;
-    QDateTime dateTime = QDateTime(date);
-    values << dateTime.toTime_t();
-    dateTime.setTime(QTime(23, 59, 59, 999));
-    values << dateTime.toTime_t();
-    Q_EMIT m_dbWorker->enqueue(DbWorker::RemoveEntriesByDate, values);
+    if (m_overflowing.loadAcquire() || !m_queue.push(operation)) {
+        QMutexLocker locker(&m_overflowMutex);
+        m_overflow.append(operation);
+        m_overflowing.storeRelease(1);
+    }
+    if (m_drainPending.testAndSetOrdered(0, 1)) {
+        QMetaObject::invokeMethod(this, "doDrain", Qt::QueuedConnection);
+    }
 }
 
-void HistoryModel::removeEntriesFromDatabaseByDomain(const QString& domain)
+void DbWorker::doDrain()
 {
-    Q_EMIT m_dbWorker->enqueue(DbWorker::RemoveEntriesByDomain, QVariantList() << domain);
+    // Operations enqueued from now on need another call to be drained
+    m_drainPending.fetchAndStoreOrdered(0);
+    if (!m_flush) {
+        m_flush = new QTimer;
+        m_flush->setInterval(FLUSH_INTERVAL);
+        m_flush->setSingleShot(true);
+        connect(m_flush, SIGNAL(timeout()), SLOT(doFlush()));
+    }
+    drainQueue();
+    if (m_resultsPending) {
+        flushPending();
+    }
+    if (m_pending.isEmpty()) {
+        m_flush->stop();
+    } else {
+        m_flush->start();
+    }
 }
 
-void HistoryModel::clearAll()
+/*
+    Move the operations enqueued by the model to the list of pending
+    operations, merging those that supersede each other.
+*/
+void DbWorker::drainQueue()
 {
-    if (!m_entries.isEmpty()) {
-        beginResetModel();
-        m_hiddenEntries.clear();
-        m_entries.clear();
-        endResetModel();
-        clearDatabase();
-        Q_EMIT rowCountChanged();
+    QueuedOperation operation;
+    while (m_queue.pop(operation)) {
+        addPending(operation);
+    }
+    // Operations that overflowed were enqueued after the ones in the queue
+    if (m_overflowing.loadAcquire()) {
+        QList<QueuedOperation> overflow;
+        {
+            QMutexLocker locker(&m_overflowMutex);
+            overflow.swap(m_overflow);
+            m_overflowing.storeRelease(0);
+        }
+        Q_FOREACH(const QueuedOperation& operation, overflow) {
+            addPending(operation);
+        }
     }
 }
 
-void HistoryModel::clearDatabase()
+void DbWorker::addPending(const QueuedOperation& operation)
 {
-    Q_EMIT m_dbWorker->enqueue(DbWorker::Clear, QVariantList() << QStringLiteral("history"));
-    Q_EMIT m_dbWorker->enqueue(DbWorker::Clear, QVariantList() << QStringLiteral("history_hidden"));
+    ++m_enqueuedCount;
+    if (operation.requestId != 0) {
+        m_resultsPending = true;
+    }
+    if (!coalesce(operation)) {
+        PendingOperation pending;
+        pending.operation = operation;
+        pending.superseded = false;
+        m_pending.append(pending);
+    }
+    if (m_pending.count() >= FLUSH_THRESHOLD) {
+        flushPending();
+    }
 }
 
-/*!
-    Mark an entry in the model as hidden.
-
-    Add a new entry to the hidden list.
-    If an entry with the URL exists, it is updated.
+/*
+    Try to merge an operation into one that is already pending for the same
+    URL. Return true if the operation was absorbed and must not be queued.
 */
-void HistoryModel::hide(const QUrl& url)
+bool DbWorker::coalesce(const QueuedOperation& operation)
 {
-    if (url.isEmpty() || m_hiddenEntries.contains(url)) {
-        return;
+    int index = m_pending.count();
+    switch (operation.type) {
+    case InsertNewEntry:
+        m_pendingEntries.insert(operation.url, index);
+        return false;
+    case UpdateExistingEntry: {
+        // An update carries the full state of the entry, so it supersedes
+        // any pending insert or update for the same URL.
+        int previous = m_pendingEntries.value(operation.url, -1);
+        if (previous != -1) {
+            QueuedOperation& pending = m_pending[previous].operation;
+            if ((pending.type == InsertNewEntry) || (pending.type == UpdateExistingEntry)) {
+                Operation type = pending.type;
+                pending = operation;
+                pending.type = type;
+                return true;
+            }
+        }
+        m_pendingEntries.insert(operation.url, index);
+        return false;
     }
-
-    m_hiddenEntries.insert(url);
-
-    QVector<int> roles;
-    roles << Hidden;
-
-    for (int i = 0; i < m_entries.count(); ++i) {
-        HistoryEntry& entry = m_entries[i];
-        if (entry.url == url) {
-            entry.hidden = true;
-            Q_EMIT dataChanged(this->index(i, 0), this->index(i, 0), roles);
+    case VisitEntry:
+    case UpdateEntryAttributes:
+        // Visits add up, and don't carry the full state of the entry: these
+        // are written in order
+        m_pendingEntries.remove(operation.url);
+        return false;
+    case RemoveEntryByUrl: {
+        int previous = m_pendingEntries.value(operation.url, -1);
+        if (previous != -1) {
+            PendingOperation& pending = m_pending[previous];
+            if (pending.operation.type != RemoveEntryByUrl) {
+                pending.superseded = true;
+            } else if (operation.requestId == 0) {
+                return true;
+            }
         }
-    }                                                                   
-
-    insertNewEntryInHiddenDatabase(url);
+        m_pendingEntries.insert(operation.url, index);
+        return false;
+    }
+    case InsertNewHiddenEntry:
+    case RemoveHiddenEntryByUrl: {
+        int previous = m_pendingHiddenEntries.value(operation.url, -1);
+        if (previous != -1) {
+            PendingOperation& pending = m_pending[previous];
+            if (pending.operation.type == operation.type) {
+                return true;
+            }
+            if (pending.operation.type == InsertNewHiddenEntry) {
+                pending.superseded = true;
+            }
+        }
+        m_pendingHiddenEntries.insert(operation.url, index);
+        return false;
+    }
+    case RemoveEntriesByDate:
+    case RemoveEntriesByDomain:
+    case Clear:
+    case ClearHidden:
+        // Bulk operations may affect any entry, operations queued after them
+        // must not be merged into operations queued before them.
+        m_pendingEntries.clear();
+        m_pendingHiddenEntries.clear();
+        return false;
+    default:
+        Q_UNREACHABLE();
+    }
+    return false;
 }
 
-/*!
-    Mark an entry in the model as not hidden.
-
-    If an entry with the URL exists on the hidden entries, it is removed.
-    If an entry with the URL exists, it is updated.
+/*
+    Bind the values of an operation to the placeholders of its prepared
+    query, replacing the domains and icons with their keys in the dictionary
+    tables.
 */
-void HistoryModel::unHide(const QUrl& url)
+void DbWorker::bindValues(QSqlQuery& query, const QueuedOperation& operation)
 {
-    if (url.isEmpty() || !m_hiddenEntries.contains(url)) {
-        return;
+    switch (operation.type) {
+    case InsertNewEntry:
+        query.bindValue(0, operation.url);
+        query.bindValue(1, dictionaryId(Domains, operation.domain, true));
+        query.bindValue(2, operation.title);
+        query.bindValue(3, dictionaryId(Icons, operation.icon, true));
+        query.bindValue(4, operation.visits);
+        query.bindValue(5, operation.lastVisit);
+        query.bindValue(6, ++m_lastVisitId);
+        break;
+    case UpdateExistingEntry:
+        query.bindValue(0, dictionaryId(Domains, operation.domain, true));
+        query.bindValue(1, operation.title);
+        query.bindValue(2, dictionaryId(Icons, operation.icon, true));
+        query.bindValue(3, operation.visits);
+        query.bindValue(4, ++m_lastVisitId);
+        query.bindValue(5, operation.visits);
+        query.bindValue(6, operation.lastVisit);
+        query.bindValue(7, operation.url);
+        break;
+    case VisitEntry:
+        query.bindValue(0, dictionaryId(Domains, operation.domain, true));
+        query.bindValue(1, operation.title);
+        query.bindValue(2, dictionaryId(Icons, operation.icon, true));
+        query.bindValue(3, operation.lastVisit);
+        query.bindValue(4, ++m_lastVisitId);
+        query.bindValue(5, operation.url);
+        break;
+    case UpdateEntryAttributes:
+        query.bindValue(0, operation.title);
+        query.bindValue(1, dictionaryId(Icons, operation.icon, true));
+        query.bindValue(2, operation.url);
+        break;
+    case InsertNewHiddenEntry:
+    case RemoveEntryByUrl:
+    case RemoveHiddenEntryByUrl:
+        query.bindValue(0, operation.url);
+        break;
+    case RemoveEntriesByDate:
+        query.bindValue(0, operation.lastVisit);
+        query.bindValue(1, operation.lastVisitEnd);
+        break;
+    case RemoveEntriesByDomain:
+        query.bindValue(0, dictionaryId(Domains, operation.domain, false));
+        break;
+    default:
+        Q_UNREACHABLE();
     }
-
-    m_hiddenEntries.remove(url);
-
-    QVector<int> roles;
-    roles << Hidden;
-
-    for (int i = 0; i < m_entries.count(); ++i) {
-        HistoryEntry& entry = m_entries[i];
-        if (entry.url == url) {
-            entry.hidden = false;
-            Q_EMIT dataChanged(this->index(i, 0), this->index(i, 0), roles);
-        }
-    }                                                                   
-
-    removeEntryFromHiddenDatabaseByUrl(url);
 }
 
-QVariantMap HistoryModel::get(int i) const
+/*
+    Return the key of a domain or icon in its dictionary table, adding it to
+    the table if needed and create is true. Empty values have no key (NULL).
+*/
+QVariant DbWorker::dictionaryId(Dictionary dictionary, const QString& value, bool create)
 {
-    QVariantMap item;
-    QHash<int, QByteArray> roles = roleNames();
+    if (value.isEmpty()) {
+        return QVariant();
+    }
+    QHash<QString, QVariant>& ids = m_dictionaryIds[dictionary];
+    QHash<QString, QVariant>::const_iterator it = ids.constFind(value);
+    if (it != ids.constEnd()) {
+        return it.value();
+    }
 
-    QModelIndex modelIndex = index(i, 0);
-    if (modelIndex.isValid()) {
-        Q_FOREACH(int role, roles.keys()) {
-            QString roleName = QString::fromUtf8(roles.value(role));
-            item.insert(roleName, data(modelIndex, role));
+    QString table = (dictionary == Domains) ? QStringLiteral("history_domains") : QStringLiteral("history_icons");
+    QString column = (dictionary == Domains) ? QStringLiteral("domain") : QStringLiteral("icon");
+    QVariant id;
+    QSqlQuery query(m_database);
+    query.prepare(QStringLiteral("SELECT id FROM %1 WHERE %2=?;").arg(table, column));
+    query.addBindValue(value);
+    query.exec();
+    if (query.next()) {
+        id = query.value(0);
+    } else if (create) {
+        query.finish();
+        query.prepare(QStringLiteral("INSERT INTO %1 (%2) VALUES (?);").arg(table, column));
+        query.addBindValue(value);
+        if (query.exec()) {
+            id = query.lastInsertId();
         }
     }
-    return item;
+    if (id.isValid()) {
+        ids.insert(value, id);
+    }
+    return id;
 }
 
-DbWorker::DbWorker()
-    : QObject()
-    , m_flush(nullptr)
+void DbWorker::clearDictionaries()
 {
-    // Ensure all database operations are performed on the same thread
-    connect(this, SIGNAL(resetDatabase(const QString&)),
-            SLOT(doResetDatabase(const QString&)), Qt::QueuedConnection);
-    connect(this, SIGNAL(fetchEntries()),
-            SLOT(doFetchEntries()), Qt::QueuedConnection);
-    qRegisterMetaType<Operation>("Operation");
-    connect(this, SIGNAL(enqueue(Operation, QVariantList)),
-            SLOT(doEnqueue(Operation, QVariantList)), Qt::QueuedConnection);
+    DatabaseUtils::exec(m_database, QStringLiteral("DELETE FROM history_domains;"));
+    DatabaseUtils::exec(m_database, QStringLiteral("DELETE FROM history_icons;"));
+    m_dictionaryIds[Domains].clear();
+    m_dictionaryIds[Icons].clear();
 }
 
-DbWorker::~DbWorker()
+void DbWorker::removeUnusedDictionaryEntries()
 {
-    if (m_flush) {
-        m_flush->stop();
-        delete m_flush;
-        m_flush = nullptr;
-    }
-    doFlush();
-    if (m_database.isOpen()) {
-        m_database.close();
-    }
-    m_database = QSqlDatabase();
-    QSqlDatabase::removeDatabase(CONNECTION_NAME);
+    DatabaseUtils::exec(m_database, QStringLiteral("DELETE FROM history_domains WHERE id NOT IN "
+                                                   "(SELECT domainId FROM history WHERE domainId IS NOT NULL);"));
+    DatabaseUtils::exec(m_database, QStringLiteral("DELETE FROM history_icons WHERE id NOT IN "
+                                                   "(SELECT iconId FROM history WHERE iconId IS NOT NULL);"));
+    m_dictionaryIds[Domains].clear();
+    m_dictionaryIds[Icons].clear();
 }
 
-void DbWorker::doResetDatabase(const QString& databaseName)
+QSqlQuery& DbWorker::preparedQuery(Operation operation)
 {
-    if (m_flush) {
-        m_flush->stop();
-        delete m_flush;
-        m_flush = nullptr;
-    }
-    doFlush();
-    if (m_database.isOpen()) {
-        m_database.close();
+    QHash<int, QSqlQuery>::iterator it = m_queries.find(operation);
+    if (it != m_queries.end()) {
+        return it.value();
     }
-    if (!m_database.isValid()) {
-         m_database = QSqlDatabase::addDatabase(SQL_DRIVER, CONNECTION_NAME);
+    QString statement;
+    switch (operation) {
+    case InsertNewEntry:
+        statement = QStringLiteral("INSERT INTO history (url, domainId, title, iconId, "
+                                   "visits, lastVisit, visitId) VALUES (?, ?, ?, ?, ?, ?, ?);");
+        break;
+    case InsertNewHiddenEntry:
+        statement = QStringLiteral("INSERT INTO history_hidden (url) VALUES (?);");
+        break;
+    case UpdateExistingEntry:
+        // Only visits get a new visitId, not changes of the title or icon
+        statement = QStringLiteral("UPDATE history SET domainId=?, title=?, iconId=?, "
+                                   "visitId=CASE WHEN visits=? THEN visitId ELSE ? END, "
+                                   "visits=?, lastVisit=? WHERE url=?;");
+        break;
+    case VisitEntry:
+        statement = QStringLiteral("UPDATE history SET domainId=?, title=?, iconId=?, "
+                                   "visits=visits+1, lastVisit=?, visitId=? WHERE url=?;");
+        break;
+    case UpdateEntryAttributes:
+        statement = QStringLiteral("UPDATE history SET title=?, iconId=? WHERE url=?;");
+        break;
+    case RemoveEntryByUrl:
+        statement = QStringLiteral("DELETE FROM history WHERE url=?;");
+        break;
+    case RemoveHiddenEntryByUrl:
+        statement = QStringLiteral("DELETE FROM history_hidden WHERE url=?;");
+        break;
+    case RemoveEntriesByDate:
+        statement = QStringLiteral("DELETE FROM history WHERE lastVisit BETWEEN ? AND ?;");
+        break;
+    case RemoveEntriesByDomain:
+        statement = QStringLiteral("DELETE FROM history WHERE domainId=?;");
+        break;
+    default:
+        Q_UNREACHABLE();
     }
-    m_database.setDatabaseName(databaseName);
-    m_database.open();
-    doCreateOrAlterDatabaseSchema();
+    QSqlQuery query(m_database);
+    query.prepare(statement);
+    return m_queries.insert(operation, query).value();
 }
 
-void DbWorker::doCreateOrAlterDatabaseSchema()
+void DbWorker::doFlush()
 {
-    QSqlQuery createQuery(m_database);
-    QString query = QStringLiteral("CREATE TABLE IF NOT EXISTS history "
-                                   "(url VARCHAR, domain VARCHAR, title VARCHAR,"
-                                   " icon VARCHAR, visits INTEGER, lastVisit DATETIME);");
-    createQuery.prepare(query);
-    createQuery.exec();
-
-    // The first version of the database schema didn't have a 'domain' column
-    QSqlQuery tableInfoQuery(m_database);
-    query = QStringLiteral("PRAGMA TABLE_INFO(history);");
-    tableInfoQuery.prepare(query);
-    tableInfoQuery.exec();
-    while (tableInfoQuery.next()) {
-        if (tableInfoQuery.value(QStringLiteral("name")).toString() == QStringLiteral("domain")) {
-            break;
-        }
-    }
-    if (!tableInfoQuery.isValid()) {
-        QSqlQuery addDomainColumnQuery(m_database);
-        query = QStringLiteral("ALTER TABLE history ADD COLUMN domain VARCHAR;");
-        addDomainColumnQuery.prepare(query);
-        addDomainColumnQuery.exec();
-        // Updating all the entries in the database to add the domain is a
-        // costly operation that would slow down the application startup,
-        // do not do it here.
-    }
-
-    QSqlQuery createHiddenQuery(m_database);
-    query = QStringLiteral("CREATE TABLE IF NOT EXISTS history_hidden (url VARCHAR);");
-    createHiddenQuery.prepare(query);
-    createHiddenQuery.exec();
+    drainQueue();
+    flushPending();
 }
 
-void DbWorker::doFetchEntries()
+void DbWorker::flushPending()
 {
-    QSqlQuery populateHiddenQuery(m_database);
-    QString query = QStringLiteral("SELECT url FROM history_hidden;");
-    populateHiddenQuery.prepare(query);
-    populateHiddenQuery.exec();
-    while (populateHiddenQuery.next()) {
-        Q_EMIT hiddenEntryFetched(populateHiddenQuery.value(0).toUrl());
-    }
-
-    QSqlQuery populateQuery(m_database);
-    query = QStringLiteral("SELECT url, domain, title, icon, visits, lastVisit "
-                           "FROM history ORDER BY lastVisit DESC;");
-    populateQuery.prepare(query);
-    populateQuery.exec();
-    while (populateQuery.next()) {
-        Q_EMIT entryFetched(populateQuery.value(0).toUrl(),
-                            populateQuery.value(1).toString(),
-                            populateQuery.value(2).toString(),
-                            populateQuery.value(3).toUrl(),
-                            populateQuery.value(4).toInt(),
-                            QDateTime::fromTime_t(populateQuery.value(5).toInt()));
+    if (m_pending.isEmpty()) {
+        return;
     }
-    Q_EMIT loaded();
-}
 
-void DbWorker::doEnqueue(DbWorker::Operation operation, QVariantList values)
-{
-    if (!m_flush) {
-        m_flush = new QTimer;
-        m_flush->setInterval(1000);
-        m_flush->setSingleShot(true);
-        connect(m_flush, SIGNAL(timeout()), SLOT(doFlush()));
-    }
-    QWriteLocker locker(&m_lock);
-    m_pending.enqueue(qMakePair(operation, values));
-    m_flush->start();
-}
+    QElapsedTimer timer;
+    timer.start();
+    int statements = 0;
 
-void DbWorker::doFlush()
-{
-    QWriteLocker locker(&m_lock);
-    while (!m_pending.isEmpty()) {
-        QPair<Operation, QVariantList> args = m_pending.dequeue();
-        QString statement;
-        switch (args.first) {
-        case InsertNewEntry:
-            statement = QStringLiteral("INSERT INTO history (url, domain, title, icon, "
-                                       "visits, lastVisit) VALUES (?, ?, ?, ?, 1, ?);");
-            break;
-        case InsertNewHiddenEntry:
-            statement = QStringLiteral("INSERT INTO history_hidden (url) VALUES (?);");
-            break;
-        case UpdateExistingEntry:
-            statement = QStringLiteral("UPDATE history SET domain=?, title=?, icon=?, "
-                                       "visits=?, lastVisit=? WHERE url=?;");
-            break;
-        case RemoveEntryByUrl:
-            statement = QStringLiteral("DELETE FROM history WHERE url=?;");
-            break;
-        case RemoveHiddenEntryByUrl:
-            statement = QStringLiteral("DELETE FROM history_hidden WHERE url=?;");
-            break;
-        case RemoveEntriesByDate:
-            statement = QStringLiteral("DELETE FROM history WHERE lastVisit BETWEEN ? AND ?;");
-            break;
-        case RemoveEntriesByDomain:
-            statement = QStringLiteral("DELETE FROM history WHERE domain=?;");
-            break;
-        case Clear:
-            statement = QStringLiteral("DELETE FROM %1;").arg(args.second.takeFirst().toString());
-            break;
-        default:
-            Q_UNREACHABLE();
-        }
-        if (statement.isEmpty()) {
-            return;
-        }
-        QSqlQuery query(m_database);
-        if (!query.prepare(statement)) {
+    // Run all pending operations in a single transaction, so that they are
+    // committed to disk at once.
+    m_database.transaction();
+    for (int i = 0; i < m_pending.count(); ++i) {
+        const PendingOperation& pending = m_pending.at(i);
+        if (pending.superseded) {
             continue;
         }
-        Q_FOREACH(const QVariant& value, args.second) {
-            query.addBindValue(value);
+        const QueuedOperation& operation = pending.operation;
+        if (operation.type == Clear) {
+            DatabaseUtils::exec(m_database, QStringLiteral("DELETE FROM history;"));
+            clearDictionaries();
+        } else if (operation.type == ClearHidden) {
+            DatabaseUtils::exec(m_database, QStringLiteral("DELETE FROM history_hidden;"));
+        } else if (operation.type == VisitEntry) {
+            if (m_importQuery) {
+                // Not to be imported anymore, or visited since it was
+                // imported
+                m_importedUrls.insert(operation.url);
+            }
+            visitEntry(operation);
+        } else {
+            if (m_importQuery && (operation.type == InsertNewHiddenEntry)) {
+                // Hidden while importing, not to be imported anymore
+                m_importedUrls.insert(operation.url);
+            } else if (m_importQuery && (operation.type == InsertNewEntry)) {
+                if (m_importedUrls.contains(operation.url)) {
+                    // Imported after the model added it, the entry of the
+                    // model replaces the imported one
+                    QSqlQuery& removeQuery = preparedQuery(RemoveEntryByUrl);
+                    removeQuery.bindValue(0, operation.url);
+                    removeQuery.exec();
+                } else {
+                    // Not to be imported anymore
+                    m_importedUrls.insert(operation.url);
+                }
+            }
+            // The model waits for the row of the entry removed
+            int row = (operation.requestId != 0) ? findRow(operation.url) : -1;
+            QSqlQuery& query = preparedQuery(operation.type);
+            bindValues(query, operation);
+            query.exec();
+            if (operation.requestId != 0) {
+                Q_EMIT operationApplied(operation.requestId, row, 0);
+            }
         }
-        query.exec();
+        ++statements;
+    }
+    m_database.commit();
+
+    int operations = m_enqueuedCount;
+    m_pending.clear();
+    m_pendingEntries.clear();
+    m_pendingHiddenEntries.clear();
+    m_enqueuedCount = 0;
+    m_resultsPending = false;
+    Q_EMIT flushed(operations, statements, timer.elapsed());
+}
+
+/*
+    Write a visit of an entry in virtualized mode: update the entry for its
+    URL if there is one, or insert a new one. The model is told the row the
+    entry was at before (-1 if it was inserted), and its number of visits.
+*/
+void DbWorker::visitEntry(const QueuedOperation& operation)
+{
+    int visits = 0;
+    int row = findRow(operation.url, &visits);
+    QSqlQuery& query = preparedQuery(VisitEntry);
+    bindValues(query, operation);
+    query.exec();
+    if (query.numRowsAffected() > 0) {
+        ++visits;
+    } else {
+        QueuedOperation inserted = operation;
+        inserted.type = InsertNewEntry;
+        inserted.visits = 1;
+        QSqlQuery& insertQuery = preparedQuery(InsertNewEntry);
+        bindValues(insertQuery, inserted);
+        insertQuery.exec();
+        row = -1;
+        visits = 1;
+    }
+    if (operation.requestId != 0) {
+        Q_EMIT operationApplied(operation.requestId, row, visits);
     }
 }
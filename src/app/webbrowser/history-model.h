@@ -22,20 +22,198 @@
 // Qt
 #include <QtCore/QAbstractListModel>
 #include <QtCore/QDateTime>
+#include <QtCore/QHash>
+#include <QtCore/QAtomicInt>
 #include <QtCore/QList>
-#include <QtCore/QPair>
-#include <QtCore/QQueue>
-#include <QtCore/QReadWriteLock>
+#include <QtCore/QMap>
+#include <QtCore/QMutex>
 #include <QtCore/QSet>
 #include <QtCore/QString>
+#include <QtCore/QStringList>
 #include <QtCore/QThread>
 #include <QtCore/QUrl>
 #include <QtCore/QVariant>
+#include <QtCore/QVector>
 #include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlQuery>
+
+// local
+#include "../ring-buffer.h"
 
 class QTimer;
 
-class DbWorker;
+class DbWorker : public QObject {
+    Q_OBJECT
+
+    Q_ENUMS(Operation)
+
+public:
+    DbWorker();
+    ~DbWorker();
+
+    struct Entry {
+        QUrl url;
+        QString domain;
+        QString title;
+        QUrl icon;
+        int visits;
+        QDateTime lastVisit;
+    };
+
+    enum Operation {
+        InsertNewEntry,
+        InsertNewHiddenEntry,
+        UpdateExistingEntry,
+        VisitEntry,
+        UpdateEntryAttributes,
+        RemoveEntryByUrl,
+        RemoveHiddenEntryByUrl,
+        RemoveEntriesByDate,
+        RemoveEntriesByDomain,
+        Clear,
+        ClearHidden,
+    };
+
+    // A write operation, as passed from the model to the worker
+    struct QueuedOperation {
+        QueuedOperation()
+            : type(Clear), visits(0), lastVisit(0), lastVisitEnd(0), requestId(0) {}
+        Operation type;
+        QString url;
+        QString domain;
+        QString title;
+        QString icon;
+        int visits;
+        uint lastVisit;
+        // Upper bound of the dates removed by RemoveEntriesByDate
+        uint lastVisitEnd;
+        // Identifier of the operation if the model waits for its result
+        // (see operationApplied()), 0 otherwise
+        int requestId;
+    };
+
+    void enqueue(const QueuedOperation& operation);
+
+Q_SIGNALS:
+    void resetDatabase(const QString& databaseName);
+    void fetchEntries();
+    void hiddenEntriesFetched(const QList<QUrl>& urls);
+    void fetchStarted(int count);
+    void entriesFetched(const QList<DbWorker::Entry>& entries);
+    void loaded();
+    void flushed(int operations, int statements, qint64 elapsed);
+    void enforceRetention(int maxEntries, int maxAge, qint64 maxDatabaseSize);
+    void entriesPruned(const QList<DbWorker::Entry>& entries);
+    void retentionEnforced();
+    void search(int requestId, const QString& query, int offset, int limit);
+    void searchFinished(int requestId, const QList<DbWorker::Entry>& entries);
+    void fetchTopEntries(int requestId, int limit);
+    void topEntriesFetched(int requestId, const QList<DbWorker::Entry>& entries);
+    void fetchPage(int requestId, int offset, int limit);
+    void pageFetched(int requestId, int offset, const QList<DbWorker::Entry>& entries);
+    void operationApplied(int requestId, int row, int visits);
+    void countEntries(int requestId);
+    void entriesCounted(int requestId, int count);
+    void importHistory(const QString& path, bool canonicalize, const QStringList& trackingParameters);
+    void entriesImported(const QList<DbWorker::Entry>& entries);
+    void importFinished(bool success, int count);
+    void startBackfill();
+
+private Q_SLOTS:
+    void doResetDatabase(const QString& databaseName);
+    void doCreateOrAlterDatabaseSchema();
+    void doFetchEntries();
+    void doFetchBatch(int fetch);
+    QList<QUrl> doFetchHiddenUrls();
+    int doCountEntries();
+    QList<DbWorker::Entry> doFetchPage(int offset, int limit);
+    void doRequestPage(int requestId, int offset, int limit);
+    void doRequestCount(int requestId);
+    int doFindRow(const QString& url);
+    void doDrain();
+    void doFlush();
+    void doStartBackfill();
+    void doBackfillDomains();
+    void doEnforceRetention(int maxEntries, int maxAge, qint64 maxDatabaseSize);
+    void doSearch(int requestId, const QString& query, int offset, int limit);
+    void doFetchTopEntries(int requestId, int limit);
+    void doImportHistory(const QString& path, bool canonicalize, const QStringList& trackingParameters);
+    void doImportBatch();
+
+private:
+    struct PendingOperation {
+        QueuedOperation operation;
+        bool superseded;
+    };
+
+    enum Dictionary {
+        Domains,
+        Icons,
+    };
+
+    QSqlDatabase m_database;
+    // Operations enqueued by the model (the only producer), until they are
+    // drained by the worker (the only consumer)
+    RingBuffer<QueuedOperation> m_queue;
+    // Whether a call to doDrain() is already posted to the worker thread
+    QAtomicInt m_drainPending;
+    // Operations enqueued while the queue was full, and whether there are any
+    QMutex m_overflowMutex;
+    QList<QueuedOperation> m_overflow;
+    QAtomicInt m_overflowing;
+    QList<PendingOperation> m_pending;
+    int m_enqueuedCount;
+    // Whether the model waits for the result of a pending operation, they
+    // are flushed right away then
+    bool m_resultsPending;
+    // Index in m_pending of the most recent operation for a given URL,
+    // used to coalesce operations that supersede each other.
+    QHash<QString, int> m_pendingEntries;
+    QHash<QString, int> m_pendingHiddenEntries;
+    QHash<int, QSqlQuery> m_queries;
+    // Keys of the domains and icons in their dictionary tables
+    QHash<QString, QVariant> m_dictionaryIds[2];
+    QTimer* m_flush;
+    QTimer* m_backfill;
+    bool m_fullTextSearch;
+    // Sequence number of the last visit written to the database
+    qint64 m_lastVisitId;
+    // Identifier of the load in progress, and sort key of the last entry
+    // fetched (lastVisit, visitId, rowid)
+    int m_fetch;
+    qint64 m_fetchLastVisit;
+    qint64 m_fetchVisitId;
+    qint64 m_fetchEntryId;
+    // State of the import in progress, if any: rows left to read from the
+    // other browser's database, and URLs not to import
+    QSqlQuery* m_importQuery;
+    QSet<QString> m_importedUrls;
+    bool m_importCanonicalize;
+    QStringList m_importTrackingParameters;
+    int m_importedCount;
+
+    void stopTimers();
+    void closeDatabase();
+    static Entry readEntry(const QSqlQuery& query);
+    QList<Entry> fetchEntryBatch(QSqlQuery& query, QSet<QString>& fetched, int limit);
+    void drainQueue();
+    void addPending(const QueuedOperation& operation);
+    void flushPending();
+    bool coalesce(const QueuedOperation& operation);
+    void visitEntry(const QueuedOperation& operation);
+    int findRow(const QString& url, int* visits=nullptr);
+    QSqlQuery& preparedQuery(Operation operation);
+    void bindValues(QSqlQuery& query, const QueuedOperation& operation);
+    QVariant dictionaryId(Dictionary dictionary, const QString& value, bool create);
+    void clearDictionaries();
+    void removeUnusedDictionaryEntries();
+    int countEntries();
+    qint64 databaseSize();
+    int pruneEntries(QSqlQuery& selection);
+    void reclaimFreePages();
+    void finishImport(bool success);
+    void closeImport();
+};
 
 class HistoryModel : public QAbstractListModel
 {
@@ -43,6 +221,13 @@ class HistoryModel : public QAbstractListModel
 
     Q_PROPERTY(QString databasePath READ databasePath WRITE setDatabasePath NOTIFY databasePathChanged)
     Q_PROPERTY(int count READ rowCount NOTIFY rowCountChanged)
+    Q_PROPERTY(qreal loadProgress READ loadProgress NOTIFY loadProgressChanged)
+    Q_PROPERTY(int maxEntries READ maxEntries WRITE setMaxEntries NOTIFY maxEntriesChanged)
+    Q_PROPERTY(int maxAge READ maxAge WRITE setMaxAge NOTIFY maxAgeChanged)
+    Q_PROPERTY(qint64 maxDatabaseSize READ maxDatabaseSize WRITE setMaxDatabaseSize NOTIFY maxDatabaseSizeChanged)
+    Q_PROPERTY(bool virtualized READ virtualized WRITE setVirtualized NOTIFY virtualizedChanged)
+    Q_PROPERTY(bool canonicalizeUrls READ canonicalizeUrls WRITE setCanonicalizeUrls NOTIFY canonicalizeUrlsChanged)
+    Q_PROPERTY(QStringList trackingParameters READ trackingParameters WRITE setTrackingParameters NOTIFY trackingParametersChanged)
 
     Q_ENUMS(Roles)
 
@@ -62,6 +247,19 @@ public:
         Hidden,
     };
 
+    // Compact in-memory representation of an entry: domains and icons are
+    // interned, and stored as indexes in per-model tables.
+    struct HistoryEntry {
+        QByteArray url; // UTF-8
+        QString title;
+        qint64 lastVisit; // milliseconds since the epoch (UTC)
+        qint32 lastVisitDay; // local date of lastVisit (Julian day), cached
+        quint32 domain;
+        quint32 icon;
+        uint visits;
+        bool hidden;
+    };
+
     // reimplemented from QAbstractListModel
     QHash<int, QByteArray> roleNames() const;
     int rowCount(const QModelIndex& parent=QModelIndex()) const;
@@ -70,6 +268,23 @@ public:
     const QString databasePath() const;
     void setDatabasePath(const QString& path);
 
+    qreal loadProgress() const;
+
+    int maxEntries() const;
+    void setMaxEntries(int maxEntries);
+    int maxAge() const;
+    void setMaxAge(int maxAge);
+    qint64 maxDatabaseSize() const;
+    void setMaxDatabaseSize(qint64 maxDatabaseSize);
+
+    bool virtualized() const;
+    void setVirtualized(bool virtualized);
+
+    bool canonicalizeUrls() const;
+    void setCanonicalizeUrls(bool canonicalize);
+    const QStringList& trackingParameters() const;
+    void setTrackingParameters(const QStringList& parameters);
+
     Q_INVOKABLE int add(const QUrl& url, const QString& title, const QUrl& icon);
     Q_INVOKABLE bool update(const QUrl& url, const QString& title, const QUrl& icon);
     Q_INVOKABLE void removeEntryByUrl(const QUrl& url);
@@ -78,38 +293,167 @@ public:
     Q_INVOKABLE void clearAll();
     Q_INVOKABLE void hide(const QUrl& url);
     Q_INVOKABLE void unHide(const QUrl& url);
-    Q_INVOKABLE QVariantMap get(int index) const;
+    Q_INVOKABLE QVariantMap get(int index, const QStringList& roles=QStringList()) const;
+    Q_INVOKABLE QVariantList getRange(int from, int count, const QStringList& roles=QStringList()) const;
+    Q_INVOKABLE QUrl urlAt(int index) const;
+    Q_INVOKABLE int indexOfUrl(const QUrl& url) const;
+    Q_INVOKABLE QUrl canonicalUrl(const QUrl& url) const;
+    Q_INVOKABLE int search(const QString& query, int offset, int limit);
+    Q_INVOKABLE int fetchTopEntries(int limit);
+    Q_INVOKABLE void importHistory(const QString& path);
 
 Q_SIGNALS:
     void databasePathChanged() const;
     void rowCountChanged();
     void loaded() const;
+    void loadProgressChanged() const;
+    void maxEntriesChanged() const;
+    void maxAgeChanged() const;
+    void maxDatabaseSizeChanged() const;
+    void virtualizedChanged() const;
+    void canonicalizeUrlsChanged() const;
+    void trackingParametersChanged() const;
+    void flushed(int operations, int statements, qint64 elapsed) const;
+    void searchFinished(int requestId, const QList<DbWorker::Entry>& results) const;
+    void topEntriesFetched(int requestId, const QList<DbWorker::Entry>& entries) const;
+    void entryHiddenChanged(const QUrl& url, bool hidden) const;
+    void importProgress(int count) const;
+    void importFinished(bool success, int count) const;
 
 protected:
-    struct HistoryEntry {
-        QUrl url;
-        QString domain;
-        QString title;
-        QUrl icon;
-        uint visits;
-        QDateTime lastVisit;
-        bool hidden;
-    };
-    QList<HistoryEntry> m_entries;
+    // Stored contiguously from the oldest to the most recent entry (i.e. in
+    // reverse row order), so that adding an entry or moving it to the front
+    // doesn't move the older ones.
+    QVector<HistoryEntry> m_entries;
+    const HistoryEntry& entryAt(int row) const;
+    HistoryEntry& entryAt(int row);
     int getEntryIndex(const QUrl& url) const;
+    int getEntryIndex(const QByteArray& url) const;
+    void indexPrependedEntry();
+    void indexInsertedEntries(int first, int count);
+    void unindexEntry(int index);
+    void reindexEntryMovedToFront(int index);
+    void rebuildUrlIndex();
     void updateExistingEntryInDatabase(const HistoryEntry& entry);
 
 private Q_SLOTS:
-    void onHiddenEntryFetched(const QUrl& url);
-    void onEntryFetched(const QUrl& url, const QString& domain, const QString& title,
-                        const QUrl& icon, int visits, const QDateTime& lastVisit);
+    void onHiddenEntriesFetched(const QList<QUrl>& urls);
+    void onFetchStarted(int count);
+    void onEntriesFetched(const QList<DbWorker::Entry>& entries);
+    void onLoaded();
+    void onEntriesPruned(const QList<DbWorker::Entry>& entries);
+    void onRetentionEnforced();
+    void onEntriesImported(const QList<DbWorker::Entry>& entries);
+    void onImportFinished(bool success, int count);
+    void onPageFetched(int requestId, int offset, const QList<DbWorker::Entry>& entries);
+    void onOperationApplied(int requestId, int row, int visits);
+    void onEntriesCounted(int requestId, int count);
+    void checkTimeZone();
 
 private:
     QString m_databasePath;
     QSet<QUrl> m_hiddenEntries;
 
+    // Maps each URL to a key from which its row is computed as
+    // (key - m_indexOffset), so that shifting all rows by one is O(1).
+    // Keys share their data with the URLs of the entries.
+    QHash<QByteArray, int> m_urlIndex;
+    int m_indexOffset;
+
+    QStringList m_domains;
+    QHash<QString, quint32> m_domainIds;
+    QList<QUrl> m_icons;
+    QHash<QUrl, quint32> m_iconIds;
+
+    // ISO representations of the dates of entries, by Julian day
+    mutable QHash<qint32, QString> m_dayStrings;
+    QByteArray m_timeZoneId;
+    QTimer* m_timeZoneCheck;
+
+    int m_fetchedCount;
+    int m_fetchTotal;
+    bool m_loaded;
+    // URL of the last entry of the history being loaded that was inserted
+    // or found in the model, later entries are inserted after it
+    QByteArray m_lastLoadedUrl;
+
+    int m_maxEntries;
+    int m_maxAge;
+    qint64 m_maxDatabaseSize;
+    // Number of retention passes requested and not finished yet
+    int m_retentionPasses;
+
+    bool m_canonicalizeUrls;
+    QStringList m_trackingParameters;
+
+    int m_lastSearchRequest;
+    int m_lastTopEntriesRequest;
+    int m_importedCount;
+
+    // An operation sent to the worker in virtualized mode, whose result
+    // tells how the rows change. The model changes them right away when it
+    // can guess how (applied), row being the row of the entry it moved or
+    // removed, or -1 if it inserted it. Guesses based on entries in memory
+    // are exact, the others are resolved by the result.
+    struct VirtualOperation {
+        DbWorker::Operation type;
+        DbWorker::Entry entry;
+        int row;
+        bool applied;
+        bool exact;
+    };
+
+    // A change of the rows in virtualized mode, made by the operation with
+    // the given identifier
+    enum RowChangeType {
+        RowInserted,
+        RowMoved,
+        RowRemoved,
+    };
+    struct RowChange {
+        int origin;
+        RowChangeType type;
+        int row;
+    };
+
+    // In virtualized mode, only the number of entries is known, and pages
+    // of entries are read from the database on demand. The entries read or
+    // visited are kept under the key (row + m_cacheOffset), so that shifting
+    // all rows by one is O(1), and indexed by URL.
+    bool m_virtualized;
+    int m_virtualCount;
+    mutable QMap<int, DbWorker::Entry> m_cachedEntries;
+    mutable QHash<QUrl, int> m_cachedUrls;
+    mutable int m_cacheOffset;
+    // Identifier of the pending request for a page, by page. Requests and
+    // operations are numbered in the order they are sent to the worker.
+    mutable QHash<int, int> m_pageRequests;
+    mutable int m_lastRequest;
+    mutable bool m_waitForPages;
+    // Operations whose result is pending, by identifier, and how many of
+    // them changed the rows in a way that is not known to be exact yet
+    QHash<int, VirtualOperation> m_virtualOperations;
+    int m_unresolvedOperations;
+    // Identifier of the pending request to count the rows again, if any
+    int m_resetRequest;
+    // Changes of the rows made while pages are being read
+    QList<RowChange> m_rowChanges;
+
     void resetDatabase(const QString& databaseName);
+    void reload();
+    void clearEntries();
+    quint32 internDomain(const QString& domain);
+    quint32 internIcon(const QUrl& icon);
+    const QString& dayString(qint32 day) const;
+    void insertEntries(int row, const QVector<HistoryEntry>& entries);
+    void insertFetchedEntries(const QList<DbWorker::Entry>& entries);
+    void insertLoadedEntries(const QList<DbWorker::Entry>& entries);
+    HistoryEntry fetchedEntry(const DbWorker::Entry& fetched);
+    void enforceRetention();
+    void enforceRetentionIfGrown();
     void removeByIndex(int index);
+    void removeRowRanges(QList<int> rows);
+    int insertionRow(qint64 lastVisit, bool beforeSameVisit=false) const;
     void insertNewEntryInDatabase(const HistoryEntry& entry);
     void insertNewEntryInHiddenDatabase(const QUrl& url);
     void removeEntryFromDatabaseByUrl(const QUrl& url);
@@ -118,51 +462,37 @@ private:
     void removeEntriesFromDatabaseByDomain(const QString& domain);
     void clearDatabase();
 
+    const DbWorker::Entry* virtualEntryAt(int row) const;
+    const DbWorker::Entry* cachedVirtualEntryAt(int row) const;
+    const DbWorker::Entry* cachedEntry(int row) const;
+    int cachedRow(const QUrl& url) const;
+    void cacheEntry(int row, const DbWorker::Entry& entry) const;
+    void uncacheRow(int row) const;
+    void shiftCachedRows(int first, int last, int delta) const;
+    void trimCache(int row) const;
+    void clearCache();
+    bool allRowsCached() const;
+    QVariant virtualData(int row, int role) const;
+    int findVirtualRow(const QUrl& url) const;
+    bool virtualRowsUnresolved() const;
+    void waitForVirtualOperations() const;
+    int addVirtualEntry(const QUrl& url, const QString& title, const QUrl& icon);
+    bool updateVirtualEntry(const QUrl& url, const QString& title, const QUrl& icon);
+    void removeVirtualEntry(const QUrl& url);
+    void storeVirtualEntry(DbWorker::Operation type, const DbWorker::Entry& entry, int requestId=0);
+    void insertVirtualRow(const DbWorker::Entry& entry, int origin);
+    void moveVirtualRow(int row, const DbWorker::Entry& entry, int origin);
+    void removeVirtualRow(int row, int origin);
+    void logRowChange(int origin, RowChangeType type, int row);
+    int mappedRow(int row, int requestId) const;
+    void clearVirtualRows();
+    void reloadVirtualRows();
+
     QThread m_dbWorkerThread;
     DbWorker* m_dbWorker;
 };
 
-class DbWorker : public QObject {
-    Q_OBJECT
-
-    Q_ENUMS(Operation)
-
-public:
-    DbWorker();
-    ~DbWorker();
-
-    enum Operation {
-        InsertNewEntry,
-        InsertNewHiddenEntry,
-        UpdateExistingEntry,
-        RemoveEntryByUrl,
-        RemoveHiddenEntryByUrl,
-        RemoveEntriesByDate,
-        RemoveEntriesByDomain,
-        Clear,
-    };
-
-Q_SIGNALS:
-    void resetDatabase(const QString& databaseName);
-    void fetchEntries();
-    void hiddenEntryFetched(const QUrl& url);
-    void entryFetched(const QUrl& url, const QString& domain, const QString& title,
-                      const QUrl& icon, int visits, const QDateTime& lastVisit);
-    void loaded();
-    void enqueue(Operation operation, QVariantList values);
-
-private Q_SLOTS:
-    void doResetDatabase(const QString& databaseName);
-    void doCreateOrAlterDatabaseSchema();
-    void doFetchEntries();
-    void doEnqueue(Operation operation, QVariantList values);
-    void doFlush();
-
-private:
-    QSqlDatabase m_database;
-    QReadWriteLock m_lock;
-    QQueue<QPair<Operation, QVariantList>> m_pending;
-    QTimer* m_flush;
-};
+Q_DECLARE_METATYPE(DbWorker::Entry)
+Q_DECLARE_TYPEINFO(HistoryModel::HistoryEntry, Q_MOVABLE_TYPE);
 
 #endif // __HISTORY_MODEL_H__
@@ -0,0 +1,232 @@
+/*
+ * Copyright 2020 UBports Foundation
+ *
+ * This file is part of morph-browser.
+ *
+ * morph-browser is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * morph-browser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "history-search-model.h"
+
+static const int DEFAULT_PAGE_SIZE = 50;
+
+// Changes of the history are batched before the search is run again
+static const int RESTART_DELAY = 250; // in milliseconds
+
+/*!
+    \class HistorySearchModel
+    \brief List model that exposes the results of a search in the history.
+
+    HistorySearchModel searches the database of a HistoryModel for entries
+    whose URL or title contain each of the search terms, most recent first
+    (see HistoryModel::search()).
+
+    Results are fetched asynchronously, one page at a time: the first page as
+    soon as the terms change, the following ones when views call fetchMore().
+    Unlike TextSearchFilterModel, it doesn’t need the whole history to be
+    loaded in memory. Without search terms, the model is empty.
+    When entries are added to, updated in or removed from the history, the
+    search is run again shortly after.
+*/
+HistorySearchModel::HistorySearchModel(QObject* parent)
+    : QAbstractListModel(parent)
+    , m_sourceModel(0)
+    , m_pageSize(DEFAULT_PAGE_SIZE)
+    , m_pendingRequest(0)
+    , m_exhausted(true)
+{
+    m_restartTimer.setSingleShot(true);
+    m_restartTimer.setInterval(RESTART_DELAY);
+    connect(&m_restartTimer, SIGNAL(timeout()), SLOT(restart()));
+}
+
+QHash<int, QByteArray> HistorySearchModel::roleNames() const
+{
+    static QHash<int, QByteArray> roles;
+    if (roles.isEmpty()) {
+        roles[Url] = "url";
+        roles[Domain] = "domain";
+        roles[Title] = "title";
+        roles[Icon] = "icon";
+        roles[Visits] = "visits";
+        roles[LastVisit] = "lastVisit";
+    }
+    return roles;
+}
+
+int HistorySearchModel::rowCount(const QModelIndex& parent) const
+{
+    Q_UNUSED(parent);
+    return m_results.count();
+}
+
+QVariant HistorySearchModel::data(const QModelIndex& index, int role) const
+{
+    if (!index.isValid()) {
+        return QVariant();
+    }
+    const DbWorker::Entry& entry = m_results.at(index.row());
+    switch (role) {
+    case Url:
+        return entry.url;
+    case Domain:
+        return entry.domain;
+    case Title:
+        return entry.title;
+    case Icon:
+        return entry.icon;
+    case Visits:
+        return entry.visits;
+    case LastVisit:
+        return entry.lastVisit;
+    default:
+        return QVariant();
+    }
+}
+
+bool HistorySearchModel::canFetchMore(const QModelIndex& parent) const
+{
+    Q_UNUSED(parent);
+    return !m_exhausted && (m_pendingRequest == 0);
+}
+
+void HistorySearchModel::fetchMore(const QModelIndex& parent)
+{
+    if (canFetchMore(parent)) {
+        requestPage();
+        Q_EMIT searchingChanged();
+    }
+}
+
+HistoryModel* HistorySearchModel::sourceModel() const
+{
+    return m_sourceModel;
+}
+
+void HistorySearchModel::setSourceModel(HistoryModel* sourceModel)
+{
+    if (sourceModel != m_sourceModel) {
+        if (m_sourceModel != 0) {
+            m_sourceModel->disconnect(this);
+        }
+        m_sourceModel = sourceModel;
+        if (m_sourceModel != 0) {
+            connect(m_sourceModel, SIGNAL(searchFinished(int, const QList<DbWorker::Entry>&)),
+                    SLOT(onSearchFinished(int, const QList<DbWorker::Entry>&)));
+            connect(m_sourceModel, SIGNAL(modelReset()), SLOT(restart()));
+            connect(m_sourceModel, SIGNAL(loaded()), SLOT(restart()));
+            connect(m_sourceModel, SIGNAL(rowsInserted(const QModelIndex&, int, int)),
+                    SLOT(onSourceChanged()));
+            connect(m_sourceModel, SIGNAL(rowsRemoved(const QModelIndex&, int, int)),
+                    SLOT(onSourceChanged()));
+            connect(m_sourceModel, SIGNAL(dataChanged(const QModelIndex&, const QModelIndex&)),
+                    SLOT(onSourceChanged()));
+        }
+        restart();
+        Q_EMIT sourceModelChanged();
+    }
+}
+
+const QStringList& HistorySearchModel::terms() const
+{
+    return m_terms;
+}
+
+void HistorySearchModel::setTerms(const QStringList& terms)
+{
+    if (terms != m_terms) {
+        m_terms = terms;
+        restart();
+        Q_EMIT termsChanged();
+    }
+}
+
+int HistorySearchModel::pageSize() const
+{
+    return m_pageSize;
+}
+
+void HistorySearchModel::setPageSize(int pageSize)
+{
+    if ((pageSize > 0) && (pageSize != m_pageSize)) {
+        m_pageSize = pageSize;
+        Q_EMIT pageSizeChanged();
+    }
+}
+
+bool HistorySearchModel::searching() const
+{
+    return (m_pendingRequest != 0);
+}
+
+QVariantMap HistorySearchModel::get(int row) const
+{
+    QVariantMap item;
+    QHash<int, QByteArray> roles = roleNames();
+
+    QModelIndex modelIndex = index(row, 0);
+    if (modelIndex.isValid()) {
+        Q_FOREACH(int role, roles.keys()) {
+            QString roleName = QString::fromUtf8(roles.value(role));
+            item.insert(roleName, data(modelIndex, role));
+        }
+    }
+    return item;
+}
+
+void HistorySearchModel::onSourceChanged()
+{
+    if (!m_terms.isEmpty() && !m_restartTimer.isActive()) {
+        m_restartTimer.start();
+    }
+}
+
+void HistorySearchModel::restart()
+{
+    m_restartTimer.stop();
+    bool wasSearching = searching();
+    beginResetModel();
+    m_results.clear();
+    m_pendingRequest = 0;
+    m_exhausted = m_terms.isEmpty() || (m_sourceModel == 0);
+    endResetModel();
+    Q_EMIT countChanged();
+    if (!m_exhausted) {
+        requestPage();
+    }
+    if (searching() != wasSearching) {
+        Q_EMIT searchingChanged();
+    }
+}
+
+void HistorySearchModel::requestPage()
+{
+    m_pendingRequest = m_sourceModel->search(m_terms.join(QLatin1Char(' ')), m_results.count(), m_pageSize);
+}
+
+void HistorySearchModel::onSearchFinished(int requestId, const QList<DbWorker::Entry>& results)
+{
+    if (requestId != m_pendingRequest) {
+        // Outdated results, or results of another search on the same history
+        return;
+    }
+    m_pendingRequest = 0;
+    m_exhausted = (results.count() < m_pageSize);
+    if (!results.isEmpty()) {
+        beginInsertRows(QModelIndex(), m_results.count(), m_results.count() + results.count() - 1);
+        m_results.append(results);
+        endInsertRows();
+        Q_EMIT countChanged();
+    }
+    Q_EMIT searchingChanged();
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2020 UBports Foundation
+ *
+ * This file is part of morph-browser.
+ *
+ * morph-browser is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * morph-browser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HISTORY_SEARCH_MODEL_H__
+#define __HISTORY_SEARCH_MODEL_H__
+
+// Qt
+#include <QtCore/QAbstractListModel>
+#include <QtCore/QList>
+#include <QtCore/QStringList>
+#include <QtCore/QTimer>
+
+// local
+#include "history-model.h"
+
+class HistorySearchModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+    Q_PROPERTY(HistoryModel* sourceModel READ sourceModel WRITE setSourceModel NOTIFY sourceModelChanged)
+    Q_PROPERTY(QStringList terms READ terms WRITE setTerms NOTIFY termsChanged)
+    Q_PROPERTY(int pageSize READ pageSize WRITE setPageSize NOTIFY pageSizeChanged)
+    Q_PROPERTY(int count READ rowCount NOTIFY countChanged)
+    Q_PROPERTY(bool searching READ searching NOTIFY searchingChanged)
+
+    Q_ENUMS(Roles)
+
+public:
+    HistorySearchModel(QObject* parent=0);
+
+    enum Roles {
+        Url = HistoryModel::Url,
+        Domain = HistoryModel::Domain,
+        Title = HistoryModel::Title,
+        Icon = HistoryModel::Icon,
+        Visits = HistoryModel::Visits,
+        LastVisit = HistoryModel::LastVisit,
+    };
+
+    // reimplemented from QAbstractListModel
+    QHash<int, QByteArray> roleNames() const;
+    int rowCount(const QModelIndex& parent=QModelIndex()) const;
+    QVariant data(const QModelIndex& index, int role) const;
+    bool canFetchMore(const QModelIndex& parent) const;
+    void fetchMore(const QModelIndex& parent);
+
+    HistoryModel* sourceModel() const;
+    void setSourceModel(HistoryModel* sourceModel);
+
+    const QStringList& terms() const;
+    void setTerms(const QStringList& terms);
+
+    int pageSize() const;
+    void setPageSize(int pageSize);
+
+    bool searching() const;
+
+    Q_INVOKABLE QVariantMap get(int row) const;
+
+Q_SIGNALS:
+    void sourceModelChanged() const;
+    void termsChanged() const;
+    void pageSizeChanged() const;
+    void countChanged() const;
+    void searchingChanged() const;
+
+private Q_SLOTS:
+    void onSearchFinished(int requestId, const QList<DbWorker::Entry>& results);
+    void onSourceChanged();
+    void restart();
+
+private:
+    HistoryModel* m_sourceModel;
+    QStringList m_terms;
+    int m_pageSize;
+    QList<DbWorker::Entry> m_results;
+    int m_pendingRequest;
+    bool m_exhausted;
+    QTimer m_restartTimer;
+
+    void requestPage();
+};
+
+#endif // __HISTORY_SEARCH_MODEL_H__
@@ -18,6 +18,7 @@
 
 #include <QtCore/QAbstractItemModel>
 
+#include "../model-utils.h"
 #include "limit-proxy-model.h"
 
 /*!
@@ -267,18 +268,23 @@ void LimitProxyModel::sourceRowsRemoved(const QModelIndex & /*parent*/, int /*st
     }
 }
 
-QVariantMap LimitProxyModel::get(int i) const
+QVariantMap LimitProxyModel::get(int i, const QStringList& roles) const
 {
-    QVariantMap item;
-    QHash<int, QByteArray> roles = roleNames();
+    return ModelUtils::get(this, i, roles);
+}
 
-    QModelIndex modelIndex = index(i, 0);
-    if (modelIndex.isValid()) {
-        Q_FOREACH(int role, roles.keys()) {
-            QString roleName = QString::fromUtf8(roles.value(role));
-            item.insert(roleName, data(modelIndex, role));
-        }
-    }
-    return item;
+QVariantList LimitProxyModel::getRange(int from, int count, const QStringList& roles) const
+{
+    return ModelUtils::getRange(this, from, count, roles);
+}
+
+QUrl LimitProxyModel::urlAt(int i) const
+{
+    return ModelUtils::urlAt(this, i);
+}
+
+int LimitProxyModel::indexOfUrl(const QUrl& url) const
+{
+    return ModelUtils::indexOfUrl(this, url);
 }
 
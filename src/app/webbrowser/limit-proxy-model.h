@@ -21,6 +21,8 @@
 
 // Qt
 #include <QtCore/QIdentityProxyModel>
+#include <QtCore/QStringList>
+#include <QtCore/QUrl>
 
 class LimitProxyModel : public QIdentityProxyModel
 {
@@ -43,7 +45,10 @@ public:
     int rowCount(const QModelIndex &parent = QModelIndex()) const;
     int unlimitedRowCount(const QModelIndex &parent = QModelIndex()) const;
 
-    Q_INVOKABLE QVariantMap get(int index) const;
+    Q_INVOKABLE QVariantMap get(int index, const QStringList& roles=QStringList()) const;
+    Q_INVOKABLE QVariantList getRange(int from, int count, const QStringList& roles=QStringList()) const;
+    Q_INVOKABLE QUrl urlAt(int index) const;
+    Q_INVOKABLE int indexOfUrl(const QUrl& url) const;
 
 Q_SIGNALS:
     void sourceModelChanged() const;
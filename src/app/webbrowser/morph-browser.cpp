@@ -22,11 +22,13 @@
 #include "history-domainlist-model.h"
 #include "history-lastvisitdatelist-model.h"
 #include "history-model.h"
+#include "history-search-model.h"
 #include "limit-proxy-model.h"
 #include "reparenter.h"
 #include "searchengine.h"
 #include "text-search-filter-model.h"
 #include "tabs-model.h"
+#include "top-sites-model.h"
 #include "morph-browser.h"
 
 // Qt
@@ -66,12 +68,14 @@ bool WebbrowserApp::initialize()
     qmlRegisterSingletonType<HistoryModel>(uri, 0, 1, "HistoryModel", HistoryModel_singleton_factory);
     qmlRegisterType<HistoryDomainListModel>(uri, 0, 1, "HistoryDomainListModel");
     qmlRegisterType<HistoryLastVisitDateListModel>(uri, 0, 1, "HistoryLastVisitDateListModel");
+    qmlRegisterType<HistorySearchModel>(uri, 0, 1, "HistorySearchModel");
     qmlRegisterType<LimitProxyModel>(uri, 0 , 1, "LimitProxyModel");
     qmlRegisterType<TabsModel>(uri, 0, 1, "TabsModel");
     qmlRegisterSingletonType<BookmarksModel>(uri, 0, 1, "BookmarksModel", BookmarksModel_singleton_factory);
     qmlRegisterType<BookmarksFolderListModel>(uri, 0, 1, "BookmarksFolderListModel");
     qmlRegisterType<SearchEngine>(uri, 0, 1, "SearchEngine");
     qmlRegisterType<TextSearchFilterModel>(uri, 0, 1, "TextSearchFilterModel");
+    qmlRegisterType<TopSitesModel>(uri, 0, 1, "TopSitesModel");
     qmlRegisterSingletonType<Reparenter>(uri, 0, 1, "Reparenter", Reparenter_singleton_factory);
 
     QString qmlfile;
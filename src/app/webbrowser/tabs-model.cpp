@@ -20,8 +20,13 @@
 
 // Qt
 #include <QtCore/QDebug>
+#include <QtCore/QMetaObject>
 #include <QtCore/QObject>
 #include <QtCore/QtGlobal>
+#include <QtCore/QVector>
+
+// system
+#include <algorithm>
 
 /*!
     \class TabsModel
@@ -34,6 +39,10 @@
     The model doesn’t own the Tab, so it is the responsibility of whoever
     adds a tab to instantiate the corresponding Tab, and to destroy it after
     it’s removed from the model.
+
+    The metadata of each tab is cached, and refreshed when the tab notifies
+    a change, so that views reading it don’t go through the dynamic property
+    system every time.
 */
 TabsModel::TabsModel(QObject* parent)
     : QAbstractListModel(parent)
@@ -68,16 +77,16 @@ QVariant TabsModel::data(const QModelIndex& index, int role) const
     if (!index.isValid()) {
         return QVariant();
     }
-    QObject* tab = m_tabs.at(index.row());
+    const TabEntry& entry = m_tabs.at(index.row());
     switch (role) {
     case Url:
-        return tab->property("url");
+        return entry.url;
     case Title:
-        return tab->property("title");
+        return entry.title;
     case Icon:
-        return tab->property("icon");
+        return entry.icon;
     case Tab:
-        return QVariant::fromValue(tab);
+        return QVariant::fromValue(entry.tab);
     default:
         return QVariant();
     }
@@ -105,7 +114,7 @@ QObject* TabsModel::currentTab() const
     if (m_tabs.isEmpty() || !checkValidTabIndex(m_currentIndex)) {
         return nullptr;
     }
-    return m_tabs.at(m_currentIndex);
+    return m_tabs.at(m_currentIndex).tab;
 }
 
 /*!
@@ -133,8 +142,18 @@ int TabsModel::insert(QObject* tab, int index)
         return -1;
     }
     index = qMax(qMin(index, m_tabs.count()), 0);
+    const QMetaObject* metaObject = tab->metaObject();
+    TabEntry entry;
+    entry.tab = tab;
+    entry.urlProperty = metaObject->property(metaObject->indexOfProperty("url"));
+    entry.titleProperty = metaObject->property(metaObject->indexOfProperty("title"));
+    entry.iconProperty = metaObject->property(metaObject->indexOfProperty("icon"));
+    entry.url = entry.urlProperty.read(tab);
+    entry.title = entry.titleProperty.read(tab);
+    entry.icon = entry.iconProperty.read(tab);
     beginInsertRows(QModelIndex(), index, index);
-    m_tabs.insert(index, tab);
+    m_tabs.insert(index, entry);
+    updateTabIndexes(index, m_tabs.count() - 1);
     connect(tab, SIGNAL(urlChanged()), SLOT(onUrlChanged()));
     connect(tab, SIGNAL(titleChanged()), SLOT(onTitleChanged()));
     connect(tab, SIGNAL(iconChanged()), SLOT(onIconChanged()));
@@ -172,7 +191,9 @@ QObject* TabsModel::remove(int index)
         return nullptr;
     }
     beginRemoveRows(QModelIndex(), index, index);
-    QObject* tab = m_tabs.takeAt(index);
+    QObject* tab = m_tabs.takeAt(index).tab;
+    m_tabIndexes.remove(tab);
+    updateTabIndexes(index, m_tabs.count() - 1);
     tab->disconnect(this);
     endRemoveRows();
     Q_EMIT countChanged();
@@ -200,7 +221,7 @@ QObject* TabsModel::get(int index) const
     if (!checkValidTabIndex(index)) {
         return nullptr;
     }
-    return m_tabs.at(index);
+    return m_tabs.at(index).tab;
 }
 
 /*!
@@ -209,32 +230,24 @@ QObject* TabsModel::get(int index) const
 */
 int TabsModel::indexOf(QObject* tab) const
 {
-    return m_tabs.indexOf(tab);
+    return m_tabIndexes.value(tab, -1);
 }
 
+/*!
+    Move the tab at index from to index to, as a single move in the model.
+*/
 void TabsModel::move(int from, int to)
 {
     if ((from == to) || !checkValidTabIndex(from) || !checkValidTabIndex(to)) {
         return;
     }
 
-    int diff = to - from;
-    int i = from;
-
-    // Shuffle index along until destination
-    while (i != to) {
-        if (diff > 0) {
-            beginMoveRows(QModelIndex(), i, i, QModelIndex(), i + 2);
-            m_tabs.move(i + 1, i);
-            i += 1;
-        } else {
-            beginMoveRows(QModelIndex(), i, i, QModelIndex(), i - 1);
-            m_tabs.move(i, i - 1);
-            i -= 1;
-        }
-
-        endMoveRows();
-    }
+    // The destination of beginMoveRows() is the row before which the tab is
+    // inserted, counted before it is taken out.
+    beginMoveRows(QModelIndex(), from, from, QModelIndex(), (to > from) ? to + 1 : to);
+    m_tabs.move(from, to);
+    updateTabIndexes(qMin(from, to), qMax(from, to));
+    endMoveRows();
 
     if (m_currentIndex == from) {
         m_currentIndex = to;
@@ -248,6 +261,95 @@ void TabsModel::move(int from, int to)
     }
 }
 
+/*!
+    Remove count tabs starting at the specified index in one go (e.g. to close
+    the tabs to the right of a given tab), and return the corresponding Tabs.
+
+    The range is clamped to the tabs in the model. It is the responsibility of
+    the caller to destroy the corresponding Tabs afterwards.
+*/
+QList<QObject*> TabsModel::removeRange(int index, int count)
+{
+    if (!checkValidTabIndex(index) || (count <= 0)) {
+        return QList<QObject*>();
+    }
+    QList<int> indexes;
+    int last = qMin(index + count, m_tabs.count()) - 1;
+    for (int i = index; i <= last; ++i) {
+        indexes.append(i);
+    }
+    return removeSortedIndexes(indexes);
+}
+
+/*!
+    Remove the tabs at the specified indexes in one go (e.g. to close all the
+    tabs but one), and return the corresponding Tabs in the order they were
+    in the model.
+
+    Invalid and duplicate indexes are ignored. It is the responsibility of the
+    caller to destroy the corresponding Tabs afterwards.
+*/
+QList<QObject*> TabsModel::removeMany(const QList<int>& indexes)
+{
+    QList<int> sorted;
+    sorted.reserve(indexes.count());
+    Q_FOREACH(int index, indexes) {
+        if (checkValidTabIndex(index)) {
+            sorted.append(index);
+        }
+    }
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    return removeSortedIndexes(sorted);
+}
+
+/*!
+    Reorder all the tabs in one go: permutation holds, for each new position,
+    the current index of the tab to move there.
+
+    The current tab stays current, its index is updated to its new position.
+*/
+void TabsModel::reorder(const QList<int>& permutation)
+{
+    int count = m_tabs.count();
+    if (permutation.count() != count) {
+        qWarning() << "Invalid permutation of" << count << "tabs:" << permutation;
+        return;
+    }
+    // Position of each tab once reordered
+    QVector<int> newIndexes(count, -1);
+    for (int i = 0; i < count; ++i) {
+        int index = permutation.at(i);
+        if (!checkValidTabIndex(index) || (newIndexes.at(index) != -1)) {
+            qWarning() << "Invalid permutation of" << count << "tabs:" << permutation;
+            return;
+        }
+        newIndexes[index] = i;
+    }
+
+    Q_EMIT layoutAboutToBeChanged(QList<QPersistentModelIndex>(), QAbstractItemModel::VerticalSortHint);
+    QList<TabEntry> tabs;
+    tabs.reserve(count);
+    Q_FOREACH(int index, permutation) {
+        tabs.append(m_tabs.at(index));
+    }
+    m_tabs = tabs;
+    updateTabIndexes(0, count - 1);
+    QModelIndexList from = persistentIndexList();
+    QModelIndexList to;
+    to.reserve(from.count());
+    Q_FOREACH(const QModelIndex& index, from) {
+        to.append(this->index(newIndexes.at(index.row()), 0));
+    }
+    changePersistentIndexList(from, to);
+    Q_EMIT layoutChanged(QList<QPersistentModelIndex>(), QAbstractItemModel::VerticalSortHint);
+
+    if ((m_currentIndex != -1) && (newIndexes.at(m_currentIndex) != m_currentIndex)) {
+        m_currentIndex = newIndexes.at(m_currentIndex);
+        Q_EMIT currentIndexChanged();
+    }
+}
+
 bool TabsModel::checkValidTabIndex(int index) const
 {
     if ((index < 0) || (index >= m_tabs.count())) {
@@ -256,10 +358,96 @@ bool TabsModel::checkValidTabIndex(int index) const
     return true;
 }
 
+/*
+    Record the position of the tabs in the given range of rows, after they
+    were shifted by an insertion, a removal or a move.
+*/
+void TabsModel::updateTabIndexes(int first, int last)
+{
+    for (int i = first; i <= last; ++i) {
+        m_tabIndexes.insert(m_tabs.at(i).tab, i);
+    }
+}
+
+/*
+    Remove the tabs at the given valid indexes, sorted in ascending order
+    without duplicates. Each run of contiguous tabs is removed as one range of
+    rows, the count and the current index are updated once at the end.
+*/
+QList<QObject*> TabsModel::removeSortedIndexes(const QList<int>& indexes)
+{
+    QList<QObject*> removed;
+    if (indexes.isEmpty()) {
+        return removed;
+    }
+    int previousCurrentIndex = m_currentIndex;
+    bool currentRemoved = false;
+    int removedBeforeCurrent = 0;
+
+    int last = indexes.count() - 1;
+    while (last >= 0) {
+        // Remove the runs from the end, so that the indexes of the next ones
+        // remain valid
+        int first = last;
+        while ((first > 0) && (indexes.at(first - 1) == indexes.at(first) - 1)) {
+            --first;
+        }
+        int firstRow = indexes.at(first);
+        int lastRow = indexes.at(last);
+        if ((m_currentIndex >= firstRow) && (m_currentIndex <= lastRow)) {
+            currentRemoved = true;
+        }
+        if (lastRow < m_currentIndex) {
+            removedBeforeCurrent += lastRow - firstRow + 1;
+        } else if (firstRow < m_currentIndex) {
+            removedBeforeCurrent += m_currentIndex - firstRow;
+        }
+        beginRemoveRows(QModelIndex(), firstRow, lastRow);
+        for (int row = lastRow; row >= firstRow; --row) {
+            QObject* tab = m_tabs.takeAt(row).tab;
+            m_tabIndexes.remove(tab);
+            tab->disconnect(this);
+            removed.prepend(tab);
+        }
+        updateTabIndexes(firstRow, m_tabs.count() - 1);
+        endRemoveRows();
+        last = first - 1;
+    }
+    Q_EMIT countChanged();
+
+    // As with remove(), if the current tab was removed the following one
+    // (if any) is made current, otherwise the preceding one.
+    m_currentIndex -= removedBeforeCurrent;
+    if (currentRemoved && (m_currentIndex >= m_tabs.count())) {
+        m_currentIndex = m_tabs.count() - 1;
+    }
+    if (m_currentIndex != previousCurrentIndex) {
+        Q_EMIT currentIndexChanged();
+    }
+    if (currentRemoved) {
+        Q_EMIT currentTabChanged();
+    }
+    return removed;
+}
+
 void TabsModel::onDataChanged(QObject* tab, int role)
 {
-    int index = m_tabs.indexOf(tab);
+    int index = m_tabIndexes.value(tab, -1);
     if (checkValidTabIndex(index)) {
+        TabEntry& entry = m_tabs[index];
+        switch (role) {
+        case Url:
+            entry.url = entry.urlProperty.read(tab);
+            break;
+        case Title:
+            entry.title = entry.titleProperty.read(tab);
+            break;
+        case Icon:
+            entry.icon = entry.iconProperty.read(tab);
+            break;
+        default:
+            break;
+        }
         Q_EMIT dataChanged(this->index(index, 0), this->index(index, 0), QVector<int>() << role);
     }
 }
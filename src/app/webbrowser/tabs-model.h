@@ -21,7 +21,10 @@
 
 // Qt
 #include <QtCore/QAbstractListModel>
+#include <QtCore/QHash>
 #include <QtCore/QList>
+#include <QtCore/QMetaProperty>
+#include <QtCore/QVariant>
 
 class QObject;
 
@@ -62,6 +65,9 @@ public:
     Q_INVOKABLE QObject* get(int index) const;
     Q_INVOKABLE int indexOf(QObject* tab) const;
     Q_INVOKABLE void move(int from, int to);
+    Q_INVOKABLE QList<QObject*> removeRange(int index, int count);
+    Q_INVOKABLE QList<QObject*> removeMany(const QList<int>& indexes);
+    Q_INVOKABLE void reorder(const QList<int>& permutation);
 
 Q_SIGNALS:
     void currentIndexChanged() const;
@@ -74,11 +80,26 @@ private Q_SLOTS:
     void onIconChanged();
 
 private:
-    QList<QObject*> m_tabs;
+    struct TabEntry {
+        QObject* tab;
+        // Handles on the properties of the tab, resolved once when it is added
+        QMetaProperty urlProperty;
+        QMetaProperty titleProperty;
+        QMetaProperty iconProperty;
+        // Last known values of the properties
+        QVariant url;
+        QVariant title;
+        QVariant icon;
+    };
+
+    QList<TabEntry> m_tabs;
+    QHash<QObject*, int> m_tabIndexes;
     int m_currentIndex;
 
     bool checkValidTabIndex(int index) const;
     void setCurrentIndexNoCheck(int index);
+    void updateTabIndexes(int first, int last);
+    QList<QObject*> removeSortedIndexes(const QList<int>& indexes);
     void onDataChanged(QObject* tab, int role);
 };
 
@@ -0,0 +1,475 @@
+/*
+ * Copyright 2020 UBports Foundation
+ *
+ * This file is part of morph-browser.
+ *
+ * morph-browser is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * morph-browser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "top-sites-model.h"
+
+// Qt
+#include <QtCore/QCryptographicHash>
+
+// system
+#include <cmath>
+
+static const int DEFAULT_LIMIT = 10;
+
+// The weight of visits halves every 30 days
+static const double FRECENCY_HALF_LIFE = 30 * 24 * 60 * 60;
+
+static QString urlHash(const QUrl& url)
+{
+    return QString::fromLatin1(QCryptographicHash::hash(url.toString().toUtf8(),
+                                                        QCryptographicHash::Md5).toHex());
+}
+
+/*!
+    \class TopSitesModel
+    \brief List model that exposes the most frequently and recently visited
+           entries of a HistoryModel.
+
+    TopSitesModel keeps the (at most) limit entries of the source model that
+    are not hidden and have the highest frecency, i.e. their number of visits
+    weighed by how recent the last visit was. Entries are sorted by
+    decreasing frecency.
+
+    The top entries are updated incrementally as entries are added to or
+    updated in the source model; the whole source model is scanned again
+    only when it is reset or when a top entry is removed or hidden. Changes
+    in rank are notified as row moves, insertions and removals, the model
+    is reset only when the source model is.
+    When the source model is virtualized, its entries are not all in memory:
+    the top entries are read from its database in the background instead of
+    scanning it (see HistoryModel::fetchTopEntries()), and changes are
+    notified once they are read.
+    Testing whether an URL (or the MD5 hash of an URL, as used to name
+    preview files) is among the top entries takes constant time.
+    The source model stores URLs in canonical form: URLs are canonicalized
+    before they are tested, and hashes must be those of canonical URLs (see
+    HistoryModel::canonicalUrl()).
+*/
+TopSitesModel::TopSitesModel(QObject* parent)
+    : QAbstractListModel(parent)
+    , m_sourceModel(0)
+    , m_limit(DEFAULT_LIMIT)
+    , m_rebuildNeeded(false)
+    , m_topEntriesRequest(0)
+    , m_changedSinceRequest(false)
+{
+}
+
+QHash<int, QByteArray> TopSitesModel::roleNames() const
+{
+    static QHash<int, QByteArray> roles;
+    if (roles.isEmpty()) {
+        roles[Url] = "url";
+        roles[Domain] = "domain";
+        roles[Title] = "title";
+        roles[Icon] = "icon";
+        roles[Visits] = "visits";
+        roles[LastVisit] = "lastVisit";
+    }
+    return roles;
+}
+
+int TopSitesModel::rowCount(const QModelIndex& parent) const
+{
+    Q_UNUSED(parent);
+    return m_sites.count();
+}
+
+QVariant TopSitesModel::data(const QModelIndex& index, int role) const
+{
+    if (!index.isValid()) {
+        return QVariant();
+    }
+    const TopSite& site = m_sites.at(index.row());
+    switch (role) {
+    case Url:
+        return site.url;
+    case Domain:
+        return site.domain;
+    case Title:
+        return site.title;
+    case Icon:
+        return site.icon;
+    case Visits:
+        return site.visits;
+    case LastVisit:
+        return site.lastVisit;
+    default:
+        return QVariant();
+    }
+}
+
+HistoryModel* TopSitesModel::sourceModel() const
+{
+    return m_sourceModel;
+}
+
+void TopSitesModel::setSourceModel(HistoryModel* sourceModel)
+{
+    if (sourceModel != m_sourceModel) {
+        if (m_sourceModel != 0) {
+            m_sourceModel->disconnect(this);
+        }
+        m_sourceModel = sourceModel;
+        if (m_sourceModel != 0) {
+            connect(m_sourceModel, SIGNAL(rowsInserted(const QModelIndex&, int, int)),
+                    SLOT(onRowsInserted(const QModelIndex&, int, int)));
+            connect(m_sourceModel, SIGNAL(rowsAboutToBeRemoved(const QModelIndex&, int, int)),
+                    SLOT(onRowsAboutToBeRemoved(const QModelIndex&, int, int)));
+            connect(m_sourceModel, SIGNAL(rowsRemoved(const QModelIndex&, int, int)),
+                    SLOT(onRowsRemoved()));
+            connect(m_sourceModel, SIGNAL(dataChanged(const QModelIndex&, const QModelIndex&)),
+                    SLOT(onDataChanged(const QModelIndex&, const QModelIndex&)));
+            connect(m_sourceModel, SIGNAL(modelReset()), SLOT(reset()));
+            connect(m_sourceModel, SIGNAL(topEntriesFetched(int, const QList<DbWorker::Entry>&)),
+                    SLOT(onTopEntriesFetched(int, const QList<DbWorker::Entry>&)));
+            connect(m_sourceModel, SIGNAL(entryHiddenChanged(const QUrl&, bool)),
+                    SLOT(onEntryHiddenChanged(const QUrl&, bool)));
+        }
+        m_topEntriesRequest = 0;
+        reset();
+        Q_EMIT sourceModelChanged();
+    }
+}
+
+int TopSitesModel::limit() const
+{
+    return m_limit;
+}
+
+void TopSitesModel::setLimit(int limit)
+{
+    if (limit != m_limit) {
+        m_limit = limit;
+        rebuild();
+        Q_EMIT limitChanged();
+    }
+}
+
+QVariantMap TopSitesModel::get(int row) const
+{
+    QVariantMap item;
+    QHash<int, QByteArray> roles = roleNames();
+
+    QModelIndex modelIndex = index(row, 0);
+    if (modelIndex.isValid()) {
+        Q_FOREACH(int role, roles.keys()) {
+            QString roleName = QString::fromUtf8(roles.value(role));
+            item.insert(roleName, data(modelIndex, role));
+        }
+    }
+    return item;
+}
+
+bool TopSitesModel::contains(const QUrl& url) const
+{
+    return m_urls.contains((m_sourceModel != 0) ? m_sourceModel->canonicalUrl(url) : url);
+}
+
+/*!
+    Whether the top entries contain an URL whose MD5 hash (hexadecimal,
+    as computed by Qt.md5() in QML) is the given one. A hash can't be
+    canonicalized: it must be the hash of the canonical URL.
+*/
+bool TopSitesModel::containsHash(const QString& hash) const
+{
+    return m_hashes.contains(hash);
+}
+
+/*!
+    The frecency of an entry is its number of visits, halved for every
+    FRECENCY_HALF_LIFE elapsed since its last visit.
+
+    The ratio between the frecency of two entries doesn’t depend on the
+    current time, so the score used to rank entries is computed relatively
+    to the epoch (as a logarithm, to avoid overflows): it remains valid as
+    time passes.
+*/
+double TopSitesModel::frecency(int visits, const QDateTime& lastVisit)
+{
+    return std::log2(double(qMax(visits, 1))) + (lastVisit.toMSecsSinceEpoch() / 1000.0) / FRECENCY_HALF_LIFE;
+}
+
+bool TopSitesModel::siteAt(int sourceRow, TopSite* site) const
+{
+    QModelIndex index = m_sourceModel->index(sourceRow, 0);
+    if (m_sourceModel->data(index, HistoryModel::Hidden).toBool()) {
+        return false;
+    }
+    site->url = m_sourceModel->data(index, HistoryModel::Url).toUrl();
+    if (site->url.isEmpty()) {
+        // Not in memory (virtualized source model)
+        return false;
+    }
+    site->domain = m_sourceModel->data(index, HistoryModel::Domain).toString();
+    site->title = m_sourceModel->data(index, HistoryModel::Title).toString();
+    site->icon = m_sourceModel->data(index, HistoryModel::Icon).toUrl();
+    site->visits = m_sourceModel->data(index, HistoryModel::Visits).toInt();
+    site->lastVisit = m_sourceModel->data(index, HistoryModel::LastVisit).toDateTime();
+    site->score = frecency(site->visits, site->lastVisit);
+    return true;
+}
+
+void TopSitesModel::insertBounded(QList<TopSite>& sites, const TopSite& site) const
+{
+    for (int i = 0; i < sites.count(); ++i) {
+        if (sites.at(i).url == site.url) {
+            sites.removeAt(i);
+            break;
+        }
+    }
+    if ((sites.count() >= m_limit) && (site.score <= sites.last().score)) {
+        return;
+    }
+    int row = 0;
+    while ((row < sites.count()) && (sites.at(row).score >= site.score)) {
+        ++row;
+    }
+    sites.insert(row, site);
+    while (sites.count() > m_limit) {
+        sites.removeLast();
+    }
+}
+
+QList<TopSitesModel::TopSite> TopSitesModel::topSites() const
+{
+    QList<TopSite> sites;
+    if ((m_sourceModel != 0) && (m_limit > 0)) {
+        int count = m_sourceModel->rowCount();
+        for (int i = 0; i < count; ++i) {
+            TopSite site;
+            if (siteAt(i, &site)) {
+                insertBounded(sites, site);
+            }
+        }
+    }
+    return sites;
+}
+
+/*
+    Request the top entries of a virtualized source model, they are
+    published once read (see onTopEntriesFetched()). Return false if the
+    source model is not virtualized.
+*/
+bool TopSitesModel::fetchTopSites()
+{
+    if ((m_sourceModel == 0) || !m_sourceModel->virtualized()) {
+        return false;
+    }
+    m_topEntriesRequest = m_sourceModel->fetchTopEntries(m_limit);
+    m_changedSinceRequest = false;
+    return true;
+}
+
+void TopSitesModel::noteSourceChange()
+{
+    if (m_topEntriesRequest != 0) {
+        // The entries being read may not account for the change
+        m_changedSinceRequest = true;
+    }
+}
+
+void TopSitesModel::rebuild()
+{
+    m_rebuildNeeded = false;
+    if (!fetchTopSites()) {
+        publish(topSites());
+    }
+}
+
+void TopSitesModel::reset()
+{
+    m_rebuildNeeded = false;
+    if (fetchTopSites()) {
+        return;
+    }
+    int previousCount = m_sites.count();
+    beginResetModel();
+    m_sites = topSites();
+    m_urls.clear();
+    m_hashes.clear();
+    Q_FOREACH(const TopSite& site, m_sites) {
+        m_urls.insert(site.url);
+        m_hashes.insert(urlHash(site.url));
+    }
+    endResetModel();
+    if (m_sites.count() != previousCount) {
+        Q_EMIT countChanged();
+    }
+}
+
+void TopSitesModel::onRowsInserted(const QModelIndex& parent, int start, int end)
+{
+    Q_UNUSED(parent);
+    if (m_limit <= 0) {
+        return;
+    }
+    noteSourceChange();
+    QList<TopSite> sites = m_sites;
+    for (int i = start; i <= end; ++i) {
+        TopSite site;
+        if (siteAt(i, &site)) {
+            insertBounded(sites, site);
+        }
+    }
+    publish(sites);
+}
+
+void TopSitesModel::onRowsAboutToBeRemoved(const QModelIndex& parent, int start, int end)
+{
+    Q_UNUSED(parent);
+    for (int i = start; (i <= end) && !m_rebuildNeeded; ++i) {
+        QUrl url = m_sourceModel->data(m_sourceModel->index(i, 0), HistoryModel::Url).toUrl();
+        // Removed entries not in memory (virtualized source model) may be
+        // top entries
+        m_rebuildNeeded = url.isEmpty() || m_urls.contains(url);
+    }
+}
+
+void TopSitesModel::onRowsRemoved()
+{
+    noteSourceChange();
+    if (m_rebuildNeeded) {
+        // Another entry needs to take the place of the removed one
+        rebuild();
+    }
+}
+
+void TopSitesModel::onDataChanged(const QModelIndex& topLeft, const QModelIndex& bottomRight)
+{
+    if (m_limit <= 0) {
+        return;
+    }
+    noteSourceChange();
+    QList<TopSite> sites = m_sites;
+    for (int i = topLeft.row(); i <= bottomRight.row(); ++i) {
+        TopSite site;
+        if (siteAt(i, &site)) {
+            int row = 0;
+            while ((row < sites.count()) && (sites.at(row).url != site.url)) {
+                ++row;
+            }
+            if ((row < sites.count()) && (site.score < sites.at(row).score)) {
+                // An entry outside of the top ones may now rank higher
+                rebuild();
+                return;
+            }
+            insertBounded(sites, site);
+        } else {
+            QUrl url = m_sourceModel->data(m_sourceModel->index(i, 0), HistoryModel::Url).toUrl();
+            if (m_urls.contains(url)) {
+                // Hidden
+                rebuild();
+                return;
+            }
+        }
+    }
+    publish(sites);
+}
+
+void TopSitesModel::onTopEntriesFetched(int requestId, const QList<DbWorker::Entry>& entries)
+{
+    if (requestId != m_topEntriesRequest) {
+        return;
+    }
+    m_topEntriesRequest = 0;
+    if (m_changedSinceRequest) {
+        fetchTopSites();
+        return;
+    }
+    QList<TopSite> sites;
+    Q_FOREACH(const DbWorker::Entry& entry, entries) {
+        TopSite site;
+        site.url = entry.url;
+        site.domain = entry.domain;
+        site.title = entry.title;
+        site.icon = entry.icon;
+        site.visits = entry.visits;
+        site.lastVisit = entry.lastVisit.toUTC();
+        site.score = frecency(site.visits, site.lastVisit);
+        sites.append(site);
+    }
+    publish(sites);
+}
+
+void TopSitesModel::onEntryHiddenChanged(const QUrl& url, bool hidden)
+{
+    // Entries not in memory in a virtualized source model are hidden
+    // without dataChanged() being emitted
+    if (m_sourceModel->virtualized() && (!hidden || m_urls.contains(url))) {
+        rebuild();
+    }
+}
+
+/*
+    Turn the current top entries into the given ones, notifying views of the
+    entries that left the top ones, moved, entered them or changed.
+*/
+void TopSitesModel::publish(const QList<TopSite>& sites)
+{
+    int previousCount = m_sites.count();
+    QSet<QUrl> urls;
+    Q_FOREACH(const TopSite& site, sites) {
+        urls.insert(site.url);
+    }
+
+    for (int i = m_sites.count() - 1; i >= 0; --i) {
+        if (!urls.contains(m_sites.at(i).url)) {
+            beginRemoveRows(QModelIndex(), i, i);
+            QUrl url = m_sites.takeAt(i).url;
+            m_urls.remove(url);
+            m_hashes.remove(urlHash(url));
+            endRemoveRows();
+        }
+    }
+
+    // Rows before i are in their final order
+    for (int i = 0; i < sites.count(); ++i) {
+        const TopSite& site = sites.at(i);
+        if ((i < m_sites.count()) && (m_sites.at(i).url == site.url)) {
+            // Already in place
+        } else if (m_urls.contains(site.url)) {
+            int from = i + 1;
+            while (m_sites.at(from).url != site.url) {
+                ++from;
+            }
+            beginMoveRows(QModelIndex(), from, from, QModelIndex(), i);
+            m_sites.move(from, i);
+            endMoveRows();
+        } else {
+            beginInsertRows(QModelIndex(), i, i);
+            m_sites.insert(i, site);
+            m_urls.insert(site.url);
+            m_hashes.insert(urlHash(site.url));
+            endInsertRows();
+            continue;
+        }
+        TopSite& current = m_sites[i];
+        bool changed = (current.title != site.title) || (current.icon != site.icon) ||
+                       (current.domain != site.domain) || (current.visits != site.visits) ||
+                       (current.lastVisit != site.lastVisit);
+        current = site;
+        if (changed) {
+            Q_EMIT dataChanged(index(i, 0), index(i, 0));
+        }
+    }
+
+    if (m_sites.count() != previousCount) {
+        Q_EMIT countChanged();
+    }
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright 2020 UBports Foundation
+ *
+ * This file is part of morph-browser.
+ *
+ * morph-browser is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * morph-browser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TOP_SITES_MODEL_H__
+#define __TOP_SITES_MODEL_H__
+
+// Qt
+#include <QtCore/QAbstractListModel>
+#include <QtCore/QDateTime>
+#include <QtCore/QList>
+#include <QtCore/QSet>
+#include <QtCore/QString>
+#include <QtCore/QUrl>
+
+// local
+#include "history-model.h"
+
+class TopSitesModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+    Q_PROPERTY(HistoryModel* model READ sourceModel WRITE setSourceModel NOTIFY sourceModelChanged)
+    Q_PROPERTY(int limit READ limit WRITE setLimit NOTIFY limitChanged)
+    Q_PROPERTY(int count READ rowCount NOTIFY countChanged)
+
+    Q_ENUMS(Roles)
+
+public:
+    TopSitesModel(QObject* parent=0);
+
+    enum Roles {
+        Url = HistoryModel::Url,
+        Domain = HistoryModel::Domain,
+        Title = HistoryModel::Title,
+        Icon = HistoryModel::Icon,
+        Visits = HistoryModel::Visits,
+        LastVisit = HistoryModel::LastVisit,
+    };
+
+    // reimplemented from QAbstractListModel
+    QHash<int, QByteArray> roleNames() const;
+    int rowCount(const QModelIndex& parent=QModelIndex()) const;
+    QVariant data(const QModelIndex& index, int role) const;
+
+    HistoryModel* sourceModel() const;
+    void setSourceModel(HistoryModel* sourceModel);
+
+    int limit() const;
+    void setLimit(int limit);
+
+    Q_INVOKABLE QVariantMap get(int row) const;
+    Q_INVOKABLE bool contains(const QUrl& url) const;
+    Q_INVOKABLE bool containsHash(const QString& hash) const;
+
+    static double frecency(int visits, const QDateTime& lastVisit);
+
+Q_SIGNALS:
+    void sourceModelChanged() const;
+    void limitChanged() const;
+    void countChanged() const;
+
+private Q_SLOTS:
+    void onRowsInserted(const QModelIndex& parent, int start, int end);
+    void onRowsAboutToBeRemoved(const QModelIndex& parent, int start, int end);
+    void onRowsRemoved();
+    void onDataChanged(const QModelIndex& topLeft, const QModelIndex& bottomRight);
+    void onTopEntriesFetched(int requestId, const QList<DbWorker::Entry>& entries);
+    void onEntryHiddenChanged(const QUrl& url, bool hidden);
+    void rebuild();
+    void reset();
+
+private:
+    struct TopSite {
+        QUrl url;
+        QString domain;
+        QString title;
+        QUrl icon;
+        int visits;
+        QDateTime lastVisit;
+        double score;
+    };
+
+    HistoryModel* m_sourceModel;
+    int m_limit;
+    // Sorted by decreasing score, at most m_limit entries
+    QList<TopSite> m_sites;
+    QSet<QUrl> m_urls;
+    QSet<QString> m_hashes;
+    bool m_rebuildNeeded;
+    // Pending request for the top entries of a virtualized source model,
+    // and whether the source model changed since it was sent
+    int m_topEntriesRequest;
+    bool m_changedSinceRequest;
+
+    bool siteAt(int sourceRow, TopSite* site) const;
+    QList<TopSite> topSites() const;
+    bool fetchTopSites();
+    void noteSourceChange();
+    void insertBounded(QList<TopSite>& sites, const TopSite& site) const;
+    void publish(const QList<TopSite>& sites);
+};
+
+#endif // __TOP_SITES_MODEL_H__
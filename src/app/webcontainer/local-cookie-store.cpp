@@ -16,6 +16,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "database-utils.h"
 #include "local-cookie-store.h"
 
 #include <QDebug>
@@ -51,9 +52,8 @@ LocalCookieStore::LocalCookieStore(QObject* parent):
 void LocalCookieStore::doGetCookies()
 {
     Cookies cookies;
-    m_db.setDatabaseName(m_dbPath);
-
-    if (Q_UNLIKELY(!m_db.open())) {
+    // The cookie database is shared with the web engine, keep its journal mode
+    if (Q_UNLIKELY(!DatabaseUtils::openDatabase(m_db, m_dbPath, QStringLiteral("shared")))) {
         qCritical() << "Could not open cookie database:" << m_dbPath
             << m_db.lastError();
         return;
@@ -142,9 +142,7 @@ bool LocalCookieStore::createDb()
 
 void LocalCookieStore::doSetCookies(const Cookies& parsedCookies)
 {
-    m_db.setDatabaseName(m_dbPath);
-
-    if (!m_db.open()) {
+    if (!DatabaseUtils::openDatabase(m_db, m_dbPath, QStringLiteral("shared"))) {
         qCritical() << "Could not open cookie database:" <<
             m_dbPath << m_db.lastError().text();
         return;
@@ -262,6 +262,12 @@ private Q_SLOTS:
         BookmarksFolderModel* entries = folderMap.value("entries").value<BookmarksFolderModel*>();
         QCOMPARE(entries->rowCount(), 1);
         QCOMPARE(entries->data(entries->index(0, 0), BookmarksModel::Url).toUrl(), QUrl("http://example.org/"));
+        folderMap = model->get(1, QStringList() << "folder");
+        QCOMPARE(folderMap.count(), 1);
+        QCOMPARE(folderMap.value("folder").toString(), QString("AnotherFolder"));
+        QVariantList folders = model->getRange(0, 3, QStringList() << "folder");
+        QCOMPARE(folders.count(), 3);
+        QCOMPARE(folders.at(1).toMap().value("folder").toString(), QString("AnotherFolder"));
     }
 };
 
@@ -18,7 +18,10 @@
 
 // Qt
 #include <QtCore/QDir>
+#include <QtCore/QTemporaryDir>
 #include <QtCore/QTemporaryFile>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlQuery>
 #include <QtTest/QSignalSpy>
 #include <QtTest/QtTest>
 
@@ -32,11 +35,39 @@ class BookmarksModelTests : public QObject
 private:
     BookmarksModel* model;
 
+    void populate(int bookmarks, int folders)
+    {
+        for (int i = 0; i < bookmarks; ++i) {
+            model->add(QUrl(QStringLiteral("http://example.org/%1").arg(i)),
+                       QStringLiteral("Example %1").arg(i), QUrl(),
+                       QStringLiteral("Folder %1").arg(i % folders));
+        }
+    }
+
+    QVariant dataOf(const QUrl& url, int role) const
+    {
+        for (int i = 0; i < model->rowCount(); ++i) {
+            QModelIndex index = model->index(i, 0);
+            if (model->data(index, BookmarksModel::Url).toUrl() == url) {
+                return model->data(index, role);
+            }
+        }
+        return QVariant();
+    }
+
+    // The database is read asynchronously
+    void setDatabasePath(const QString& path)
+    {
+        QSignalSpy spyLoaded(model, SIGNAL(loaded()));
+        model->setDatabasePath(path);
+        QTRY_COMPARE(spyLoaded.count(), 1);
+    }
+
 private Q_SLOTS:
     void init()
     {
         model = new BookmarksModel;
-        model->setDatabasePath(":memory:");
+        setDatabasePath(":memory:");
     }
 
     void cleanup()
@@ -200,15 +231,49 @@ private Q_SLOTS:
         QString fileName = tempFile.fileName();
         delete model;
         model = new BookmarksModel;
-        model->setDatabasePath(fileName);
+        setDatabasePath(fileName);
         model->add(QUrl("http://example.org/"), "Example Domain", QUrl(), "");
         model->add(QUrl("http://ubuntu.com/"), "Ubuntu", QUrl(), "");
         delete model;
         model = new BookmarksModel;
-        model->setDatabasePath(fileName);
+        setDatabasePath(fileName);
         QCOMPARE(model->rowCount(), 2);
     }
 
+    void shouldMergeBookmarksAddedWhileLoading()
+    {
+        QTemporaryFile tempFile;
+        tempFile.open();
+        QString fileName = tempFile.fileName();
+        setDatabasePath(fileName);
+        model->add(QUrl("http://example.org/"), "Example Domain", QUrl(), "Work");
+        model->add(QUrl("http://ubuntu.com/"), "Ubuntu", QUrl(), "");
+        delete model;
+
+        model = new BookmarksModel;
+        QSignalSpy spyLoaded(model, SIGNAL(loaded()));
+        model->setDatabasePath(fileName);
+        model->add(QUrl("http://example.org/"), "Example", QUrl(), "");
+        model->add(QUrl("http://example.com/"), "Example Com", QUrl(), "Work");
+        model->add(QUrl("http://wikipedia.org/"), "Wikipedia", QUrl(), "Other");
+        QCOMPARE(model->rowCount(), 3);
+        QTRY_COMPARE(spyLoaded.count(), 1);
+        QCOMPARE(model->rowCount(), 4);
+        QCOMPARE(model->folders().count(), 3);
+        QCOMPARE(dataOf(QUrl("http://example.org/"), BookmarksModel::Title).toString(), QString("Example"));
+        QCOMPARE(dataOf(QUrl("http://ubuntu.com/"), BookmarksModel::Title).toString(), QString("Ubuntu"));
+
+        // The database holds a single row per URL, and a single folder per name
+        delete model;
+        model = new BookmarksModel;
+        setDatabasePath(fileName);
+        QCOMPARE(model->rowCount(), 4);
+        QCOMPARE(model->folders().count(), 3);
+        QCOMPARE(dataOf(QUrl("http://example.org/"), BookmarksModel::Title).toString(), QString("Example"));
+        QCOMPARE(dataOf(QUrl("http://example.com/"), BookmarksModel::Folder).toString(), QString("Work"));
+        QCOMPARE(dataOf(QUrl("http://wikipedia.org/"), BookmarksModel::Folder).toString(), QString("Other"));
+    }
+
     void shouldCountNumberOfEntries()
     {
         QSignalSpy spyCount(model, SIGNAL(rowCountChanged()));
@@ -224,6 +289,73 @@ private Q_SLOTS:
         QCOMPARE(spyCount.count(), 3);
     }
 
+    void shouldMigrateLegacySchemas_data()
+    {
+        QTest::addColumn<QStringList>("statements");
+        QTest::newRow("without created and folderId") << (QStringList()
+            << "CREATE TABLE bookmarks (url VARCHAR, title VARCHAR, icon VARCHAR);"
+            << "INSERT INTO bookmarks VALUES ('http://example.org/', 'Example', '');");
+        QTest::newRow("without folderId") << (QStringList()
+            << "CREATE TABLE bookmarks (url VARCHAR, title VARCHAR, icon VARCHAR, created INTEGER);"
+            << "INSERT INTO bookmarks VALUES ('http://example.org/', 'Example', '', 0);");
+        QTest::newRow("unversioned") << (QStringList()
+            << "CREATE TABLE bookmarks (url VARCHAR, title VARCHAR, icon VARCHAR, created INTEGER, folderId INTEGER);"
+            << "CREATE TABLE folders (folderId INTEGER PRIMARY KEY, folder VARCHAR);"
+            << "INSERT INTO bookmarks VALUES ('http://example.org/', 'Example', '', 0, NULL);");
+    }
+
+    void shouldMigrateLegacySchemas()
+    {
+        QFETCH(QStringList, statements);
+        QTemporaryFile tempFile;
+        tempFile.open();
+        QString fileName = tempFile.fileName();
+        {
+            QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), "tst_bookmarks");
+            database.setDatabaseName(fileName);
+            database.open();
+            Q_FOREACH(const QString& statement, statements) {
+                QSqlQuery query(database);
+                QVERIFY(query.exec(statement));
+            }
+            database.close();
+        }
+        QSqlDatabase::removeDatabase("tst_bookmarks");
+
+        setDatabasePath(fileName);
+        QCOMPARE(model->rowCount(), 1);
+        QCOMPARE(model->data(model->index(0, 0), BookmarksModel::Url).toUrl(), QUrl("http://example.org/"));
+        model->add(QUrl("http://example.com/"), "Example", QUrl(), "folder");
+        QCOMPARE(model->rowCount(), 2);
+        // Writes are asynchronous, deleting the model flushes them
+        delete model;
+        model = new BookmarksModel;
+
+        {
+            QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), "tst_bookmarks");
+            database.setDatabaseName(fileName);
+            database.open();
+            QSqlQuery query(database);
+            query.exec("PRAGMA user_version;");
+            QVERIFY(query.next());
+            QCOMPARE(query.value(0).toInt(), 2);
+            query.exec("SELECT name FROM sqlite_master WHERE type='index';");
+            QStringList indexes;
+            while (query.next()) {
+                indexes << query.value(0).toString();
+            }
+            QVERIFY(indexes.contains("bookmarks_url"));
+            QVERIFY(indexes.contains("bookmarks_created"));
+            QVERIFY(indexes.contains("bookmarks_folderId"));
+            QVERIFY(indexes.contains("folders_folder"));
+            query.exec("SELECT folderId FROM bookmarks WHERE url='http://example.com/';");
+            QVERIFY(query.next());
+            QVERIFY(query.value(0).toInt() > 0);
+            database.close();
+        }
+        QSqlDatabase::removeDatabase("tst_bookmarks");
+    }
+
     void shouldPopulateModelWithExistingFolders()
     {
         QTemporaryFile tempFile;
@@ -232,7 +364,7 @@ private Q_SLOTS:
         delete model;
         model = new BookmarksModel;
         QSignalSpy spy(model, SIGNAL(folderAdded(QString)));
-        model->setDatabasePath(fileName);
+        setDatabasePath(fileName);
         model->addFolder("SampleFolder");
         model->addFolder("AnotherFolder");
         // The empty folder is added by default
@@ -241,10 +373,227 @@ private Q_SLOTS:
         delete model;
         model = new BookmarksModel;
         QSignalSpy spyPopulate(model, SIGNAL(folderAdded(QString)));
-        model->setDatabasePath(fileName);
+        setDatabasePath(fileName);
         QCOMPARE(spyPopulate.count(), 3);
         QCOMPARE(model->folders().count(), 3);
     }
+
+    void shouldAssignDistinctFolderIds()
+    {
+        int first = model->addFolder("SampleFolder");
+        int second = model->addFolder("AnotherFolder");
+        QVERIFY(first > 0);
+        QVERIFY(second > 0);
+        QVERIFY(first != second);
+        model->add(QUrl("http://example.org/"), "Example Domain", QUrl(), "AnotherFolder");
+        QCOMPARE(model->folders().count(), 3);
+        QCOMPARE(model->data(model->index(0, 0), BookmarksModel::Folder).toString(), QString("AnotherFolder"));
+    }
+
+    void shouldImportBookmarks()
+    {
+        QTemporaryFile file;
+        QVERIFY(file.open());
+        file.write("<!DOCTYPE NETSCAPE-Bookmark-file-1>\n"
+                   "<!-- <A HREF=\"http://comment.example.org/\">Comment</A> -->\n"
+                   "<META HTTP-EQUIV=\"Content-Type\" CONTENT=\"text/html; charset=UTF-8\">\n"
+                   "<TITLE>Bookmarks</TITLE>\n"
+                   "<H1>Bookmarks</H1>\n"
+                   "<DL><p>\n"
+                   "    <DT><H3 PERSONAL_TOOLBAR_FOLDER=\"true\">Bookmarks bar</H3>\n"
+                   "    <DL><p>\n"
+                   "        <DT><A HREF=\"http://ubuntu.com/\" ADD_DATE=\"1577836800\">Ubuntu</A>\n"
+                   "    </DL><p>\n"
+                   "    <DT><H3>Work</H3>\n"
+                   "    <DL><p>\n"
+                   "        <DT><A HREF=\"http://example.com/?a=1&amp;b=2\" ADD_DATE=\"1577836700\">Q&amp;A</A>\n"
+                   "        <DT><H3>Docs</H3>\n"
+                   "        <DL><p>\n"
+                   "            <DT><A HREF=\"http://docs.example.com/\">Docs</A>\n"
+                   "        </DL><p>\n"
+                   "        <DT><A HREF=\"http://example.net/\">Example\n  Net</A>\n"
+                   "    </DL><p>\n"
+                   "    <DT><A HREF=\"http://example.org/\">Already bookmarked</A>\n"
+                   "    <DT><A HREF=\"place:sort=8\">Most Visited</A>\n"
+                   "</DL><p>\n");
+        file.close();
+
+        model->add(QUrl("http://example.org/"), "Example Domain", QUrl(), "");
+        QSignalSpy spyReset(model, SIGNAL(modelReset()));
+        QSignalSpy spyInserted(model, SIGNAL(rowsInserted(QModelIndex, int, int)));
+        QSignalSpy spyFolder(model, SIGNAL(folderAdded(QString)));
+        QSignalSpy spyFinished(model, SIGNAL(importFinished(bool, int)));
+        model->importBookmarks(file.fileName());
+        QTRY_COMPARE(spyFinished.count(), 1);
+        QList<QVariant> args = spyFinished.takeFirst();
+        QVERIFY(args.at(0).toBool());
+        QCOMPARE(args.at(1).toInt(), 4);
+        QCOMPARE(spyReset.count(), 1);
+        QVERIFY(spyInserted.isEmpty());
+        QCOMPARE(spyFolder.count(), 2);
+
+        QCOMPARE(model->rowCount(), 5);
+        QCOMPARE(model->folders().count(), 3);
+        QCOMPARE(dataOf(QUrl("http://ubuntu.com/"), BookmarksModel::Folder).toString(), QString());
+        QCOMPARE(dataOf(QUrl("http://ubuntu.com/"), BookmarksModel::Created).toDateTime(),
+                 QDateTime::fromMSecsSinceEpoch(1577836800000LL));
+        QUrl qa("http://example.com/?a=1&b=2");
+        QCOMPARE(dataOf(qa, BookmarksModel::Title).toString(), QString("Q&A"));
+        QCOMPARE(dataOf(qa, BookmarksModel::Folder).toString(), QString("Work"));
+        QCOMPARE(dataOf(QUrl("http://docs.example.com/"), BookmarksModel::Folder).toString(), QString("Docs"));
+        QCOMPARE(dataOf(QUrl("http://example.net/"), BookmarksModel::Folder).toString(), QString("Work"));
+        QCOMPARE(dataOf(QUrl("http://example.net/"), BookmarksModel::Title).toString(), QString("Example Net"));
+        QCOMPARE(dataOf(QUrl("http://example.org/"), BookmarksModel::Title).toString(), QString("Example Domain"));
+        QVERIFY(!model->contains(QUrl("place:sort=8")));
+
+        // Imported bookmarks are kept sorted chronologically
+        QDateTime previous = QDateTime::currentDateTime();
+        for (int i = 0; i < model->rowCount(); ++i) {
+            QDateTime created = model->data(model->index(i, 0), BookmarksModel::Created).toDateTime();
+            QVERIFY(created <= previous);
+            previous = created;
+        }
+
+        // Imported bookmarks can be modified like the other ones
+        model->remove(qa);
+        model->update(QUrl("http://docs.example.com/"), "Documentation", "Work");
+        QCOMPARE(model->rowCount(), 4);
+    }
+
+    void shouldReportFailedImport()
+    {
+        QSignalSpy spyFinished(model, SIGNAL(importFinished(bool, int)));
+        QTest::ignoreMessage(QtWarningMsg, "Failed to open bookmarks file \"/nonexistent/bookmarks.html\"");
+        model->importBookmarks("/nonexistent/bookmarks.html");
+        QTRY_COMPARE(spyFinished.count(), 1);
+        QVERIFY(!spyFinished.first().at(0).toBool());
+        QCOMPARE(spyFinished.first().at(1).toInt(), 0);
+    }
+
+    void shouldKeepBookmarksAddedWhileImporting()
+    {
+        QTemporaryDir dir;
+        QString databasePath = dir.filePath("bookmarks.sqlite");
+        QString fileName = dir.filePath("bookmarks.html");
+        QFile file(fileName);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write("<!DOCTYPE NETSCAPE-Bookmark-file-1>\n"
+                   "<DL><p>\n"
+                   "    <DT><A HREF=\"http://example.org/\">Imported</A>\n"
+                   "    <DT><A HREF=\"http://ubuntu.com/\">Ubuntu</A>\n"
+                   "</DL><p>\n");
+        file.close();
+
+        setDatabasePath(databasePath);
+        QSignalSpy spyFinished(model, SIGNAL(importFinished(bool, int)));
+        model->importBookmarks(fileName);
+        model->add(QUrl("http://example.org/"), "Example Domain", QUrl(), "");
+        QTRY_COMPARE(spyFinished.count(), 1);
+        QCOMPARE(spyFinished.first().at(1).toInt(), 1);
+        QCOMPARE(model->rowCount(), 2);
+        QCOMPARE(dataOf(QUrl("http://example.org/"), BookmarksModel::Title).toString(), QString("Example Domain"));
+
+        // The database holds a single row per URL
+        delete model;
+        model = new BookmarksModel;
+        setDatabasePath(databasePath);
+        QCOMPARE(model->rowCount(), 2);
+        QCOMPARE(dataOf(QUrl("http://example.org/"), BookmarksModel::Title).toString(), QString("Example Domain"));
+    }
+
+    void shouldMergeFoldersAddedWhileImporting()
+    {
+        QTemporaryDir dir;
+        QString databasePath = dir.filePath("bookmarks.sqlite");
+        QString fileName = dir.filePath("bookmarks.html");
+        QFile file(fileName);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write("<!DOCTYPE NETSCAPE-Bookmark-file-1>\n"
+                   "<DL><p>\n"
+                   "    <DT><H3>Work</H3>\n"
+                   "    <DL><p>\n"
+                   "        <DT><A HREF=\"http://ubuntu.com/\">Ubuntu</A>\n"
+                   "    </DL><p>\n"
+                   "</DL><p>\n");
+        file.close();
+
+        setDatabasePath(databasePath);
+        QSignalSpy spyFolder(model, SIGNAL(folderAdded(QString)));
+        QSignalSpy spyFinished(model, SIGNAL(importFinished(bool, int)));
+        model->importBookmarks(fileName);
+        model->add(QUrl("http://example.org/"), "Example Domain", QUrl(), "Work");
+        QTRY_COMPARE(spyFinished.count(), 1);
+        QCOMPARE(spyFinished.first().at(1).toInt(), 1);
+        QCOMPARE(spyFolder.count(), 1);
+        QCOMPARE(model->folders().count(), 2);
+        QCOMPARE(dataOf(QUrl("http://ubuntu.com/"), BookmarksModel::Folder).toString(), QString("Work"));
+
+        // Both bookmarks are in the same folder in the database
+        delete model;
+        model = new BookmarksModel;
+        setDatabasePath(databasePath);
+        QCOMPARE(model->folders().count(), 2);
+        QCOMPARE(dataOf(QUrl("http://ubuntu.com/"), BookmarksModel::Folder).toString(), QString("Work"));
+        QCOMPARE(dataOf(QUrl("http://example.org/"), BookmarksModel::Folder).toString(), QString("Work"));
+    }
+
+    void shouldExportAndImportBookmarks()
+    {
+        QTemporaryDir dir;
+        QString fileName = dir.filePath("bookmarks.html");
+        model->add(QUrl("http://example.org/"), "Example <Domain> & \"co\"", QUrl("http://example.org/favicon.ico"), "");
+        model->add(QUrl("http://ubuntu.com/"), "Ubuntu", QUrl(), "Work");
+        model->add(QUrl("http://wikipedia.org/"), "Wikipedia", QUrl(), "Work");
+        QSignalSpy spyExported(model, SIGNAL(exportFinished(bool, int)));
+        model->exportBookmarks(fileName);
+        QTRY_COMPARE(spyExported.count(), 1);
+        QVERIFY(spyExported.first().at(0).toBool());
+        QCOMPARE(spyExported.first().at(1).toInt(), 3);
+
+        delete model;
+        model = new BookmarksModel;
+        setDatabasePath(":memory:");
+        QSignalSpy spyImported(model, SIGNAL(importFinished(bool, int)));
+        model->importBookmarks(fileName);
+        QTRY_COMPARE(spyImported.count(), 1);
+        QCOMPARE(spyImported.first().at(1).toInt(), 3);
+        QCOMPARE(model->rowCount(), 3);
+        QCOMPARE(dataOf(QUrl("http://example.org/"), BookmarksModel::Title).toString(),
+                 QString("Example <Domain> & \"co\""));
+        QCOMPARE(dataOf(QUrl("http://example.org/"), BookmarksModel::Icon).toUrl(),
+                 QUrl("http://example.org/favicon.ico"));
+        QCOMPARE(dataOf(QUrl("http://example.org/"), BookmarksModel::Folder).toString(), QString());
+        QCOMPARE(dataOf(QUrl("http://ubuntu.com/"), BookmarksModel::Folder).toString(), QString("Work"));
+        QCOMPARE(dataOf(QUrl("http://wikipedia.org/"), BookmarksModel::Folder).toString(), QString("Work"));
+    }
+
+    void benchmarkRemoveOldestEntry()
+    {
+        populate(20000, 500);
+        // Removing the oldest entry and adding it back makes the next oldest
+        // one the last row, the worst case for a lookup
+        QBENCHMARK {
+            QModelIndex last = model->index(model->rowCount() - 1, 0);
+            QUrl url = model->data(last, BookmarksModel::Url).toUrl();
+            QString folder = model->data(last, BookmarksModel::Folder).toString();
+            model->remove(url);
+            model->add(url, QStringLiteral("Example"), QUrl(), folder);
+        }
+        QCOMPARE(model->rowCount(), 20000);
+    }
+
+    void benchmarkUpdateOldestEntry()
+    {
+        populate(20000, 500);
+        QUrl url = model->data(model->index(model->rowCount() - 1, 0), BookmarksModel::Url).toUrl();
+        int i = 0;
+        QBENCHMARK {
+            // Move the entry between existing folders
+            model->update(url, QStringLiteral("Example %1").arg(i), QStringLiteral("Folder %1").arg(i % 500));
+            ++i;
+        }
+        QCOMPARE(model->folders().count(), 501);
+    }
 };
 
 QTEST_MAIN(BookmarksModelTests)
@@ -0,0 +1,180 @@
+/*
+ * Copyright 2020 UBports Foundation
+ *
+ * This file is part of morph-browser.
+ *
+ * morph-browser is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * morph-browser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Qt
+#include <QtCore/QObject>
+#include <QtTest/QSignalSpy>
+#include <QtTest/QtTest>
+
+// local
+#include "bookmarks-model.h"
+#include "bookmarks-sorted-model.h"
+
+class BookmarksSortedModelTests : public QObject
+{
+    Q_OBJECT
+
+private:
+    BookmarksModel* bookmarks;
+
+    QStringList values(QAbstractItemModel* model, int role)
+    {
+        QStringList values;
+        for (int i = 0; i < model->rowCount(); ++i) {
+            values.append(model->data(model->index(i, 0), role).toString());
+        }
+        return values;
+    }
+
+private Q_SLOTS:
+    void init()
+    {
+        bookmarks = new BookmarksModel;
+        bookmarks->setDatabasePath(":memory:");
+    }
+
+    void cleanup()
+    {
+        delete bookmarks;
+    }
+
+    void shouldShareViews()
+    {
+        QAbstractItemModel* model = bookmarks->sortedBy(BookmarksModel::Title);
+        QVERIFY(model);
+        QCOMPARE(bookmarks->sortedBy(BookmarksModel::Title), model);
+        QVERIFY(bookmarks->sortedBy(BookmarksModel::Title, Qt::DescendingOrder) != model);
+        QCOMPARE(model->roleNames(), bookmarks->roleNames());
+        QTest::ignoreMessage(QtWarningMsg, "Bookmarks cannot be sorted by role 261");
+        QVERIFY(!bookmarks->sortedBy(BookmarksModel::Folder));
+    }
+
+    void shouldSortByTitle()
+    {
+        bookmarks->add(QUrl("http://example.org/b"), "b", QUrl(), "");
+        bookmarks->add(QUrl("http://example.org/a"), "A", QUrl(), "");
+        bookmarks->add(QUrl("http://example.org/10"), "Page 10", QUrl(), "");
+        bookmarks->add(QUrl("http://example.org/9"), "Page 9", QUrl(), "");
+        QAbstractItemModel* model = bookmarks->sortedBy(BookmarksModel::Title);
+        QCOMPARE(values(model, BookmarksModel::Title), QStringList() << "A" << "b" << "Page 9" << "Page 10");
+        model = bookmarks->sortedBy(BookmarksModel::Title, Qt::DescendingOrder);
+        QCOMPARE(values(model, BookmarksModel::Title), QStringList() << "Page 10" << "Page 9" << "b" << "A");
+    }
+
+    void shouldSortByUrl()
+    {
+        bookmarks->add(QUrl("http://example.org/b"), "1", QUrl(), "");
+        bookmarks->add(QUrl("http://example.com/"), "2", QUrl(), "");
+        bookmarks->add(QUrl("http://example.org/a"), "3", QUrl(), "");
+        QAbstractItemModel* model = bookmarks->sortedBy(BookmarksModel::Url);
+        QCOMPARE(values(model, BookmarksModel::Title), QStringList() << "2" << "3" << "1");
+    }
+
+    void shouldSortByCreationDate()
+    {
+        bookmarks->add(QUrl("http://example.org/1"), "1", QUrl(), "");
+        bookmarks->add(QUrl("http://example.org/2"), "2", QUrl(), "");
+        bookmarks->add(QUrl("http://example.org/3"), "3", QUrl(), "");
+        QAbstractItemModel* model = bookmarks->sortedBy(BookmarksModel::Created, Qt::DescendingOrder);
+        QCOMPARE(values(model, BookmarksModel::Url), values(bookmarks, BookmarksModel::Url));
+    }
+
+    void shouldInsertAndRemoveAtSortedPosition()
+    {
+        bookmarks->add(QUrl("http://example.org/a"), "a", QUrl(), "");
+        bookmarks->add(QUrl("http://example.org/c"), "c", QUrl(), "");
+        QAbstractItemModel* model = bookmarks->sortedBy(BookmarksModel::Title);
+        QSignalSpy spyInserted(model, SIGNAL(rowsInserted(const QModelIndex&, int, int)));
+        QSignalSpy spyRemoved(model, SIGNAL(rowsRemoved(const QModelIndex&, int, int)));
+        QSignalSpy spyReset(model, SIGNAL(modelReset()));
+
+        bookmarks->add(QUrl("http://example.org/b"), "b", QUrl(), "");
+        QCOMPARE(spyInserted.count(), 1);
+        QList<QVariant> args = spyInserted.takeFirst();
+        QCOMPARE(args.at(1).toInt(), 1);
+        QCOMPARE(args.at(2).toInt(), 1);
+        QCOMPARE(values(model, BookmarksModel::Title), QStringList() << "a" << "b" << "c");
+
+        bookmarks->remove(QUrl("http://example.org/a"));
+        QCOMPARE(spyRemoved.count(), 1);
+        args = spyRemoved.takeFirst();
+        QCOMPARE(args.at(1).toInt(), 0);
+        QCOMPARE(args.at(2).toInt(), 0);
+        QCOMPARE(values(model, BookmarksModel::Title), QStringList() << "b" << "c");
+        QVERIFY(spyReset.isEmpty());
+    }
+
+    void shouldMoveWhenSortKeyChanges()
+    {
+        bookmarks->add(QUrl("http://example.org/a"), "a", QUrl(), "");
+        bookmarks->add(QUrl("http://example.org/b"), "b", QUrl(), "");
+        bookmarks->add(QUrl("http://example.org/c"), "c", QUrl(), "");
+        QAbstractItemModel* model = bookmarks->sortedBy(BookmarksModel::Title);
+        qRegisterMetaType<QVector<int> >();
+        QSignalSpy spyMoved(model, SIGNAL(rowsMoved(const QModelIndex&, int, int, const QModelIndex&, int)));
+        QSignalSpy spyChanged(model, SIGNAL(dataChanged(const QModelIndex&, const QModelIndex&, const QVector<int>&)));
+
+        bookmarks->update(QUrl("http://example.org/a"), "d", "");
+        QCOMPARE(spyMoved.count(), 1);
+        QCOMPARE(values(model, BookmarksModel::Title), QStringList() << "b" << "c" << "d");
+        QCOMPARE(spyChanged.count(), 1);
+        QCOMPARE(spyChanged.takeFirst().at(0).toModelIndex().row(), 2);
+
+        bookmarks->update(QUrl("http://example.org/a"), "0", "");
+        QCOMPARE(spyMoved.count(), 2);
+        QCOMPARE(values(model, BookmarksModel::Title), QStringList() << "0" << "b" << "c");
+        spyChanged.clear();
+
+        // Changes that keep the order, or of other roles, do not move rows
+        bookmarks->update(QUrl("http://example.org/b"), "bb", "");
+        bookmarks->update(QUrl("http://example.org/c"), "c", "SampleFolder");
+        QCOMPARE(spyMoved.count(), 2);
+        QCOMPARE(spyChanged.count(), 2);
+        QCOMPARE(spyChanged.at(1).at(0).toModelIndex().row(), 2);
+        QCOMPARE(values(model, BookmarksModel::Folder), QStringList() << "" << "" << "SampleFolder");
+    }
+
+    void shouldResetWithSourceModel()
+    {
+        bookmarks->add(QUrl("http://example.org/a"), "a", QUrl(), "");
+        QAbstractItemModel* model = bookmarks->sortedBy(BookmarksModel::Url);
+        QSignalSpy spyReset(model, SIGNAL(modelReset()));
+        bookmarks->setDatabasePath("");
+        QCOMPARE(spyReset.count(), 1);
+        QCOMPARE(model->rowCount(), 0);
+    }
+
+    void benchmarkUpdateTitle()
+    {
+        for (int i = 0; i < 20000; ++i) {
+            bookmarks->add(QUrl(QStringLiteral("http://example.org/%1").arg(i)),
+                           QStringLiteral("Example %1").arg(i), QUrl(), "");
+        }
+        QAbstractItemModel* model = bookmarks->sortedBy(BookmarksModel::Title);
+        QUrl url("http://example.org/0");
+        int i = 0;
+        QBENCHMARK {
+            // Move the bookmark back and forth across the whole view
+            bookmarks->update(url, (i++ % 2) ? QStringLiteral("Example 0") : QStringLiteral("Example 99999"), "");
+        }
+        QCOMPARE(model->rowCount(), 20000);
+    }
+};
+
+QTEST_MAIN(BookmarksSortedModelTests)
+#include "tst_BookmarksSortedModelTests.moc"
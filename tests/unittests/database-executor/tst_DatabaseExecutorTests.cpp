@@ -0,0 +1,225 @@
+/*
+ * Copyright 2020 UBports Foundation
+ *
+ * This file is part of morph-browser.
+ *
+ * morph-browser is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * morph-browser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Qt
+#include <QtCore/QTemporaryDir>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlQuery>
+#include <QtTest/QSignalSpy>
+#include <QtTest/QtTest>
+
+// local
+#include "database-executor.h"
+
+static const QString CONNECTION_NAME = QStringLiteral("database-executor-tests");
+static const QString INSERT_STATEMENT = QStringLiteral("INSERT INTO entries (value) VALUES (?);");
+
+class DatabaseExecutorTests : public QObject
+{
+    Q_OBJECT
+
+private:
+    QTemporaryDir* dir;
+    DatabaseExecutor* executor;
+
+    static bool createTable(QSqlDatabase& database)
+    {
+        return DatabaseUtils::exec(database, QStringLiteral("CREATE TABLE entries (id INTEGER PRIMARY KEY, value INTEGER);"));
+    }
+
+    QString databaseFile() const
+    {
+        return dir->filePath(QStringLiteral("test.sqlite"));
+    }
+
+    int countEntries()
+    {
+        int count = -1;
+        executor->run([&](QSqlDatabase& database) {
+            QSqlQuery query(database);
+            query.exec(QStringLiteral("SELECT COUNT(*) FROM entries;"));
+            if (query.next()) {
+                count = query.value(0).toInt();
+            }
+        });
+        return count;
+    }
+
+    bool open()
+    {
+        QSignalSpy spy(executor, SIGNAL(opened(bool)));
+        executor->open(databaseFile(), QList<DatabaseUtils::Migration>() << createTable);
+        return spy.wait() && spy.first().at(0).toBool();
+    }
+
+private Q_SLOTS:
+    void init()
+    {
+        dir = new QTemporaryDir;
+        executor = new DatabaseExecutor(CONNECTION_NAME);
+        // Operations are only written when explicitly flushed
+        executor->setFlushInterval(60000);
+        QVERIFY(open());
+    }
+
+    void cleanup()
+    {
+        delete executor;
+        delete dir;
+    }
+
+    void shouldOpenAndMigrateDatabase()
+    {
+        QCOMPARE(executor->databaseName(), databaseFile());
+        QCOMPARE(countEntries(), 0);
+    }
+
+    void shouldOpenAsynchronously()
+    {
+        delete executor;
+        executor = new DatabaseExecutor(CONNECTION_NAME);
+        QSignalSpy spy(executor, SIGNAL(opened(bool)));
+        executor->open(databaseFile(), QList<DatabaseUtils::Migration>() << createTable);
+        QVERIFY(spy.isEmpty());
+        // Operations passed before the database is open are executed after
+        executor->enqueue(INSERT_STATEMENT, QVariantList() << 1);
+        QTRY_COMPARE(spy.count(), 1);
+        QVERIFY(spy.first().at(0).toBool());
+        QCOMPARE(countEntries(), 1);
+    }
+
+    void shouldWritePendingOperationsInOneBatch()
+    {
+        QSignalSpy spy(executor, SIGNAL(flushed(int, qint64)));
+        for (int i = 0; i < 10; ++i) {
+            executor->enqueue(INSERT_STATEMENT, QVariantList() << i);
+        }
+        executor->flush();
+        QTRY_COMPARE(spy.count(), 1);
+        QCOMPARE(spy.first().at(0).toInt(), 10);
+        QCOMPARE(countEntries(), 10);
+    }
+
+    void shouldFlushWhenThresholdIsReached()
+    {
+        QSignalSpy spy(executor, SIGNAL(flushed(int, qint64)));
+        for (int i = 0; i < 250; ++i) {
+            executor->enqueue(INSERT_STATEMENT, QVariantList() << i);
+        }
+        executor->flush();
+        QTRY_COMPARE(spy.count(), 2);
+        QCOMPARE(spy.at(0).at(0).toInt(), 200);
+        QCOMPARE(spy.at(1).at(0).toInt(), 50);
+    }
+
+    void shouldSeePendingOperationsWhenRunningTasks()
+    {
+        executor->enqueue(INSERT_STATEMENT, QVariantList() << 1);
+        executor->enqueue(INSERT_STATEMENT, QVariantList() << 2);
+        QCOMPARE(countEntries(), 2);
+    }
+
+    void shouldInvokeCallbackWithLastInsertId()
+    {
+        QList<int> ids;
+        bool success = false;
+        executor->enqueue(INSERT_STATEMENT, QVariantList() << 1);
+        executor->enqueue(INSERT_STATEMENT, QVariantList() << 2,
+                          [&](bool result, const QVariant& lastInsertId) {
+                              success = result;
+                              ids.append(lastInsertId.toInt());
+                          });
+        executor->flush();
+        QTRY_COMPARE(ids.count(), 1);
+        QVERIFY(success);
+        QCOMPARE(ids.first(), 2);
+    }
+
+    void shouldReportFailedOperations()
+    {
+        bool called = false;
+        bool success = true;
+        executor->enqueue(QStringLiteral("INSERT INTO missing (value) VALUES (?);"), QVariantList() << 1,
+                          [&](bool result, const QVariant&) {
+                              called = true;
+                              success = result;
+                          });
+        executor->enqueue(INSERT_STATEMENT, QVariantList() << 2);
+        executor->flush();
+        QTRY_VERIFY(called);
+        QVERIFY(!success);
+        QCOMPARE(countEntries(), 1);
+    }
+
+    void shouldRunPostedTasksAsynchronously()
+    {
+        int count = -1;
+        bool called = false;
+        executor->enqueue(INSERT_STATEMENT, QVariantList() << 1);
+        executor->post([&](QSqlDatabase& database) {
+            QSqlQuery query(database);
+            query.exec(QStringLiteral("SELECT COUNT(*) FROM entries;"));
+            if (query.next()) {
+                count = query.value(0).toInt();
+            }
+        }, [&](bool, const QVariant&) {
+            called = true;
+        });
+        QVERIFY(!called);
+        QTRY_VERIFY(called);
+        QCOMPARE(count, 1);
+    }
+
+    void shouldExecuteSynchronously()
+    {
+        executor->enqueue(INSERT_STATEMENT, QVariantList() << 1);
+        QCOMPARE(executor->exec(INSERT_STATEMENT, QVariantList() << 2).toInt(), 2);
+    }
+
+    void shouldWritePendingOperationsWhenClosed()
+    {
+        executor->enqueue(INSERT_STATEMENT, QVariantList() << 1);
+        executor->close();
+        {
+            QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), "tst_executor");
+            database.setDatabaseName(databaseFile());
+            QVERIFY(database.open());
+            QSqlQuery query(database);
+            query.exec(QStringLiteral("SELECT value FROM entries;"));
+            QVERIFY(query.next());
+            QCOMPARE(query.value(0).toInt(), 1);
+            database.close();
+        }
+        QSqlDatabase::removeDatabase("tst_executor");
+
+        QVERIFY(open());
+        QCOMPARE(countEntries(), 1);
+    }
+
+    void shouldWritePendingOperationsWhenDestroyed()
+    {
+        executor->enqueue(INSERT_STATEMENT, QVariantList() << 1);
+        delete executor;
+        executor = new DatabaseExecutor(CONNECTION_NAME);
+        QVERIFY(open());
+        QCOMPARE(countEntries(), 1);
+    }
+};
+
+QTEST_MAIN(DatabaseExecutorTests)
+#include "tst_DatabaseExecutorTests.moc"
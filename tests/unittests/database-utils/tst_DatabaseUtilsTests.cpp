@@ -0,0 +1,204 @@
+/*
+ * Copyright 2020 UBports Foundation
+ *
+ * This file is part of morph-browser.
+ *
+ * morph-browser is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * morph-browser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Qt
+#include <QtCore/QTemporaryDir>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlQuery>
+#include <QtTest/QtTest>
+
+// local
+#include "database-utils.h"
+
+static const QString CONNECTION_NAME = QStringLiteral("database-utils-tests");
+
+class DatabaseUtilsTests : public QObject
+{
+    Q_OBJECT
+
+private:
+    QTemporaryDir* dir;
+
+    QVariant pragma(const QString& name)
+    {
+        QSqlQuery query(QSqlDatabase::database(CONNECTION_NAME));
+        query.exec(QStringLiteral("PRAGMA %1;").arg(name));
+        return query.next() ? query.value(0) : QVariant();
+    }
+
+    static bool createTable(QSqlDatabase& database)
+    {
+        return DatabaseUtils::exec(database, QStringLiteral("CREATE TABLE entries (value INTEGER);"));
+    }
+
+    static bool addColumn(QSqlDatabase& database)
+    {
+        return DatabaseUtils::exec(database, QStringLiteral("ALTER TABLE entries ADD COLUMN extra VARCHAR;"));
+    }
+
+    static bool failingMigration(QSqlDatabase& database)
+    {
+        DatabaseUtils::exec(database, QStringLiteral("CREATE TABLE leftovers (value INTEGER);"));
+        return false;
+    }
+
+private Q_SLOTS:
+    void init()
+    {
+        dir = new QTemporaryDir;
+        QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), CONNECTION_NAME);
+    }
+
+    void cleanup()
+    {
+        QSqlDatabase::database(CONNECTION_NAME).close();
+        QSqlDatabase::removeDatabase(CONNECTION_NAME);
+        DatabaseUtils::selectedProfiles().clear();
+        delete dir;
+    }
+
+    void shouldApplyConnectionProfile_data()
+    {
+        QTest::addColumn<QString>("profile");
+        QTest::addColumn<QString>("journalMode");
+        QTest::addColumn<int>("synchronous");
+        QTest::addColumn<int>("busyTimeout");
+        QTest::newRow("default") << QString("default") << QString("delete") << 2 << 0;
+        QTest::newRow("wal") << QString("wal") << QString("wal") << 1 << 5000;
+        QTest::newRow("durable") << QString("durable") << QString("wal") << 2 << 5000;
+        QTest::newRow("shared") << QString("shared") << QString("delete") << 2 << 5000;
+    }
+
+    void shouldApplyConnectionProfile()
+    {
+        QFETCH(QString, profile);
+        QFETCH(QString, journalMode);
+        QFETCH(int, synchronous);
+        QFETCH(int, busyTimeout);
+        QSqlDatabase database = QSqlDatabase::database(CONNECTION_NAME, false);
+        QVERIFY(DatabaseUtils::openDatabase(database, dir->filePath("test.sqlite"), profile));
+        QCOMPARE(pragma("journal_mode").toString(), journalMode);
+        QCOMPARE(pragma("synchronous").toInt(), synchronous);
+        QCOMPARE(pragma("busy_timeout").toInt(), busyTimeout);
+    }
+
+    void shouldUseSelectedProfileForConnection()
+    {
+        DatabaseUtils::selectConnectionProfile(CONNECTION_NAME, "durable");
+        QSqlDatabase database = QSqlDatabase::database(CONNECTION_NAME, false);
+        QVERIFY(DatabaseUtils::openDatabase(database, dir->filePath("test.sqlite"), "default"));
+        QCOMPARE(pragma("journal_mode").toString(), QString("wal"));
+        QCOMPARE(pragma("synchronous").toInt(), 2);
+    }
+
+    void shouldSelectProfilesFromEnvironment_data()
+    {
+        QTest::addColumn<QString>("profiles");
+        QTest::addColumn<QString>("fallback");
+        QTest::addColumn<QString>("expected");
+        QTest::newRow("none") << QString() << QString("wal") << QString("wal");
+        QTest::newRow("connection") << QString("*=default,%1=durable").arg(CONNECTION_NAME) << QString("shared") << QString("durable");
+        QTest::newRow("wildcard") << QString("*=durable") << QString("wal") << QString("durable");
+        QTest::newRow("wildcard and explicit fallback") << QString("*=wal") << QString("shared") << QString("shared");
+        QTest::newRow("other connection") << QString("other=durable") << QString("wal") << QString("wal");
+    }
+
+    void shouldSelectProfilesFromEnvironment()
+    {
+        QFETCH(QString, profiles);
+        QFETCH(QString, fallback);
+        QFETCH(QString, expected);
+        qputenv("MORPH_SQLITE_PROFILES", profiles.toLocal8Bit());
+        QCOMPARE(DatabaseUtils::selectedConnectionProfile(CONNECTION_NAME, fallback), expected);
+        qunsetenv("MORPH_SQLITE_PROFILES");
+    }
+
+    void shouldCheckpointOpenedDatabases()
+    {
+        QSqlDatabase database = QSqlDatabase::database(CONNECTION_NAME, false);
+        QString path = dir->filePath("test.sqlite");
+        QVERIFY(DatabaseUtils::openDatabase(database, path, "wal"));
+        QVERIFY(createTable(database));
+        QFileInfo wal(path + "-wal");
+        QVERIFY(wal.exists());
+        QVERIFY(wal.size() > 0);
+        DatabaseUtils::checkpointDatabases();
+        QSqlQuery query(database);
+        QVERIFY(query.exec("PRAGMA wal_checkpoint(PASSIVE);"));
+        QVERIFY(query.next());
+        // Nothing left to checkpoint
+        QCOMPARE(query.value(1).toInt(), query.value(2).toInt());
+    }
+
+    void shouldMigrateSchema()
+    {
+        QSqlDatabase database = QSqlDatabase::database(CONNECTION_NAME, false);
+        QVERIFY(DatabaseUtils::openDatabase(database, dir->filePath("test.sqlite")));
+        QList<DatabaseUtils::Migration> migrations;
+        migrations << createTable;
+        QVERIFY(DatabaseUtils::migrateSchema(database, migrations));
+        QCOMPARE(DatabaseUtils::schemaVersion(database), 1);
+        migrations << addColumn;
+        QVERIFY(DatabaseUtils::migrateSchema(database, migrations));
+        QCOMPARE(DatabaseUtils::schemaVersion(database), 2);
+        QVERIFY(DatabaseUtils::hasColumn(database, "entries", "extra"));
+        // Already up to date
+        QVERIFY(DatabaseUtils::migrateSchema(database, migrations));
+        QCOMPARE(DatabaseUtils::schemaVersion(database), 2);
+    }
+
+    void shouldRollbackFailedMigration()
+    {
+        QSqlDatabase database = QSqlDatabase::database(CONNECTION_NAME, false);
+        QVERIFY(DatabaseUtils::openDatabase(database, dir->filePath("test.sqlite")));
+        QList<DatabaseUtils::Migration> migrations;
+        migrations << createTable << failingMigration;
+        QVERIFY(!DatabaseUtils::migrateSchema(database, migrations));
+        QCOMPARE(DatabaseUtils::schemaVersion(database), 1);
+        QSqlQuery query(database);
+        query.exec("SELECT name FROM sqlite_master WHERE type='table' AND name='leftovers';");
+        QVERIFY(!query.next());
+    }
+
+    void benchmarkWriteLatency_data()
+    {
+        QTest::addColumn<QString>("profile");
+        QTest::newRow("default") << QString("default");
+        QTest::newRow("wal") << QString("wal");
+        QTest::newRow("durable") << QString("durable");
+    }
+
+    void benchmarkWriteLatency()
+    {
+        // Each insertion is committed on its own, as most model updates are
+        QFETCH(QString, profile);
+        QSqlDatabase database = QSqlDatabase::database(CONNECTION_NAME, false);
+        QVERIFY(DatabaseUtils::openDatabase(database, dir->filePath("test.sqlite"), profile));
+        QVERIFY(createTable(database));
+        QSqlQuery query(database);
+        query.prepare("INSERT INTO entries (value) VALUES (?);");
+        int i = 0;
+        QBENCHMARK {
+            query.addBindValue(i++);
+            query.exec();
+        }
+    }
+};
+
+QTEST_MAIN(DatabaseUtilsTests)
+#include "tst_DatabaseUtilsTests.moc"
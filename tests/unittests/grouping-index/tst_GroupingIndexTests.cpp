@@ -0,0 +1,364 @@
+/*
+ * Copyright 2020 UBports Foundation
+ *
+ * This file is part of morph-browser.
+ *
+ * morph-browser is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * morph-browser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Qt
+#include <QtCore/QAbstractListModel>
+#include <QtCore/QPair>
+#include <QtCore/QStringList>
+#include <QtTest/QSignalSpy>
+#include <QtTest/QtTest>
+
+// local
+#include "grouping-index.h"
+
+class KeyListModel : public QAbstractListModel {
+    Q_OBJECT
+
+public:
+    enum Roles {
+        Key = Qt::UserRole + 1,
+        Value
+    };
+
+    QHash<int, QByteArray> roleNames() const
+    {
+        static QHash<int, QByteArray> roles;
+        if (roles.isEmpty()) {
+            roles[Key] = "key";
+            roles[Value] = "value";
+        }
+        return roles;
+    }
+
+    int rowCount(const QModelIndex& parent=QModelIndex()) const
+    {
+        Q_UNUSED(parent);
+        return m_rows.count();
+    }
+
+    QVariant data(const QModelIndex& index, int role) const
+    {
+        if (!index.isValid()) {
+            return QVariant();
+        }
+        switch (role) {
+        case Key:
+            return m_rows.at(index.row()).first;
+        case Value:
+            return m_rows.at(index.row()).second;
+        default:
+            return QVariant();
+        }
+    }
+
+    void insert(int row, const QString& key, const QString& value)
+    {
+        beginInsertRows(QModelIndex(), row, row);
+        m_rows.insert(row, qMakePair(key, value));
+        endInsertRows();
+    }
+
+    void append(const QString& key, const QString& value)
+    {
+        insert(m_rows.count(), key, value);
+    }
+
+    void remove(int row)
+    {
+        beginRemoveRows(QModelIndex(), row, row);
+        m_rows.removeAt(row);
+        endRemoveRows();
+    }
+
+    void move(int from, int to)
+    {
+        beginMoveRows(QModelIndex(), from, from, QModelIndex(), (to < from) ? to : to + 1);
+        m_rows.move(from, to);
+        endMoveRows();
+    }
+
+    void setKey(int row, const QString& key)
+    {
+        m_rows[row].first = key;
+        Q_EMIT dataChanged(index(row, 0), index(row, 0), QVector<int>() << Key);
+    }
+
+    void setValue(int row, const QString& value)
+    {
+        m_rows[row].second = value;
+        Q_EMIT dataChanged(index(row, 0), index(row, 0), QVector<int>() << Value);
+    }
+
+private:
+    QList<QPair<QString, QString> > m_rows;
+};
+
+class GroupingIndexTests : public QObject
+{
+    Q_OBJECT
+
+private:
+    KeyListModel* source;
+    GroupingIndex* index;
+
+    QStringList values(GroupModel* model)
+    {
+        QStringList values;
+        for (int i = 0; i < model->rowCount(); ++i) {
+            values.append(model->data(model->index(i, 0), KeyListModel::Value).toString());
+        }
+        return values;
+    }
+
+private Q_SLOTS:
+    void init()
+    {
+        source = new KeyListModel;
+        source->append("a", "a1");
+        source->append("b", "b1");
+        source->append("a", "a2");
+        source->append("c", "c1");
+        index = new GroupingIndex;
+        index->setKeyRole(KeyListModel::Key);
+        index->setSourceModel(source);
+    }
+
+    void cleanup()
+    {
+        delete index;
+        delete source;
+    }
+
+    void shouldGroupRowsByKey()
+    {
+        QCOMPARE(index->keys(), QStringList() << "a" << "b" << "c");
+        QCOMPARE(index->rows("a"), QVector<int>() << 0 << 2);
+        QCOMPARE(index->rows("b"), QVector<int>() << 1);
+        QVERIFY(index->rows("d").isEmpty());
+        GroupModel group;
+        group.setGroup(index, "a");
+        QCOMPARE(group.rowCount(), 2);
+        QCOMPARE(values(&group), QStringList() << "a1" << "a2");
+        QCOMPARE(group.roleNames(), source->roleNames());
+    }
+
+    void shouldOnlyNotifyAffectedGroupsWhenInsertingRows()
+    {
+        GroupModel a;
+        a.setGroup(index, "a");
+        GroupModel b;
+        b.setGroup(index, "b");
+        QSignalSpy spyInsertedA(&a, SIGNAL(rowsInserted(const QModelIndex&, int, int)));
+        QSignalSpy spyInsertedB(&b, SIGNAL(rowsInserted(const QModelIndex&, int, int)));
+        QSignalSpy spyGroupAdded(index, SIGNAL(groupAdded(const QString&)));
+
+        source->insert(0, "b", "b0");
+        QVERIFY(spyInsertedA.isEmpty());
+        QCOMPARE(spyInsertedB.count(), 1);
+        QList<QVariant> args = spyInsertedB.takeFirst();
+        QCOMPARE(args.at(1).toInt(), 0);
+        QCOMPARE(args.at(2).toInt(), 0);
+        QVERIFY(spyGroupAdded.isEmpty());
+        QCOMPARE(values(&a), QStringList() << "a1" << "a2");
+        QCOMPARE(values(&b), QStringList() << "b0" << "b1");
+
+        source->insert(2, "d", "d1");
+        QCOMPARE(spyGroupAdded.count(), 1);
+        QCOMPARE(spyGroupAdded.takeFirst().at(0).toString(), QString("d"));
+        QCOMPARE(index->rows("a"), QVector<int>() << 1 << 4);
+        QCOMPARE(values(&a), QStringList() << "a1" << "a2");
+    }
+
+    void shouldRemoveEmptyGroups()
+    {
+        GroupModel c;
+        c.setGroup(index, "c");
+        QSignalSpy spyRemoved(&c, SIGNAL(rowsRemoved(const QModelIndex&, int, int)));
+        QSignalSpy spyGroupRemoved(index, SIGNAL(groupRemoved(const QString&)));
+
+        source->remove(0);
+        QVERIFY(spyRemoved.isEmpty());
+        QVERIFY(spyGroupRemoved.isEmpty());
+        QCOMPARE(index->rows("a"), QVector<int>() << 1);
+
+        source->remove(2);
+        QCOMPARE(spyRemoved.count(), 1);
+        QCOMPARE(c.rowCount(), 0);
+        QCOMPARE(spyGroupRemoved.count(), 1);
+        QCOMPARE(spyGroupRemoved.takeFirst().at(0).toString(), QString("c"));
+        QVERIFY(!index->contains("c"));
+        QCOMPARE(index->keys(), QStringList() << "b" << "a");
+    }
+
+    void shouldMoveRowsWithinTheirGroup()
+    {
+        GroupModel a;
+        a.setGroup(index, "a");
+        GroupModel b;
+        b.setGroup(index, "b");
+        QSignalSpy spyMovedA(&a, SIGNAL(rowsMoved(const QModelIndex&, int, int, const QModelIndex&, int)));
+        QSignalSpy spyMovedB(&b, SIGNAL(rowsMoved(const QModelIndex&, int, int, const QModelIndex&, int)));
+
+        source->move(2, 0);
+        QCOMPARE(spyMovedA.count(), 1);
+        QVERIFY(spyMovedB.isEmpty());
+        QCOMPARE(values(&a), QStringList() << "a2" << "a1");
+        QCOMPARE(index->rows("a"), QVector<int>() << 0 << 1);
+        QCOMPARE(index->rows("b"), QVector<int>() << 2);
+
+        // Moving a row past rows of other groups only does not re-order
+        // its own group
+        spyMovedA.clear();
+        source->move(2, 1);
+        QVERIFY(spyMovedA.isEmpty());
+        QVERIFY(spyMovedB.isEmpty());
+        QCOMPARE(index->rows("a"), QVector<int>() << 0 << 2);
+        QCOMPARE(index->rows("b"), QVector<int>() << 1);
+
+        source->move(0, 3);
+        QCOMPARE(spyMovedA.count(), 1);
+        QCOMPARE(values(&a), QStringList() << "a1" << "a2");
+        QCOMPARE(index->keys(), QStringList() << "b" << "a" << "c");
+    }
+
+    void shouldMoveRowsBetweenGroupsWhenKeyChanges()
+    {
+        GroupModel a;
+        a.setGroup(index, "a");
+        GroupModel c;
+        c.setGroup(index, "c");
+        QSignalSpy spyRemovedA(&a, SIGNAL(rowsRemoved(const QModelIndex&, int, int)));
+        QSignalSpy spyInsertedC(&c, SIGNAL(rowsInserted(const QModelIndex&, int, int)));
+        QSignalSpy spyGroupRemoved(index, SIGNAL(groupRemoved(const QString&)));
+
+        source->setKey(0, "c");
+        QCOMPARE(spyRemovedA.count(), 1);
+        QCOMPARE(spyInsertedC.count(), 1);
+        QList<QVariant> args = spyInsertedC.takeFirst();
+        QCOMPARE(args.at(1).toInt(), 0);
+        QCOMPARE(values(&a), QStringList() << "a2");
+        QCOMPARE(values(&c), QStringList() << "a1" << "c1");
+        QVERIFY(spyGroupRemoved.isEmpty());
+
+        source->setKey(2, "c");
+        QCOMPARE(spyGroupRemoved.count(), 1);
+        QCOMPARE(spyGroupRemoved.takeFirst().at(0).toString(), QString("a"));
+        QCOMPARE(a.rowCount(), 0);
+    }
+
+    void shouldForwardDataChangesToTheirGroup()
+    {
+        GroupModel a;
+        a.setGroup(index, "a");
+        GroupModel b;
+        b.setGroup(index, "b");
+        qRegisterMetaType<QVector<int> >();
+        QSignalSpy spyChangedA(&a, SIGNAL(dataChanged(const QModelIndex&, const QModelIndex&, const QVector<int>&)));
+        QSignalSpy spyChangedB(&b, SIGNAL(dataChanged(const QModelIndex&, const QModelIndex&, const QVector<int>&)));
+
+        source->setValue(2, "a3");
+        QVERIFY(spyChangedB.isEmpty());
+        QCOMPARE(spyChangedA.count(), 1);
+        QList<QVariant> args = spyChangedA.takeFirst();
+        QCOMPARE(args.at(0).toModelIndex().row(), 1);
+        QCOMPARE(args.at(1).toModelIndex().row(), 1);
+        QCOMPARE(values(&a), QStringList() << "a1" << "a3");
+    }
+
+    void shouldResetWithSourceModel()
+    {
+        GroupModel a;
+        a.setGroup(index, "a");
+        QSignalSpy spyReset(&a, SIGNAL(modelReset()));
+        KeyListModel other;
+        other.append("a", "x1");
+        index->setSourceModel(&other);
+        QCOMPARE(spyReset.count(), 1);
+        QCOMPARE(values(&a), QStringList() << "x1");
+        index->setSourceModel(0);
+        QCOMPARE(a.rowCount(), 0);
+    }
+
+    void shouldExposeAllRows()
+    {
+        GroupModel all;
+        all.setGroup(index, QString(), true);
+        QCOMPARE(values(&all), QStringList() << "a1" << "b1" << "a2" << "c1");
+        source->insert(1, "d", "d1");
+        source->remove(0);
+        QCOMPARE(values(&all), QStringList() << "d1" << "b1" << "a2" << "c1");
+    }
+
+    void shouldGroupCaseInsensitively()
+    {
+        source->append("A", "a3");
+        index->setCaseSensitivity(Qt::CaseInsensitive);
+        QCOMPARE(index->keys(), QStringList() << "a" << "b" << "c");
+        GroupModel a;
+        a.setGroup(index, "A");
+        QCOMPARE(values(&a), QStringList() << "a1" << "a2" << "a3");
+    }
+
+    void shouldShiftRowsFromTheClosestEnd()
+    {
+        for (int i = 0; i < 20; ++i) {
+            source->append(QString::number(i % 3), QStringLiteral("v%1").arg(i));
+        }
+        // Changes close to the top and close to the bottom shift the rows
+        // from different ends
+        source->insert(0, "a", "x1");
+        source->insert(2, "b", "x2");
+        source->insert(20, "c", "x3");
+        source->remove(1);
+        source->remove(19);
+        source->move(3, 0);
+        source->move(1, 21);
+        source->insert(0, "1", "x4");
+        source->remove(0);
+
+        GroupingIndex expected;
+        expected.setKeyRole(KeyListModel::Key);
+        expected.setSourceModel(source);
+        QCOMPARE(index->keys(), expected.keys());
+        Q_FOREACH(const QString& key, expected.keys()) {
+            QCOMPARE(index->rows(key), expected.rows(key));
+        }
+    }
+
+    void benchmarkPrependRows()
+    {
+        // A large history, most recent entries first
+        KeyListModel history;
+        for (int i = 0; i < 100000; ++i) {
+            history.append(QStringLiteral("example%1.org").arg(i % 3000), QString::number(i));
+        }
+        GroupingIndex domains;
+        domains.setKeyRole(KeyListModel::Key);
+        domains.setSourceModel(&history);
+        GroupModel group;
+        group.setGroup(&domains, "example0.org");
+        int i = 0;
+        QBENCHMARK {
+            history.insert(0, QStringLiteral("example%1.org").arg(i++ % 3000), QString());
+        }
+        QCOMPARE(domains.keys().count(), 3000);
+    }
+};
+
+QTEST_MAIN(GroupingIndexTests)
+#include "tst_GroupingIndexTests.moc"
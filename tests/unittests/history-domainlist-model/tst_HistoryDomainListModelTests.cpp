@@ -86,8 +86,8 @@ private Q_SLOTS:
         QVERIFY(spyDataChanged.isEmpty());
         QCOMPARE(spyRowsInserted.count(), 1);
         args = spyRowsInserted.takeFirst();
-        QCOMPARE(args.at(1).toInt(), 0);
-        QCOMPARE(args.at(2).toInt(), 0);
+        QCOMPARE(args.at(1).toInt(), 1);
+        QCOMPARE(args.at(2).toInt(), 1);
         QCOMPARE(model->rowCount(), 2);
         QCOMPARE(model->data(model->index(1, 0), HistoryDomainListModel::Domain).toString(), QString("example.com"));
 
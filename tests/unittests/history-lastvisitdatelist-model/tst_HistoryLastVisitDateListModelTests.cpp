@@ -114,6 +114,46 @@ public:
         }
     }
 
+    void populate(int count, int domains)
+    {
+        // One entry every five minutes, across as many days as needed
+        QDateTime now = QDateTime(QDate(2020, 1, 1), QTime(12, 0, 0));
+        beginResetModel();
+        m_entries.clear();
+        m_entries.reserve(count);
+        for (int i = 0; i < count; ++i) {
+            HistoryEntry entry;
+            entry.domain = QStringLiteral("example%1.org").arg(i % domains);
+            entry.url = QUrl(QStringLiteral("http://%1/%2").arg(entry.domain).arg(i));
+            entry.visits = 1;
+            entry.lastVisit = now.addSecs(-300 * i);
+            entry.hidden = false;
+            m_entries.append(entry);
+        }
+        endResetModel();
+    }
+
+    void removeEntriesByDomain(const QString& domain)
+    {
+        // Remove contiguous ranges of rows, starting from the end
+        int last = m_entries.count() - 1;
+        while (last >= 0) {
+            if (m_entries.at(last).domain != domain) {
+                --last;
+                continue;
+            }
+            int first = last;
+            while ((first > 0) && (m_entries.at(first - 1).domain == domain)) {
+                --first;
+            }
+            beginRemoveRows(QModelIndex(), first, last);
+            m_entries.erase(m_entries.begin() + first, m_entries.begin() + last + 1);
+            endRemoveRows();
+            last = first - 1;
+        }
+        Q_EMIT rowCountChanged();
+    }
+
 private:
     struct HistoryEntry {
         QUrl url;
@@ -361,6 +401,56 @@ private Q_SLOTS:
         QCOMPARE(model->data(model->index(1, 0), HistoryLastVisitDateListModel::LastVisitDate).toDate(), dt1.date());
         QVERIFY(!model->data(model->index(1, 0), HistoryLastVisitDateListModel::LastVisitDate + 1).isValid());
     }
+
+    void shouldUpdateCountsWhenRemovingEntriesByDomain()
+    {
+        // 600 entries over three days
+        mockHistory->populate(600, 3);
+        QCOMPARE(model->rowCount(), 4);
+        QSignalSpy spyRowsRemoved(model, SIGNAL(rowsRemoved(const QModelIndex&, int, int)));
+        mockHistory->removeEntriesByDomain("example0.org");
+        mockHistory->removeEntriesByDomain("example1.org");
+        QVERIFY(spyRowsRemoved.isEmpty());
+        QCOMPARE(model->rowCount(), 4);
+        mockHistory->removeEntriesByDomain("example2.org");
+        QCOMPARE(spyRowsRemoved.count(), 4);
+        QCOMPARE(model->rowCount(), 0);
+    }
+
+    void benchmarkPopulate_data()
+    {
+        QTest::addColumn<int>("entries");
+        QTest::newRow("1k") << 1000;
+        QTest::newRow("10k") << 10000;
+        QTest::newRow("100k") << 100000;
+    }
+
+    void benchmarkPopulate()
+    {
+        QFETCH(int, entries);
+        mockHistory->populate(entries, 100);
+        QBENCHMARK {
+            model->setSourceModel(QVariant());
+            model->setSourceModel(QVariant::fromValue(mockHistory));
+        }
+        QVERIFY(model->rowCount() > 1);
+    }
+
+    void benchmarkRemoveEntriesByDomain_data()
+    {
+        benchmarkPopulate_data();
+    }
+
+    void benchmarkRemoveEntriesByDomain()
+    {
+        QFETCH(int, entries);
+        // Entries of a domain are scattered, each one is removed separately
+        mockHistory->populate(entries, 10);
+        QBENCHMARK_ONCE {
+            mockHistory->removeEntriesByDomain("example0.org");
+        }
+        QCOMPARE(mockHistory->rowCount(), entries - entries / 10);
+    }
 };
 
 QTEST_MAIN(HistoryLastVisitDateListModelTests)
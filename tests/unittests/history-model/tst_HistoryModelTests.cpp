@@ -18,13 +18,48 @@
 
 // Qt
 #include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFileInfo>
 #include <QtCore/QTemporaryFile>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlQuery>
 #include <QtTest/QSignalSpy>
 #include <QtTest/QtTest>
 
+// system
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
 // local
 #include "history-model.h"
 
+namespace {
+
+// The layout of history entries before they were made compact,
+// for comparison in benchmarkMemoryPerEntry().
+struct LegacyHistoryEntry {
+    QUrl url;
+    QString domain;
+    QString title;
+    QUrl icon;
+    uint visits;
+    QDateTime lastVisit;
+    bool hidden;
+};
+
+qint64 allocatedBytes()
+{
+#if defined(__GLIBC__)
+    struct mallinfo info = mallinfo();
+    return qint64(info.uordblks) + qint64(info.hblkhd);
+#else
+    return -1;
+#endif
+}
+
+}
+
 class HistoryModelTests : public QObject
 {
     Q_OBJECT
@@ -235,6 +270,43 @@ private Q_SLOTS:
         QVERIFY(!model->data(model->index(0, 0), HistoryModel::LastVisit + 4).isValid());
     }
 
+    void shouldUpdateLastVisitDatesWhenTimeZoneChanges()
+    {
+        QByteArray timeZone = qgetenv("TZ");
+        qputenv("TZ", "UTC0");
+        QMetaObject::invokeMethod(model, "checkTimeZone");
+        QDateTime lastVisit(QDate(2020, 1, 1), QTime(22, 30), Qt::UTC);
+        fetchEntries(lastVisit, 3, 3600);
+        QCOMPARE(model->data(model->index(0, 0), HistoryModel::LastVisitDate).toDate(), QDate(2020, 1, 1));
+        QCOMPARE(model->data(model->index(0, 0), HistoryModel::LastVisitDateString).toString(), QString("2020-01-01"));
+        QCOMPARE(model->data(model->index(2, 0), HistoryModel::LastVisitDate).toDate(), QDate(2020, 1, 1));
+
+        QSignalSpy spy(model, SIGNAL(dataChanged(const QModelIndex&, const QModelIndex&, const QVector<int>&)));
+        QMetaObject::invokeMethod(model, "checkTimeZone");
+        QVERIFY(spy.isEmpty());
+
+        qputenv("TZ", "JST-9");
+        QMetaObject::invokeMethod(model, "checkTimeZone");
+        QCOMPARE(spy.count(), 1);
+        QList<QVariant> args = spy.takeFirst();
+        QCOMPARE(args.at(0).toModelIndex().row(), 0);
+        QCOMPARE(args.at(1).toModelIndex().row(), 2);
+        QVector<int> roles = args.at(2).value<QVector<int> >();
+        QVERIFY(roles.contains(HistoryModel::LastVisitDate));
+        QVERIFY(roles.contains(HistoryModel::LastVisitDateString));
+        QCOMPARE(model->data(model->index(0, 0), HistoryModel::LastVisitDate).toDate(), QDate(2020, 1, 2));
+        QCOMPARE(model->data(model->index(0, 0), HistoryModel::LastVisitDateString).toString(), QString("2020-01-02"));
+        QCOMPARE(model->data(model->index(2, 0), HistoryModel::LastVisitDate).toDate(), QDate(2020, 1, 2));
+        model->removeEntriesByDate(QDate(2020, 1, 2));
+        QCOMPARE(model->rowCount(), 0);
+
+        if (timeZone.isNull()) {
+            qunsetenv("TZ");
+        } else {
+            qputenv("TZ", timeZone);
+        }
+    }
+
     void shouldReturnDatabasePath()
     {
         QCOMPARE(model->databasePath(), QString(":memory:"));
@@ -333,6 +405,164 @@ private Q_SLOTS:
         QCOMPARE(model->rowCount(), 0);
     }
 
+    void shouldCanonicalizeUrls()
+    {
+        QVERIFY(model->canonicalizeUrls());
+        QCOMPARE(model->add(QUrl("http://example.org/page#top"), "Example Domain", QUrl()), 1);
+        QCOMPARE(model->add(QUrl("http://example.org:80/page?utm_source=feed&fbclid=42"), "Example Domain", QUrl()), 2);
+        QCOMPARE(model->add(QUrl("http://example.org/page/"), "Example Domain", QUrl()), 3);
+        QCOMPARE(model->rowCount(), 1);
+        QCOMPARE(model->data(model->index(0, 0), HistoryModel::Url).toUrl(), QUrl("http://example.org/page"));
+        QCOMPARE(model->indexOfUrl(QUrl("http://example.org/page#bottom")), 0);
+
+        QVERIFY(model->update(QUrl("http://example.org/page?gclid=1"), "Example Page", QUrl()));
+        QCOMPARE(model->data(model->index(0, 0), HistoryModel::Title).toString(), QString("Example Page"));
+        model->hide(QUrl("http://example.org/page#top"));
+        QVERIFY(model->data(model->index(0, 0), HistoryModel::Hidden).toBool());
+        model->unHide(QUrl("http://example.org/page"));
+        QVERIFY(!model->data(model->index(0, 0), HistoryModel::Hidden).toBool());
+
+        QSignalSpy spyParameters(model, SIGNAL(trackingParametersChanged()));
+        model->setTrackingParameters(QStringList() << "ref");
+        QCOMPARE(spyParameters.count(), 1);
+        QCOMPARE(model->add(QUrl("http://example.org/page?ref=home"), "Example Domain", QUrl()), 4);
+        QCOMPARE(model->add(QUrl("http://example.org/page?utm_source=feed"), "Example Domain", QUrl()), 1);
+        QCOMPARE(model->rowCount(), 2);
+
+        QSignalSpy spyCanonicalize(model, SIGNAL(canonicalizeUrlsChanged()));
+        model->setCanonicalizeUrls(false);
+        QCOMPARE(spyCanonicalize.count(), 1);
+        QCOMPARE(model->add(QUrl("http://example.org/page#top"), "Example Domain", QUrl()), 1);
+        QCOMPARE(model->rowCount(), 3);
+        model->removeEntryByUrl(QUrl("http://example.org/page#top"));
+        QCOMPARE(model->rowCount(), 2);
+    }
+
+    void shouldMergeUrlVariantsWhenMigrating()
+    {
+        QTemporaryFile tempFile;
+        tempFile.open();
+        QString fileName = tempFile.fileName();
+        {
+            QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), "tst_history");
+            database.setDatabaseName(fileName);
+            database.open();
+            QSqlQuery query(database);
+            QVERIFY(query.exec("CREATE TABLE history (url VARCHAR, domain VARCHAR, title VARCHAR,"
+                               " icon VARCHAR, visits INTEGER, lastVisit DATETIME);"));
+            QVERIFY(query.exec("CREATE TABLE history_hidden (url VARCHAR);"));
+            QVERIFY(query.exec("INSERT INTO history VALUES "
+                               "('http://example.org/page#top', 'example.org', 'Old', '', 2, 1000), "
+                               "('http://example.com/', 'example.com', 'Example', '', 1, 1500), "
+                               "('http://example.org/page?fbclid=42', 'example.org', 'New', '', 3, 2000);"));
+            QVERIFY(query.exec("INSERT INTO history_hidden VALUES ('http://example.com/#top'), ('http://example.com/');"));
+            database.close();
+        }
+        QSqlDatabase::removeDatabase("tst_history");
+
+        QSignalSpy spyLoaded(model, SIGNAL(loaded()));
+        model->setDatabasePath(fileName);
+        QVERIFY(spyLoaded.wait());
+        QCOMPARE(model->rowCount(), 2);
+        QCOMPARE(model->data(model->index(0, 0), HistoryModel::Url).toUrl(), QUrl("http://example.org/page"));
+        QCOMPARE(model->data(model->index(0, 0), HistoryModel::Title).toString(), QString("New"));
+        QCOMPARE(model->data(model->index(0, 0), HistoryModel::Visits).toInt(), 5);
+        QCOMPARE(model->data(model->index(1, 0), HistoryModel::Url).toUrl(), QUrl("http://example.com/"));
+        QVERIFY(model->data(model->index(1, 0), HistoryModel::Hidden).toBool());
+        model->unHide(QUrl("http://example.com/"));
+        QVERIFY(!model->data(model->index(1, 0), HistoryModel::Hidden).toBool());
+    }
+
+    void shouldResumeInterruptedUrlVariantsMerge()
+    {
+        QTemporaryFile tempFile;
+        tempFile.open();
+        QString fileName = tempFile.fileName();
+        {
+            QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), "tst_history");
+            database.setDatabaseName(fileName);
+            database.open();
+            QSqlQuery query(database);
+            QVERIFY(query.exec("CREATE TABLE history (url VARCHAR, domain VARCHAR, title VARCHAR,"
+                               " icon VARCHAR, visits INTEGER, lastVisit DATETIME);"));
+            QVERIFY(query.exec("CREATE TABLE history_hidden (url VARCHAR);"));
+            QVERIFY(query.exec("INSERT INTO history VALUES "
+                               "('http://example.org/', 'example.org', 'Processed', '', 2, 1000), "
+                               "('http://example.org/#top', 'example.org', 'Not processed', '', 3, 2000);"));
+            // The first entry was processed before the migration was interrupted
+            QVERIFY(query.exec("CREATE TABLE history_merge_progress (lastRowid INTEGER);"));
+            QVERIFY(query.exec("INSERT INTO history_merge_progress VALUES (1);"));
+            database.close();
+        }
+        QSqlDatabase::removeDatabase("tst_history");
+
+        QSignalSpy spyLoaded(model, SIGNAL(loaded()));
+        model->setDatabasePath(fileName);
+        QVERIFY(spyLoaded.wait());
+        QCOMPARE(model->rowCount(), 1);
+        QCOMPARE(model->data(model->index(0, 0), HistoryModel::Url).toUrl(), QUrl("http://example.org/"));
+        QCOMPARE(model->data(model->index(0, 0), HistoryModel::Title).toString(), QString("Not processed"));
+        QCOMPARE(model->data(model->index(0, 0), HistoryModel::Visits).toInt(), 5);
+
+        {
+            QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), "tst_history");
+            database.setDatabaseName(fileName);
+            database.open();
+            QSqlQuery query(database);
+            query.exec("SELECT name FROM sqlite_master WHERE name='history_merge_progress';");
+            QVERIFY(!query.next());
+            database.close();
+        }
+        QSqlDatabase::removeDatabase("tst_history");
+    }
+
+    void shouldStoreDomainsAndIconsOnce()
+    {
+        QTemporaryFile tempFile;
+        tempFile.open();
+        QString fileName = tempFile.fileName();
+        model->setDatabasePath(fileName);
+        QUrl icon("image://webicon/123");
+        model->add(QUrl("http://example.org/page1"), "Example Domain Page 1", icon);
+        model->add(QUrl("http://example.org/page2"), "Example Domain Page 2", icon);
+        model->add(QUrl("http://example.com/page1"), "Example Domain Page 1", icon);
+        model->add(QUrl("http://example.com/page2"), "Example Domain Page 2", QUrl());
+        model->removeEntriesByDomain("example.org");
+        // Write the pending operations
+        model->setDatabasePath(":memory:");
+
+        {
+            QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), "tst_history");
+            database.setDatabaseName(fileName);
+            database.open();
+            QSqlQuery query(database);
+            query.exec("SELECT COUNT(*) FROM history_domains;");
+            QVERIFY(query.next());
+            QCOMPARE(query.value(0).toInt(), 2);
+            query.exec("SELECT COUNT(*) FROM history_icons;");
+            QVERIFY(query.next());
+            QCOMPARE(query.value(0).toInt(), 1);
+            query.exec("SELECT url, domain, icon FROM history_entries ORDER BY url;");
+            QVERIFY(query.next());
+            QCOMPARE(query.value(0).toString(), QString("http://example.com/page1"));
+            QCOMPARE(query.value(1).toString(), QString("example.com"));
+            QCOMPARE(query.value(2).toString(), icon.toString());
+            QVERIFY(query.next());
+            QCOMPARE(query.value(0).toString(), QString("http://example.com/page2"));
+            QVERIFY(query.value(2).isNull());
+            QVERIFY(!query.next());
+            database.close();
+        }
+        QSqlDatabase::removeDatabase("tst_history");
+
+        QSignalSpy spyLoaded(model, SIGNAL(loaded()));
+        model->setDatabasePath(fileName);
+        QVERIFY(spyLoaded.wait());
+        QCOMPARE(model->rowCount(), 2);
+        QCOMPARE(model->data(model->index(1, 0), HistoryModel::Domain).toString(), QString("example.com"));
+        QCOMPARE(model->data(model->index(1, 0), HistoryModel::Icon).toUrl(), icon);
+    }
+
     void shouldCountNumberOfEntries()
     {
         QSignalSpy spyCount(model, SIGNAL(rowCountChanged()));
@@ -348,6 +578,1153 @@ private Q_SLOTS:
         QCOMPARE(spyCount.count(), 3);
     }
 
+    void shouldKeepUrlLookupsConsistent()
+    {
+        for (int i = 0; i < 10; ++i) {
+            model->add(QUrl(QStringLiteral("http://example.org/%1").arg(i)), QString(), QUrl());
+        }
+        // Move entries from both halves of the list to the front
+        QCOMPARE(model->add(QUrl("http://example.org/1"), QString(), QUrl()), 2);
+        QCOMPARE(model->add(QUrl("http://example.org/8"), QString(), QUrl()), 2);
+        // Remove entries from both halves of the list
+        model->removeEntryByUrl(QUrl("http://example.org/0"));
+        model->removeEntryByUrl(QUrl("http://example.org/7"));
+        QCOMPARE(model->rowCount(), 8);
+        for (int i = 0; i < model->rowCount(); ++i) {
+            QUrl url = model->data(model->index(i, 0), HistoryModel::Url).toUrl();
+            QVERIFY(model->update(url, QStringLiteral("title %1").arg(i), QUrl()));
+            QCOMPARE(model->data(model->index(i, 0), HistoryModel::Title).toString(),
+                     QStringLiteral("title %1").arg(i));
+        }
+        model->hide(QUrl("http://example.org/2"));
+        for (int i = 0; i < model->rowCount(); ++i) {
+            QModelIndex index = model->index(i, 0);
+            bool hidden = (model->data(index, HistoryModel::Url).toUrl() == QUrl("http://example.org/2"));
+            QCOMPARE(model->data(index, HistoryModel::Hidden).toBool(), hidden);
+        }
+    }
+
+    void shouldMigrateLegacySchemas_data()
+    {
+        QTest::addColumn<QStringList>("statements");
+        QTest::newRow("without domain") << (QStringList()
+            << "CREATE TABLE history (url VARCHAR, title VARCHAR, icon VARCHAR, visits INTEGER, lastVisit DATETIME);"
+            << "INSERT INTO history VALUES ('http://example.org/', 'Example', '', 3, 1000);");
+        QTest::newRow("with domain") << (QStringList()
+            << "CREATE TABLE history (url VARCHAR, domain VARCHAR, title VARCHAR, icon VARCHAR, visits INTEGER, lastVisit DATETIME);"
+            << "CREATE TABLE history_hidden (url VARCHAR);"
+            << "INSERT INTO history VALUES ('http://example.org/', 'example.org', 'Example', '', 3, 1000);");
+    }
+
+    void shouldMigrateLegacySchemas()
+    {
+        QFETCH(QStringList, statements);
+        QTemporaryFile tempFile;
+        tempFile.open();
+        QString fileName = tempFile.fileName();
+        {
+            QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), "tst_history");
+            database.setDatabaseName(fileName);
+            database.open();
+            Q_FOREACH(const QString& statement, statements) {
+                QSqlQuery query(database);
+                QVERIFY(query.exec(statement));
+            }
+            database.close();
+        }
+        QSqlDatabase::removeDatabase("tst_history");
+
+        delete model;
+        model = new HistoryModel;
+        QSignalSpy spyLoaded(model, SIGNAL(loaded()));
+        model->setDatabasePath(fileName);
+        QVERIFY(spyLoaded.wait());
+        QCOMPARE(model->rowCount(), 1);
+        QCOMPARE(model->data(model->index(0, 0), HistoryModel::Domain).toString(), QString("example.org"));
+        QCOMPARE(model->data(model->index(0, 0), HistoryModel::Visits).toInt(), 3);
+
+        {
+            QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), "tst_history");
+            database.setDatabaseName(fileName);
+            database.open();
+            QSqlQuery query(database);
+            query.exec("PRAGMA user_version;");
+            QVERIFY(query.next());
+            QCOMPARE(query.value(0).toInt(), 6);
+            query.exec("SELECT name FROM sqlite_master WHERE type='index';");
+            QStringList indexes;
+            while (query.next()) {
+                indexes << query.value(0).toString();
+            }
+            QVERIFY(indexes.contains("history_url"));
+            QVERIFY(indexes.contains("history_domainId"));
+            QVERIFY(indexes.contains("history_lastVisit"));
+            QVERIFY(indexes.contains("history_hidden_url"));
+            query.exec("SELECT url, domain, visits FROM history_entries;");
+            QVERIFY(query.next());
+            QCOMPARE(query.value(0).toString(), QString("http://example.org/"));
+            QCOMPARE(query.value(1).toString(), QString("example.org"));
+            QCOMPARE(query.value(2).toInt(), 3);
+            database.close();
+        }
+        QSqlDatabase::removeDatabase("tst_history");
+    }
+
+    void shouldBackfillMissingDomains()
+    {
+        QTemporaryFile tempFile;
+        tempFile.open();
+        QString fileName = tempFile.fileName();
+        const int count = 250;
+        {
+            QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), "tst_history");
+            database.setDatabaseName(fileName);
+            database.open();
+            QSqlQuery query(database);
+            query.exec(QStringLiteral("CREATE TABLE history (url VARCHAR, title VARCHAR,"
+                                      " icon VARCHAR, visits INTEGER, lastVisit DATETIME);"));
+            database.transaction();
+            query.prepare(QStringLiteral("INSERT INTO history VALUES (?, ?, ?, ?, ?);"));
+            for (int i = 0; i < count; ++i) {
+                query.addBindValue(QStringLiteral("http://www.example%1.org/").arg(i));
+                query.addBindValue(QString());
+                query.addBindValue(QString());
+                query.addBindValue(1);
+                query.addBindValue(1000 + i);
+                query.exec();
+            }
+            database.commit();
+            database.close();
+        }
+        QSqlDatabase::removeDatabase("tst_history");
+
+        delete model;
+        model = new HistoryModel;
+        QSignalSpy spyLoaded(model, SIGNAL(loaded()));
+        model->setDatabasePath(fileName);
+        QVERIFY(spyLoaded.wait());
+        QCOMPARE(model->data(model->index(0, 0), HistoryModel::Domain).toString(), QString("example249.org"));
+
+        {
+            QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), "tst_history");
+            database.setDatabaseName(fileName);
+            database.open();
+            QSqlQuery query(database);
+            QTRY_VERIFY_WITH_TIMEOUT(query.exec("SELECT COUNT(*) FROM history WHERE domainId IS NULL;") &&
+                                     query.next() && (query.value(0).toInt() == 0), 10000);
+            query.exec("SELECT domain FROM history_entries WHERE url = 'http://www.example42.org/';");
+            QVERIFY(query.next());
+            QCOMPARE(query.value(0).toString(), QString("example42.org"));
+            database.close();
+        }
+        QSqlDatabase::removeDatabase("tst_history");
+    }
+
+    void shouldLoadEntriesInBatches()
+    {
+        QTemporaryFile tempFile;
+        tempFile.open();
+        QString fileName = tempFile.fileName();
+        const int count = 2500;
+        {
+            QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), "tst_history");
+            database.setDatabaseName(fileName);
+            database.open();
+            QSqlQuery query(database);
+            query.exec(QStringLiteral("CREATE TABLE history (url VARCHAR, domain VARCHAR, title VARCHAR,"
+                                      " icon VARCHAR, visits INTEGER, lastVisit DATETIME);"));
+            database.transaction();
+            query.prepare(QStringLiteral("INSERT INTO history VALUES (?, ?, ?, ?, ?, ?);"));
+            uint now = QDateTime::currentDateTimeUtc().toTime_t();
+            for (int i = 0; i < count; ++i) {
+                query.addBindValue(QStringLiteral("http://example.org/%1").arg(i));
+                query.addBindValue(QStringLiteral("example.org"));
+                query.addBindValue(QStringLiteral("page %1").arg(i));
+                query.addBindValue(QString());
+                // The oldest entries are the most visited ones
+                query.addBindValue(i);
+                query.addBindValue(now - i * 60);
+                query.exec();
+            }
+            database.commit();
+            database.close();
+        }
+        QSqlDatabase::removeDatabase("tst_history");
+
+        delete model;
+        model = new HistoryModel;
+        QSignalSpy spyLoaded(model, SIGNAL(loaded()));
+        QSignalSpy spyInserted(model, SIGNAL(rowsInserted(const QModelIndex&, int, int)));
+        model->setDatabasePath(fileName);
+        QCOMPARE(model->loadProgress(), 0.0);
+        QVERIFY(spyLoaded.wait());
+        QCOMPARE(model->loadProgress(), 1.0);
+        QCOMPARE(model->rowCount(), count);
+        // One insertion for the priority entries (possibly split in as many
+        // runs as there are most visited entries), then one per batch.
+        QVERIFY(spyInserted.count() < 60);
+        for (int i = 0; i < count; ++i) {
+            QCOMPARE(model->data(model->index(i, 0), HistoryModel::Url).toUrl(),
+                     QUrl(QStringLiteral("http://example.org/%1").arg(i)));
+        }
+        QCOMPARE(model->add(QUrl("http://example.org/2000"), QString(), QUrl()), 2001);
+        QCOMPARE(model->data(model->index(0, 0), HistoryModel::Url).toUrl(), QUrl("http://example.org/2000"));
+    }
+
+    void shouldLoadEntriesVisitedWithinTheSameSecondInOrder()
+    {
+        QTemporaryFile tempFile;
+        tempFile.open();
+        QString fileName = tempFile.fileName();
+        const int count = 2500;
+        {
+            // Let the model create the schema
+            HistoryModel history;
+            history.setDatabasePath(fileName);
+        }
+        {
+            QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), "tst_history");
+            database.setDatabaseName(fileName);
+            database.open();
+            QSqlQuery query(database);
+            database.transaction();
+            query.prepare(QStringLiteral("INSERT INTO history (url, title, visits, lastVisit, visitId) "
+                                         "VALUES (?, ?, ?, ?, ?);"));
+            uint now = QDateTime::currentDateTimeUtc().toTime_t();
+            for (int i = 0; i < count; ++i) {
+                query.addBindValue(QStringLiteral("http://example.org/%1").arg(i));
+                query.addBindValue(QStringLiteral("page %1").arg(i));
+                // Some of the most visited entries are fetched first
+                query.addBindValue((i % 37 == 0) ? 100 : 1);
+                query.addBindValue(now);
+                // Entries visited before visits were numbered come last
+                query.addBindValue((i < 500) ? QVariant() : QVariant(i));
+                query.exec();
+            }
+            database.commit();
+            database.close();
+        }
+        QSqlDatabase::removeDatabase("tst_history");
+
+        delete model;
+        model = new HistoryModel;
+        QSignalSpy spyLoaded(model, SIGNAL(loaded()));
+        model->setDatabasePath(fileName);
+        QVERIFY(spyLoaded.wait());
+        QCOMPARE(model->rowCount(), count);
+        for (int i = 0; i < count; ++i) {
+            QCOMPARE(model->data(model->index(i, 0), HistoryModel::Url).toUrl(),
+                     QUrl(QStringLiteral("http://example.org/%1").arg(count - 1 - i)));
+        }
+
+        // The same order as in virtualized mode
+        QVariantList items = model->getRange(0, count, QStringList() << "url");
+        model->setVirtualized(true);
+        QCOMPARE(model->getRange(0, count, QStringList() << "url"), items);
+    }
+
+    void shouldCoalesceDatabaseOperations()
+    {
+        QSignalSpy spyFlushed(model, SIGNAL(flushed(int, int, qint64)));
+        QUrl url(QStringLiteral("http://example.org/"));
+        model->add(url, QStringLiteral("title"), QUrl());
+        for (int i = 0; i < 10; ++i) {
+            model->update(url, QStringLiteral("title %1").arg(i), QUrl());
+        }
+        model->add(url, QStringLiteral("title"), QUrl());
+        model->hide(url);
+        model->unHide(url);
+        QVERIFY(spyFlushed.wait(2000));
+        QList<QVariant> args = spyFlushed.takeFirst();
+        QCOMPARE(args.at(0).toInt(), 14);
+        // One insert with the latest state of the entry, one delete from
+        // the hidden entries (the insert into them was superseded).
+        QCOMPARE(args.at(1).toInt(), 2);
+    }
+
+    void shouldPruneLeastValuableEntries()
+    {
+        QTRY_COMPARE(model->loadProgress(), 1.0);
+        for (int i = 0; i < 10; ++i) {
+            QUrl url(QStringLiteral("http://example.org/%1").arg(i));
+            for (int j = 0; j <= i; ++j) {
+                model->add(url, QString(), QUrl());
+            }
+        }
+        QCOMPARE(model->rowCount(), 10);
+        QSignalSpy spyRemoved(model, SIGNAL(rowsRemoved(const QModelIndex&, int, int)));
+        model->setMaxEntries(4);
+        QTRY_COMPARE(model->rowCount(), 4);
+        // The most visited entries are kept, removed in as many contiguous runs
+        QCOMPARE(spyRemoved.count(), 1);
+        for (int i = 0; i < 4; ++i) {
+            QCOMPARE(model->data(model->index(i, 0), HistoryModel::Url).toUrl(),
+                     QUrl(QStringLiteral("http://example.org/%1").arg(9 - i)));
+        }
+        QCOMPARE(model->add(QUrl("http://example.org/6"), QString(), QUrl()), 8);
+    }
+
+    void shouldPruneEntriesAddedPastTheLimitInBatches()
+    {
+        QTemporaryFile tempFile;
+        tempFile.open();
+        model->setDatabasePath(tempFile.fileName());
+        QTRY_COMPARE(model->loadProgress(), 1.0);
+        model->setMaxEntries(10);
+        // Let the first retention pass finish
+        QTest::qWait(100);
+
+        // A batch of entries takes the model past the retention threshold
+        const int count = 200;
+        uint lastVisit = QDateTime::currentDateTimeUtc().addSecs(-3600).toTime_t();
+        {
+            QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), "tst_history");
+            database.setDatabaseName(tempFile.fileName());
+            database.open();
+            QSqlQuery query(database);
+            database.transaction();
+            query.prepare("INSERT INTO history (url, title, visits, lastVisit) VALUES (?, ?, 1, ?);");
+            for (int i = 0; i < count; ++i) {
+                query.addBindValue(QStringLiteral("http://example.org/%1").arg(i));
+                query.addBindValue(QStringLiteral("Example page %1").arg(i));
+                query.addBindValue(lastVisit - i * 60);
+                query.exec();
+            }
+            database.commit();
+            database.close();
+        }
+        QSqlDatabase::removeDatabase("tst_history");
+        fetchEntries(QDateTime::fromTime_t(lastVisit), count, 60);
+
+        model->add(QUrl("http://example.com/"), "Example Domain", QUrl());
+        QTRY_COMPARE(model->rowCount(), 10);
+        QCOMPARE(model->urlAt(0), QUrl("http://example.com/"));
+    }
+
+    void shouldPruneOldEntries()
+    {
+        QTemporaryFile tempFile;
+        tempFile.open();
+        QString fileName = tempFile.fileName();
+        const int count = 1200;
+        {
+            QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), "tst_history");
+            database.setDatabaseName(fileName);
+            database.open();
+            QSqlQuery query(database);
+            query.exec(QStringLiteral("CREATE TABLE history (url VARCHAR, domain VARCHAR, title VARCHAR,"
+                                      " icon VARCHAR, visits INTEGER, lastVisit DATETIME);"));
+            database.transaction();
+            query.prepare(QStringLiteral("INSERT INTO history VALUES (?, ?, ?, ?, ?, ?);"));
+            QDateTime now = QDateTime::currentDateTimeUtc();
+            for (int i = 0; i < count; ++i) {
+                query.addBindValue(QStringLiteral("http://example.org/%1").arg(i));
+                query.addBindValue(QStringLiteral("example.org"));
+                query.addBindValue(QString());
+                query.addBindValue(QString());
+                query.addBindValue(1);
+                // One entry per hour, the first 48 ones in the last two days
+                query.addBindValue(now.addSecs(-3600 * i - 1800).toTime_t());
+                query.exec();
+            }
+            database.commit();
+            database.close();
+        }
+        QSqlDatabase::removeDatabase("tst_history");
+
+        delete model;
+        model = new HistoryModel;
+        QSignalSpy spyLoaded(model, SIGNAL(loaded()));
+        model->setDatabasePath(fileName);
+        QVERIFY(spyLoaded.wait());
+        QCOMPARE(model->rowCount(), count);
+        QSignalSpy spyRemoved(model, SIGNAL(rowsRemoved(const QModelIndex&, int, int)));
+        model->setMaxAge(2);
+        QTRY_COMPARE(model->rowCount(), 48);
+        // One removal per batch of pruned entries
+        QCOMPARE(spyRemoved.count(), 3);
+
+        {
+            QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), "tst_history");
+            database.setDatabaseName(fileName);
+            database.open();
+            QSqlQuery query(database);
+            query.exec("SELECT COUNT(*) FROM history;");
+            QVERIFY(query.next());
+            QCOMPARE(query.value(0).toInt(), 48);
+            query.exec("PRAGMA auto_vacuum;");
+            QVERIFY(query.next());
+            QCOMPARE(query.value(0).toInt(), 2);
+            database.close();
+        }
+        QSqlDatabase::removeDatabase("tst_history");
+    }
+
+    void shouldAccessEntriesByUrl()
+    {
+        model->add(QUrl("http://example.org/"), "Example Domain", QUrl());
+        model->add(QUrl("http://example.com/"), "Example Domain", QUrl());
+        QCOMPARE(model->urlAt(0), QUrl("http://example.com/"));
+        QCOMPARE(model->urlAt(1), QUrl("http://example.org/"));
+        QVERIFY(model->urlAt(2).isEmpty());
+        QVERIFY(model->urlAt(-1).isEmpty());
+        QCOMPARE(model->indexOfUrl(QUrl("http://example.org/")), 1);
+        QCOMPARE(model->indexOfUrl(QUrl("http://example.net/")), -1);
+    }
+
+    void shouldGetRangeOfEntries()
+    {
+        model->add(QUrl("http://example.org/"), "Example Domain", QUrl());
+        model->add(QUrl("http://example.com/"), "Example Domain", QUrl());
+        model->add(QUrl("http://example.net/"), "Example Domain", QUrl());
+        QVariantMap item = model->get(1, QStringList() << "url" << "visits");
+        QCOMPARE(item.count(), 2);
+        QCOMPARE(item.value("url").toUrl(), QUrl("http://example.com/"));
+        QCOMPARE(item.value("visits").toInt(), 1);
+        QVariantList items = model->getRange(1, 10, QStringList() << "url");
+        QCOMPARE(items.count(), 2);
+        QCOMPARE(items.at(0).toMap().value("url").toUrl(), QUrl("http://example.com/"));
+        QCOMPARE(items.at(1).toMap().value("url").toUrl(), QUrl("http://example.org/"));
+        QCOMPARE(model->getRange(0, 1).first().toMap().count(), model->roleNames().count());
+    }
+
+    void shouldLoadVirtualizedHistory()
+    {
+        QTemporaryFile tempFile;
+        tempFile.open();
+        model->setDatabasePath(tempFile.fileName());
+        populate(250);
+        model->hide(QUrl("http://example.org/42"));
+        delete model;
+
+        model = new HistoryModel;
+        model->setVirtualized(true);
+        model->setDatabasePath(tempFile.fileName());
+        QSignalSpy spyLoaded(model, SIGNAL(loaded()));
+        QCOMPARE(model->rowCount(), 250);
+        QVERIFY(spyLoaded.wait());
+        QCOMPARE(model->loadProgress(), 1.0);
+        // Pages are read in the background, rows have no data until then
+        qRegisterMetaType<QVector<int> >();
+        QSignalSpy spyChanged(model, SIGNAL(dataChanged(const QModelIndex&, const QModelIndex&, const QVector<int>&)));
+        for (int i = 0; i < 250; ++i) {
+            QVERIFY(!model->data(model->index(i, 0), HistoryModel::Url).isValid());
+        }
+        QTRY_COMPARE(spyChanged.count(), 3);
+        QCOMPARE(spyChanged.at(2).at(0).toModelIndex().row(), 200);
+        QCOMPARE(spyChanged.at(2).at(1).toModelIndex().row(), 249);
+        // Rows are read in pages, in the order they were added
+        for (int i = 0; i < 250; ++i) {
+            QModelIndex index = model->index(249 - i, 0);
+            QCOMPARE(model->data(index, HistoryModel::Url).toUrl(), QUrl(QStringLiteral("http://example.org/%1").arg(i)));
+            QCOMPARE(model->data(index, HistoryModel::Domain).toString(), QString("example.org"));
+            QCOMPARE(model->data(index, HistoryModel::Visits).toInt(), 1);
+            QCOMPARE(model->data(index, HistoryModel::Hidden).toBool(), i == 42);
+        }
+        QVERIFY(!model->data(model->index(250, 0), HistoryModel::Url).isValid());
+    }
+
+    void shouldKeepVirtualizedRowsInSyncWithDatabase()
+    {
+        model->setVirtualized(true);
+        QVERIFY(model->virtualized());
+        populate(10);
+
+        QSignalSpy spyMoved(model, SIGNAL(rowsMoved(const QModelIndex&, int, int, const QModelIndex&, int)));
+        QCOMPARE(model->add(QUrl("http://example.org/3"), "Example Domain", QUrl()), 2);
+        QCOMPARE(model->rowCount(), 10);
+        // Entries visited within the same second are ordered by visit
+        int row = model->indexOfUrl(QUrl("http://example.org/3"));
+        QCOMPARE(row, 0);
+        QCOMPARE(spyMoved.count(), 1);
+        QCOMPARE(model->urlAt(row), QUrl("http://example.org/3"));
+        QCOMPARE(model->data(model->index(row, 0), HistoryModel::Visits).toInt(), 2);
+
+        QVERIFY(model->update(QUrl("http://example.org/5"), "updated", QUrl()));
+        row = model->indexOfUrl(QUrl("http://example.org/5"));
+        QCOMPARE(model->data(model->index(row, 0), HistoryModel::Title).toString(), QString("updated"));
+        QVERIFY(!model->update(QUrl("http://example.org/5"), "updated", QUrl()));
+        QVERIFY(!model->update(QUrl("http://example.com/"), "missing", QUrl()));
+
+        QSignalSpy spyChanged(model, SIGNAL(dataChanged(const QModelIndex&, const QModelIndex&, const QVector<int>&)));
+        model->hide(QUrl("http://example.org/7"));
+        QCOMPARE(spyChanged.count(), 1);
+        row = model->indexOfUrl(QUrl("http://example.org/7"));
+        QVERIFY(model->data(model->index(row, 0), HistoryModel::Hidden).toBool());
+
+        model->removeEntryByUrl(QUrl("http://example.org/0"));
+        QCOMPARE(model->rowCount(), 9);
+        QCOMPARE(model->indexOfUrl(QUrl("http://example.org/0")), -1);
+
+        model->add(QUrl("http://example.com/"), "Example Domain", QUrl());
+        QCOMPARE(model->rowCount(), 10);
+        model->removeEntriesByDomain("example.org");
+        // Bulk removals reset the model once the database is updated
+        QTRY_COMPARE(model->rowCount(), 1);
+        QCOMPARE(model->urlAt(0), QUrl("http://example.com/"));
+
+        model->clearAll();
+        QCOMPARE(model->rowCount(), 0);
+        QVERIFY(model->urlAt(0).isEmpty());
+    }
+
+    void shouldResetVirtualizedRowsOutOfSyncWithDatabase()
+    {
+        QTemporaryFile tempFile;
+        tempFile.open();
+        model->setDatabasePath(tempFile.fileName());
+        model->setVirtualized(true);
+        populate(5);
+        QCOMPARE(model->urlAt(0), QUrl("http://example.org/4"));
+
+        // Entries written by another connection are not known to the model
+        {
+            QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), "tst_history");
+            database.setDatabaseName(tempFile.fileName());
+            database.open();
+            QSqlQuery query(database);
+            query.prepare("INSERT INTO history (url, title, visits, lastVisit) VALUES (?, 'Example', 1, ?);");
+            uint later = QDateTime::currentDateTimeUtc().toTime_t() + 3600;
+            for (int i = 0; i < 10; ++i) {
+                query.addBindValue(QStringLiteral("http://example.com/%1").arg(i));
+                query.addBindValue(later);
+                QVERIFY(query.exec());
+            }
+            database.close();
+        }
+        QSqlDatabase::removeDatabase("tst_history");
+
+        QSignalSpy spyReset(model, SIGNAL(modelReset()));
+        QCOMPARE(model->add(QUrl("http://example.org/0"), "Example Domain", QUrl()), 2);
+        QTRY_COMPARE(spyReset.count(), 1);
+        QCOMPARE(model->rowCount(), 15);
+        int row = model->indexOfUrl(QUrl("http://example.org/0"));
+        QTRY_COMPARE(model->data(model->index(row, 0), HistoryModel::Visits).toInt(), 2);
+    }
+
+    void shouldNotWaitForTheDatabaseToVisitEntriesInVirtualizedMode()
+    {
+        QTemporaryFile tempFile;
+        tempFile.open();
+        createHistory(tempFile.fileName(), 1000);
+        model->setVirtualized(true);
+        model->setDatabasePath(tempFile.fileName());
+        QCOMPARE(model->rowCount(), 1000);
+
+        // Another connection holds the write lock
+        QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), "tst_history");
+        database.setDatabaseName(tempFile.fileName());
+        database.open();
+        QSqlQuery query(database);
+        QVERIFY(query.exec("BEGIN IMMEDIATE;"));
+        QElapsedTimer timer;
+        timer.start();
+        // The number of visits of entries not in memory is not known yet
+        QCOMPARE(model->add(QUrl("http://www.example0.org/page/500"), "Example page", QUrl()), 1);
+        QCOMPARE(model->add(QUrl("http://example.org/"), "Example Domain", QUrl()), 1);
+        QVERIFY(timer.elapsed() < 1000);
+        QCOMPARE(model->rowCount(), 1001);
+        QCOMPARE(model->urlAt(0), QUrl("http://www.example0.org/page/500"));
+
+        // Rows are corrected in the order the database is updated
+        QVERIFY(query.exec("COMMIT;"));
+        QTRY_COMPARE(model->urlAt(0), QUrl("http://example.org/"));
+        QCOMPARE(model->rowCount(), 1001);
+        QCOMPARE(model->urlAt(1), QUrl("http://www.example0.org/page/500"));
+        QCOMPARE(model->data(model->index(1, 0), HistoryModel::Visits).toInt(), 2);
+        QCOMPARE(model->urlAt(502), QUrl("http://www.example1.org/page/501"));
+        query = QSqlQuery();
+        database.close();
+        database = QSqlDatabase();
+        QSqlDatabase::removeDatabase("tst_history");
+    }
+
+    void shouldSwitchToVirtualizedMode()
+    {
+        populate(150);
+        QVariantList items = model->getRange(0, 150, QStringList() << "url");
+        QSignalSpy spyReset(model, SIGNAL(modelReset()));
+        QSignalSpy spyVirtualized(model, SIGNAL(virtualizedChanged()));
+        model->setVirtualized(true);
+        QCOMPARE(spyVirtualized.count(), 1);
+        QCOMPARE(spyReset.count(), 1);
+        QCOMPARE(model->getRange(0, 150, QStringList() << "url"), items);
+
+        QSignalSpy spyLoaded(model, SIGNAL(loaded()));
+        model->setVirtualized(false);
+        QVERIFY(spyLoaded.wait());
+        QCOMPARE(model->rowCount(), 150);
+        Q_FOREACH(const QVariant& item, items) {
+            QVERIFY(model->indexOfUrl(item.toMap().value("url").toUrl()) != -1);
+        }
+    }
+
+    void shouldImportBrowserHistory_data()
+    {
+        QTest::addColumn<bool>("chromium");
+        QTest::newRow("chromium") << true;
+        QTest::newRow("firefox") << false;
+    }
+
+    void shouldImportBrowserHistory()
+    {
+        QFETCH(bool, chromium);
+        QTemporaryFile tempFile;
+        tempFile.open();
+        createBrowserHistory(tempFile.fileName(), chromium, 10);
+
+        model->add(QUrl("http://example.org/3"), "Already visited", QUrl());
+        QSignalSpy spyProgress(model, SIGNAL(importProgress(int)));
+        QSignalSpy spyFinished(model, SIGNAL(importFinished(bool, int)));
+        model->importHistory(tempFile.fileName());
+        QVERIFY(spyFinished.wait());
+        QCOMPARE(spyFinished.first().at(0).toBool(), true);
+        // Existing URLs, hidden pages and non-web URLs are skipped
+        QCOMPARE(spyFinished.first().at(1).toInt(), 6);
+        QCOMPARE(spyProgress.count(), 1);
+        QCOMPARE(spyProgress.first().at(0).toInt(), 6);
+        QCOMPARE(model->rowCount(), 7);
+
+        QCOMPARE(model->data(model->index(0, 0), HistoryModel::Url).toUrl(), QUrl("http://example.org/3"));
+        QCOMPARE(model->data(model->index(0, 0), HistoryModel::Title).toString(), QString("Already visited"));
+        QCOMPARE(model->data(model->index(0, 0), HistoryModel::Visits).toInt(), 1);
+        QCOMPARE(model->data(model->index(1, 0), HistoryModel::Url).toUrl(), QUrl("http://example.org/0"));
+        QCOMPARE(model->data(model->index(1, 0), HistoryModel::Domain).toString(), QString("example.org"));
+        QCOMPARE(model->data(model->index(1, 0), HistoryModel::Title).toString(), QString("Page 0"));
+        QCOMPARE(model->data(model->index(1, 0), HistoryModel::Visits).toInt(), 1);
+        QCOMPARE(model->data(model->index(2, 0), HistoryModel::Url).toUrl(), QUrl("http://example.org/1"));
+        QCOMPARE(model->data(model->index(2, 0), HistoryModel::Visits).toInt(), 2);
+        for (int i = 1; i < model->rowCount(); ++i) {
+            QVERIFY(model->data(model->index(i - 1, 0), HistoryModel::LastVisit).toDateTime() >=
+                    model->data(model->index(i, 0), HistoryModel::LastVisit).toDateTime());
+        }
+        QDateTime lastVisit = model->data(model->index(1, 0), HistoryModel::LastVisit).toDateTime();
+        QVERIFY(qAbs(lastVisit.secsTo(QDateTime::currentDateTimeUtc()) - 60) < 5);
+
+        // Importing again doesn’t add duplicates
+        spyFinished.clear();
+        model->importHistory(tempFile.fileName());
+        QVERIFY(spyFinished.wait());
+        QCOMPARE(spyFinished.first().at(1).toInt(), 0);
+        QCOMPARE(model->rowCount(), 7);
+    }
+
+    void shouldNotImportHiddenUrls()
+    {
+        QTemporaryFile tempFile;
+        tempFile.open();
+        createBrowserHistory(tempFile.fileName(), false, 10);
+
+        model->add(QUrl("http://example.org/3"), "Already visited", QUrl());
+        model->hide(QUrl("http://example.org/3"));
+        // Hidden without ever being visited in this browser
+        model->hide(QUrl("http://example.org/5"));
+        QSignalSpy spyFinished(model, SIGNAL(importFinished(bool, int)));
+        model->importHistory(tempFile.fileName());
+        QVERIFY(spyFinished.wait());
+        QVERIFY(spyFinished.first().at(0).toBool());
+        QCOMPARE(spyFinished.first().at(1).toInt(), 5);
+        QCOMPARE(model->rowCount(), 6);
+        QCOMPARE(model->indexOfUrl(QUrl("http://example.org/5")), -1);
+        QCOMPARE(model->data(model->index(model->indexOfUrl(QUrl("http://example.org/3")), 0),
+                             HistoryModel::Title).toString(), QString("Already visited"));
+    }
+
+    void shouldVisitPagesWhileImporting()
+    {
+        QTemporaryFile sourceFile;
+        sourceFile.open();
+        // 14000 web pages, imported in several batches
+        createBrowserHistory(sourceFile.fileName(), true, 20000);
+        QTemporaryFile tempFile;
+        tempFile.open();
+        model->setDatabasePath(tempFile.fileName());
+
+        QSignalSpy spyProgress(model, SIGNAL(importProgress(int)));
+        QSignalSpy spyFinished(model, SIGNAL(importFinished(bool, int)));
+        model->importHistory(sourceFile.fileName());
+        QVERIFY(spyProgress.wait());
+        // Pages visited while importing don't wait for the whole import
+        model->add(QUrl("http://example.org/0"), "Visited", QUrl());
+        model->add(QUrl("http://example.org/19990"), "Visited", QUrl());
+        QCOMPARE(model->rowCount(), 5001);
+        QVERIFY(spyFinished.wait(60000));
+        QVERIFY(spyFinished.first().at(0).toBool());
+        QCOMPARE(model->rowCount(), 14000);
+
+        // The database holds a single entry per URL
+        delete model;
+        model = new HistoryModel;
+        QSignalSpy spyLoaded(model, SIGNAL(loaded()));
+        model->setDatabasePath(tempFile.fileName());
+        QVERIFY(spyLoaded.wait());
+        QCOMPARE(model->rowCount(), 14000);
+        int row = model->indexOfUrl(QUrl("http://example.org/19990"));
+        QCOMPARE(model->data(model->index(row, 0), HistoryModel::Title).toString(), QString("Visited"));
+    }
+    void shouldFailToImportUnknownHistory()
+    {
+        QTemporaryFile tempFile;
+        tempFile.open();
+        {
+            QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), "tst_history");
+            database.setDatabaseName(tempFile.fileName());
+            database.open();
+            QSqlQuery query(database);
+            query.exec(QStringLiteral("CREATE TABLE unrelated (url VARCHAR);"));
+            database.close();
+        }
+        QSqlDatabase::removeDatabase("tst_history");
+
+        QSignalSpy spyFinished(model, SIGNAL(importFinished(bool, int)));
+        model->importHistory(tempFile.fileName());
+        QVERIFY(spyFinished.wait());
+        QCOMPARE(spyFinished.first().at(0).toBool(), false);
+        QCOMPARE(spyFinished.first().at(1).toInt(), 0);
+
+        spyFinished.clear();
+        model->importHistory(QStringLiteral("/nonexistent/History"));
+        QVERIFY(spyFinished.wait());
+        QCOMPARE(spyFinished.first().at(0).toBool(), false);
+        QCOMPARE(model->rowCount(), 0);
+    }
+
+    void benchmarkAddExistingEntry_data()
+    {
+        QTest::addColumn<int>("entries");
+        QTest::newRow("1k") << 1000;
+        QTest::newRow("10k") << 10000;
+        QTest::newRow("100k") << 100000;
+    }
+
+    void benchmarkAddExistingEntry()
+    {
+        QFETCH(int, entries);
+        populate(entries);
+        // Always re-visit the oldest entry, the worst case for a lookup
+        QBENCHMARK {
+            QUrl url = model->data(model->index(entries - 1, 0), HistoryModel::Url).toUrl();
+            model->add(url, QStringLiteral("Example Domain"), QUrl());
+        }
+        QCOMPARE(model->rowCount(), entries);
+    }
+
+    void benchmarkUpdateEntry_data()
+    {
+        benchmarkAddExistingEntry_data();
+    }
+
+    void benchmarkUpdateEntry()
+    {
+        QFETCH(int, entries);
+        populate(entries);
+        QUrl url = model->data(model->index(entries - 1, 0), HistoryModel::Url).toUrl();
+        int i = 0;
+        QBENCHMARK {
+            model->update(url, QStringLiteral("title %1").arg(++i), QUrl());
+        }
+    }
+
+    void benchmarkEnqueueOperations_data()
+    {
+        QTest::addColumn<int>("operations");
+        QTest::newRow("100") << 100;
+        QTest::newRow("1k") << 1000;
+        QTest::newRow("10k") << 10000;
+    }
+
+    void benchmarkEnqueueOperations()
+    {
+        QFETCH(int, operations);
+        QList<QUrl> urls;
+        for (int i = 0; i < operations / 2; ++i) {
+            urls.append(QUrl(QStringLiteral("http://example.org/%1").arg(i)));
+        }
+        // Bulk hides, each one queues a write operation for the worker
+        QBENCHMARK {
+            Q_FOREACH(const QUrl& url, urls) {
+                model->hide(url);
+            }
+            Q_FOREACH(const QUrl& url, urls) {
+                model->unHide(url);
+            }
+        }
+        QSignalSpy spyFlushed(model, SIGNAL(flushed(int, int, qint64)));
+        QVERIFY(spyFlushed.wait(2000));
+    }
+
+    void benchmarkEnqueueOperationsWhileWorkerIsBusy()
+    {
+        QTemporaryFile tempFile;
+        tempFile.open();
+        model->setDatabasePath(tempFile.fileName());
+        QTRY_COMPARE(model->loadProgress(), 1.0);
+        // Another connection holds the write lock, the worker waits for it
+        // as soon as it flushes operations, while far more operations than
+        // the queue can hold are enqueued
+        QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), "tst_history");
+        database.setDatabaseName(tempFile.fileName());
+        database.open();
+        QSqlQuery query(database);
+        QVERIFY(query.exec("BEGIN IMMEDIATE;"));
+        QList<QUrl> urls;
+        for (int i = 0; i < 5000; ++i) {
+            urls.append(QUrl(QStringLiteral("http://example.org/%1").arg(i)));
+        }
+        QBENCHMARK {
+            Q_FOREACH(const QUrl& url, urls) {
+                model->hide(url);
+            }
+            Q_FOREACH(const QUrl& url, urls) {
+                model->unHide(url);
+            }
+        }
+        QSignalSpy spyFlushed(model, SIGNAL(flushed(int, int, qint64)));
+        QVERIFY(query.exec("COMMIT;"));
+        QVERIFY(spyFlushed.wait(30000));
+        query = QSqlQuery();
+        database.close();
+        database = QSqlDatabase();
+        QSqlDatabase::removeDatabase("tst_history");
+    }
+
+    void benchmarkDataSweep_data()
+    {
+        QTest::addColumn<int>("role");
+        QTest::newRow("lastVisit") << int(HistoryModel::LastVisit);
+        QTest::newRow("lastVisitDate") << int(HistoryModel::LastVisitDate);
+        QTest::newRow("lastVisitDateString") << int(HistoryModel::LastVisitDateString);
+    }
+
+    void benchmarkDataSweep()
+    {
+        QFETCH(int, role);
+        const int entries = 100000;
+        // One visit every 10 minutes, i.e. about two years of history
+        fetchEntries(QDateTime::currentDateTimeUtc(), entries, 600);
+        QBENCHMARK {
+            for (int i = 0; i < entries; ++i) {
+                model->data(model->index(i, 0), role);
+            }
+        }
+    }
+
+    void benchmarkMemoryPerEntry_data()
+    {
+        QTest::addColumn<bool>("legacy");
+        QTest::newRow("legacy layout") << true;
+        QTest::newRow("compact layout") << false;
+    }
+
+    void benchmarkMemoryPerEntry()
+    {
+        QFETCH(bool, legacy);
+        if (allocatedBytes() < 0) {
+            QSKIP("Heap usage can only be measured with glibc");
+        }
+        const int entries = 100000;
+        const int batchSize = 1000;
+        QDateTime now = QDateTime::currentDateTimeUtc();
+        QList<LegacyHistoryEntry> legacyEntries;
+        qint64 before = allocatedBytes();
+        for (int i = 0; i < entries; i += batchSize) {
+            QList<DbWorker::Entry> batch;
+            for (int j = i; j < i + batchSize; ++j) {
+                DbWorker::Entry entry;
+                entry.url = QUrl(QStringLiteral("http://www.example%1.org/page/%2").arg(j % 500).arg(j));
+                entry.domain = QStringLiteral("example%1.org").arg(j % 500);
+                entry.title = QStringLiteral("Example page %1").arg(j);
+                entry.icon = QUrl(QStringLiteral("http://www.example%1.org/favicon.ico").arg(j % 500));
+                entry.visits = 1;
+                entry.lastVisit = now.addSecs(-j);
+                batch.append(entry);
+            }
+            if (legacy) {
+                Q_FOREACH(const DbWorker::Entry& fetched, batch) {
+                    LegacyHistoryEntry entry;
+                    entry.url = fetched.url;
+                    entry.domain = fetched.domain;
+                    entry.title = fetched.title;
+                    entry.icon = fetched.icon;
+                    entry.visits = fetched.visits;
+                    entry.lastVisit = fetched.lastVisit;
+                    entry.hidden = false;
+                    legacyEntries.append(entry);
+                }
+            } else {
+                QMetaObject::invokeMethod(model, "onEntriesFetched", Qt::DirectConnection,
+                                          Q_ARG(QList<DbWorker::Entry>, batch));
+            }
+        }
+        qint64 after = allocatedBytes();
+        QCOMPARE(legacy ? legacyEntries.count() : model->rowCount(), entries);
+        QTest::setBenchmarkResult(qreal(after - before) / entries, QTest::BytesAllocated);
+    }
+
+    void benchmarkVirtualizedMemory_data()
+    {
+        QTest::addColumn<int>("entries");
+        QTest::newRow("10000 entries") << 10000;
+        QTest::newRow("100000 entries") << 100000;
+    }
+
+    void benchmarkVirtualizedMemory()
+    {
+        QFETCH(int, entries);
+        if (allocatedBytes() < 0) {
+            QSKIP("Heap usage can only be measured with glibc");
+        }
+        QTemporaryFile tempFile;
+        tempFile.open();
+        createHistory(tempFile.fileName(), entries);
+        delete model;
+        model = new HistoryModel;
+        model->setVirtualized(true);
+        qint64 before = allocatedBytes();
+        model->setDatabasePath(tempFile.fileName());
+        QCOMPARE(model->rowCount(), entries);
+        // Read all the entries once
+        QStringList roles;
+        roles << "url" << "title";
+        for (int i = 0; i < entries; ++i) {
+            model->get(i, roles);
+        }
+        qint64 after = allocatedBytes();
+        QTest::setBenchmarkResult(qreal(after - before), QTest::BytesAllocated);
+    }
+
+    void benchmarkImportHistory()
+    {
+        const int count = 200000;
+        QTemporaryFile tempFile;
+        tempFile.open();
+        createBrowserHistory(tempFile.fileName(), true, count);
+        QSignalSpy spyFinished(model, SIGNAL(importFinished(bool, int)));
+        QBENCHMARK_ONCE {
+            model->importHistory(tempFile.fileName());
+            QVERIFY(spyFinished.wait(60000));
+        }
+        QCOMPARE(model->rowCount(), count * 7 / 10);
+    }
+
+    void benchmarkDatabaseSize_data()
+    {
+        QTest::addColumn<bool>("legacy");
+        QTest::newRow("legacy layout") << true;
+        QTest::newRow("normalized layout") << false;
+    }
+
+    void benchmarkDatabaseSize()
+    {
+        QFETCH(bool, legacy);
+        QTemporaryFile tempFile;
+        tempFile.open();
+        QString fileName = tempFile.fileName();
+        createLegacyHistory(fileName, 100000);
+        if (!legacy) {
+            delete model;
+            model = new HistoryModel;
+            QSignalSpy spyLoaded(model, SIGNAL(loaded()));
+            model->setDatabasePath(fileName);
+            QVERIFY(spyLoaded.wait(60000));
+            model->setDatabasePath(":memory:");
+        }
+        {
+            // The full-text index is left out of the comparison
+            QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), "tst_history");
+            database.setDatabaseName(fileName);
+            database.open();
+            QSqlQuery query(database);
+            query.exec("DROP TRIGGER IF EXISTS history_fts_insert;");
+            query.exec("DROP TRIGGER IF EXISTS history_fts_delete;");
+            query.exec("DROP TRIGGER IF EXISTS history_fts_update;");
+            query.exec("DROP TABLE IF EXISTS history_fts;");
+            query.exec("VACUUM;");
+            database.close();
+        }
+        QSqlDatabase::removeDatabase("tst_history");
+        QTest::setBenchmarkResult(QFileInfo(fileName).size(), QTest::BytesAllocated);
+    }
+
+    void benchmarkLoadLargeHistory_data()
+    {
+        QTest::addColumn<bool>("legacy");
+        QTest::newRow("legacy layout, migrated") << true;
+        QTest::newRow("normalized layout") << false;
+    }
+
+    void benchmarkLoadLargeHistory()
+    {
+        QFETCH(bool, legacy);
+        QTemporaryFile tempFile;
+        tempFile.open();
+        QString fileName = tempFile.fileName();
+        createLegacyHistory(fileName, 100000);
+        if (!legacy) {
+            HistoryModel history;
+            QSignalSpy spyLoaded(&history, SIGNAL(loaded()));
+            history.setDatabasePath(fileName);
+            QVERIFY(spyLoaded.wait(60000));
+        }
+        delete model;
+        model = new HistoryModel;
+        QSignalSpy spyLoaded(model, SIGNAL(loaded()));
+        QBENCHMARK_ONCE {
+            model->setDatabasePath(fileName);
+            QVERIFY(spyLoaded.wait(60000));
+        }
+        QCOMPARE(model->rowCount(), 100000);
+    }
+
+private:
+    void createLegacyHistory(const QString& fileName, int count)
+    {
+        // The layout of schema version 2, domains and icons stored as text
+        QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), "tst_history");
+        database.setDatabaseName(fileName);
+        database.open();
+        QSqlQuery query(database);
+        query.exec(QStringLiteral("CREATE TABLE history (url VARCHAR, domain VARCHAR, title VARCHAR,"
+                                  " icon VARCHAR, visits INTEGER, lastVisit DATETIME);"));
+        query.exec(QStringLiteral("CREATE TABLE history_hidden (url VARCHAR);"));
+        query.exec(QStringLiteral("CREATE INDEX history_url ON history (url);"));
+        query.exec(QStringLiteral("CREATE INDEX history_domain ON history (domain);"));
+        query.exec(QStringLiteral("CREATE INDEX history_lastVisit ON history (lastVisit);"));
+        query.exec(QStringLiteral("CREATE INDEX history_hidden_url ON history_hidden (url);"));
+        query.exec(QStringLiteral("PRAGMA user_version = 2;"));
+        database.transaction();
+        query.prepare(QStringLiteral("INSERT INTO history VALUES (?, ?, ?, ?, ?, ?);"));
+        uint now = QDateTime::currentDateTimeUtc().toTime_t();
+        for (int i = 0; i < count; ++i) {
+            query.addBindValue(QStringLiteral("http://www.example%1.org/page/%2").arg(i % 500).arg(i));
+            query.addBindValue(QStringLiteral("example%1.org").arg(i % 500));
+            query.addBindValue(QStringLiteral("Example page %1").arg(i));
+            query.addBindValue(QStringLiteral("http://www.example%1.org/favicon.ico").arg(i % 500));
+            query.addBindValue(1 + i % 7);
+            query.addBindValue(now - i);
+            query.exec();
+        }
+        database.commit();
+        database.close();
+        database = QSqlDatabase();
+        QSqlDatabase::removeDatabase("tst_history");
+    }
+
+    void createHistory(const QString& fileName, int count)
+    {
+        {
+            // Let the model create the schema
+            HistoryModel history;
+            history.setDatabasePath(fileName);
+        }
+        QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), "tst_history");
+        database.setDatabaseName(fileName);
+        database.open();
+        QSqlQuery query(database);
+        database.transaction();
+        query.prepare(QStringLiteral("INSERT INTO history_domains (id, domain) VALUES (?, ?);"));
+        for (int i = 0; i < 500; ++i) {
+            query.addBindValue(i + 1);
+            query.addBindValue(QStringLiteral("example%1.org").arg(i));
+            query.exec();
+        }
+        query.prepare(QStringLiteral("INSERT INTO history (url, domainId, title, iconId, visits, lastVisit) "
+                                     "VALUES (?, ?, ?, ?, ?, ?);"));
+        uint now = QDateTime::currentDateTimeUtc().toTime_t();
+        for (int i = 0; i < count; ++i) {
+            query.addBindValue(QStringLiteral("http://www.example%1.org/page/%2").arg(i % 500).arg(i));
+            query.addBindValue(i % 500 + 1);
+            query.addBindValue(QStringLiteral("Example page %1").arg(i));
+            query.addBindValue(QVariant());
+            query.addBindValue(1);
+            query.addBindValue(now - i);
+            query.exec();
+        }
+        database.commit();
+        database.close();
+        database = QSqlDatabase();
+        QSqlDatabase::removeDatabase("tst_history");
+    }
+
+    void createBrowserHistory(const QString& fileName, bool chromium, int count)
+    {
+        // Out of every 10 rows, one is hidden and two are not web pages
+        QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), "tst_history");
+        database.setDatabaseName(fileName);
+        database.open();
+        QSqlQuery query(database);
+        if (chromium) {
+            query.exec(QStringLiteral("CREATE TABLE urls (id INTEGER PRIMARY KEY, url LONGVARCHAR, "
+                                      "title LONGVARCHAR, visit_count INTEGER, typed_count INTEGER, "
+                                      "last_visit_time INTEGER, hidden INTEGER);"));
+            query.prepare(QStringLiteral("INSERT INTO urls (url, title, visit_count, typed_count, "
+                                         "last_visit_time, hidden) VALUES (?, ?, ?, 0, ?, ?);"));
+        } else {
+            query.exec(QStringLiteral("CREATE TABLE moz_places (id INTEGER PRIMARY KEY, url LONGVARCHAR, "
+                                      "title LONGVARCHAR, visit_count INTEGER, hidden INTEGER, "
+                                      "last_visit_date INTEGER);"));
+            query.prepare(QStringLiteral("INSERT INTO moz_places (url, title, visit_count, "
+                                         "last_visit_date, hidden) VALUES (?, ?, ?, ?, ?);"));
+        }
+        database.transaction();
+        qint64 now = QDateTime::currentDateTimeUtc().toMSecsSinceEpoch() * 1000;
+        for (int i = 0; i < count; ++i) {
+            QString url;
+            switch (i % 10) {
+            case 8:
+                url = QStringLiteral("file:///tmp/%1").arg(i);
+                break;
+            case 9:
+                url = QStringLiteral("about:page%1").arg(i);
+                break;
+            default:
+                url = QStringLiteral("http://example.org/%1").arg(i);
+            }
+            // One visit per minute, starting a minute ago
+            qint64 lastVisit = now - Q_INT64_C(60000000) * (i + 1);
+            if (chromium) {
+                lastVisit += Q_INT64_C(11644473600000000);
+            }
+            query.addBindValue(url);
+            query.addBindValue(QStringLiteral("Page %1").arg(i));
+            query.addBindValue((i % 10) + 1);
+            query.addBindValue(lastVisit);
+            query.addBindValue((i % 10) == 7 ? 1 : 0);
+            query.exec();
+        }
+        database.commit();
+        database.close();
+        database = QSqlDatabase();
+        QSqlDatabase::removeDatabase("tst_history");
+    }
+
+    // Feed entries to the model as if they were read from the database,
+    // the most recent one visited at the given time.
+    void fetchEntries(const QDateTime& lastVisit, int count, int interval)
+    {
+        QList<DbWorker::Entry> entries;
+        for (int i = 0; i < count; ++i) {
+            DbWorker::Entry entry;
+            entry.url = QUrl(QStringLiteral("http://example.org/%1").arg(i));
+            entry.domain = QStringLiteral("example.org");
+            entry.title = QStringLiteral("Example page %1").arg(i);
+            entry.visits = 1;
+            entry.lastVisit = lastVisit.addSecs(-qint64(i) * interval);
+            entries.append(entry);
+        }
+        QMetaObject::invokeMethod(model, "onEntriesFetched", Qt::DirectConnection,
+                                  Q_ARG(QList<DbWorker::Entry>, entries));
+        QCOMPARE(model->rowCount(), count);
+    }
+
+    void populate(int count)
+    {
+        for (int i = 0; i < count; ++i) {
+            model->add(QUrl(QStringLiteral("http://example.org/%1").arg(i)),
+                       QStringLiteral("Example Domain"), QUrl());
+        }
+        QCOMPARE(model->rowCount(), count);
+    }
 };
 
 QTEST_MAIN(HistoryModelTests)
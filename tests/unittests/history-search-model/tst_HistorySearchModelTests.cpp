@@ -0,0 +1,217 @@
+/*
+ * Copyright 2020 UBports Foundation
+ *
+ * This file is part of morph-browser.
+ *
+ * morph-browser is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * morph-browser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Qt
+#include <QtCore/QTemporaryFile>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlQuery>
+#include <QtTest/QSignalSpy>
+#include <QtTest/QtTest>
+
+// local
+#include "history-model.h"
+#include "history-search-model.h"
+
+class HistorySearchModelTests : public QObject
+{
+    Q_OBJECT
+
+private:
+    HistoryModel* history;
+    HistorySearchModel* model;
+
+    QStringList urls() const
+    {
+        QStringList result;
+        for (int i = 0; i < model->rowCount(); ++i) {
+            result << model->data(model->index(i, 0), HistorySearchModel::Url).toUrl().toString();
+        }
+        result.sort();
+        return result;
+    }
+
+private Q_SLOTS:
+    void init()
+    {
+        history = new HistoryModel;
+        history->setDatabasePath(":memory:");
+        model = new HistorySearchModel;
+        model->setSourceModel(history);
+        QTRY_COMPARE(history->loadProgress(), 1.0);
+        history->add(QUrl("http://example.org/"), "Example Domain", QUrl());
+        history->add(QUrl("http://www.gogol.com/"), "Gogol", QUrl());
+        history->add(QUrl("http://ubuntu.com/phone"), "Ubuntu Phone", QUrl());
+        history->add(QUrl("http://ubports.com/"), "Ubuntu Touch", QUrl());
+        history->add(QUrl("http://www.youtube.com/"), "YouTube", QUrl());
+    }
+
+    void cleanup()
+    {
+        delete model;
+        delete history;
+    }
+
+    void shouldBeEmptyWithoutTerms()
+    {
+        QCOMPARE(model->rowCount(), 0);
+        QVERIFY(!model->searching());
+        QVERIFY(!model->canFetchMore(QModelIndex()));
+    }
+
+    void shouldFindEntriesMatchingAllTerms_data()
+    {
+        QTest::addColumn<QStringList>("terms");
+        QTest::addColumn<QStringList>("expected");
+        QTest::newRow("title") << (QStringList() << "gogol") << (QStringList() << "http://www.gogol.com/");
+        QTest::newRow("prefix") << (QStringList() << "ubu")
+                                << (QStringList() << "http://ubports.com/" << "http://ubuntu.com/phone");
+        QTest::newRow("substring") << (QStringList() << "tube") << (QStringList() << "http://www.youtube.com/");
+        QTest::newRow("short term") << (QStringList() << "og") << (QStringList() << "http://www.gogol.com/");
+        QTest::newRow("case insensitive") << (QStringList() << "EXAMPLE") << (QStringList() << "http://example.org/");
+        QTest::newRow("url and title") << (QStringList() << "ubuntu" << "phone")
+                                       << (QStringList() << "http://ubuntu.com/phone");
+        QTest::newRow("no match") << (QStringList() << "ubuntu" << "gogol") << QStringList();
+    }
+
+    void shouldFindEntriesMatchingAllTerms()
+    {
+        QFETCH(QStringList, terms);
+        QFETCH(QStringList, expected);
+        QSignalSpy spySearching(model, SIGNAL(searchingChanged()));
+        model->setTerms(terms);
+        QVERIFY(model->searching());
+        QTRY_VERIFY(!model->searching());
+        QCOMPARE(spySearching.count(), 2);
+        QCOMPARE(urls(), expected);
+    }
+
+    void shouldFetchResultsInPages()
+    {
+        for (int i = 0; i < 25; ++i) {
+            history->add(QUrl(QStringLiteral("http://example.com/%1").arg(i)), "Example Page", QUrl());
+        }
+        model->setPageSize(10);
+        model->setTerms(QStringList() << "page");
+        QTRY_COMPARE(model->rowCount(), 10);
+        QVERIFY(model->canFetchMore(QModelIndex()));
+        model->fetchMore(QModelIndex());
+        QVERIFY(!model->canFetchMore(QModelIndex()));
+        QTRY_COMPARE(model->rowCount(), 20);
+        model->fetchMore(QModelIndex());
+        QTRY_COMPARE(model->rowCount(), 25);
+        QVERIFY(!model->canFetchMore(QModelIndex()));
+        QCOMPARE(QSet<QString>::fromList(urls()).count(), 25);
+    }
+
+    void shouldIgnoreOutdatedResults()
+    {
+        model->setTerms(QStringList() << "ubuntu");
+        model->setTerms(QStringList() << "gogol");
+        QTRY_VERIFY(!model->searching());
+        QCOMPARE(urls(), QStringList() << "http://www.gogol.com/");
+    }
+
+    void shouldFindNewEntries()
+    {
+        model->setTerms(QStringList() << "wiki");
+        QTRY_VERIFY(!model->searching());
+        QCOMPARE(model->rowCount(), 0);
+        history->add(QUrl("http://en.wikipedia.org/"), "Wikipedia", QUrl());
+        history->clearAll();
+        QTRY_VERIFY(!model->searching());
+        QCOMPARE(model->rowCount(), 0);
+        history->add(QUrl("http://en.wikipedia.org/"), "Wikipedia", QUrl());
+        model->setTerms(QStringList() << "wikipedia");
+        QTRY_COMPARE(model->rowCount(), 1);
+    }
+
+    void shouldFollowChangesWhileSearching()
+    {
+        model->setTerms(QStringList() << "ubuntu");
+        QTRY_COMPARE(urls(), QStringList() << "http://ubports.com/" << "http://ubuntu.com/phone");
+
+        // Hidden entries are only hidden from the top sites
+        QSignalSpy spyReset(model, SIGNAL(modelReset()));
+        history->hide(QUrl("http://ubports.com/"));
+        QTRY_COMPARE(spyReset.count(), 1);
+        QTRY_VERIFY(!model->searching());
+        QCOMPARE(urls(), QStringList() << "http://ubports.com/" << "http://ubuntu.com/phone");
+
+        // Changes are batched
+        history->update(QUrl("http://www.gogol.com/"), "Ubuntu News", QUrl());
+        history->removeEntryByUrl(QUrl("http://ubuntu.com/phone"));
+        QTRY_COMPARE(spyReset.count(), 2);
+        QTRY_VERIFY(!model->searching());
+        QCOMPARE(urls(), QStringList() << "http://ubports.com/" << "http://www.gogol.com/");
+    }
+
+    void shouldReturnData()
+    {
+        model->setTerms(QStringList() << "gogol");
+        QTRY_COMPARE(model->rowCount(), 1);
+        QVariantMap item = model->get(0);
+        QCOMPARE(item.value("url").toUrl(), QUrl("http://www.gogol.com/"));
+        QCOMPARE(item.value("domain").toString(), QString("gogol.com"));
+        QCOMPARE(item.value("title").toString(), QString("Gogol"));
+        QCOMPARE(item.value("visits").toInt(), 1);
+        QVERIFY(model->get(1).isEmpty());
+    }
+
+    void benchmarkSearch()
+    {
+        // Search a large history stored on disk
+        QTemporaryFile tempFile;
+        tempFile.open();
+        QString fileName = tempFile.fileName();
+        {
+            QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), "tst_history");
+            database.setDatabaseName(fileName);
+            database.open();
+            QSqlQuery query(database);
+            query.exec(QStringLiteral("CREATE TABLE history (url VARCHAR, domain VARCHAR, title VARCHAR,"
+                                      " icon VARCHAR, visits INTEGER, lastVisit DATETIME);"));
+            database.transaction();
+            query.prepare(QStringLiteral("INSERT INTO history VALUES (?, ?, ?, ?, ?, ?);"));
+            for (int i = 0; i < 100000; ++i) {
+                query.addBindValue(QStringLiteral("http://site%1.example.org/page/%2").arg(i % 1000).arg(i));
+                query.addBindValue(QStringLiteral("example.org"));
+                query.addBindValue(QStringLiteral("Article %1 about topic %2").arg(i).arg(i % 97));
+                query.addBindValue(QString());
+                query.addBindValue(1 + i % 13);
+                query.addBindValue(1000000 + i);
+                query.exec();
+            }
+            database.commit();
+            database.close();
+        }
+        QSqlDatabase::removeDatabase("tst_history");
+
+        QSignalSpy spyLoaded(history, SIGNAL(loaded()));
+        history->setDatabasePath(fileName);
+        QVERIFY(spyLoaded.wait(60000));
+        QSignalSpy spyFinished(history, SIGNAL(searchFinished(int, const QList<DbWorker::Entry>&)));
+        QBENCHMARK {
+            int requestId = history->search("site42 topic", 0, 20);
+            QVERIFY(spyFinished.wait());
+            QCOMPARE(spyFinished.takeFirst().at(0).toInt(), requestId);
+        }
+    }
+};
+
+QTEST_MAIN(HistorySearchModelTests)
+#include "tst_HistorySearchModelTests.moc"
@@ -198,6 +198,33 @@ private Q_SLOTS:
         QVERIFY(item.isEmpty());
     }
 
+    void shouldGetOnlyRequestedRoles()
+    {
+        strings->append({"a"});
+        QVariantMap item = model->get(0, QStringList() << "string" << "unknown");
+        QCOMPARE(item.count(), 1);
+        QCOMPARE(item.value("string").toString(), QString("a"));
+    }
+
+    void shouldGetRangeWithinLimit()
+    {
+        strings->append({"a", "b", "c", "d"});
+        model->setLimit(3);
+        QVariantList items = model->getRange(1, 5, QStringList() << "string");
+        QCOMPARE(items.count(), 2);
+        QCOMPARE(items.at(0).toMap().value("string").toString(), QString("b"));
+        QCOMPARE(items.at(1).toMap().value("string").toString(), QString("c"));
+        QVERIFY(model->getRange(3, 1, QStringList()).isEmpty());
+        QCOMPARE(model->getRange(0, 1, QStringList()).first().toMap().count(), 2);
+    }
+
+    void shouldNotFindUrlsWithoutUrlRole()
+    {
+        strings->append({"a"});
+        QVERIFY(model->urlAt(0).isEmpty());
+        QCOMPARE(model->indexOfUrl(QUrl("a")), -1);
+    }
+
 };
 
 QTEST_MAIN(LimitProxyModelTests)
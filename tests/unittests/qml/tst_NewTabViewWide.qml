@@ -166,22 +166,22 @@ Item {
             var items = getListItems(findChild(view, "topSitesList"), "topSiteItem")
             keyClick(Qt.Key_Return)
             compare(historyEntryClickedSpy.count, 1)
-            compare(historyEntryClickedSpy.signalArguments[0][0], "http://example.com")
+            compare(historyEntryClickedSpy.signalArguments[0][0], "http://example.com/")
             keyClick(Qt.Key_Right)
             keyClick(Qt.Key_Return)
             compare(historyEntryClickedSpy.count, 2)
-            compare(historyEntryClickedSpy.signalArguments[1][0], "http://example.org")
+            compare(historyEntryClickedSpy.signalArguments[1][0], "http://example.org/")
         }
 
         function test_activate_topsites_by_mouse() {
             var items = getListItems(findChild(view, "topSitesList"), "topSiteItem")
             clickItem(items[0])
             compare(historyEntryClickedSpy.count, 1)
-            compare(historyEntryClickedSpy.signalArguments[0][0], "http://example.com")
+            compare(historyEntryClickedSpy.signalArguments[0][0], "http://example.com/")
 
             clickItem(items[1])
             compare(historyEntryClickedSpy.count, 2)
-            compare(historyEntryClickedSpy.signalArguments[1][0], "http://example.org")
+            compare(historyEntryClickedSpy.signalArguments[1][0], "http://example.org/")
 
         }
 
@@ -94,6 +94,27 @@ Item {
             }
         }
 
+        function test_topsite_visited_through_tracking_url() {
+            var url = baseUrl + "top?utm_source=feed"
+            HistoryModel.add(url, "Example Com", "")
+            var path = PreviewManager.previewPathFromUrl(url)
+            compare(path, PreviewManager.previewPathFromUrl(baseUrl + "top"))
+
+            PreviewManager.saveToDisk(grabResultMock, url)
+            var file = Qt.resolvedUrl(path)
+            verify(FileOperations.exists(file))
+
+            // The preview belongs to the top site the visit was recorded as
+            PreviewManager.checkDelete(url)
+            verify(FileOperations.exists(file))
+            PreviewManager.cleanUnusedPreviews([])
+            verify(FileOperations.exists(file))
+
+            HistoryModel.removeEntryByUrl(url)
+            PreviewManager.checkDelete(url)
+            verify(!FileOperations.exists(file))
+        }
+
         function test_save_preview() {
             var file = Qt.resolvedUrl(PreviewManager.previewPathFromUrl(baseUrl))
 
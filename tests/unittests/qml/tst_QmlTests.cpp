@@ -34,11 +34,13 @@
 #include "history-domainlist-model.h"
 #include "history-model.h"
 #include "history-lastvisitdatelist-model.h"
+#include "history-search-model.h"
 #include "limit-proxy-model.h"
 #include "reparenter.h"
 #include "searchengine.h"
 #include "tabs-model.h"
 #include "text-search-filter-model.h"
+#include "top-sites-model.h"
 
 class TestContext : public QObject
 {
@@ -124,6 +126,7 @@ class HistoryModelMock : public HistoryModel {
     Q_OBJECT
 
 public:
+    // Entries are stored from the oldest to the most recent one
     static bool compareHistoryEntries(const HistoryEntry& a, const HistoryEntry& b) {
         return a.lastVisit < b.lastVisit;
     }
@@ -142,16 +145,18 @@ public:
         // we reorder the model and reset it every time we add a new item by date
         // to keep things simple.
         beginResetModel();
-        HistoryEntry entry = m_entries.takeAt(index);
-        entry.lastVisit = date;
+        HistoryEntry& entry = entryAt(index);
+        entry.lastVisit = date.toMSecsSinceEpoch();
+        entry.lastVisitDay = date.toLocalTime().date().toJulianDay();
         entry.visits = entry.visits + visitsToAdd;
-        m_entries.append(entry);
-        std::sort(m_entries.begin(), m_entries.end(), compareHistoryEntries);
+        HistoryEntry updated = entry;
+        std::stable_sort(m_entries.begin(), m_entries.end(), compareHistoryEntries);
+        rebuildUrlIndex();
         endResetModel();
 
-        updateExistingEntryInDatabase(entry);
+        updateExistingEntryInDatabase(updated);
 
-        return entry.visits;
+        return updated.visits;
     }
 };
 
@@ -183,8 +188,10 @@ int main(int argc, char** argv)
     qmlRegisterType<HistoryDomainModel>(browserUri, 0, 1, "HistoryDomainModel");
     qmlRegisterType<HistoryDomainListModel>(browserUri, 0, 1, "HistoryDomainListModel");
     qmlRegisterType<HistoryLastVisitDateListModel>(browserUri, 0, 1, "HistoryLastVisitDateListModel");
+    qmlRegisterType<HistorySearchModel>(browserUri, 0, 1, "HistorySearchModel");
     qmlRegisterType<LimitProxyModel>(browserUri, 0, 1, "LimitProxyModel");
     qmlRegisterType<TextSearchFilterModel>(browserUri, 0, 1, "TextSearchFilterModel");
+    qmlRegisterType<TopSitesModel>(browserUri, 0, 1, "TopSitesModel");
     qmlRegisterSingletonType<Reparenter>(browserUri, 0, 1, "Reparenter", Reparenter_singleton_factory);
 
     const char* testUri = "webbrowsertest.private";
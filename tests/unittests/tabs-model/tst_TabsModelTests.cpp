@@ -499,6 +499,75 @@ private Q_SLOTS:
         delete nonAddedTab;
     }
 
+    void shouldUpdateDataWhenTabPropertiesChange()
+    {
+        QQuickItem* tab = createTab();
+        model->add(createTab());
+        model->add(tab);
+        QQmlProperty(tab, "url").write(QUrl("http://ubuntu.com/"));
+        QQmlProperty(tab, "title").write(QString("Lorem Ipsum"));
+        QQmlProperty(tab, "icon").write(QUrl("image://webicon/123"));
+        QCOMPARE(model->data(model->index(1, 0), TabsModel::Url).toUrl(), QUrl("http://ubuntu.com/"));
+        QCOMPARE(model->data(model->index(1, 0), TabsModel::Title).toString(), QString("Lorem Ipsum"));
+        QCOMPARE(model->data(model->index(1, 0), TabsModel::Icon).toUrl(), QUrl("image://webicon/123"));
+
+        // The metadata follows the tab when it is moved
+        model->move(1, 0);
+        QQmlProperty(tab, "title").write(QString("Dolor Sit Amet"));
+        QCOMPARE(model->data(model->index(0, 0), TabsModel::Title).toString(), QString("Dolor Sit Amet"));
+        QCOMPARE(model->data(model->index(1, 0), TabsModel::Title).toString(), QString());
+    }
+
+    void shouldUpdateTabIndexWhenModelChanges()
+    {
+        QQuickItem* tab1 = createTab();
+        QQuickItem* tab2 = createTab();
+        QQuickItem* tab3 = createTab();
+        model->add(tab1);
+        model->add(tab2);
+        model->insert(tab3, 0);
+        QCOMPARE(model->indexOf(tab3), 0);
+        QCOMPARE(model->indexOf(tab1), 1);
+        QCOMPARE(model->indexOf(tab2), 2);
+        model->move(0, 2);
+        QCOMPARE(model->indexOf(tab1), 0);
+        QCOMPARE(model->indexOf(tab2), 1);
+        QCOMPARE(model->indexOf(tab3), 2);
+        delete model->remove(0);
+        QCOMPARE(model->indexOf(tab1), -1);
+        QCOMPARE(model->indexOf(tab2), 0);
+        QCOMPARE(model->indexOf(tab3), 1);
+    }
+
+    void benchmarkConcurrentPageLoads()
+    {
+        // 500 tabs loading at the same time, each one changing its
+        // metadata several times while the views read it back
+        QList<QQuickItem*> tabs;
+        for (int i = 0; i < 500; ++i) {
+            QQuickItem* tab = createTab();
+            model->add(tab);
+            tabs.append(tab);
+        }
+        int round = 0;
+        QBENCHMARK {
+            ++round;
+            Q_FOREACH(QQuickItem* tab, tabs) {
+                tab->setProperty("url", QUrl(QStringLiteral("http://example.org/%1").arg(round)));
+                tab->setProperty("title", QStringLiteral("Example %1").arg(round));
+                tab->setProperty("icon", QUrl(QStringLiteral("image://webicon/%1").arg(round)));
+            }
+            for (int i = 0; i < model->rowCount(); ++i) {
+                QModelIndex index = model->index(i, 0);
+                model->data(index, TabsModel::Url);
+                model->data(index, TabsModel::Title);
+                model->data(index, TabsModel::Icon);
+            }
+        }
+        QCOMPARE(model->data(model->index(499, 0), TabsModel::Title).toString(),
+                 QStringLiteral("Example %1").arg(round));
+    }
+
 private:
     void moveTabs(int from, int to, bool moved, bool indexChanged, int newIndex)
     {
@@ -507,28 +576,12 @@ private:
         QSignalSpy spyTab(model, SIGNAL(currentTabChanged()));
 
         model->move(from, to);
-        QCOMPARE(spyMoved.count(), moved ? abs(from - to) : 0);
+        QCOMPARE(spyMoved.count(), moved ? 1 : 0);
         if (moved) {
-            QList<QVariant> argsFirst = spyMoved.first();
-            QList<QVariant> argsLast = spyMoved.last();
-
-            if (to > from) {
-                QCOMPARE(argsFirst.at(1).toInt(), from);
-                QCOMPARE(argsFirst.at(2).toInt(), from);
-                QCOMPARE(argsFirst.at(4).toInt(), from + 2);
-
-                QCOMPARE(argsLast.at(1).toInt(), to - 1);
-                QCOMPARE(argsLast.at(2).toInt(), to - 1);
-                QCOMPARE(argsLast.at(4).toInt(), to + 1);
-            } else {
-                QCOMPARE(argsFirst.at(1).toInt(), from);
-                QCOMPARE(argsFirst.at(2).toInt(), from);
-                QCOMPARE(argsFirst.at(4).toInt(), from - 1);
-
-                QCOMPARE(argsLast.at(1).toInt(), to + 1);
-                QCOMPARE(argsLast.at(2).toInt(), to + 1);
-                QCOMPARE(argsLast.at(4).toInt(), to);
-            }
+            QList<QVariant> args = spyMoved.first();
+            QCOMPARE(args.at(1).toInt(), from);
+            QCOMPARE(args.at(2).toInt(), from);
+            QCOMPARE(args.at(4).toInt(), (to > from) ? to + 1 : to);
         }
         QCOMPARE(spyIndex.count(), indexChanged ? 1 : 0);
         QCOMPARE(model->currentIndex(), newIndex);
@@ -552,6 +605,148 @@ private Q_SLOTS:
         moveTabs(2, 1, true, true, 1);
         moveTabs(0, 2, true, true, 0);
     }
+
+    void shouldMoveTabsAcrossTheModel()
+    {
+        for (int i = 0; i < 5; ++i) {
+            model->add(createTabWithTitle(QString::number(i)));
+        }
+        model->move(0, 4);
+        verifyTabsOrder(QStringList({"1", "2", "3", "4", "0"}));
+        model->move(4, 1);
+        verifyTabsOrder(QStringList({"1", "0", "2", "3", "4"}));
+    }
+
+    void shouldRemoveRange()
+    {
+        for (int i = 0; i < 5; ++i) {
+            model->add(createTabWithTitle(QString::number(i)));
+        }
+        model->setCurrentIndex(3);
+        QObject* current = model->currentTab();
+        QSignalSpy spyRemoved(model, SIGNAL(rowsRemoved(const QModelIndex&, int, int)));
+        QSignalSpy spyCount(model, SIGNAL(countChanged()));
+        QSignalSpy spyIndex(model, SIGNAL(currentIndexChanged()));
+        QSignalSpy spyTab(model, SIGNAL(currentTabChanged()));
+
+        QList<QObject*> removed = model->removeRange(0, 2);
+        QCOMPARE(removed.count(), 2);
+        QCOMPARE(removed.at(0)->property("title").toString(), QString("0"));
+        QCOMPARE(removed.at(1)->property("title").toString(), QString("1"));
+        qDeleteAll(removed);
+        QCOMPARE(spyRemoved.count(), 1);
+        QList<QVariant> args = spyRemoved.takeFirst();
+        QCOMPARE(args.at(1).toInt(), 0);
+        QCOMPARE(args.at(2).toInt(), 1);
+        QCOMPARE(spyCount.count(), 1);
+        QCOMPARE(spyIndex.count(), 1);
+        QVERIFY(spyTab.isEmpty());
+        QCOMPARE(model->currentIndex(), 1);
+        QCOMPARE(model->currentTab(), current);
+        verifyTabsOrder(QStringList({"2", "3", "4"}));
+
+        // The range is clamped, and the current tab falls back to the
+        // preceding one when there is none after it
+        removed = model->removeRange(1, 10);
+        QCOMPARE(removed.count(), 2);
+        qDeleteAll(removed);
+        QCOMPARE(spyRemoved.count(), 1);
+        QCOMPARE(spyCount.count(), 2);
+        QCOMPARE(spyIndex.count(), 2);
+        QCOMPARE(spyTab.count(), 1);
+        QCOMPARE(model->currentIndex(), 0);
+        verifyTabsOrder(QStringList({"2"}));
+
+        QVERIFY(model->removeRange(1, 1).isEmpty());
+        QVERIFY(model->removeRange(0, 0).isEmpty());
+        QCOMPARE(spyCount.count(), 2);
+    }
+
+    void shouldRemoveMany()
+    {
+        QList<QQuickItem*> tabs;
+        for (int i = 0; i < 6; ++i) {
+            tabs.append(createTabWithTitle(QString::number(i)));
+            model->add(tabs.last());
+        }
+        model->setCurrentIndex(2);
+        QSignalSpy spyRemoved(model, SIGNAL(rowsRemoved(const QModelIndex&, int, int)));
+        QSignalSpy spyCount(model, SIGNAL(countChanged()));
+        QSignalSpy spyIndex(model, SIGNAL(currentIndexChanged()));
+        QSignalSpy spyTab(model, SIGNAL(currentTabChanged()));
+
+        // Close all the tabs but the current one, in any order
+        QList<QObject*> removed = model->removeMany(QList<int>({5, 0, 1, 3, 4, 1, 12, -1}));
+        QCOMPARE(removed.count(), 5);
+        QCOMPARE(removed.at(0), tabs.at(0));
+        QCOMPARE(removed.at(4), tabs.at(5));
+        qDeleteAll(removed);
+        // One range of rows per run of contiguous tabs
+        QCOMPARE(spyRemoved.count(), 2);
+        QCOMPARE(spyCount.count(), 1);
+        QCOMPARE(spyIndex.count(), 1);
+        QVERIFY(spyTab.isEmpty());
+        QCOMPARE(model->currentIndex(), 0);
+        QCOMPARE(model->currentTab(), tabs.at(2));
+        QCOMPARE(model->indexOf(tabs.at(2)), 0);
+
+        removed = model->removeMany(QList<int>({0}));
+        qDeleteAll(removed);
+        QCOMPARE(spyIndex.count(), 2);
+        QCOMPARE(spyTab.count(), 1);
+        QCOMPARE(model->currentIndex(), -1);
+        QCOMPARE(model->currentTab(), (QObject*) nullptr);
+    }
+
+    void shouldUpdateCurrentTabWhenRemovingManyIncludingCurrent()
+    {
+        QList<QQuickItem*> tabs;
+        for (int i = 0; i < 5; ++i) {
+            tabs.append(createTab());
+            model->add(tabs.last());
+        }
+        model->setCurrentIndex(2);
+        QSignalSpy spyIndex(model, SIGNAL(currentIndexChanged()));
+        QSignalSpy spyTab(model, SIGNAL(currentTabChanged()));
+        qDeleteAll(model->removeMany(QList<int>({1, 2, 3})));
+        QCOMPARE(spyIndex.count(), 1);
+        QCOMPARE(spyTab.count(), 1);
+        QCOMPARE(model->currentIndex(), 1);
+        QCOMPARE(model->currentTab(), tabs.at(4));
+    }
+
+    void shouldReorderTabs()
+    {
+        QList<QQuickItem*> tabs;
+        for (int i = 0; i < 4; ++i) {
+            tabs.append(createTabWithTitle(QString::number(i)));
+            model->add(tabs.last());
+        }
+        model->setCurrentIndex(1);
+        QPersistentModelIndex persistent(model->index(3, 0));
+        QSignalSpy spyLayout(model, SIGNAL(layoutChanged()));
+        QSignalSpy spyMoved(model, SIGNAL(rowsMoved(const QModelIndex&, int, int, const QModelIndex&, int)));
+        QSignalSpy spyIndex(model, SIGNAL(currentIndexChanged()));
+        QSignalSpy spyTab(model, SIGNAL(currentTabChanged()));
+
+        model->reorder(QList<int>({3, 2, 0, 1}));
+        verifyTabsOrder(QStringList({"3", "2", "0", "1"}));
+        QCOMPARE(spyLayout.count(), 1);
+        QVERIFY(spyMoved.isEmpty());
+        QCOMPARE(spyIndex.count(), 1);
+        QVERIFY(spyTab.isEmpty());
+        QCOMPARE(model->currentIndex(), 3);
+        QCOMPARE(model->currentTab(), tabs.at(1));
+        QCOMPARE(persistent.row(), 0);
+        QCOMPARE(model->indexOf(tabs.at(0)), 2);
+
+        QTest::ignoreMessage(QtWarningMsg, QRegularExpression("^Invalid permutation"));
+        model->reorder(QList<int>({0, 0, 1, 2}));
+        QTest::ignoreMessage(QtWarningMsg, QRegularExpression("^Invalid permutation"));
+        model->reorder(QList<int>({0, 1}));
+        verifyTabsOrder(QStringList({"3", "2", "0", "1"}));
+        QCOMPARE(spyLayout.count(), 1);
+    }
 };
 
 QTEST_MAIN(TabsModelTests)
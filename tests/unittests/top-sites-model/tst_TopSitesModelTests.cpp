@@ -0,0 +1,227 @@
+/*
+ * Copyright 2020 UBports Foundation
+ *
+ * This file is part of morph-browser.
+ *
+ * morph-browser is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * morph-browser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Qt
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QTemporaryFile>
+#include <QtTest/QSignalSpy>
+#include <QtTest/QtTest>
+
+// local
+#include "history-model.h"
+#include "top-sites-model.h"
+
+class TopSitesModelTests : public QObject
+{
+    Q_OBJECT
+
+private:
+    HistoryModel* history;
+    TopSitesModel* model;
+
+    void visit(const QString& url, int times)
+    {
+        for (int i = 0; i < times; ++i) {
+            history->add(QUrl(url), QString(), QUrl());
+        }
+    }
+
+    QStringList urls() const
+    {
+        QStringList result;
+        for (int i = 0; i < model->rowCount(); ++i) {
+            result << model->data(model->index(i, 0), TopSitesModel::Url).toUrl().toString();
+        }
+        return result;
+    }
+
+private Q_SLOTS:
+    void init()
+    {
+        history = new HistoryModel;
+        history->setDatabasePath(":memory:");
+        model = new TopSitesModel;
+        model->setLimit(3);
+        model->setSourceModel(history);
+    }
+
+    void cleanup()
+    {
+        delete model;
+        delete history;
+    }
+
+    void shouldBeInitiallyEmpty()
+    {
+        QCOMPARE(model->rowCount(), 0);
+        QVERIFY(!model->contains(QUrl("http://example.org/")));
+    }
+
+    void shouldRankByVisits()
+    {
+        visit("http://a.org/", 1);
+        visit("http://b.org/", 3);
+        visit("http://c.org/", 2);
+        visit("http://d.org/", 4);
+        QCOMPARE(urls(), QStringList() << "http://d.org/" << "http://b.org/" << "http://c.org/");
+        QVERIFY(model->contains(QUrl("http://b.org/")));
+        QVERIFY(!model->contains(QUrl("http://a.org/")));
+        visit("http://a.org/", 4);
+        QCOMPARE(urls(), QStringList() << "http://a.org/" << "http://d.org/" << "http://b.org/");
+        QVERIFY(!model->contains(QUrl("http://c.org/")));
+    }
+
+    void shouldNotResetWhenRankChanges()
+    {
+        visit("http://a.org/", 1);
+        visit("http://b.org/", 3);
+        visit("http://c.org/", 2);
+        visit("http://d.org/", 4);
+        QSignalSpy spyReset(model, SIGNAL(modelReset()));
+        QSignalSpy spyMoved(model, SIGNAL(rowsMoved(const QModelIndex&, int, int, const QModelIndex&, int)));
+        QSignalSpy spyInserted(model, SIGNAL(rowsInserted(const QModelIndex&, int, int)));
+        QSignalSpy spyRemoved(model, SIGNAL(rowsRemoved(const QModelIndex&, int, int)));
+
+        // c.org overtakes b.org
+        visit("http://c.org/", 2);
+        QCOMPARE(urls(), QStringList() << "http://d.org/" << "http://c.org/" << "http://b.org/");
+        QCOMPARE(spyMoved.count(), 1);
+        QList<QVariant> args = spyMoved.takeFirst();
+        QCOMPARE(args.at(1).toInt(), 2);
+        QCOMPARE(args.at(4).toInt(), 1);
+
+        // a.org enters the top entries, b.org leaves them
+        visit("http://a.org/", 9);
+        QCOMPARE(urls(), QStringList() << "http://a.org/" << "http://d.org/" << "http://c.org/");
+        QCOMPARE(spyRemoved.count(), 1);
+        QCOMPARE(spyRemoved.first().at(1).toInt(), 2);
+        QCOMPARE(spyInserted.count(), 1);
+        QCOMPARE(spyInserted.first().at(1).toInt(), 0);
+        QVERIFY(spyMoved.isEmpty());
+        QVERIFY(!model->contains(QUrl("http://b.org/")));
+        QVERIFY(spyReset.isEmpty());
+
+        history->setDatabasePath("");
+        QCOMPARE(spyReset.count(), 1);
+        QCOMPARE(model->rowCount(), 0);
+    }
+
+    void shouldDecayOldVisits()
+    {
+        QDateTime now = QDateTime::currentDateTimeUtc();
+        // Twice the visits, but two half-lives older
+        QVERIFY(TopSitesModel::frecency(2, now.addDays(-60)) < TopSitesModel::frecency(1, now));
+        QVERIFY(TopSitesModel::frecency(8, now.addDays(-60)) > TopSitesModel::frecency(1, now));
+        QVERIFY(TopSitesModel::frecency(2, now) > TopSitesModel::frecency(1, now));
+    }
+
+    void shouldMatchPreviewHashes()
+    {
+        visit("http://example.org/", 1);
+        QString hash = QString::fromLatin1(QCryptographicHash::hash(QByteArray("http://example.org/"),
+                                                                    QCryptographicHash::Md5).toHex());
+        QVERIFY(model->containsHash(hash));
+        QVERIFY(!model->containsHash(QString("0123456789abcdef0123456789abcdef")));
+    }
+
+    void shouldReplaceHiddenEntries()
+    {
+        visit("http://a.org/", 1);
+        visit("http://b.org/", 3);
+        visit("http://c.org/", 2);
+        visit("http://d.org/", 4);
+        history->hide(QUrl("http://b.org/"));
+        QCOMPARE(urls(), QStringList() << "http://d.org/" << "http://c.org/" << "http://a.org/");
+        history->unHide(QUrl("http://b.org/"));
+        QCOMPARE(urls(), QStringList() << "http://d.org/" << "http://b.org/" << "http://c.org/");
+    }
+
+    void shouldReplaceRemovedEntries()
+    {
+        visit("http://a.org/", 1);
+        visit("http://b.org/", 3);
+        visit("http://c.org/", 2);
+        visit("http://d.org/", 4);
+        QSignalSpy spyCount(model, SIGNAL(countChanged()));
+        history->removeEntryByUrl(QUrl("http://d.org/"));
+        QCOMPARE(urls(), QStringList() << "http://b.org/" << "http://c.org/" << "http://a.org/");
+        history->removeEntryByUrl(QUrl("http://a.org/"));
+        QCOMPARE(urls(), QStringList() << "http://b.org/" << "http://c.org/");
+        QCOMPARE(spyCount.count(), 1);
+        history->clearAll();
+        QCOMPARE(model->rowCount(), 0);
+        QCOMPARE(spyCount.count(), 2);
+    }
+
+    void shouldUpdateTitles()
+    {
+        visit("http://a.org/", 1);
+        QSignalSpy spyChanged(model, SIGNAL(dataChanged(const QModelIndex&, const QModelIndex&, const QVector<int>&)));
+        history->update(QUrl("http://a.org/"), QString("A"), QUrl());
+        QCOMPARE(spyChanged.count(), 1);
+        QCOMPARE(model->get(0).value("title").toString(), QString("A"));
+    }
+
+    void shouldReadTopEntriesOfVirtualizedHistory()
+    {
+        QTemporaryFile tempFile;
+        tempFile.open();
+        history->setDatabasePath(tempFile.fileName());
+        visit("http://a.org/", 2);
+        visit("http://b.org/", 4);
+        visit("http://c.org/", 3);
+        visit("http://d.org/", 5);
+        for (int i = 0; i < 500; ++i) {
+            visit(QStringLiteral("http://example.org/%1").arg(i), 1);
+        }
+        delete model;
+        delete history;
+
+        // No entry is in memory, the top ones are read from the database
+        history = new HistoryModel;
+        history->setVirtualized(true);
+        history->setDatabasePath(tempFile.fileName());
+        model = new TopSitesModel;
+        model->setLimit(3);
+        model->setSourceModel(history);
+        QTRY_COMPARE(urls(), QStringList() << "http://d.org/" << "http://b.org/" << "http://c.org/");
+        QCOMPARE(model->get(0).value("visits").toInt(), 5);
+
+        history->removeEntryByUrl(QUrl("http://d.org/"));
+        QTRY_COMPARE(urls(), QStringList() << "http://b.org/" << "http://c.org/" << "http://a.org/");
+        history->hide(QUrl("http://c.org/"));
+        QTRY_COMPARE(urls(), QStringList() << "http://b.org/" << "http://a.org/" << "http://example.org/499");
+        visit("http://example.org/0", 2);
+        QTRY_COMPARE(urls(), QStringList() << "http://b.org/" << "http://example.org/0" << "http://a.org/");
+    }
+
+    void benchmarkVisit()
+    {
+        model->setLimit(10);
+        for (int i = 0; i < 10000; ++i) {
+            history->add(QUrl(QStringLiteral("http://example.org/%1").arg(i)), QString(), QUrl());
+        }
+        int i = 0;
+        QBENCHMARK {
+            history->add(QUrl(QStringLiteral("http://example.org/%1").arg((i++ * 7919) % 10000)), QString(), QUrl());
+        }
+    }
+};
+
+QTEST_MAIN(TopSitesModelTests)
+#include "tst_TopSitesModelTests.moc"
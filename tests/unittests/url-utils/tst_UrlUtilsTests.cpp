@@ -0,0 +1,70 @@
+/*
+ * Copyright 2020 UBports Foundation
+ *
+ * This file is part of morph-browser.
+ *
+ * morph-browser is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * morph-browser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Qt
+#include <QtTest/QtTest>
+
+// local
+#include "url-utils.h"
+
+class UrlUtilsTests : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void shouldCanonicalizeUrl_data()
+    {
+        QTest::addColumn<QUrl>("url");
+        QTest::addColumn<QUrl>("canonical");
+        QTest::newRow("already canonical") << QUrl("http://example.org/") << QUrl("http://example.org/");
+        QTest::newRow("empty path") << QUrl("http://example.org") << QUrl("http://example.org/");
+        QTest::newRow("trailing slash") << QUrl("https://example.org/foo/bar/") << QUrl("https://example.org/foo/bar");
+        QTest::newRow("fragment") << QUrl("http://example.org/page#section") << QUrl("http://example.org/page");
+        QTest::newRow("default http port") << QUrl("http://example.org:80/") << QUrl("http://example.org/");
+        QTest::newRow("default https port") << QUrl("https://example.org:443/") << QUrl("https://example.org/");
+        QTest::newRow("other port") << QUrl("http://example.org:8080/") << QUrl("http://example.org:8080/");
+        QTest::newRow("https on port 80") << QUrl("https://example.org:80/") << QUrl("https://example.org:80/");
+        QTest::newRow("tracking parameters") << QUrl("http://example.org/?utm_source=feed&utm_medium=rss&fbclid=123")
+                                             << QUrl("http://example.org/");
+        QTest::newRow("mixed parameters") << QUrl("http://example.org/search?q=a%20b&gclid=42&page=2#top")
+                                          << QUrl("http://example.org/search?q=a%20b&page=2");
+        QTest::newRow("prefix is not a match") << QUrl("http://example.org/?utm=1&xfbclid=2")
+                                               << QUrl("http://example.org/?utm=1&xfbclid=2");
+        QTest::newRow("not a web page") << QUrl("file:///home/foo/#bar") << QUrl("file:///home/foo/#bar");
+    }
+
+    void shouldCanonicalizeUrl()
+    {
+        QFETCH(QUrl, url);
+        QFETCH(QUrl, canonical);
+        QCOMPARE(UrlUtils::canonicalUrl(url), canonical);
+    }
+
+    void shouldUseCustomTrackingParameters()
+    {
+        QStringList parameters;
+        parameters << QStringLiteral("ref") << QStringLiteral("src_*");
+        QCOMPARE(UrlUtils::canonicalUrl(QUrl("http://example.org/?ref=a&src_id=b&utm_source=c"), parameters),
+                 QUrl("http://example.org/?utm_source=c"));
+        QCOMPARE(UrlUtils::canonicalUrl(QUrl("http://example.org/?utm_source=c#top"), QStringList()),
+                 QUrl("http://example.org/?utm_source=c"));
+    }
+};
+
+QTEST_MAIN(UrlUtilsTests)
+#include "tst_UrlUtilsTests.moc"